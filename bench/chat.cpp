@@ -0,0 +1,114 @@
+/*
+ * a shout to [players] players, the two ways the gameserver wrote it:
+ *   - before: for each player RemoteChatToPlayer copied the message, converted it to a
+ *     STOC_Chat, wrote the packet in net_server_write and bufferevent_write copied it
+ *   - now: one ChatPacket encoded once, each output evbuffer gets a reference to it
+ * The outputs are then drained, as the socket writes do: with the references that is
+ * where the packet goes back to its pool. Only the write path, no checkBacklog.
+ *
+ *   bench/chat [shouts] [message length]
+ */
+#include "ChatPacket.h"
+#include "network.h"
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+using namespace ygo;
+
+static int64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char net_server_write[0x20000];
+
+//RoomInterface::RemoteChatToPlayer and SendBufferToPlayer before the ChatPacket
+static void remoteChatToPlayer(bufferevent* bev, std::wstring msg, int color)
+{
+    if(msg.length() > 256)
+        msg.resize(256);
+    STOC_Chat scc;
+    scc.player = ChatPacket::playerFromColor(color);
+    int msglen = BufferIO::CopyWStr(msg.c_str(), scc.msg, 256);
+    size_t len = 4 + msglen * 2;
+    char* p = net_server_write;
+    BufferIO::WriteInt16(p, 1 + len);
+    BufferIO::WriteInt8(p, STOC_CHAT);
+    memcpy(p, &scc, len);
+    bufferevent_write(bev, net_server_write, len + 3);
+}
+
+static void drain(std::vector<bufferevent*>& players)
+{
+    for(bufferevent* bev : players)
+    {
+        evbuffer* out = bufferevent_get_output(bev);
+        evbuffer_drain(out, evbuffer_get_length(out));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int shouts = argc > 1 ? atoi(argv[1]) : 2000;
+    int length = argc > 2 ? atoi(argv[2]) : 80;
+    std::wstring msg;
+    for(int i = 0; i < length; i++)
+        msg += (wchar_t)(L'a' + i % 26);
+
+    event_base* base = event_base_new();
+    printf("players   before us/shout   now us/shout   before +drain   now +drain\n");
+    for(int n : {100, 1000, 5000})
+    {
+        std::vector<bufferevent*> players;
+        for(int i = 0; i < n; i++)
+        {
+            //without a socket the output is frozen, nothing would be queued
+            bufferevent* bev = bufferevent_socket_new(base, -1, 0);
+            evbuffer_unfreeze(bufferevent_get_output(bev), 1);
+            players.push_back(bev);
+        }
+
+        int64_t write = 0, total = 0;
+        for(int s = 0; s < shouts; s++)
+        {
+            int64_t start = nowNs();
+            for(bufferevent* bev : players)
+                remoteChatToPlayer(bev, msg, 0);
+            int64_t written = nowNs();
+            drain(players);
+            write += written - start;
+            total += nowNs() - start;
+        }
+        double before = write / 1000.0 / shouts, beforeDrain = total / 1000.0 / shouts;
+
+        write = total = 0;
+        for(int s = 0; s < shouts; s++)
+        {
+            int64_t start = nowNs();
+            {
+                ChatPacketRef packet(ChatPacket::create(msg, 0));
+                for(bufferevent* bev : players)
+                    packet->sendTo(bev);
+            }
+            int64_t written = nowNs();
+            drain(players);
+            write += written - start;
+            total += nowNs() - start;
+        }
+        printf("%7d   %15.1f   %12.1f   %13.1f   %10.1f\n", n, before, write / 1000.0 / shouts, beforeDrain,
+               total / 1000.0 / shouts);
+
+        for(bufferevent* bev : players)
+            bufferevent_free(bev);
+    }
+    event_base_free(base);
+    return 0;
+}
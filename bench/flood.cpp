@@ -0,0 +1,165 @@
+/*
+ * connection flood against a running server:
+ * opens idle connections from many loopback ips (127.1.x.y, 5 for each ip),
+ * then logs in for real from other ips and counts the logins that get an answer.
+ *
+ *   bench/flood [port] [idle connections] [logins] [keep|burst]
+ *
+ * the idle connections stay open until the end, like a flood that never sends anything;
+ * with keep the logged players stay connected too, to fill the gameservers,
+ * with burst they also connect all together and then send the login at the same time
+ */
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static int64_t nowMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int connectFrom(const char* source, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, source, &local.sin_addr);
+    bind(fd, (sockaddr*)&local, sizeof(local));
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+    if(connect(fd, (sockaddr*)&server, sizeof(server)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//CTOS_PLAYER_INFO and CTOS_JOIN_GAME as in network.h, the room name is the password
+static size_t loginPackets(unsigned char* out, int n)
+{
+    unsigned char* p = out;
+    char name[20];
+    snprintf(name, sizeof(name), "flood%d", n);
+    *p++ = 41;
+    *p++ = 0;
+    *p++ = 0x10;
+    memset(p, 0, 40);
+    for(int i = 0; name[i]; i++)
+        p[i * 2] = name[i];
+    p += 40;
+    *p++ = 49;
+    *p++ = 0;
+    *p++ = 0x12;
+    //any version: a wrong one is answered with an error, that is still an answer
+    memset(p, 0, 48);
+    const char* room = "flood";
+    for(int i = 0; room[i]; i++)
+        p[8 + i * 2] = room[i];
+    p += 48;
+    return p - out;
+}
+
+int main(int argc, char** argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 9999;
+    int idle = argc > 2 ? atoi(argv[2]) : 3000;
+    int logins = argc > 3 ? atoi(argv[3]) : 100;
+    bool burst = argc > 4 && !strcmp(argv[4], "burst");
+    bool keep = burst || (argc > 4 && !strcmp(argv[4], "keep"));
+
+    std::vector<int> idleFds;
+    char source[32];
+    int64_t start = nowMs();
+    for(int i = 0; i < idle; i++)
+    {
+        snprintf(source, sizeof(source), "127.1.%d.%d", i / 5 / 250, (i / 5) % 250 + 1);
+        int fd = connectFrom(source, port);
+        if(fd >= 0)
+            idleFds.push_back(fd);
+    }
+    printf("%d/%d idle connections opened in %d ms\n", (int)idleFds.size(), idle, (int)(nowMs() - start));
+
+    //one login at a time, or all of them connected first and then sent together
+    int batch = burst ? logins : 1;
+    std::vector<int> players;
+    int answered = 0, refused = 0;
+    int64_t total = 0, worst = 0;
+    for(int first = 0; first < logins; first += batch)
+    {
+        int64_t t0 = nowMs();
+        std::vector<pollfd> waiting;
+        for(int i = first; i < first + batch && i < logins; i++)
+        {
+            snprintf(source, sizeof(source), "127.2.%d.%d", i / 250, i % 250 + 1);
+            int fd = connectFrom(source, port);
+            if(fd < 0)
+                continue;
+            pollfd pfd = {fd, POLLIN, 0};
+            waiting.push_back(pfd);
+        }
+        for(size_t i = 0; i < waiting.size(); i++)
+        {
+            unsigned char packets[128];
+            size_t len = loginPackets(packets, first + i);
+            if(write(waiting[i].fd, packets, len) != (ssize_t)len)
+                waiting[i].events = 0;
+        }
+        //any packet of the server is an answer: the room, the waiting room chat or STOC_ERROR_MSG when it is full
+        int left = waiting.size();
+        while(left > 0 && nowMs() - t0 < 2000 && poll(&waiting[0], waiting.size(), 2000 - (nowMs() - t0)) > 0)
+        {
+            for(size_t i = 0; i < waiting.size(); i++)
+            {
+                unsigned char header[3];
+                if(!(waiting[i].revents & POLLIN) || !waiting[i].events)
+                    continue;
+                waiting[i].events = 0;
+                left--;
+                if(recv(waiting[i].fd, header, 3, MSG_WAITALL) != 3)
+                    continue;
+                int64_t latency = nowMs() - t0;
+                if(header[2] == 0x2)
+                    refused++;
+                answered++;
+                total += latency;
+                if(latency > worst)
+                    worst = latency;
+            }
+        }
+        for(size_t i = 0; i < waiting.size(); i++)
+        {
+            if(keep)
+                players.push_back(waiting[i].fd);
+            else
+                close(waiting[i].fd);
+        }
+        if(!burst)
+            usleep(20000);
+    }
+    printf("%d/%d logins answered (%d with an error), avg %d ms, max %d ms\n", answered, logins, refused,
+           answered ? (int)(total / answered) : 0, (int)worst);
+    //a few seconds to read the counters of the server, or to run another burst on top
+    if(keep)
+        sleep(3);
+
+    for(size_t i = 0; i < idleFds.size(); i++)
+        close(idleFds[i]);
+    for(size_t i = 0; i < players.size(); i++)
+        close(players[i]);
+    return 0;
+}
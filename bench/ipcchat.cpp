@@ -0,0 +1,189 @@
+/*
+ * the global chat from a gameserver to the father over their socketpair, at [rate] messages
+ * per second for [seconds], the two formats the channel had:
+ *   - struct: one GameServerChat (type, color, wchar_t[260]) written for each message
+ *   - frame: ChatMessage in IpcFrame::appendChat, batched for CHAT_TICK_MS (50 ms) like
+ *     GameServer::callChatCallback and sent as one CHAT frame
+ * The father side reads and decodes them. Latency is from the call to the decode,
+ * bytes are what went on the socket, headers included.
+ *
+ *   bench/ipcchat [seconds] [rate] [text length]
+ */
+#include "IpcFrame.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ygo;
+
+//as in GameServer.h before the frames
+struct GameServerChat
+{
+    MessageType type;
+    int chatColor;
+    wchar_t messaggio[260];
+};
+
+static const int CHAT_TICK_MS = 50;
+
+static int64_t nowUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool readAll(int fd, void* buffer, size_t len)
+{
+    char* p = (char*)buffer;
+    while(len)
+    {
+        ssize_t r = read(fd, p, len);
+        if(r <= 0)
+            return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* buffer, size_t len)
+{
+    const char* p = (const char*)buffer;
+    while(len)
+    {
+        ssize_t w = write(fd, p, len);
+        if(w <= 0)
+            return false;
+        p += w;
+        len -= w;
+    }
+    return true;
+}
+
+static void run(bool framed, int messages, int rate, const std::wstring& text)
+{
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        return;
+    std::vector<int64_t> sent(messages), received(messages);
+    long bytes = 0;
+    int writes = 0;
+
+    //the father
+    std::thread father([&]()
+    {
+        int count = 0;
+        while(count < messages)
+        {
+            if(framed)
+            {
+                IpcHeader header;
+                if(!readAll(sv[1], &header, sizeof(header)))
+                    break;
+                std::string payload(header.length, 0);
+                std::vector<ChatMessage> batch;
+                if(!readAll(sv[1], &payload[0], header.length) || !IpcFrame::parseChat(payload.data(), header.length, batch))
+                    break;
+                int64_t now = nowUs();
+                for(size_t i = 0; i < batch.size() && count < messages; i++)
+                    received[count++] = now;
+            }
+            else
+            {
+                GameServerChat gsc;
+                if(!readAll(sv[1], &gsc, sizeof(gsc)))
+                    break;
+                std::wstring message(gsc.messaggio);
+                received[count++] = nowUs();
+            }
+        }
+    });
+
+    //the gameserver, a message every 1/rate seconds
+    std::string batch;
+    int64_t flushAt = 0;
+    auto flush = [&]()
+    {
+        int64_t now = nowUs();
+        if(flushAt > now)
+            usleep(flushAt - now);
+        std::string frame;
+        IpcFrame::append(frame, CHAT, batch.data(), batch.size());
+        writeAll(sv[0], frame.data(), frame.size());
+        bytes += frame.size();
+        writes++;
+        batch.clear();
+        flushAt = 0;
+    };
+    int64_t start = nowUs();
+    for(int i = 0; i < messages; i++)
+    {
+        int64_t due = start + (int64_t)i * 1000000 / rate;
+        if(flushAt && flushAt <= due)
+            flush();
+        int64_t now = nowUs();
+        if(due > now)
+            usleep(due - now);
+        sent[i] = nowUs();
+        if(framed)
+        {
+            IpcFrame::appendChat(batch, ChatMessage(text, 1));
+            if(!flushAt)
+                flushAt = sent[i] + CHAT_TICK_MS * 1000;
+        }
+        else
+        {
+            GameServerChat gsc;
+            gsc.type = CHAT;
+            gsc.chatColor = 1;
+            wcsncpy(gsc.messaggio, text.c_str(), 259);
+            gsc.messaggio[259] = 0;
+            writeAll(sv[0], &gsc, sizeof(gsc));
+            bytes += sizeof(gsc);
+            writes++;
+        }
+    }
+    if(flushAt)
+        flush();
+    father.join();
+    close(sv[0]);
+    close(sv[1]);
+
+    std::vector<int64_t> latencies;
+    for(int i = 0; i < messages; i++)
+        latencies.push_back(received[i] - sent[i]);
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    printf("%-6s %6d messages in %5d writes, %7.1f bytes per message, latency ms p50 %.2f p99 %.2f max %.2f\n",
+           framed ? "frame" : "struct", messages, writes, (double)bytes / messages, latencies[n / 2] / 1000.0,
+           latencies[std::min(n - 1, n * 99 / 100)] / 1000.0, latencies[n - 1] / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 20;
+    int rate = argc > 2 ? atoi(argv[2]) : 50;
+    int length = argc > 3 ? atoi(argv[3]) : 60;
+    if(rate < 1)
+        rate = 1;
+    //a line of the global chat: [name<^_^>]: text
+    std::wstring text = L"[player123<^_^>]: ";
+    for(int i = 0; (int)text.size() < length; i++)
+        text += (wchar_t)(L'a' + i % 26);
+    int messages = std::max(1, seconds * rate);
+
+    printf("%d messages per second, %d characters, sizeof(GameServerChat) %u\n", rate, (int)text.size(),
+           (unsigned int)sizeof(GameServerChat));
+    run(false, messages, rate, text);
+    run(true, messages, rate, text);
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * login throughput of a running server with its mysql:
+ * [clients] connections log in together, each one closes at the answer and a new login
+ * starts at once, for [seconds]. Every login comes from its own loopback ip (127.3.x.y),
+ * under the limits of max_connections_per_minute and max_connections_per_ip.
+ * The names are bench<n>$benchpw: the first run creates the accounts, the next ones
+ * find them, so run it twice and look at the second one.
+ *
+ *   bench/logins [port] [clients] [seconds] [accounts]
+ *
+ * the wait for a connection of the mysql pool is in the "mysql pool" line of the server log
+ */
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static int64_t nowUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int connectFrom(const char* source, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, source, &local.sin_addr);
+    bind(fd, (sockaddr*)&local, sizeof(local));
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+    if(connect(fd, (sockaddr*)&server, sizeof(server)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//CTOS_PLAYER_INFO with name$password and CTOS_JOIN_GAME, as in bench/flood
+static size_t loginPackets(unsigned char* out, int account)
+{
+    unsigned char* p = out;
+    char name[32];
+    snprintf(name, sizeof(name), "bench%d$benchpw", account);
+    *p++ = 41;
+    *p++ = 0;
+    *p++ = 0x10;
+    memset(p, 0, 40);
+    for(int i = 0; name[i] && i < 19; i++)
+        p[i * 2] = name[i];
+    p += 40;
+    *p++ = 49;
+    *p++ = 0;
+    *p++ = 0x12;
+    memset(p, 0, 48);
+    const char* room = "bench";
+    for(int i = 0; room[i]; i++)
+        p[8 + i * 2] = room[i];
+    p += 48;
+    return p - out;
+}
+
+struct Client
+{
+    int fd;
+    int64_t start;
+};
+
+int main(int argc, char** argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 9999;
+    int clients = argc > 2 ? atoi(argv[2]) : 8;
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    int accounts = argc > 4 ? atoi(argv[4]) : 1000;
+
+    int next = 0, failed = 0, refused = 0;
+    std::vector<int64_t> latencies;
+    char source[32];
+    //a login on a client that has none
+    auto startLogin = [&](Client& c)
+    {
+        snprintf(source, sizeof(source), "127.3.%d.%d", (next / 250) % 250, next % 250 + 1);
+        unsigned char packets[128];
+        size_t len = loginPackets(packets, next % accounts);
+        next++;
+        c.start = nowUs();
+        c.fd = connectFrom(source, port);
+        if(c.fd >= 0 && write(c.fd, packets, len) != (ssize_t)len)
+        {
+            close(c.fd);
+            c.fd = -1;
+        }
+        if(c.fd < 0)
+            failed++;
+    };
+
+    std::vector<Client> pending(clients);
+    for(auto& c : pending)
+        startLogin(c);
+    int64_t begin = nowUs();
+    int64_t end = begin + (int64_t)seconds * 1000000;
+    while(nowUs() < end)
+    {
+        std::vector<pollfd> fds;
+        for(auto& c : pending)
+        {
+            pollfd pfd = {c.fd, POLLIN, 0};
+            fds.push_back(pfd);
+        }
+        //on a timeout only the clients that could not connect start again
+        poll(&fds[0], fds.size(), 100);
+        for(size_t i = 0; i < fds.size(); i++)
+        {
+            Client& c = pending[i];
+            if(c.fd >= 0 && !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            unsigned char header[3];
+            if(c.fd >= 0 && recv(c.fd, header, 3, MSG_WAITALL) == 3)
+            {
+                latencies.push_back(nowUs() - c.start);
+                if(header[2] == 0x2)
+                    refused++;
+            }
+            else if(c.fd >= 0)
+                failed++;
+            if(c.fd >= 0)
+                close(c.fd);
+            startLogin(c);
+        }
+    }
+    double elapsed = (nowUs() - begin) / 1e6;
+    for(auto& c : pending)
+        if(c.fd >= 0)
+            close(c.fd);
+
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    printf("%d clients, %d accounts: %d logins answered in %.1f s, %.0f logins/s (%d with an error, %d failed)\n",
+           clients, accounts, (int)n, elapsed, n / elapsed, refused, failed);
+    if(n)
+        printf("latency ms: p50 %.1f, p99 %.1f, max %.1f\n", latencies[n / 2] / 1000.0,
+               latencies[std::min(n - 1, n * 99 / 100)] / 1000.0, latencies[n - 1] / 1000.0);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * the send path of a room: the loops of DuelRoom on its players, with the
+ * PlayerTable of the rooms and with the std::map<DuelPlayer*,DuelPlayerInfo> it replaced.
+ * For each room size (2 duelists and n observers) one "message" is:
+ *   - a loop on the players that skips the observers (the duelists get the game messages)
+ *   - a loop on all the players (chat, observers)
+ *   - players[dp] of a duelist (the pending messages of the chat)
+ * No packet is written: only what the table costs.
+ *
+ *   bench/players [messages]
+ */
+#include "RoomInterface.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+using namespace ygo;
+
+static int64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+template<class Table>
+static int64_t run(Table& players, std::vector<DuelPlayer*>& dps, int messages, unsigned long& sink)
+{
+    int64_t start = nowNs();
+    for(int m = 0; m < messages; m++)
+    {
+        for(auto it = players.begin(); it != players.end(); ++it)
+            if(it->first->type != NETPLAYER_TYPE_OBSERVER)
+                sink += it->first->state;
+        for(auto it = players.begin(); it != players.end(); ++it)
+            if(!it->second.zombiePlayer)
+                sink += it->first->type;
+        sink += players[dps[m & 1]].pendingMessages.size();
+    }
+    return nowNs() - start;
+}
+
+int main(int argc, char** argv)
+{
+    int messages = argc > 1 ? atoi(argv[1]) : 100000;
+    int sizes[] = {0, 10, 100, 1000};
+    unsigned long sink = 0;
+    printf("observers   std::map ns/msg   PlayerTable ns/msg\n");
+    for(int observers : sizes)
+    {
+        //the players come from the pool and from the heap of a running server: not contiguous
+        std::vector<DuelPlayer*> dps;
+        std::vector<void*> noise;
+        for(int i = 0; i < 2 + observers; i++)
+        {
+            DuelPlayer* dp = new DuelPlayer;
+            dp->type = i < 2 ? i : NETPLAYER_TYPE_OBSERVER;
+            dps.push_back(dp);
+            noise.push_back(malloc(64 + rand() % 512));
+        }
+        std::map<DuelPlayer*, DuelPlayerInfo> byMap;
+        PlayerTable table;
+        for(DuelPlayer* dp : dps)
+        {
+            byMap[dp];
+            table[dp];
+        }
+        int n = observers >= 100 ? messages / 10 : messages;
+        run(byMap, dps, n / 10, sink);
+        int64_t mapNs = run(byMap, dps, n, sink);
+        run(table, dps, n / 10, sink);
+        int64_t tableNs = run(table, dps, n, sink);
+        printf("%9d   %15.1f   %18.1f\n", observers, (double)mapNs / n, (double)tableNs / n);
+        for(DuelPlayer* dp : dps)
+            delete dp;
+        for(void* p : noise)
+            free(p);
+    }
+    return sink == 42;
+}
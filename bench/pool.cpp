@@ -0,0 +1,113 @@
+/*
+ * connect/disconnect churn on the DuelPlayer pool, against malloc and free of the same object.
+ *   - churn: a gameserver with n players, each step one of them leaves and a new one arrives
+ *   - spike: from 200 players to [spike] and back, the memory of the process after the spike
+ *     and after ObjectPoolBase::TrimAll (the stats timer of the gameserver, every 5 seconds)
+ *
+ *   bench/pool [steps] [spike]
+ */
+#include "network.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace ygo;
+
+static int64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long rssKb()
+{
+    long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(fp == nullptr)
+        return 0;
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static DuelPlayer* newPooled()
+{
+    return new DuelPlayer;
+}
+static void deletePooled(DuelPlayer* dp)
+{
+    delete dp;
+}
+static DuelPlayer* newMalloc()
+{
+    return ::new(malloc(sizeof(DuelPlayer))) DuelPlayer;
+}
+static void deleteMalloc(DuelPlayer* dp)
+{
+    dp->~DuelPlayer();
+    free(dp);
+}
+
+static double churn(int players, int steps, DuelPlayer* (*create)(), void (*destroy)(DuelPlayer*))
+{
+    std::vector<DuelPlayer*> live;
+    for(int i = 0; i < players; i++)
+        live.push_back(create());
+    srand(1);
+    int64_t start = nowNs();
+    for(int s = 0; s < steps; s++)
+    {
+        int i = rand() % players;
+        destroy(live[i]);
+        live[i] = create();
+    }
+    int64_t elapsed = nowNs() - start;
+    for(DuelPlayer* dp : live)
+        destroy(dp);
+    return (double)elapsed / steps;
+}
+
+int main(int argc, char** argv)
+{
+    int steps = argc > 1 ? atoi(argv[1]) : 1000000;
+    int spike = argc > 2 ? atoi(argv[2]) : 20000;
+    ObjectPool<DuelPlayer>* pool = ObjectPool<DuelPlayer>::getInstance("DuelPlayer");
+
+    printf("players   pool ns/step   malloc ns/step\n");
+    for(int players : {100, 1000, 5000})
+    {
+        double pooled = churn(players, steps, newPooled, deletePooled);
+        double heap = churn(players, steps, newMalloc, deleteMalloc);
+        printf("%7d   %12.1f   %14.1f\n", players, pooled, heap);
+    }
+    ObjectPoolBase::TrimAll();
+
+    //a spike of connections that leave in a random order, 200 players stay
+    std::vector<DuelPlayer*> live;
+    long before = rssKb();
+    for(int i = 0; i < spike; i++)
+        live.push_back(new DuelPlayer);
+    long peak = rssKb();
+    srand(2);
+    for(int i = live.size() - 1; i > 0; i--)
+        std::swap(live[i], live[rand() % (i + 1)]);
+    while(live.size() > 200)
+    {
+        delete live.back();
+        live.pop_back();
+    }
+    long after = rssKb();
+    unsigned int capacity = pool->capacity;
+    ObjectPoolBase::TrimAll();
+    printf("spike of %d players (%u bytes each), 200 left\n", spike, (unsigned int)sizeof(DuelPlayer));
+    printf("rss: %ld KB before, %ld KB at the peak, %ld KB after, %ld KB after the trim\n", before, peak, after, rssKb());
+    printf("pool: %u in use, capacity %u after, %u after the trim, %u slabs released\n", pool->inUse, capacity,
+           pool->capacity, pool->released);
+    for(DuelPlayer* dp : live)
+        delete dp;
+    return 0;
+}
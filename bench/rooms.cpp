@@ -0,0 +1,146 @@
+/*
+ * room create/destroy churn, what createServer and removeDeadRooms do: a DuelRoom, its
+ * SingleDuel or TagDuel and the replay buffer of its Replay, from the pools against
+ * plain new and delete of the same sizes.
+ * The constructors are the same in both cases and are not called: the objects are cleared
+ * like a constructor does, and a duel writes [replay KB] of its replay buffer.
+ * The page faults count the memory taken from the system at each room.
+ *
+ *   bench/rooms [steps] [replay KB]
+ */
+#include "DuelRoom.h"
+#include "single_duel.h"
+#include "tag_duel.h"
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace ygo;
+
+static int64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long minorFaults()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+//as in replay.cpp
+struct ReplayBuffer
+{
+    unsigned char data[0x20000];
+};
+typedef ObjectPool<ReplayBuffer, 4> ReplayBufferPool;
+
+static size_t replayBytes = 16 * 1024;
+
+struct Room
+{
+    void* room;
+    void* duel;
+    void* replay;
+    bool tag;
+};
+
+static Room createPooled(bool tag)
+{
+    Room r;
+    r.tag = tag;
+    r.room = DuelRoom::operator new(sizeof(DuelRoom));
+    r.duel = tag ? TagDuel::operator new(sizeof(TagDuel)) : SingleDuel::operator new(sizeof(SingleDuel));
+    r.replay = ReplayBufferPool::getInstance("ReplayBuffer")->allocate(sizeof(ReplayBuffer));
+    return r;
+}
+static void destroyPooled(Room& r)
+{
+    ReplayBufferPool::getInstance("ReplayBuffer")->deallocate(r.replay, sizeof(ReplayBuffer));
+    if(r.tag)
+        TagDuel::operator delete(r.duel, sizeof(TagDuel));
+    else
+        SingleDuel::operator delete(r.duel, sizeof(SingleDuel));
+    DuelRoom::operator delete(r.room, sizeof(DuelRoom));
+}
+static Room createHeap(bool tag)
+{
+    Room r;
+    r.tag = tag;
+    r.room = ::operator new(sizeof(DuelRoom));
+    r.duel = ::operator new(tag ? sizeof(TagDuel) : sizeof(SingleDuel));
+    r.replay = ::operator new(sizeof(ReplayBuffer));
+    return r;
+}
+static void destroyHeap(Room& r)
+{
+    ::operator delete(r.replay);
+    ::operator delete(r.duel);
+    ::operator delete(r.room);
+}
+
+static void use(Room& r)
+{
+    memset(r.room, 0, sizeof(DuelRoom));
+    memset(r.duel, 0, r.tag ? sizeof(TagDuel) : sizeof(SingleDuel));
+    memset(r.replay, 1, replayBytes);
+}
+
+struct Result
+{
+    double ns;
+    double faults;
+};
+
+static Result churn(int rooms, int steps, Room (*create)(bool), void (*destroy)(Room&))
+{
+    std::vector<Room> live;
+    for(int i = 0; i < rooms; i++)
+    {
+        live.push_back(create(i % 4 == 0));
+        use(live.back());
+    }
+    srand(1);
+    long faults = minorFaults();
+    int64_t start = nowNs();
+    for(int s = 0; s < steps; s++)
+    {
+        int i = rand() % rooms;
+        destroy(live[i]);
+        //one tag duel every four rooms
+        live[i] = create(s % 4 == 0);
+        use(live[i]);
+    }
+    Result result;
+    result.ns = (double)(nowNs() - start) / steps;
+    result.faults = (double)(minorFaults() - faults) / steps;
+    for(Room& r : live)
+        destroy(r);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int steps = argc > 1 ? atoi(argv[1]) : 200000;
+    replayBytes = (argc > 2 ? atoi(argv[2]) : 16) * 1024;
+    if(replayBytes > sizeof(ReplayBuffer))
+        replayBytes = sizeof(ReplayBuffer);
+
+    printf("DuelRoom %u bytes, SingleDuel %u, TagDuel %u, replay buffer %u, %u KB of replay written\n",
+           (unsigned int)sizeof(DuelRoom), (unsigned int)sizeof(SingleDuel), (unsigned int)sizeof(TagDuel),
+           (unsigned int)sizeof(ReplayBuffer), (unsigned int)(replayBytes / 1024));
+    printf("rooms   pool ns/room   faults/room   new ns/room   faults/room\n");
+    for(int rooms : {10, 100, 1000})
+    {
+        Result pooled = churn(rooms, steps, createPooled, destroyPooled);
+        Result heap = churn(rooms, steps, createHeap, destroyHeap);
+        printf("%5d   %12.1f   %11.2f   %11.1f   %11.2f\n", rooms, pooled.ns, pooled.faults, heap.ns, heap.faults);
+    }
+    return 0;
+}
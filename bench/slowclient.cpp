@@ -0,0 +1,201 @@
+/*
+ * clients that stop reading, against a running server: the output limits of the gameserver
+ * (output_limit_observer, output_limit_duelist, output_grace_seconds).
+ * [clients] connections from their own loopback ips log in and join a room like bench/logins.
+ * Each one keeps asking for answers that go to all the room: to duelist and back to observer
+ * 20 times a second, and a chat line of 200 characters every second (under the chat limit).
+ * They read only for the first [read seconds]: then their kernel buffers fill (SO_RCVBUF of
+ * 4 KB) and the server queues the rest.
+ * On loopback the socket buffers of the server take some MB before the gameserver queues
+ * anything: lower them on the test machine, e.g. sysctl net.ipv4.tcp_wmem="4096 16384 65536".
+ * Every second: the clients still connected and the bytes read. At the end, when the server
+ * closed each one of them; the queued bytes are in ygo_output_queued_bytes of /metrics.
+ *
+ *   bench/slowclient [port] [clients] [read seconds] [seconds]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static int64_t nowMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int connectFrom(const char* source, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    //before the connect: the window announced to the server stays small
+    int size = 4096;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, source, &local.sin_addr);
+    bind(fd, (sockaddr*)&local, sizeof(local));
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+    if(connect(fd, (sockaddr*)&server, sizeof(server)))
+    {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+//CTOS_PLAYER_INFO with name$password and CTOS_JOIN_GAME, as in bench/logins
+static size_t loginPackets(unsigned char* out, int client)
+{
+    unsigned char* p = out;
+    char name[32];
+    snprintf(name, sizeof(name), "slow%d$benchpw", client);
+    *p++ = 41;
+    *p++ = 0;
+    *p++ = 0x10;
+    memset(p, 0, 40);
+    for(int i = 0; name[i] && i < 19; i++)
+        p[i * 2] = name[i];
+    p += 40;
+    *p++ = 49;
+    *p++ = 0;
+    *p++ = 0x12;
+    memset(p, 0, 48);
+    const char* room = "slow";
+    for(int i = 0; room[i]; i++)
+        p[8 + i * 2] = room[i];
+    p += 48;
+    return p - out;
+}
+
+struct Client
+{
+    int fd;
+    bool observerFirst;
+    long bytesRead;
+    int64_t closedMs;
+};
+
+int main(int argc, char** argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 9999;
+    int clients = argc > 2 ? atoi(argv[2]) : 4;
+    int readSeconds = argc > 3 ? atoi(argv[3]) : 5;
+    int seconds = argc > 4 ? atoi(argv[4]) : 90;
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Client> all(clients);
+    int64_t start = nowMs();
+    for(int i = 0; i < clients; i++)
+    {
+        char source[32];
+        snprintf(source, sizeof(source), "127.4.%d.%d", i / 250, i % 250 + 1);
+        Client& c = all[i];
+        c.fd = connectFrom(source, port);
+        c.observerFirst = i % 2;
+        c.bytesRead = 0;
+        c.closedMs = c.fd < 0 ? 0 : -1;
+        unsigned char packets[128];
+        size_t len = loginPackets(packets, i);
+        if(c.fd >= 0 && write(c.fd, packets, len) != (ssize_t)len)
+        {
+            close(c.fd);
+            c.fd = -1;
+            c.closedMs = 0;
+        }
+    }
+
+    //to observer and to duelist, one after the other
+    unsigned char toObserver[] = {1, 0, 0x21};
+    unsigned char toDuelist[] = {1, 0, 0x20};
+    //CTOS_CHAT, utf-16 with the terminator
+    unsigned char chat[3 + 402];
+    chat[0] = (sizeof(chat) - 2) & 0xff;
+    chat[1] = (sizeof(chat) - 2) >> 8;
+    chat[2] = 0x16;
+    for(int i = 0; i < 200; i++)
+    {
+        chat[3 + i * 2] = 'a' + i % 26;
+        chat[4 + i * 2] = 0;
+    }
+    chat[403] = chat[404] = 0;
+    int ticks = 0;
+    int64_t end = start + (int64_t)seconds * 1000;
+    int64_t nextReport = start + 1000;
+    bool toggle = false;
+    char buffer[65536];
+    while(nowMs() < end)
+    {
+        int64_t now = nowMs();
+        bool reading = now - start < readSeconds * 1000;
+        int open = 0;
+        long total = 0;
+        for(auto& c : all)
+        {
+            if(c.fd < 0)
+                continue;
+            //the room tells everybody in it
+            unsigned char* request = (c.observerFirst == toggle) ? toDuelist : toObserver;
+            ssize_t sent = send(c.fd, request, 3, 0);
+            if(sent == 3 && ticks % 20 == 0)
+                sent = send(c.fd, chat, sizeof(chat), 0);
+            bool closed = sent < 0 && errno != EAGAIN;
+            if(reading || closed)
+            {
+                ssize_t r;
+                while((r = recv(c.fd, buffer, sizeof(buffer), 0)) > 0)
+                    c.bytesRead += r;
+                closed = closed || r == 0 || (r < 0 && errno != EAGAIN);
+            }
+            if(closed)
+            {
+                close(c.fd);
+                c.fd = -1;
+                c.closedMs = now - start;
+                continue;
+            }
+            open++;
+            total += c.bytesRead;
+        }
+        toggle = !toggle;
+        ticks++;
+        if(now >= nextReport)
+        {
+            printf("%3d s: %d clients connected, %ld bytes read%s\n", (int)((now - start) / 1000), open, total,
+                   reading ? "" : ", not reading");
+            fflush(stdout);
+            nextReport += 1000;
+        }
+        usleep(50000);
+    }
+
+    for(int i = 0; i < clients; i++)
+    {
+        const Client& c = all[i];
+        if(c.closedMs > 0)
+            printf("client %d: closed by the server after %.1f s, %.1f s without reading\n", i, c.closedMs / 1000.0,
+                   c.closedMs / 1000.0 - readSeconds);
+        else if(c.closedMs == 0)
+            printf("client %d: could not connect\n", i);
+        else
+            printf("client %d: still connected\n", i);
+        if(c.fd >= 0)
+            close(c.fd);
+    }
+    return 0;
+}
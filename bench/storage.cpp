@@ -0,0 +1,121 @@
+/*
+ * login and score update throughput of the storage backends, through StorageBackend
+ * as UsersDatabase uses them, on the calling thread like the gameserver does:
+ *   - create: the first login of [users] new accounts (bstore<n>, a new user is created)
+ *   - login: the same accounts again, with the password
+ *   - rate: [duels] updateRatings of random players, one tag duel (4 players) every four
+ * sqlite on [sqlite file], removed first. mysql only with a host, on the database of the
+ * server (the bstore accounts stay there, the next runs find them at the create step).
+ * Linked with the objects of the server, built with its flags.
+ *
+ *   bench/storage [users] [duels] [sqlite file] [mysql host] [user] [password] [database]
+ */
+#include "SqliteStorage.h"
+#include "MySqlStorage.h"
+#include "MySqlWrapper.h"
+#include "Config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace ygo;
+
+static int64_t nowUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void report(const char* backend, const char* step, std::vector<int64_t>& latencies, int64_t elapsed,
+                   int failed, const char* extra = "")
+{
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    if(!n)
+        return;
+    printf("%-7s %-7s %6d in %6.2f s: %8.0f/s, latency ms p50 %.2f p99 %.2f max %.2f, %d failed%s\n", backend, step,
+           (int)n, elapsed / 1e6, n * 1e6 / elapsed, latencies[n / 2] / 1000.0,
+           latencies[std::min(n - 1, n * 99 / 100)] / 1000.0, latencies[n - 1] / 1000.0, failed, extra);
+}
+
+static std::string account(int i)
+{
+    return "bstore" + std::to_string(i);
+}
+
+static void run(const char* backend, StorageBackend* storage, int users, int duels)
+{
+    char ip[] = "127.0.0.1";
+    for(const char* step : {"create", "login"})
+    {
+        std::vector<int64_t> latencies;
+        int failed = 0;
+        int64_t start = nowUs();
+        for(int i = 0; i < users; i++)
+        {
+            int64_t t0 = nowUs();
+            if(storage->login(account(i), "benchpw", ip) <= 0)
+                failed++;
+            latencies.push_back(nowUs() - t0);
+        }
+        report(backend, step, latencies, nowUs() - start, failed);
+    }
+
+    std::vector<int64_t> latencies;
+    int failed = 0;
+    long statements = 0;
+    srand(1);
+    int64_t start = nowUs();
+    for(int d = 0; d < duels; d++)
+    {
+        RatingUpdate ru;
+        int players = d % 4 == 0 ? 4 : 2;
+        for(int p = 0; p < players; p++)
+            ru.names.push_back(account(rand() % users));
+        ru.risultato = rand() % 3 == 2 ? 2 : 0;
+        int64_t t0 = nowUs();
+        if(!storage->updateRatings(ru))
+            failed++;
+        latencies.push_back(nowUs() - t0);
+        statements += ru.statements;
+    }
+    char extra[64];
+    snprintf(extra, sizeof(extra), ", %.1f statements per duel", duels ? (double)statements / duels : 0.0);
+    report(backend, "rate", latencies, nowUs() - start, failed, extra);
+}
+
+int main(int argc, char** argv)
+{
+    int users = argc > 1 ? atoi(argv[1]) : 2000;
+    int duels = argc > 2 ? atoi(argv[2]) : 5000;
+    std::string sqlitePath = argc > 3 ? argv[3] : "bench-storage.sqlite";
+    if(users < 4)
+        users = 4;
+
+    unlink(sqlitePath.c_str());
+    unlink((sqlitePath + "-wal").c_str());
+    unlink((sqlitePath + "-shm").c_str());
+    {
+        SqliteStorage sqlite(sqlitePath);
+        run("sqlite", &sqlite, users, duels);
+    }
+
+    if(argc > 4)
+    {
+        Config* config = Config::getInstance();
+        config->mysql_host = argv[4];
+        config->mysql_username = argc > 5 ? argv[5] : "root";
+        config->mysql_password = argc > 6 ? argv[6] : "";
+        config->mysql_database = argc > 7 ? argv[7] : "ygo";
+        MySqlWrapper::getInstance()->connect();
+        MySqlStorage mysql;
+        run("mysql", &mysql, users, duels);
+        MySqlWrapper::getInstance()->disconnect();
+    }
+    return 0;
+}
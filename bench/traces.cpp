@@ -0,0 +1,63 @@
+/*
+ * the load traces for the -S replay of the autoscaler, in the format of autoscale_trace
+ * (time, players, arrivals every 5 seconds), [days] from 2025-10-09 00:00 UTC:
+ *   - smooth: the players follow a daily curve, 60 at night, about 280 in the afternoon and
+ *     40 more from 20:00 to 21:30, with a few logins and logouts at each sample
+ *   - noisy: the same day with bursts and dips of the target at every sample, that the
+ *     arrivals and the departures chase
+ * The same seed gives the same trace. Replay them with TZ=UTC, the profile is by local time:
+ *
+ *   bench/traces smooth > smooth.trace
+ *   TZ=UTC ./server -c server.conf -S smooth.trace
+ *
+ *   bench/traces [smooth|noisy] [days] [seed]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+
+static const time_t START = 1759968000;
+static const int TICK = 5;
+
+int main(int argc, char** argv)
+{
+    bool noisy = argc > 1 && !strcmp(argv[1], "noisy");
+    int days = argc > 2 ? atoi(argv[2]) : 3;
+    unsigned int seed = argc > 3 ? atoi(argv[3]) : (noisy ? 1 : 2);
+    if(argc > 1 && !noisy && strcmp(argv[1], "smooth"))
+    {
+        fprintf(stderr, "usage: %s [smooth|noisy] [days] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 random(seed);
+    std::normal_distribution<double> normal(0, 1);
+    //how fast the players go after the target, for each sample
+    double gain = noisy ? 0.2 : 0.05;
+    int players = 50;
+    for(int i = 0; i < days * 86400; i += TICK)
+    {
+        time_t t = START + i;
+        double hour = (t % 86400) / 3600.0;
+        double target = 60 + 220 * std::max(0.0, sin((hour - 8) / 24 * 2 * M_PI)) + (hour >= 20 && hour < 21.5 ? 40 : 0);
+        int arrivals, departures;
+        if(noisy)
+        {
+            target += 25 * normal(random);
+            arrivals = std::max(0, (int)(std::max(target - players, 0.0) * gain + 3 + 2 * normal(random)));
+            departures = std::max(0, (int)(arrivals - (target - players) * gain));
+        }
+        else
+        {
+            arrivals = std::max(0, (int)(std::max(target - players, 0.0) * gain + 2 + 1.5 * normal(random)));
+            departures = std::max(0, (int)(arrivals - (target - players) * gain + normal(random)));
+        }
+        players = std::max(0, players + arrivals - departures);
+        printf("%ld %d %d\n", (long)t, players, arrivals);
+    }
+    return 0;
+}
@@ -0,0 +1,360 @@
+#include "Autoscaler.h"
+#include "Config.h"
+#include "debug.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace ygo
+{
+
+Autoscaler::Autoscaler():arrivalRate(0),departureRate(0),lastObserve(0),lastPlayers(0),lastLogins(0),lastArrivals(0),
+    lastSpawn(0),lowSince(0),currentSlot(-1),slotSum(0),slotSamples(0)
+{
+    memset(profile,0,sizeof(profile));
+    memset(visits,0,sizeof(visits));
+}
+
+int Autoscaler::slotOf(time_t t)
+{
+    tm local;
+    localtime_r(&t,&local);
+    return (local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec) / SLOT_SECONDS;
+}
+
+void Autoscaler::Observe(time_t now, int players, uint64_t logins)
+{
+    if(lastObserve != 0 && now > lastObserve)
+    {
+        double dt = now - lastObserve;
+        //the departures are the logins that did not add a player
+        int arrivals = logins >= lastLogins ? (int)(logins - lastLogins) : 0;
+        int departures = std::max(arrivals - (players - lastPlayers),0);
+        double alpha = 1 - exp(-dt / RATE_TAU);
+        arrivalRate += alpha * (arrivals * 60.0 / dt - arrivalRate);
+        departureRate += alpha * (departures * 60.0 / dt - departureRate);
+        lastArrivals = arrivals;
+    }
+    else if(lastObserve != 0)
+        return;
+
+    int slot = slotOf(now);
+    if(slot != currentSlot)
+    {
+        if(currentSlot >= 0 && slotSamples)
+        {
+            double mean = slotSum / slotSamples;
+            profile[currentSlot] = visits[currentSlot] ? (1 - PROFILE_WEIGHT) * profile[currentSlot] + PROFILE_WEIGHT * mean : mean;
+            visits[currentSlot]++;
+        }
+        currentSlot = slot;
+        slotSum = 0;
+        slotSamples = 0;
+    }
+    slotSum += players;
+    slotSamples++;
+
+    lastObserve = now;
+    lastPlayers = players;
+    lastLogins = logins;
+}
+
+double Autoscaler::Forecast(time_t now) const
+{
+    int horizon = Config::getInstance()->autoscale_horizon;
+    double trend = lastPlayers + (arrivalRate - departureRate) * horizon / 60.0;
+    double forecast = std::max((double)lastPlayers,trend);
+    //the same time in the last days: what changes from now to the horizon
+    int cur = slotOf(now);
+    int next = slotOf(now + horizon);
+    if(visits[cur] && visits[next] && profile[cur] >= 1)
+        forecast = std::max(forecast,lastPlayers * profile[next] / profile[cur]);
+    return forecast;
+}
+
+int Autoscaler::Wanted(double headroom, int capacity, time_t now) const
+{
+    return std::max(1,(int)ceil(Forecast(now) * (1 + headroom) / capacity));
+}
+
+Autoscaler::Decision Autoscaler::Decide(time_t now, int alive, int capacity, int maxChildren)
+{
+    if(capacity <= 0)
+        return KEEP;
+    Config* config = Config::getInstance();
+    if(alive < std::min(Wanted(config->autoscale_up_headroom,capacity,now),maxChildren))
+    {
+        lowSince = 0;
+        //the new gameserver has not reported its players yet
+        if(now - lastSpawn < SPAWN_COOLDOWN)
+            return KEEP;
+        lastSpawn = now;
+        return SPAWN;
+    }
+    if(alive > 1 && (Wanted(config->autoscale_down_headroom,capacity,now) < alive || alive > maxChildren))
+    {
+        if(!lowSince)
+            lowSince = now;
+        if(now - lowSince >= config->autoscale_scale_down_seconds)
+        {
+            //the next one after another full delay
+            lowSince = 0;
+            return RETIRE;
+        }
+    }
+    else
+        lowSince = 0;
+    return KEEP;
+}
+
+int Autoscaler::ChooseVictim(const std::vector<Child>& children, time_t now) const
+{
+    //a gameserver that drains moves its duels: the fewer the better
+    int victim = -1;
+    for(size_t i = 0; i < children.size(); i++)
+    {
+        const Child& c = children[i];
+        if(!c.isAlive || now - c.spawnedAt < Config::getInstance()->autoscale_min_lifetime)
+            continue;
+        if(victim < 0 || c.duels < children[victim].duels || (c.duels == children[victim].duels && c.players < children[victim].players))
+            victim = i;
+    }
+    return victim;
+}
+
+bool Autoscaler::LoadProfile(const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(),"r");
+    if(fp == nullptr)
+        return false;
+    char line[128];
+    int loaded = 0;
+    while(fgets(line,sizeof(line),fp))
+    {
+        int slot;
+        double players;
+        unsigned int count;
+        if(line[0] == '#' || sscanf(line,"%d %lf %u",&slot,&players,&count) != 3 || slot < 0 || slot >= SLOTS)
+            continue;
+        profile[slot] = players;
+        visits[slot] = count;
+        loaded++;
+    }
+    fclose(fp);
+    log(INFO,"autoscale: %d slots of the profile loaded from %s\n",loaded,path.c_str());
+    return true;
+}
+
+bool Autoscaler::SaveProfile(const std::string& path) const
+{
+    //written aside and renamed, a crash does not leave half a profile
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(),"w");
+    if(fp == nullptr)
+    {
+        log(WARN,"autoscale: cannot write %s\n",tmp.c_str());
+        return false;
+    }
+    fprintf(fp,"# players in slots of %d minutes of local time: slot players days\n",SLOT_SECONDS / 60);
+    for(int i = 0; i < SLOTS; i++)
+        if(visits[i])
+            fprintf(fp,"%d %.1f %u\n",i,profile[i],visits[i]);
+    bool ok = fclose(fp) == 0 && rename(tmp.c_str(),path.c_str()) == 0;
+    if(!ok)
+        log(WARN,"autoscale: cannot save the profile in %s\n",path.c_str());
+    return ok;
+}
+
+void Autoscaler::Record(FILE* trace) const
+{
+    fprintf(trace,"%ld %d %d\n",(long)lastObserve,lastPlayers,lastArrivals);
+}
+
+namespace
+{
+
+struct Sample
+{
+    time_t time;
+    int players;
+    int arrivals;
+};
+
+//the gameservers of one policy during the replay
+struct Fleet
+{
+    const char* name;
+    std::vector<Autoscaler::Child> children;
+    int spawns;
+    int retires;
+    int flaps;
+    double serverSeconds;
+    double overflowSeconds;
+    time_t lastSpawn;
+    time_t lastRetire;
+
+    static const int FLAP_WINDOW = 600;
+
+    Fleet(const char* name, time_t start):name(name),spawns(0),retires(0),flaps(0),serverSeconds(0),overflowSeconds(0),
+        lastSpawn(0),lastRetire(0)
+    {
+        spawn(start);
+        spawns = 0;
+        lastSpawn = 0;
+    }
+    int alive() const
+    {
+        return children.size();
+    }
+    int players() const
+    {
+        int total = 0;
+        for(auto& c : children)
+            total += c.players;
+        return total;
+    }
+    //the new players go to the emptiest gameserver, the departures are spread
+    void setPlayers(int target, int capacity)
+    {
+        int current = players();
+        while(current > target)
+        {
+            auto fullest = std::max_element(children.begin(),children.end(),[](const Autoscaler::Child& a,const Autoscaler::Child& b)
+            {
+                return a.players < b.players;
+            });
+            fullest->players--;
+            current--;
+        }
+        while(current < target)
+        {
+            auto emptiest = std::min_element(children.begin(),children.end(),[](const Autoscaler::Child& a,const Autoscaler::Child& b)
+            {
+                return a.players < b.players;
+            });
+            if(emptiest->players >= capacity)
+                break;
+            emptiest->players++;
+            current++;
+        }
+        //the trace has no duels: two players each
+        for(auto& c : children)
+            c.duels = c.players / 2;
+    }
+    void spawn(time_t now)
+    {
+        Autoscaler::Child child = {0,0,now,true};
+        children.push_back(child);
+        if(lastRetire && now - lastRetire < FLAP_WINDOW)
+            flaps++;
+        spawns++;
+        lastSpawn = now;
+    }
+    void retire(int victim, time_t now, int capacity)
+    {
+        //its players move to the brothers, like a drain
+        int moved = children[victim].players;
+        children.erase(children.begin() + victim);
+        int total = players() + moved;
+        setPlayers(total,capacity);
+        if(lastSpawn && now - lastSpawn < FLAP_WINDOW)
+            flaps++;
+        retires++;
+        lastRetire = now;
+    }
+    void account(int wanted, double dt, int capacity)
+    {
+        serverSeconds += alive() * dt;
+        overflowSeconds += std::max(0,wanted - alive() * capacity) * dt;
+    }
+};
+
+}
+
+bool Autoscaler::Simulate(const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(),"r");
+    if(fp == nullptr)
+    {
+        fprintf(stderr,"cannot open the trace %s\n",path.c_str());
+        return false;
+    }
+    std::vector<Sample> samples;
+    char line[128];
+    while(fgets(line,sizeof(line),fp))
+    {
+        long t;
+        Sample s;
+        if(line[0] != '#' && sscanf(line,"%ld %d %d",&t,&s.players,&s.arrivals) == 3)
+        {
+            s.time = t;
+            samples.push_back(s);
+        }
+    }
+    fclose(fp);
+    if(samples.size() < 2)
+    {
+        fprintf(stderr,"the trace %s has less than two samples\n",path.c_str());
+        return false;
+    }
+
+    Config* config = Config::getInstance();
+    int capacity = config->max_users_per_process;
+    int maxChildren = config->max_processes;
+    Autoscaler policy;
+    Fleet predictive("predictive",samples[0].time);
+    Fleet thresholds("thresholds",samples[0].time);
+    uint64_t logins = 0;
+    int peak = 0;
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        const Sample& s = samples[i];
+        time_t now = s.time;
+        double dt = i ? (double)(now - samples[i - 1].time) : 0;
+        logins += s.arrivals;
+        peak = std::max(peak,s.players);
+
+        predictive.setPlayers(s.players,capacity);
+        predictive.account(s.players,dt,capacity);
+        policy.Observe(now,s.players,logins);
+        Decision d = policy.Decide(now,predictive.alive(),capacity,maxChildren);
+        if(d == SPAWN)
+            predictive.spawn(now);
+        else if(d == RETIRE)
+        {
+            int victim = policy.ChooseVictim(predictive.children,now);
+            if(victim >= 0)
+                predictive.retire(victim,now,capacity);
+        }
+
+        //serversAlmostFull and serversAlmostEmpty as they were
+        thresholds.setPlayers(s.players,capacity);
+        thresholds.account(s.players,dt,capacity);
+        int alive = thresholds.alive();
+        int players = thresholds.players();
+        int high = std::min(std::max(capacity / 10,1),5);
+        int low = std::max(std::min((int)(0.5 * capacity),30),1);
+        if(players + high > alive * capacity && alive < maxChildren)
+            thresholds.spawn(now);
+        else if(players <= (alive - 1) * capacity - low)
+        {
+            auto fewest = std::min_element(thresholds.children.begin(),thresholds.children.end(),[](const Child& a,const Child& b)
+            {
+                return a.players < b.players;
+            });
+            thresholds.retire(fewest - thresholds.children.begin(),now,capacity);
+        }
+    }
+
+    double hours = (samples.back().time - samples.front().time) / 3600.0;
+    printf("%d samples, %.1f hours, peak %d players, %d players for each gameserver, at most %d gameservers\n",
+           (int)samples.size(),hours,peak,capacity,maxChildren);
+    printf("%-12s %7s %7s %7s %15s %22s\n","policy","spawns","drains","flaps","server hours","player hours refused");
+    for(const Fleet* f : {&predictive,&thresholds})
+        printf("%-12s %7d %7d %7d %15.1f %22.2f\n",f->name,f->spawns,f->retires,f->flaps,f->serverSeconds / 3600,f->overflowSeconds / 3600);
+    printf("flaps: a spawn and a drain less than %d minutes apart\n",Fleet::FLAP_WINDOW / 60);
+    return true;
+}
+
+}
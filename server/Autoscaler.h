@@ -0,0 +1,82 @@
+#ifndef _AUTOSCALER_H_
+#define _AUTOSCALER_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+namespace ygo
+{
+
+/*
+ * how many gameservers the father keeps alive.
+ * Every TICK it gets the players and the logins: arrivals and departures are smoothed
+ * (EWMA, RATE_TAU) and the load of the next autoscale_horizon seconds is the highest of the
+ * current one, the trend of the rates and the time-of-day profile of the last days, kept in
+ * autoscale_profile. A gameserver is added when the forecast with autoscale_up_headroom does
+ * not fit, one is drained when it fits with autoscale_down_headroom in one less for
+ * autoscale_scale_down_seconds: the gap between the two is the hysteresis. The victim is the
+ * gameserver with the fewest duels in progress, never one younger than autoscale_min_lifetime.
+ * The samples can be written to autoscale_trace and replayed with -S.
+ */
+class Autoscaler
+{
+public:
+    enum Decision {KEEP,SPAWN,RETIRE};
+    struct Child
+    {
+        int players;
+        int duels;
+        time_t spawnedAt;
+        bool isAlive;
+    };
+
+    static const int TICK = 5;
+    static const int RATE_TAU = 300;
+    static const int SPAWN_COOLDOWN = 30;
+    static const int SLOT_SECONDS = 900;
+    static const int SLOTS = 86400 / SLOT_SECONDS;
+    //weight of the last day in the profile
+    static constexpr double PROFILE_WEIGHT = 0.3;
+
+    Autoscaler();
+    //logins is the total since the start of the father
+    void Observe(time_t now, int players, uint64_t logins);
+    Decision Decide(time_t now, int alive, int capacity, int maxChildren);
+    //index in children, -1 if nobody can go
+    int ChooseVictim(const std::vector<Child>& children, time_t now) const;
+    double Forecast(time_t now) const;
+    int Wanted(double headroom, int capacity, time_t now) const;
+
+    bool LoadProfile(const std::string& path);
+    bool SaveProfile(const std::string& path) const;
+    //a line for each sample: time, players, arrivals
+    void Record(FILE* trace) const;
+
+    //replays a trace against this policy and against the old thresholds
+    static bool Simulate(const std::string& trace);
+
+    double arrivalRate;
+    double departureRate;
+
+private:
+    time_t lastObserve;
+    int lastPlayers;
+    uint64_t lastLogins;
+    int lastArrivals;
+    time_t lastSpawn;
+    time_t lowSince;
+
+    double profile[SLOTS];
+    uint32_t visits[SLOTS];
+    //the slot being visited now, folded in the profile when it ends
+    int currentSlot;
+    double slotSum;
+    int slotSamples;
+
+    static int slotOf(time_t t);
+};
+
+}
+#endif
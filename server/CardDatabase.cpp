@@ -0,0 +1,351 @@
+#include "CardDatabase.h"
+#include "debug.h"
+#include "deck_manager.h"
+#include "../ocgcore/card.h"
+#include <sqlite3.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <string>
+
+namespace ygo
+{
+
+static const char IMAGE_MAGIC[8] = {'Y','G','O','C','D','B','\0','\0'};
+static const uint32_t IMAGE_VERSION = 1;
+static const uint32_t EMPTY_SLOT = 0xffffffff;
+
+const size_t CardDatabase::MAIN_MIN;
+const size_t CardDatabase::MAIN_MAX;
+const size_t CardDatabase::EXTRA_MAX;
+const size_t CardDatabase::SIDE_MAX;
+
+CardDatabase* CardDatabase::getInstance()
+{
+    static CardDatabase cardDatabase;
+    return &cardDatabase;
+}
+
+CardDatabase::CardDatabase():image(nullptr),imageSize(0),header(nullptr),
+    records(nullptr),displacements(nullptr),slots(nullptr)
+{
+}
+
+uint32_t CardDatabase::hash(uint32_t code,uint32_t seed)
+{
+    uint32_t h = code ^ (seed * 0x9e3779b9u);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+bool CardDatabase::Compile(const char* cdbFile,const char* imageFile)
+{
+    sqlite3* pDB;
+    if(sqlite3_open_v2(cdbFile, &pDB, SQLITE_OPEN_READONLY, 0) != SQLITE_OK)
+    {
+        log(WARN,"cannot open %s: %s\n",cdbFile,sqlite3_errmsg(pDB));
+        sqlite3_close(pDB);
+        return false;
+    }
+    sqlite3_stmt* pStmt;
+    const char* sql = "select id,ot,alias,setcode,type,atk,def,level,race,attribute,category from datas";
+    if(sqlite3_prepare_v2(pDB, sql, -1, &pStmt, 0) != SQLITE_OK)
+    {
+        log(WARN,"cannot read %s: %s\n",cdbFile,sqlite3_errmsg(pDB));
+        sqlite3_close(pDB);
+        return false;
+    }
+
+    std::vector<CardRecord> cards;
+    while(sqlite3_step(pStmt) == SQLITE_ROW)
+    {
+        CardRecord cr;
+        memset(&cr,0,sizeof(cr));
+        cr.code = sqlite3_column_int(pStmt, 0);
+        cr.ot = sqlite3_column_int(pStmt, 1);
+        cr.alias = sqlite3_column_int(pStmt, 2);
+        cr.setcode = sqlite3_column_int64(pStmt, 3);
+        cr.type = sqlite3_column_int(pStmt, 4);
+        cr.attack = sqlite3_column_int(pStmt, 5);
+        cr.defence = sqlite3_column_int(pStmt, 6);
+        unsigned int level = sqlite3_column_int(pStmt, 7);
+        cr.level = level & 0xff;
+        cr.lscale = (level >> 24) & 0xff;
+        cr.rscale = (level >> 16) & 0xff;
+        cr.race = sqlite3_column_int(pStmt, 8);
+        cr.attribute = sqlite3_column_int(pStmt, 9);
+        cr.category = sqlite3_column_int(pStmt, 10);
+        cards.push_back(cr);
+    }
+    sqlite3_finalize(pStmt);
+    sqlite3_close(pDB);
+
+    if(cards.empty())
+    {
+        log(WARN,"%s contains no cards\n",cdbFile);
+        return false;
+    }
+
+    /* hash and displace: every bucket gets the first seed that puts all its keys in free slots */
+    uint32_t numCards = cards.size();
+    uint32_t numBuckets = std::max(1u,numCards/4);
+    uint32_t numSlots = numCards + numCards/8 + 1;
+    std::vector<std::vector<uint32_t>> buckets(numBuckets);
+    for(uint32_t i = 0; i < numCards; i++)
+        buckets[hash(cards[i].code,0) % numBuckets].push_back(i);
+
+    std::vector<uint32_t> order(numBuckets);
+    for(uint32_t i = 0; i < numBuckets; i++)
+        order[i] = i;
+    std::sort(order.begin(),order.end(),[&buckets](uint32_t a,uint32_t b)
+    {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<uint32_t> displacement(numBuckets,0);
+    std::vector<uint32_t> slot(numSlots,EMPTY_SLOT);
+    std::vector<uint32_t> positions;
+    for(uint32_t b : order)
+    {
+        if(buckets[b].empty())
+            break;
+        uint32_t d;
+        for(d = 1; d < 0x1000000; d++)
+        {
+            positions.clear();
+            bool ok = true;
+            for(uint32_t idx : buckets[b])
+            {
+                uint32_t pos = hash(cards[idx].code,d) % numSlots;
+                if(slot[pos] != EMPTY_SLOT ||
+                        std::find(positions.begin(),positions.end(),pos) != positions.end())
+                {
+                    ok = false;
+                    break;
+                }
+                positions.push_back(pos);
+            }
+            if(ok)
+                break;
+        }
+        if(d == 0x1000000)
+        {
+            log(WARN,"cannot build the card index, duplicated codes in %s?\n",cdbFile);
+            return false;
+        }
+        displacement[b] = d;
+        for(size_t i = 0; i < positions.size(); i++)
+            slot[positions[i]] = buckets[b][i];
+    }
+
+    ImageHeader ih;
+    memset(&ih,0,sizeof(ih));
+    memcpy(ih.magic,IMAGE_MAGIC,sizeof(ih.magic));
+    ih.version = IMAGE_VERSION;
+    ih.numCards = numCards;
+    ih.numBuckets = numBuckets;
+    ih.numSlots = numSlots;
+    ih.recordsOffset = sizeof(ImageHeader);
+    ih.displacementsOffset = ih.recordsOffset + numCards * sizeof(CardRecord);
+    ih.slotsOffset = ih.displacementsOffset + numBuckets * sizeof(uint32_t);
+    ih.fileSize = ih.slotsOffset + numSlots * sizeof(uint32_t);
+
+    std::string tmpFile = std::string(imageFile) + ".tmp";
+    FILE* fp = fopen(tmpFile.c_str(),"wb");
+    if(!fp)
+    {
+        log(WARN,"cannot write %s\n",tmpFile.c_str());
+        return false;
+    }
+    bool written = fwrite(&ih,sizeof(ih),1,fp) == 1 &&
+                   fwrite(cards.data(),sizeof(CardRecord),numCards,fp) == numCards &&
+                   fwrite(displacement.data(),sizeof(uint32_t),numBuckets,fp) == numBuckets &&
+                   fwrite(slot.data(),sizeof(uint32_t),numSlots,fp) == numSlots;
+    if(fclose(fp) != 0 || !written || rename(tmpFile.c_str(),imageFile) != 0)
+    {
+        log(WARN,"cannot write %s\n",imageFile);
+        unlink(tmpFile.c_str());
+        return false;
+    }
+    log(INFO,"%s: %u cards, %u buckets, %u slots, %u bytes\n",imageFile,numCards,numBuckets,numSlots,ih.fileSize);
+    return true;
+}
+
+bool CardDatabase::Load(const char* imageFile)
+{
+    int fd = open(imageFile,O_RDONLY);
+    if(fd < 0)
+    {
+        log(WARN,"card image %s not found, using the sqlite database\n",imageFile);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(ImageHeader))
+    {
+        log(WARN,"card image %s is truncated\n",imageFile);
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        log(WARN,"cannot map %s\n",imageFile);
+        return false;
+    }
+
+    const ImageHeader* ih = (const ImageHeader*)map;
+    if(memcmp(ih->magic,IMAGE_MAGIC,sizeof(ih->magic)) || ih->version != IMAGE_VERSION ||
+            ih->fileSize != (size_t)st.st_size || ih->numBuckets == 0 || ih->numSlots == 0 ||
+            ih->recordsOffset + (size_t)ih->numCards * sizeof(CardRecord) > ih->fileSize ||
+            ih->displacementsOffset + (size_t)ih->numBuckets * sizeof(uint32_t) > ih->fileSize ||
+            ih->slotsOffset + (size_t)ih->numSlots * sizeof(uint32_t) > ih->fileSize)
+    {
+        log(WARN,"card image %s is not valid, rebuild it with -C\n",imageFile);
+        munmap(map,st.st_size);
+        return false;
+    }
+
+    if(image)
+        munmap((void*)image,imageSize);
+    image = (const char*)map;
+    imageSize = st.st_size;
+    header = ih;
+    records = (const CardRecord*)(image + ih->recordsOffset);
+    displacements = (const uint32_t*)(image + ih->displacementsOffset);
+    slots = (const uint32_t*)(image + ih->slotsOffset);
+    log(INFO,"card image %s mapped: %u cards\n",imageFile,ih->numCards);
+    return true;
+}
+
+bool CardDatabase::isLoaded()
+{
+    return header != nullptr;
+}
+
+const CardDatabase::CardRecord* CardDatabase::getCard(uint32_t code)
+{
+    if(!header)
+        return nullptr;
+    uint32_t d = displacements[hash(code,0) % header->numBuckets];
+    uint32_t idx = slots[hash(code,d) % header->numSlots];
+    if(idx >= header->numCards || records[idx].code != code)
+        return nullptr;
+    return &records[idx];
+}
+
+int CardDatabase::CardReader(int code, card_data* pData)
+{
+    const CardRecord* cr = getInstance()->getCard(code);
+    memset(pData,0,sizeof(card_data));
+    if(cr)
+    {
+        pData->code = cr->code;
+        pData->alias = cr->alias;
+        pData->setcode = cr->setcode;
+        pData->type = cr->type;
+        pData->level = cr->level;
+        pData->attribute = cr->attribute;
+        pData->race = cr->race;
+        pData->attack = cr->attack;
+        pData->defence = cr->defence;
+        pData->lscale = cr->lscale;
+        pData->rscale = cr->rscale;
+    }
+    return 0;
+}
+
+int CardDatabase::LoadDeck(Deck& deck, int* dbuf, int mainc, int sidec)
+{
+    //unknown cards and tokens are dropped, the extra deck cards go to the extra deck and each part is capped
+    deck.clear();
+    int errorcode = 0;
+    for(int i = 0; i < mainc + sidec; i++)
+    {
+        const CardRecord* cr = getCard(dbuf[i]);
+        if(!cr)
+        {
+            errorcode = dbuf[i];
+            continue;
+        }
+        if(cr->type & TYPE_TOKEN)
+            continue;
+        if(i >= mainc)
+        {
+            if(deck.side.size() < SIDE_MAX)
+                deck.side.push_back(cr);
+        }
+        else if(cr->type & (TYPE_FUSION | TYPE_SYNCHRO | TYPE_XYZ))
+        {
+            if(deck.extra.size() < EXTRA_MAX)
+                deck.extra.push_back(cr);
+        }
+        else if(deck.main.size() < MAIN_MAX)
+            deck.main.push_back(cr);
+    }
+    return errorcode;
+}
+
+bool CardDatabase::LoadSide(Deck& deck, int* dbuf, int mainc, int sidec)
+{
+    //the side deck can only swap cards: the same cards, the same sizes
+    std::unordered_map<int, int> pcount;
+    std::unordered_map<int, int> ncount;
+    Deck ndeck;
+    LoadDeck(ndeck, dbuf, mainc, sidec);
+    if(ndeck.main.size() != deck.main.size() || ndeck.extra.size() != deck.extra.size())
+        return false;
+    for(const std::vector<const CardRecord*>* part : {&deck.main, &deck.extra, &deck.side})
+        for(const CardRecord* cr : *part)
+            pcount[cr->code]++;
+    for(const std::vector<const CardRecord*>* part : {&ndeck.main, &ndeck.extra, &ndeck.side})
+        for(const CardRecord* cr : *part)
+            ncount[cr->code]++;
+    for(auto it = ncount.begin(); it != ncount.end(); ++it)
+        if(it->second != pcount[it->first])
+            return false;
+    deck = ndeck;
+    return true;
+}
+
+int CardDatabase::CheckLFList(const Deck& deck, unsigned int lfhash, bool allow_ocg, bool allow_tcg)
+{
+    std::unordered_map<int, int>* list = nullptr;
+    for(size_t i = 0; i < deckManager._lfList.size(); ++i)
+    {
+        if(deckManager._lfList[i].hash == lfhash)
+        {
+            list = deckManager._lfList[i].content;
+            break;
+        }
+    }
+    if(!list)
+        return 0;
+    if(deck.main.size() < MAIN_MIN || deck.main.size() > MAIN_MAX || deck.extra.size() > EXTRA_MAX || deck.side.size() > SIDE_MAX)
+        return 1;
+
+    std::unordered_map<int, int> ccount;
+    for(const std::vector<const CardRecord*>* part : {&deck.main, &deck.extra, &deck.side})
+        for(const CardRecord* cr : *part)
+        {
+            if((!allow_ocg && cr->ot == 0x1) || (!allow_tcg && cr->ot == 0x2))
+                return cr->code;
+            int code = cr->alias ? cr->alias : cr->code;
+            int dc = ++ccount[code];
+            auto it = list->find(code);
+            if(dc > 3 || (it != list->end() && dc > it->second))
+                return cr->code;
+        }
+    return 0;
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef _CARDDATABASE_H_
+#define _CARDDATABASE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+struct card_data;
+
+namespace ygo
+{
+
+/*
+ * Read-only card image shared by every gameserver.
+ * cards.bin is produced offline from cards.cdb (see -C) and mapped before the fork:
+ * the pages are never written so the children keep sharing them.
+ * The file contains only offsets, no pointers, so it can be mapped anywhere.
+ * It is the only copy of the cards in the server: cards.cdb is read only to build it.
+ */
+class CardDatabase
+{
+public:
+    struct ImageHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t numCards;
+        uint32_t numBuckets;
+        uint32_t numSlots;
+        uint32_t recordsOffset;
+        uint32_t displacementsOffset;
+        uint32_t slotsOffset;
+        uint32_t fileSize;
+    };
+    struct CardRecord
+    {
+        uint32_t code;
+        uint32_t alias;
+        uint64_t setcode;
+        uint32_t type;
+        uint32_t level;
+        uint32_t attribute;
+        uint32_t race;
+        int32_t attack;
+        int32_t defence;
+        uint32_t lscale;
+        uint32_t rscale;
+        uint32_t ot;
+        uint32_t category;
+    };
+
+    //the sizes of a deck, the same of the client
+    static const size_t MAIN_MIN = 40;
+    static const size_t MAIN_MAX = 60;
+    static const size_t EXTRA_MAX = 15;
+    static const size_t SIDE_MAX = 15;
+
+    //the Deck of the client on the image: the records stay mapped until the exit
+    struct Deck
+    {
+        std::vector<const CardRecord*> main;
+        std::vector<const CardRecord*> extra;
+        std::vector<const CardRecord*> side;
+        void clear()
+        {
+            main.clear();
+            extra.clear();
+            side.clear();
+        }
+    };
+
+    static CardDatabase* getInstance();
+
+    static bool Compile(const char* cdbFile,const char* imageFile);
+    bool Load(const char* imageFile);
+    bool isLoaded();
+
+    const CardRecord* getCard(uint32_t code);
+    //the rules of DeckManager::LoadDeck, LoadSide and CheckLFList
+    int LoadDeck(Deck& deck, int* dbuf, int mainc, int sidec);
+    bool LoadSide(Deck& deck, int* dbuf, int mainc, int sidec);
+    int CheckLFList(const Deck& deck, unsigned int lfhash, bool allow_ocg, bool allow_tcg);
+
+    static int CardReader(int code, card_data* pData);
+
+private:
+    CardDatabase();
+    static uint32_t hash(uint32_t code,uint32_t seed);
+
+    const char* image;
+    size_t imageSize;
+    const ImageHeader* header;
+    const CardRecord* records;
+    const uint32_t* displacements;
+    const uint32_t* slots;
+};
+
+}
+#endif
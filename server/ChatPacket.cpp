@@ -0,0 +1,56 @@
+#include "ChatPacket.h"
+#include "network.h"
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+namespace ygo
+{
+
+unsigned long ChatPacket::encoded = 0;
+unsigned long ChatPacket::sent = 0;
+
+unsigned short ChatPacket::playerFromColor(int color)
+{
+    if(color == -1) //[System]:
+        return 8;
+    else if(color == -2) //checkmate admin
+        return 14;
+    else if(color > 0) //colored chat
+        return 11+color;
+    else //[---]: [name] guest
+        return 10;
+}
+
+ChatPacket* ChatPacket::create(const std::wstring& msg,int color)
+{
+    ChatPacket* packet = new ChatPacket();
+    char* p = packet->buffer;
+    STOC_Chat scc;
+    scc.player = playerFromColor(color);
+    int msglen = BufferIO::CopyWStr(msg.c_str(), scc.msg, 256);
+    unsigned short len = 4 + msglen * 2;
+    BufferIO::WriteInt16(p, 1 + len);
+    BufferIO::WriteInt8(p, STOC_CHAT);
+    memcpy(p, &scc, len);
+    packet->len = len + 3;
+    encoded++;
+    return packet;
+}
+
+void ChatPacket::sendTo(bufferevent* bev)
+{
+    retain();
+    if(evbuffer_add_reference(bufferevent_get_output(bev),buffer,len,cleanup,this))
+    {
+        release();
+        return;
+    }
+    sent++;
+}
+
+void ChatPacket::cleanup(const void* data,size_t datalen,void* extra)
+{
+    ((ChatPacket*)extra)->release();
+}
+
+}
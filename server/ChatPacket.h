@@ -0,0 +1,91 @@
+#ifndef _CHATPACKET_H_
+#define _CHATPACKET_H_
+#include <string>
+#include <stddef.h>
+#include "ObjectPool.h"
+
+struct bufferevent;
+
+namespace ygo
+{
+
+/*
+ * a STOC_CHAT packet already encoded for the wire (length, proto, STOC_Chat).
+ * A broadcast encodes the message once and every recipient gets a reference
+ * to the same bytes in its output evbuffer: the packet is freed when the last
+ * evbuffer (or pending message queue) releases it.
+ * The reference count is not atomic, a packet never leaves its gameserver.
+ */
+class ChatPacket
+{
+public:
+    static ChatPacket* create(const std::wstring& msg,int color);
+    static unsigned short playerFromColor(int color);
+
+    void retain()
+    {
+        refs++;
+    }
+    void release()
+    {
+        if(--refs == 0)
+            delete this;
+    }
+    const char* data() const
+    {
+        return buffer;
+    }
+    size_t size() const
+    {
+        return len;
+    }
+    void sendTo(bufferevent* bev);
+
+    static unsigned long encoded;
+    static unsigned long sent;
+
+    DECLARE_POOLED_NEW(ChatPacket)
+
+private:
+    ChatPacket():refs(0),len(0) {}
+    ~ChatPacket() {}
+    static void cleanup(const void* data,size_t datalen,void* extra);
+
+    unsigned int refs;
+    size_t len;
+    char buffer[3 + 2 + 256 * 2];
+};
+
+//keeps a ChatPacket alive, like a shared_ptr without its own allocation
+class ChatPacketRef
+{
+    ChatPacket* packet;
+public:
+    ChatPacketRef(ChatPacket* packet = nullptr):packet(packet)
+    {
+        if(packet)
+            packet->retain();
+    }
+    ChatPacketRef(const ChatPacketRef& other):ChatPacketRef(other.packet) {}
+    ~ChatPacketRef()
+    {
+        if(packet)
+            packet->release();
+    }
+    ChatPacketRef& operator=(ChatPacketRef other)
+    {
+        std::swap(packet,other.packet);
+        return *this;
+    }
+    ChatPacket* get() const
+    {
+        return packet;
+    }
+    ChatPacket* operator->() const
+    {
+        return packet;
+    }
+};
+
+}
+#endif
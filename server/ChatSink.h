@@ -0,0 +1,22 @@
+#ifndef _CHATSINK_H_
+#define _CHATSINK_H_
+#include "IpcFrame.h"
+#include <vector>
+
+namespace ygo
+{
+
+/*
+ * destination of the global chat outside the server (web chat, logs...).
+ * The father calls publish() for every message of the gameservers,
+ * from the select loop: it must not block.
+ */
+class ChatSink
+{
+public:
+    virtual ~ChatSink() {}
+    virtual void publish(const ChatMessage& msg) = 0;
+};
+
+}
+#endif
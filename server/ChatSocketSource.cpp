@@ -0,0 +1,181 @@
+#include "ChatSocketSource.h"
+#include "debug.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+namespace ygo
+{
+
+ChatSocketSource::ChatSocketSource(const std::string& path):path(path),listen_fd(-1),lastMessage(0)
+{
+    sockaddr_un addr;
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        log(WARN,"chat socket path too long: %s\n",path.c_str());
+        return;
+    }
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path,path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(listen_fd < 0)
+        return;
+    unlink(path.c_str());
+    if(bind(listen_fd,(sockaddr*)&addr,sizeof(addr)) || listen(listen_fd,MAX_CLIENTS))
+    {
+        log(WARN,"cannot listen on the chat socket %s: %s\n",path.c_str(),strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return;
+    }
+    log(INFO,"chat socket listening on %s\n",path.c_str());
+}
+
+ChatSocketSource::~ChatSocketSource()
+{
+    for(auto it = clients.cbegin(); it != clients.cend(); ++it)
+        close(it->first);
+    if(listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+}
+
+bool ChatSocketSource::isOpen()
+{
+    return listen_fd >= 0;
+}
+
+bool ChatSocketSource::isActive()
+{
+    return !clients.empty() || time(NULL) - lastMessage < ACTIVE_TIMEOUT;
+}
+
+int ChatSocketSource::prepareSelect(fd_set* rfds)
+{
+    if(listen_fd < 0)
+        return -1;
+    int max_fd = listen_fd;
+    FD_SET(listen_fd,rfds);
+    for(auto it = clients.cbegin(); it != clients.cend(); ++it)
+    {
+        FD_SET(it->first,rfds);
+        max_fd = std::max(max_fd,it->first);
+    }
+    return max_fd;
+}
+
+void ChatSocketSource::readMessages(fd_set* rfds, std::vector<ChatMessage>& messages)
+{
+    if(listen_fd < 0)
+        return;
+    if(FD_ISSET(listen_fd,rfds))
+        acceptClients();
+    for(auto it = clients.begin(); it != clients.end();)
+    {
+        if(FD_ISSET(it->first,rfds) && !readClient(it->first,it->second,messages))
+        {
+            close(it->first);
+            it = clients.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void ChatSocketSource::acceptClients()
+{
+    while(true)
+    {
+        int fd = accept4(listen_fd,NULL,NULL,SOCK_NONBLOCK);
+        if(fd < 0)
+            return;
+        if(clients.size() >= MAX_CLIENTS)
+        {
+            log(WARN,"too many writers on the chat socket\n");
+            close(fd);
+            continue;
+        }
+        clients[fd] = std::string();
+    }
+}
+
+bool ChatSocketSource::readClient(int fd, std::string& buffer, std::vector<ChatMessage>& messages)
+{
+    //true is OK
+    char data[4096];
+    while(true)
+    {
+        int bytesread = read(fd,data,sizeof(data));
+        if(bytesread == 0)
+            return false;
+        if(bytesread < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        buffer.append(data,bytesread);
+        if(buffer.size() > MAX_LINE * 4)
+            break;
+    }
+
+    size_t start = 0;
+    size_t end;
+    while((end = buffer.find('\n',start)) != std::string::npos)
+    {
+        ChatMessage msg;
+        if(parseLine(buffer.substr(start,end - start),msg))
+        {
+            messages.push_back(msg);
+            lastMessage = time(NULL);
+        }
+        start = end + 1;
+    }
+    buffer.erase(0,start);
+    if(buffer.size() > MAX_LINE)
+    {
+        log(WARN,"line too long on the chat socket\n");
+        return false;
+    }
+    return true;
+}
+
+bool ChatSocketSource::parseLine(const std::string& line, ChatMessage& msg)
+{
+    size_t tab1 = line.find('\t');
+    if(tab1 == std::string::npos)
+        return false;
+    size_t tab2 = line.find('\t',tab1 + 1);
+    if(tab2 == std::string::npos)
+        return false;
+    int color = atoi(line.substr(0,tab1).c_str());
+    std::string username = line.substr(tab1 + 1,tab2 - tab1 - 1);
+    std::string text = line.substr(tab2 + 1);
+    if(username.empty() || text.empty())
+        return false;
+    msg = webMessage(username,text,color);
+    return true;
+}
+
+void ChatSocketSource::afterFork()
+{
+    //the file belongs to the father, only the descriptors are closed
+    for(auto it = clients.cbegin(); it != clients.cend(); ++it)
+        close(it->first);
+    clients.clear();
+    if(listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef _CHATSOCKETSOURCE_H_
+#define _CHATSOCKETSOURCE_H_
+#include "ChatSource.h"
+#include <map>
+#include <string>
+#include <ctime>
+
+namespace ygo
+{
+
+/*
+ * push endpoint for the web chat: a unix socket where the web side (or anything
+ * local) writes one message per line:
+ *     color \t username \t text \n
+ * text is UTF-8. The messages go in the chat bus at the next turn of the select loop.
+ */
+class ChatSocketSource: public ChatSource
+{
+public:
+    ChatSocketSource(const std::string& path);
+    ~ChatSocketSource();
+    bool isOpen();
+    //a writer is connected or wrote recently: the mysql polling is not needed
+    bool isActive();
+
+    int prepareSelect(fd_set* rfds);
+    void readMessages(fd_set* rfds, std::vector<ChatMessage>& messages);
+    void afterFork();
+
+    static const unsigned int MAX_CLIENTS = 16;
+    static const unsigned int MAX_LINE = 4096;
+    static const int ACTIVE_TIMEOUT = 60;
+
+private:
+    std::string path;
+    int listen_fd;
+    std::map<int,std::string> clients;
+    time_t lastMessage;
+
+    void acceptClients();
+    bool readClient(int fd, std::string& buffer, std::vector<ChatMessage>& messages);
+    bool parseLine(const std::string& line, ChatMessage& msg);
+};
+
+}
+#endif
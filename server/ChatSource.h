@@ -0,0 +1,45 @@
+#ifndef _CHATSOURCE_H_
+#define _CHATSOURCE_H_
+#include "IpcFrame.h"
+#include <sys/select.h>
+#include <vector>
+
+namespace ygo
+{
+
+/*
+ * origin of global chat messages written outside the server (web chat...).
+ * The father adds the descriptors of the sources to its select and then asks
+ * every source for the messages it has: nothing here may block.
+ */
+class ChatSource
+{
+public:
+    virtual ~ChatSource() {}
+    //adds the descriptors to watch, returns the highest one or -1
+    virtual int prepareSelect(fd_set* rfds)
+    {
+        return -1;
+    }
+    virtual void readMessages(fd_set* rfds, std::vector<ChatMessage>& messages) = 0;
+    //in the gameserver after the fork: release what belongs to the father
+    virtual void afterFork() {}
+
+    //same format of the messages of the web chat
+    static ChatMessage webMessage(const std::string& username, const std::string& text, int color)
+    {
+        ChatMessage msg;
+        msg.color = color;
+        msg.timestamp = IpcFrame::nowMs();
+        if(username.find(">",1) != std::string::npos || color < 0)
+            msg.text = "[" + username + "]: " + text;
+        else
+            msg.text = "[" + username + "<^_^>]: " + text;
+        //capped with the prefix, on a character
+        msg.text.resize(IpcFrame::utf8Length(msg.text,IpcFrame::MAX_CHAT_TEXT));
+        return msg;
+    }
+};
+
+}
+#endif
@@ -1,9 +1,16 @@
 #include "Config.h"
-#include "data_manager.h"
 #include "deck_manager.h"
+#include "CardDatabase.h"
+#include "DuelAnalytics.h"
+#include "Autoscaler.h"
+#include "IpcFrame.h"
+#include "debug.h"
 #include <getopt.h>
 #include <signal.h>
+#include <sys/time.h>
 #include <event2/thread.h>
+#include <vector>
+#include <unordered_map>
 
 const unsigned short PRO_VERSION = 0x1321;
 extern const unsigned int BUILD_NUMBER = VERSION;
@@ -12,6 +19,8 @@ int enable_log = 2;
 namespace ygo
 {
 using namespace std;
+volatile sig_atomic_t Config::reloadRequested = 0;
+
 Config* Config::getInstance()
 {
     static Config config;
@@ -21,7 +30,7 @@ bool Config::parseCommandLine(int argc, char**argv)
 {
     //true if you must stop
     opterr = 0;
-    for (int c; (c = getopt (argc, argv, ":hc:p:")) != -1;)
+    for (int c; (c = getopt (argc, argv, ":hc:p:C:A:US:")) != -1;)
     {
 
         switch (c)
@@ -34,7 +43,32 @@ bool Config::parseCommandLine(int argc, char**argv)
             cout<<"-c configfile    for the config file"<<endl;
             cout<<"-h               help "<<endl;
             cout<<"-p num           port "<<endl;
+            cout<<"-C cards.cdb     compile the card database into "<<card_image<<" and exit"<<endl;
+            cout<<"-A 'files[:cols]' query the duel analytics, e.g. -A '"<<analytics_dir<<"/duels-*.col:mode,turns'"<<endl;
+            cout<<"-U               take the port from the running server (upgrade_socket) instead of binding it"<<endl;
+            cout<<"-S trace         replay an autoscale_trace against the autoscaler, with the -c config given before"<<endl;
+            return true;
+        case 'C':
+            CardDatabase::Compile(optarg,card_image.c_str());
+            return true;
+        case 'A':
+            DuelAnalytics::Query(optarg);
             return true;
+        case 'U':
+            hotUpgrade = true;
+            break;
+        case 'S':
+        {
+            //only the numbers of the config file, without the cards
+            FILE* fp = fopen(configFile.c_str(), "r");
+            if(fp)
+            {
+                parseConfig(fp);
+                fclose(fp);
+            }
+            Autoscaler::Simulate(optarg);
+            return true;
+        }
         case 'p':
             serverport = stoi(optarg);
             cout<<"command line, port set to: "<<serverport<<endl;
@@ -88,50 +122,36 @@ void Config::check_variable(bool &var,std::string value,std::string name)
     printf("caricata la variabile %s con il valore %s\n",name.c_str(),value.c_str());
 }
 
+void Config::check_variable(double &var,std::string value,std::string name)
+{
+    var=stod(value);
+    printf("caricata la variabile %s con il valore %g\n",name.c_str(),var);
+}
 
 
 
-void Config::LoadConfig()
-{
-#ifdef _WIN32
-    evthread_use_windows_threads();
-#else
-    evthread_use_pthreads();
-#endif //_WIN32
-
-    signal(SIGPIPE, SIG_IGN);
-	signal(SIGCHLD, SIG_IGN);
-    deckManager.LoadLFList();
-    if(wcsstr(deckManager._lfList[0].listName,L"TCG"))
-        std::swap(deckManager._lfList[0],deckManager._lfList[1]);
 
-    if(!dataManager.LoadDB("cards.cdb"))
-        return;
-    //if(!dataManager.LoadStrings("strings.conf"))
-      //  return;
-    FILE* fp = fopen(configFile.c_str(), "r");
-    if(!fp)
-    {
-        cerr<<"Couldn't open config file: "<<configFile<<endl;
-    }
-    else
-    {
-        char linebuf[256];
-        char strbuf[32];
-        char valbuf[256];
-        wchar_t wstr[256];
+int Config::parseConfig(FILE* fp)
+{
+    char linebuf[256];
+    char strbuf[32];
+    char valbuf[256];
+    wchar_t wstr[256];
 
-        fseek(fp, 0, SEEK_END);
-        size_t fsize = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-        int linenum=0;
+    fseek(fp, 0, SEEK_END);
+    size_t fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    int errors = 0;
 
-        #define CHECK_VARIABLE(VAR) else if(!strcmp(strbuf,#VAR)) check_variable(VAR,valbuf,#VAR)
+    #define CHECK_VARIABLE(VAR) else if(!strcmp(strbuf,#VAR)) check_variable(VAR,valbuf,#VAR)
 
-        for(int linenum=0; ftell(fp) < fsize; linenum++)
+    for(int linenum=0; ftell(fp) < fsize; linenum++)
+    {
+        fgets(linebuf, 250, fp);
+        int scanfSuccess = sscanf(linebuf, "%s = %[^\n]s", strbuf, valbuf);
+        //stoi throws on a number that is not a number
+        try
         {
-            fgets(linebuf, 250, fp);
-            int scanfSuccess = sscanf(linebuf, "%s = %[^\n]s", strbuf, valbuf);
             if(scanfSuccess <= 0 || strbuf[0] == '#')
             {
                 //ignored line
@@ -139,11 +159,16 @@ void Config::LoadConfig()
             else if(scanfSuccess < 2)
             {
                 cerr<<"Could not parse line "<<linenum<<": "<<linebuf<<endl;
+                errors++;
             }
             else if(!strcmp(strbuf,"serverport"))
             {
+                //the listener is bound once: a different port needs a restart
                 if(serverport)
-                    cout<<"the serverport is already set, ignoring the one in the config file"<<endl;
+                {
+                    if(stoi(valbuf) != serverport)
+                        cout<<"the serverport is already set to "<<serverport<<", ignoring the one in the config file"<<endl;
+                }
                 else
                 {
                     serverport = stoi(valbuf);
@@ -162,13 +187,78 @@ void Config::LoadConfig()
             CHECK_VARIABLE(waitingroom_min_waiting);
             CHECK_VARIABLE(waitingroom_max_waiting);
             CHECK_VARIABLE(noExternalChat);
-			CHECK_VARIABLE(debugSql);
+            CHECK_VARIABLE(debugSql);
+            CHECK_VARIABLE(card_image);
+            CHECK_VARIABLE(deck_archive);
+            CHECK_VARIABLE(max_connections_per_minute);
+            CHECK_VARIABLE(ban_seconds);
+            CHECK_VARIABLE(chat_socket);
+            CHECK_VARIABLE(mysql_pool_size);
+            CHECK_VARIABLE(stats_journal);
+            CHECK_VARIABLE(storage_backend);
+            CHECK_VARIABLE(sqlite_path);
+            CHECK_VARIABLE(analytics_dir);
+            CHECK_VARIABLE(upgrade_socket);
+            CHECK_VARIABLE(output_limit_observer);
+            CHECK_VARIABLE(output_limit_duelist);
+            CHECK_VARIABLE(output_grace_seconds);
+            CHECK_VARIABLE(handshake_seconds);
+            CHECK_VARIABLE(max_connections_per_ip);
+            CHECK_VARIABLE(proxy_ips);
+            CHECK_VARIABLE(metrics_port);
+            CHECK_VARIABLE(flight_recorder_dir);
+            CHECK_VARIABLE(room_budget_engine_ms);
+            CHECK_VARIABLE(room_budget_kbytes);
+            CHECK_VARIABLE(autoscale_profile);
+            CHECK_VARIABLE(autoscale_trace);
+            CHECK_VARIABLE(autoscale_min_lifetime);
+            CHECK_VARIABLE(autoscale_scale_down_seconds);
+            CHECK_VARIABLE(autoscale_horizon);
+            CHECK_VARIABLE(autoscale_up_headroom);
+            CHECK_VARIABLE(autoscale_down_headroom);
 
             else
+            {
                 cerr<<"Could not understand the keyword at line"<<linenum<<": "<<strbuf<<endl;
+                errors++;
+            }
         }
-        #undef CHECK_VARIABLE
+        catch(std::exception& e)
+        {
+            cerr<<"Invalid value at line "<<linenum<<": "<<linebuf<<endl;
+            errors++;
+        }
+    }
+    #undef CHECK_VARIABLE
+    return errors;
+}
 
+void Config::LoadConfig()
+{
+#ifdef _WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif //_WIN32
+
+    signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
+    timeval startTime;
+    gettimeofday(&startTime,NULL);
+    deckManager.LoadLFList();
+    if(wcsstr(deckManager._lfList[0].listName,L"TCG"))
+        std::swap(deckManager._lfList[0],deckManager._lfList[1]);
+
+    //if(!dataManager.LoadStrings("strings.conf"))
+      //  return;
+    FILE* fp = fopen(configFile.c_str(), "r");
+    if(!fp)
+    {
+        cerr<<"Couldn't open config file: "<<configFile<<endl;
+    }
+    else
+    {
+        parseConfig(fp);
         fclose(fp);
     }
     if(!serverport)
@@ -177,6 +267,330 @@ void Config::LoadConfig()
         serverport = 9999;
     }
     strictAllowedList = false;
+
+    //the image is the only copy of the cards: without it cards.cdb is compiled once, here in the father
+    CardDatabase* cdb = CardDatabase::getInstance();
+    if(!cdb->Load(card_image.c_str()) &&
+            !(CardDatabase::Compile("cards.cdb",card_image.c_str()) && cdb->Load(card_image.c_str())))
+    {
+        log(BUG,"no card data: neither %s nor cards.cdb can be loaded\n",card_image.c_str());
+        return;
+    }
+    timeval endTime;
+    gettimeofday(&endTime,NULL);
+    log(INFO,"card data loaded in %ld ms\n",(endTime.tv_sec-startTime.tv_sec)*1000+(endTime.tv_usec-startTime.tv_usec)/1000);
+}
+
+bool Config::validate() const
+{
+    //what would stop the gameservers from working, the rest is up to who writes the file
+    bool ok = true;
+    if(max_users_per_process <= 0 || max_processes <= 0)
+    {
+        log(WARN,"max_users_per_process and max_processes must be positive\n");
+        ok = false;
+    }
+    if(waitingroom_min_waiting < 0 || waitingroom_min_waiting > waitingroom_max_waiting)
+    {
+        log(WARN,"waitingroom_min_waiting must be between 0 and waitingroom_max_waiting\n");
+        ok = false;
+    }
+    if(output_limit_observer <= 0 || output_limit_duelist <= 0 || output_grace_seconds < 0)
+    {
+        log(WARN,"the output limits must be positive\n");
+        ok = false;
+    }
+    if(handshake_seconds <= 0 || max_connections_per_ip <= 0 || max_connections_per_minute <= 0 || ban_seconds < 0)
+    {
+        log(WARN,"handshake_seconds, max_connections_per_ip and max_connections_per_minute must be positive\n");
+        ok = false;
+    }
+    if(autoscale_min_lifetime < 0 || autoscale_scale_down_seconds < 0 || autoscale_horizon < 0)
+    {
+        log(WARN,"the autoscale times cannot be negative\n");
+        ok = false;
+    }
+    //with less room to drain than to spawn a gameserver would be drained and spawned again
+    if(autoscale_up_headroom < 0 || autoscale_down_headroom < autoscale_up_headroom)
+    {
+        log(WARN,"autoscale_up_headroom cannot be negative nor more than autoscale_down_headroom\n");
+        ok = false;
+    }
+    if(room_budget_engine_ms < 0 || room_budget_kbytes < 0)
+    {
+        log(WARN,"the room budgets cannot be negative\n");
+        ok = false;
+    }
+    return ok;
+}
+
+bool Config::parseSnapshot(const std::string& text, Config& fresh)
+{
+    if(text.empty())
+        return fresh.validate();
+    FILE* fp = fmemopen(const_cast<char*>(text.data()), text.size(), "r");
+    if(fp == nullptr)
+        return false;
+    int errors = fresh.parseConfig(fp);
+    fclose(fp);
+    if(errors)
+        log(WARN,"%d lines of the config file are not valid\n",errors);
+    return !errors && fresh.validate();
+}
+
+void Config::applyReloadable(const Config& fresh)
+{
+    //read by other threads, or used once to open a socket or a file
+    #define RESTART_ONLY(VAR) if(VAR != fresh.VAR) log(WARN,"config: " #VAR " changes only with a restart\n")
+    RESTART_ONLY(mysql_username);
+    RESTART_ONLY(mysql_password);
+    RESTART_ONLY(mysql_database);
+    RESTART_ONLY(mysql_host);
+    RESTART_ONLY(mysql_pool_size);
+    RESTART_ONLY(noExternalChat);
+    RESTART_ONLY(card_image);
+    RESTART_ONLY(deck_archive);
+    RESTART_ONLY(chat_socket);
+    RESTART_ONLY(stats_journal);
+    RESTART_ONLY(storage_backend);
+    RESTART_ONLY(sqlite_path);
+    RESTART_ONLY(analytics_dir);
+    RESTART_ONLY(upgrade_socket);
+    RESTART_ONLY(metrics_port);
+    RESTART_ONLY(autoscale_profile);
+    RESTART_ONLY(autoscale_trace);
+    //the connections already counted would be released from the wrong ip
+    RESTART_ONLY(proxy_ips);
+    #undef RESTART_ONLY
+
+    spam_string = fresh.spam_string;
+    max_users_per_process = fresh.max_users_per_process;
+    max_processes = fresh.max_processes;
+    waitingroom_min_waiting = fresh.waitingroom_min_waiting;
+    waitingroom_max_waiting = fresh.waitingroom_max_waiting;
+    debugSql = fresh.debugSql;
+    max_connections_per_minute = fresh.max_connections_per_minute;
+    ban_seconds = fresh.ban_seconds;
+    output_limit_observer = fresh.output_limit_observer;
+    output_limit_duelist = fresh.output_limit_duelist;
+    output_grace_seconds = fresh.output_grace_seconds;
+    handshake_seconds = fresh.handshake_seconds;
+    max_connections_per_ip = fresh.max_connections_per_ip;
+    flight_recorder_dir = fresh.flight_recorder_dir;
+    room_budget_engine_ms = fresh.room_budget_engine_ms;
+    room_budget_kbytes = fresh.room_budget_kbytes;
+    autoscale_min_lifetime = fresh.autoscale_min_lifetime;
+    autoscale_scale_down_seconds = fresh.autoscale_scale_down_seconds;
+    autoscale_horizon = fresh.autoscale_horizon;
+    autoscale_up_headroom = fresh.autoscale_up_headroom;
+    autoscale_down_headroom = fresh.autoscale_down_headroom;
+}
+
+bool Config::parseBanlists(const std::string& text, std::vector<LFList>& lists)
+{
+    //DeckManager::LoadLFList reads only lflist.conf: the same parser and the same hash on a text
+    LFList* cur = nullptr;
+    size_t pos = text.find('\n');
+    //the first line is skipped, like the client does
+    pos = pos == std::string::npos ? text.size() : pos + 1;
+    while(pos < text.size())
+    {
+        size_t next = text.find('\n',pos);
+        if(next == std::string::npos)
+            next = text.size();
+        char linebuf[256];
+        size_t len = std::min(next - pos,sizeof(linebuf) - 1);
+        memcpy(linebuf,text.data() + pos,len);
+        linebuf[len] = 0;
+        pos = next + 1;
+        if(linebuf[0] == '#')
+            continue;
+        if(linebuf[0] == '!')
+        {
+            wchar_t name[256];
+            int namelen = BufferIO::DecodeUTF8(&linebuf[1],name);
+            while(namelen > 0 && (name[namelen - 1] == L'\r' || name[namelen - 1] == L'\n'))
+                namelen--;
+            LFList list;
+            memset(list.listName,0,sizeof(list.listName));
+            wcsncpy(list.listName,name,std::min<int>(namelen,sizeof(list.listName) / sizeof(wchar_t) - 1));
+            list.content = new std::unordered_map<int,int>;
+            list.hash = 0x7dfcee6a;
+            lists.push_back(list);
+            cur = &lists.back();
+            continue;
+        }
+        int p = 0;
+        while(linebuf[p] != ' ' && linebuf[p] != '\t' && linebuf[p] != 0)
+            p++;
+        if(linebuf[p] == 0)
+            continue;
+        linebuf[p++] = 0;
+        int sa = p;
+        int code = atoi(linebuf);
+        if(code == 0)
+            continue;
+        while(linebuf[p] == ' ' || linebuf[p] == '\t')
+            p++;
+        while(linebuf[p] != ' ' && linebuf[p] != '\t' && linebuf[p] != 0)
+            p++;
+        linebuf[p] = 0;
+        int count = atoi(&linebuf[sa]);
+        if(cur == nullptr)
+            continue;
+        (*cur->content)[code] = count;
+        unsigned int c = code;
+        cur->hash = cur->hash ^ ((c << 18) | (c >> 14)) ^ ((c << (27 + count)) | (c >> (5 - count)));
+    }
+    LFList nolimit;
+    memset(nolimit.listName,0,sizeof(nolimit.listName));
+    wcscpy(nolimit.listName,L"N/A");
+    nolimit.hash = 0;
+    nolimit.content = new std::unordered_map<int,int>;
+    lists.push_back(nolimit);
+    if(lists.size() >= 2 && wcsstr(lists[0].listName,L"TCG"))
+        std::swap(lists[0],lists[1]);
+    return lists.size() >= 3;
+}
+
+void Config::freeBanlists(std::vector<LFList>& lists)
+{
+    for(auto it = lists.begin(); it != lists.end(); ++it)
+        delete it->content;
+    lists.clear();
+}
+
+bool Config::installBanlists(const std::string& text, const uint32_t* expected, uint32_t* replaced)
+{
+    std::vector<LFList> lists;
+    bool ok = parseBanlists(text,lists);
+    if(!ok)
+        log(WARN,"lflist.conf: the rooms need at least two banlists\n");
+    else if(lists[0].hash != expected[0] || lists[1].hash != expected[1])
+    {
+        log(BUG,"the banlists of the snapshot do not have the hashes of the father\n");
+        ok = false;
+    }
+    if(!ok)
+    {
+        freeBanlists(lists);
+        return false;
+    }
+    //the rooms keep the hash of their list: the caller moves them to the new ones before the next check
+    replaced[0] = deckManager._lfList[0].hash;
+    replaced[1] = deckManager._lfList[1].hash;
+    lists.swap(deckManager._lfList);
+    freeBanlists(lists);
+    return true;
+}
+
+bool Config::Reload(std::string& snapshot)
+{
+    FILE* fp = fopen(configFile.c_str(), "r");
+    if(!fp)
+    {
+        log(WARN,"reload: cannot open %s, nothing changed\n",configFile.c_str());
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    for(size_t n; (n = fread(buf,1,sizeof(buf),fp)) > 0;)
+        text.append(buf,n);
+    fclose(fp);
+
+    std::string banlists;
+    fp = fopen("lflist.conf", "r");
+    if(fp)
+    {
+        for(size_t n; (n = fread(buf,1,sizeof(buf),fp)) > 0;)
+            banlists.append(buf,n);
+        fclose(fp);
+    }
+
+    //the defaults, then the file: a line removed from the file goes back to the default
+    Config fresh;
+    fresh.serverport = serverport;
+    ConfigSnapshotHeader header;
+    if(!parseSnapshot(text,fresh) || !checkBanlists(banlists,header.lfHash)
+            || sizeof(header) + text.size() + banlists.size() > IpcFrame::MAX_PAYLOAD)
+    {
+        log(WARN,"reload: %s or lflist.conf rejected, the configuration %u stays\n",configFile.c_str(),version);
+        return false;
+    }
+    //the father has no rooms that use the old lists
+    uint32_t replaced[2];
+    installBanlists(banlists,header.lfHash,replaced);
+    applyReloadable(fresh);
+    header.version = ++version;
+    header.configLength = text.size();
+    snapshot.assign((const char*)&header,sizeof(header));
+    snapshot += text;
+    snapshot += banlists;
+    log(INFO,"reload: configuration %u loaded\n",version);
+    return true;
+}
+
+bool Config::checkBanlists(const std::string& text, uint32_t* hashes)
+{
+    //the gameservers parse the text with parseBanlists: it must give the hashes of the client
+    std::vector<LFList> parsed, loaded;
+    bool ok = parseBanlists(text,parsed);
+    loaded.swap(deckManager._lfList);
+    deckManager.LoadLFList();
+    loaded.swap(deckManager._lfList);
+    if(loaded.size() >= 2 && wcsstr(loaded[0].listName,L"TCG"))
+        std::swap(loaded[0],loaded[1]);
+    if(!ok)
+        log(WARN,"lflist.conf: the rooms need at least two banlists\n");
+    else if(parsed.size() != loaded.size())
+        ok = false;
+    for(size_t i = 0; ok && i < parsed.size(); i++)
+        ok = parsed[i].hash == loaded[i].hash;
+    if(!ok && parsed.size() >= 3)
+        log(BUG,"lflist.conf: the banlists of the snapshot are not the ones of DeckManager, or the file changed while it was read\n");
+    if(ok)
+    {
+        hashes[0] = parsed[0].hash;
+        hashes[1] = parsed[1].hash;
+    }
+    freeBanlists(parsed);
+    freeBanlists(loaded);
+    return ok;
+}
+
+bool Config::ApplySnapshot(const char* payload, uint32_t len, uint32_t* replacedLists)
+{
+    ConfigSnapshotHeader header;
+    if(len < sizeof(header))
+        return false;
+    memcpy(&header,payload,sizeof(header));
+    if(header.version <= version)
+        return false;
+    if(header.configLength > len - sizeof(header))
+    {
+        log(BUG,"config %u: truncated snapshot\n",header.version);
+        return false;
+    }
+    const char* text = payload + sizeof(header);
+    Config fresh;
+    fresh.serverport = serverport;
+    if(!parseSnapshot(std::string(text,header.configLength),fresh))
+    {
+        log(BUG,"config %u accepted by the father but not by the gameserver\n",header.version);
+        return false;
+    }
+    //the banlists come with the snapshot, the gameserver does not read lflist.conf again
+    std::string banlists(text + header.configLength,len - sizeof(header) - header.configLength);
+    if(!installBanlists(banlists,header.lfHash,replacedLists))
+    {
+        log(BUG,"config %u: the banlists are not updated\n",header.version);
+        replacedLists[0] = deckManager._lfList[0].hash;
+        replacedLists[1] = deckManager._lfList[1].hash;
+    }
+    applyReloadable(fresh);
+    version = header.version;
+    log(INFO,"config %u applied\n",version);
+    return true;
 }
 
 void disMysql(int)
@@ -192,7 +606,7 @@ void enMysql(int)
 
 }
 
-Config::Config():configFile("server.conf"),serverport(0)
+Config::Config():version(1),serverport(0),configFile("server.conf")
 {
     debugSql = true;
     disableMysql = false;
@@ -203,6 +617,32 @@ Config::Config():configFile("server.conf"),serverport(0)
     startTimer = 60;
     maxTimer = 80;
     noExternalChat = false;
+    card_image = "cards.bin";
+    deck_archive = "deck/archive.ydk";
+    max_connections_per_minute = 30;
+    ban_seconds = 1800;
+    mysql_pool_size = 2;
+    stats_journal = "stats.journal";
+    storage_backend = "mysql";
+    sqlite_path = "users.db";
+    analytics_dir = "analytics";
+    upgrade_socket = "upgrade.sock";
+    output_limit_observer = 256*1024;
+    output_limit_duelist = 1024*1024;
+    output_grace_seconds = 30;
+    handshake_seconds = 5;
+    max_connections_per_ip = 10;
+    metrics_port = 0;
+    flight_recorder_dir = "flightrecorder";
+    room_budget_engine_ms = 6000;
+    room_budget_kbytes = 8192;
+    autoscale_profile = "autoscale.profile";
+    autoscale_min_lifetime = 600;
+    autoscale_scale_down_seconds = 300;
+    autoscale_horizon = 300;
+    autoscale_up_headroom = 0.2;
+    autoscale_down_headroom = 0.5;
+    hotUpgrade = false;
     spam_string = "www.ygopro.it <-- this is the official website of this server";
     signal(SIGUSR1,disMysql);
     signal(SIGUSR2,enMysql);
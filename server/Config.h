@@ -1,9 +1,24 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
 
 namespace ygo
 {
+    struct LFList;
+
+    //a CONFIG frame is this header followed by the text of the config file and by the text of lflist.conf
+    struct ConfigSnapshotHeader
+    {
+        uint32_t version;
+        //the first two banlists of the father, the ones the rooms use
+        uint32_t lfHash[2];
+        uint32_t configLength;
+    };
+
     class Config
     {
         public:
@@ -11,6 +26,22 @@ namespace ygo
         void LoadConfig();
         bool parseCommandLine(int argc, char**argv);
 
+        /*
+         * reload without a restart: SIGHUP sets reloadRequested, the father reads
+         * server.conf and lflist.conf again, validates them and publishes the text
+         * as a CONFIG frame with a new version; each gameserver parses the same text,
+         * banlists included, and applies it between two events. Nothing changes if the validation fails.
+         * The settings read by other threads or when a socket or a file is opened
+         * keep their value until a restart.
+         */
+        static volatile sig_atomic_t reloadRequested;
+        uint32_t version;
+        //father: the payload of the CONFIG frame, false if the new files are rejected
+        bool Reload(std::string& snapshot);
+        //gameserver: false if nothing changed. replacedLists are the hashes of the first two
+        //banlists before the snapshot, the rooms that use them must move to the new ones
+        bool ApplySnapshot(const char* payload, uint32_t len, uint32_t* replacedLists);
+
         /*config data*/
         int serverport;
         std::string mysql_username;
@@ -28,13 +59,54 @@ namespace ygo
         bool noExternalChat;
         unsigned int startTimer;
         unsigned int maxTimer;
+        std::string card_image;
+        std::string deck_archive;
+        int max_connections_per_minute;
+        int ban_seconds;
+        std::string chat_socket;
+        int mysql_pool_size;
+        std::string stats_journal;
+        std::string storage_backend;
+        std::string sqlite_path;
+        std::string analytics_dir;
+        std::string upgrade_socket;
+        int output_limit_observer;
+        int output_limit_duelist;
+        int output_grace_seconds;
+        int handshake_seconds;
+        int max_connections_per_ip;
+        //separated by spaces: their connections are counted by the ip they send with ipchange
+        std::string proxy_ips;
+        int metrics_port;
+        std::string flight_recorder_dir;
+        int room_budget_engine_ms;
+        int room_budget_kbytes;
+        std::string autoscale_profile;
+        std::string autoscale_trace;
+        int autoscale_min_lifetime;
+        int autoscale_scale_down_seconds;
+        int autoscale_horizon;
+        double autoscale_up_headroom;
+        double autoscale_down_headroom;
+        bool hotUpgrade;
         private:
         Config();
         std::string configFile;
+        //the number of lines with errors
+        int parseConfig(FILE* fp);
+        bool parseSnapshot(const std::string& text, Config& fresh);
+        bool validate() const;
+        void applyReloadable(const Config& fresh);
+        static bool parseBanlists(const std::string& text, std::vector<LFList>& lists);
+        static void freeBanlists(std::vector<LFList>& lists);
+        //against DeckManager::LoadLFList, hashes are the first two
+        static bool checkBanlists(const std::string& text, uint32_t* hashes);
+        static bool installBanlists(const std::string& text, const uint32_t* expected, uint32_t* replaced);
 
         void check_variable(int &,std::string value,std::string name);
         void check_variable(std::string &,std::string value,std::string name);
         void check_variable(bool &,std::string value,std::string name);
+        void check_variable(double &,std::string value,std::string name);
     };
 
 }
@@ -0,0 +1,221 @@
+#include "DeckArchive.h"
+#include "Config.h"
+#include "debug.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <string.h>
+#include <stdio.h>
+
+namespace ygo
+{
+
+DeckArchive* DeckArchive::getInstance()
+{
+    static DeckArchive deckArchive;
+    return &deckArchive;
+}
+
+DeckArchive::DeckArchive():isRunning(false),indexReadOffset(0),writesDone(0),writesAvoided(0)
+{
+}
+
+DeckArchive::~DeckArchive()
+{
+    if(isRunning)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            isRunning = false;
+        }
+        queueCond.notify_one();
+        writer.join();
+    }
+}
+
+unsigned int DeckArchive::getWritesDone()
+{
+    return writesDone;
+}
+
+unsigned int DeckArchive::getWritesAvoided()
+{
+    return writesAvoided;
+}
+
+unsigned int DeckArchive::getQueueSize()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return queue.size();
+}
+
+void DeckArchive::Archive(Entry& entry)
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if(queue.size() >= MAX_QUEUE)
+    {
+        log(WARN,"deck archive queue full, dropping the deck of %s\n",entry.player.c_str());
+        return;
+    }
+    //the thread is started here and not in the constructor: it must live in the gameserver, not in the father
+    if(!isRunning)
+    {
+        isRunning = true;
+        writer = std::thread(&DeckArchive::WriterThread,this);
+    }
+    queue.push_back(entry);
+    queueCond.notify_one();
+}
+
+uint64_t DeckArchive::hashDeck(Entry& entry)
+{
+    //FNV-1a on the sorted codes, the order of the cards doesn't matter
+    uint64_t h = 14695981039346656037ULL;
+    std::vector<int>* parts[3] = {&entry.main,&entry.extra,&entry.side};
+    for(int p = 0; p < 3; p++)
+    {
+        std::vector<int> codes(*parts[p]);
+        std::sort(codes.begin(),codes.end());
+        codes.push_back(-1);
+        for(int code : codes)
+            for(int i = 0; i < 4; i++)
+            {
+                h ^= (code >> (i * 8)) & 0xff;
+                h *= 1099511628211ULL;
+            }
+    }
+    return h;
+}
+
+void DeckArchive::ReadIndex(int fd)
+{
+    //reads the lines appended by the other gameservers since the last time
+    off_t end = lseek(fd,0,SEEK_END);
+    if(end <= indexReadOffset)
+        return;
+    std::string data(end - indexReadOffset,'\0');
+    ssize_t n = pread(fd,&data[0],data.size(),indexReadOffset);
+    if(n <= 0)
+        return;
+    data.resize(n);
+
+    size_t start = 0;
+    for(size_t nl; (nl = data.find('\n',start)) != std::string::npos; start = nl + 1)
+    {
+        std::string line = data.substr(start,nl - start);
+        unsigned long long hash;
+        long offset;
+        if(sscanf(line.c_str(),"%llx\t%ld",&hash,&offset) != 2)
+            continue;
+        size_t tab = 0;
+        for(int i = 0; i < 4 && tab != std::string::npos; i++)
+            tab = line.find('\t',i ? tab + 1 : 0);
+        if(tab == std::string::npos)
+            continue;
+        storedDecks[hash] = offset;
+        indexedDecks.insert(std::make_pair((uint64_t)hash,line.substr(tab + 1)));
+    }
+    indexReadOffset += start;
+}
+
+void DeckArchive::Store(Entry& entry)
+{
+    Config* config = Config::getInstance();
+    std::string indexFile = config->deck_archive + ".idx";
+    int archiveFd = open(config->deck_archive.c_str(),O_RDWR|O_APPEND|O_CREAT,0644);
+    int indexFd = open(indexFile.c_str(),O_RDWR|O_APPEND|O_CREAT,0644);
+    if(archiveFd < 0 || indexFd < 0)
+    {
+        log(WARN,"cannot open the deck archive %s\n",config->deck_archive.c_str());
+        if(archiveFd >= 0)
+            close(archiveFd);
+        if(indexFd >= 0)
+            close(indexFd);
+        return;
+    }
+
+    for(char& c : entry.player)
+        if(c == '\t' || c == '\n' || c == '\r')
+            c = '_';
+    uint64_t hash = hashDeck(entry);
+
+    flock(indexFd,LOCK_EX);
+    ReadIndex(indexFd);
+    if(indexedDecks.count(std::make_pair(hash,entry.player)))
+    {
+        writesAvoided++;
+        log(VERBOSE,"deck of %s already archived\n",entry.player.c_str());
+    }
+    else
+    {
+        long offset;
+        auto it = storedDecks.find(hash);
+        if(it != storedDecks.end())
+        {
+            offset = it->second;
+            writesAvoided++;
+        }
+        else
+        {
+            std::string ydk = "#created by " + entry.player + "\n#main\n";
+            for(int code : entry.main)
+                ydk += std::to_string(code) + "\n";
+            ydk += "#extra\n";
+            for(int code : entry.extra)
+                ydk += std::to_string(code) + "\n";
+            ydk += "!side\n";
+            for(int code : entry.side)
+                ydk += std::to_string(code) + "\n";
+
+            flock(archiveFd,LOCK_EX);
+            offset = lseek(archiveFd,0,SEEK_END);
+            bool ok = write(archiveFd,ydk.c_str(),ydk.size()) == (ssize_t)ydk.size();
+            flock(archiveFd,LOCK_UN);
+            if(!ok)
+            {
+                log(WARN,"cannot write the deck archive %s\n",config->deck_archive.c_str());
+                offset = -1;
+            }
+            else
+            {
+                storedDecks[hash] = offset;
+                writesDone++;
+            }
+        }
+
+        if(offset >= 0)
+        {
+            char line[256];
+            int n = snprintf(line,sizeof(line),"%016llx\t%ld\t%ld\t%d\t%s\n",(unsigned long long)hash,
+                             offset,(long)entry.date,entry.score,entry.player.c_str());
+            if(n > 0 && n < (int)sizeof(line) && write(indexFd,line,n) == n)
+            {
+                indexedDecks.insert(std::make_pair(hash,entry.player));
+                indexReadOffset = lseek(indexFd,0,SEEK_END);
+            }
+        }
+    }
+    flock(indexFd,LOCK_UN);
+    close(indexFd);
+    close(archiveFd);
+}
+
+void DeckArchive::WriterThread()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while(true)
+    {
+        queueCond.wait(lock,[this] {return !queue.empty() || !isRunning;});
+        if(queue.empty())
+            break;
+        Entry entry = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        Store(entry);
+        lock.lock();
+    }
+    log(INFO,"deck archive: %u decks written, %u writes avoided\n",writesDone,writesAvoided);
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef _DECKARCHIVE_H_
+#define _DECKARCHIVE_H_
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <ctime>
+#include <stdint.h>
+
+namespace ygo
+{
+
+/*
+ * Archive of the decks used by the high rated players.
+ * The network thread only queues the deck, a background thread does the I/O.
+ * The decks are stored once per content hash in an append-only file (ydk format),
+ * the index file has one line per (player,deck): hash, offset, date, score, player.
+ * Archive and index are shared by all the gameservers, the appends are done under flock.
+ */
+class DeckArchive
+{
+public:
+    struct Entry
+    {
+        std::string player;
+        int score;
+        time_t date;
+        std::vector<int> main;
+        std::vector<int> extra;
+        std::vector<int> side;
+    };
+
+    static DeckArchive* getInstance();
+    void Archive(Entry& entry);
+    unsigned int getWritesDone();
+    unsigned int getWritesAvoided();
+    unsigned int getQueueSize();
+
+private:
+    DeckArchive();
+    ~DeckArchive();
+    void WriterThread();
+    void ReadIndex(int fd);
+    void Store(Entry& entry);
+    static uint64_t hashDeck(Entry& entry);
+
+    std::thread writer;
+    std::mutex queueMutex;
+    std::condition_variable queueCond;
+    std::deque<Entry> queue;
+    bool isRunning;
+
+    /* used only by the writer thread */
+    std::map<uint64_t,long> storedDecks;
+    std::set<std::pair<uint64_t,std::string>> indexedDecks;
+    long indexReadOffset;
+
+    volatile unsigned int writesDone;
+    volatile unsigned int writesAvoided;
+
+    static const unsigned int MAX_QUEUE = 1000;
+};
+
+}
+#endif
@@ -0,0 +1,422 @@
+#include "DuelAnalytics.h"
+#include "Config.h"
+#include "debug.h"
+#include "network.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+
+namespace ygo
+{
+
+namespace
+{
+
+struct Column
+{
+    std::string name;
+    uint8_t type;
+    std::string data;
+    Column(const char* name,uint8_t type):name(name),type(type) {}
+    void add(int32_t value)
+    {
+        data.append((const char*)&value,sizeof(value));
+    }
+    void add(const std::string& text)
+    {
+        uint8_t len = std::min<size_t>(text.size(),255);
+        data.append((const char*)&len,sizeof(len));
+        data.append(text.data(),len);
+    }
+};
+
+struct Table
+{
+    const char* name;
+    std::vector<Column> columns;
+    uint32_t rows;
+    Table(const char* name):name(name),rows(0) {}
+    Column& operator[](unsigned int i)
+    {
+        return columns[i];
+    }
+    std::string block()
+    {
+        std::string out = "YGA1";
+        uint16_t ncolumns = columns.size();
+        out.append((const char*)&rows,sizeof(rows));
+        out.append((const char*)&ncolumns,sizeof(ncolumns));
+        for(auto it = columns.cbegin(); it != columns.cend(); ++it)
+        {
+            uint8_t namelen = it->name.size();
+            uint32_t datalen = it->data.size();
+            out.append((const char*)&it->type,sizeof(it->type));
+            out.append((const char*)&namelen,sizeof(namelen));
+            out.append(it->name);
+            out.append((const char*)&datalen,sizeof(datalen));
+            out.append(it->data);
+        }
+        return out;
+    }
+};
+
+Table makeTable(const char* name,std::initializer_list<std::pair<const char*,uint8_t>> columns)
+{
+    Table table(name);
+    for(auto it = columns.begin(); it != columns.end(); ++it)
+        table.columns.push_back(Column(it->first,it->second));
+    return table;
+}
+
+const uint8_t I = DuelAnalytics::INT_COLUMN;
+const uint8_t T = DuelAnalytics::TEXT_COLUMN;
+
+bool appendBlock(const std::string& path,const std::string& block)
+{
+    int fd = open(path.c_str(),O_WRONLY|O_APPEND|O_CREAT,0644);
+    if(fd < 0)
+        return false;
+    //the blocks of the gameservers must not interleave
+    flock(fd,LOCK_EX);
+    bool ok = write(fd,block.data(),block.size()) == (ssize_t)block.size();
+    flock(fd,LOCK_UN);
+    close(fd);
+    return ok;
+}
+
+struct ColumnData
+{
+    uint8_t type;
+    std::vector<int32_t> ints;
+    std::vector<std::string> texts;
+};
+
+//reads a block, only the wanted columns (all if wanted is empty)
+bool readBlock(FILE* fp,const std::vector<std::string>& wanted,uint32_t& rows,std::map<std::string,ColumnData>& out)
+{
+    char magic[4];
+    uint16_t ncolumns;
+    if(fread(magic,1,4,fp) != 4 || memcmp(magic,"YGA1",4) ||
+            fread(&rows,sizeof(rows),1,fp) != 1 || fread(&ncolumns,sizeof(ncolumns),1,fp) != 1)
+        return false;
+    for(unsigned int c = 0; c < ncolumns; c++)
+    {
+        uint8_t type,namelen;
+        uint32_t datalen;
+        char name[256];
+        if(fread(&type,1,1,fp) != 1 || fread(&namelen,1,1,fp) != 1 || fread(name,1,namelen,fp) != namelen ||
+                fread(&datalen,sizeof(datalen),1,fp) != 1)
+            return false;
+        std::string colname(name,namelen);
+        if(!wanted.empty() && std::find(wanted.begin(),wanted.end(),colname) == wanted.end())
+        {
+            if(fseek(fp,datalen,SEEK_CUR))
+                return false;
+            continue;
+        }
+        std::string data(datalen,'\0');
+        if(datalen && fread(&data[0],1,datalen,fp) != datalen)
+            return false;
+        ColumnData& cd = out[colname];
+        cd.type = type;
+        size_t pos = 0;
+        for(uint32_t r = 0; r < rows; r++)
+        {
+            if(type == DuelAnalytics::INT_COLUMN && pos + sizeof(int32_t) <= data.size())
+            {
+                int32_t value;
+                memcpy(&value,&data[pos],sizeof(value));
+                cd.ints.push_back(value);
+                pos += sizeof(value);
+            }
+            else if(type == DuelAnalytics::TEXT_COLUMN && pos < data.size())
+            {
+                uint8_t len = data[pos];
+                cd.texts.push_back(data.substr(pos + 1,len));
+                pos += 1 + len;
+            }
+            else
+                return false;
+        }
+    }
+    return true;
+}
+
+}
+
+DuelAnalytics* DuelAnalytics::getInstance()
+{
+    static DuelAnalytics duelAnalytics;
+    return &duelAnalytics;
+}
+
+DuelAnalytics::DuelAnalytics():isRunning(false),duelSeq(0),duelsWritten(0)
+{
+}
+
+DuelAnalytics::~DuelAnalytics()
+{
+    if(isRunning)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            isRunning = false;
+        }
+        queueCond.notify_one();
+        writer.join();
+    }
+}
+
+unsigned int DuelAnalytics::getDuelsWritten()
+{
+    return duelsWritten;
+}
+
+void DuelAnalytics::Record(DuelLogger& logger,int mode,int lflist,int winner)
+{
+    if(Config::getInstance()->analytics_dir.empty())
+        return;
+    Duel duel;
+    duel.mode = mode;
+    duel.lflist = lflist;
+    duel.winner = winner;
+    duel.end = time(NULL);
+    logger.TakeDuel(duel.players,duel.turns,duel.start);
+    if(!duel.start)
+        duel.start = duel.end;
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    duel.id = ++duelSeq;
+    if(queue.size() >= MAX_QUEUE)
+    {
+        log(WARN,"duel analytics queue full, duel dropped\n");
+        return;
+    }
+    //started here and not in the constructor: it must live in the gameserver, not in the father
+    if(!isRunning)
+    {
+        isRunning = true;
+        writer = std::thread(&DuelAnalytics::WriterThread,this);
+    }
+    queue.push_back(duel);
+    queueCond.notify_one();
+}
+
+void DuelAnalytics::WriterThread()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while(true)
+    {
+        queueCond.wait(lock,[this] {return !queue.empty() || !isRunning;});
+        if(queue.empty())
+            break;
+        //one write per file for many duels: waits for a full batch, at most BATCH_SECONDS
+        queueCond.wait_for(lock,std::chrono::seconds(BATCH_SECONDS),[this] {return queue.size() >= BATCH_SIZE || !isRunning;});
+        std::vector<Duel> batch(queue.begin(),queue.end());
+        queue.clear();
+        lock.unlock();
+        WriteBatch(batch);
+        lock.lock();
+    }
+    log(INFO,"duel analytics: %u duels written\n",duelsWritten);
+}
+
+void DuelAnalytics::WriteBatch(std::vector<Duel>& batch)
+{
+    int32_t pid = getpid();
+    Table duels = makeTable("duels",{{"pid",I},{"duel",I},{"start",I},{"duration",I},{"mode",I},{"lflist",I},
+        {"winner",I},{"turns",I},{"players",I}});
+    Table players = makeTable("players",{{"pid",I},{"duel",I},{"name",T},{"pos",I},{"turns",I},{"spsummons",I},
+        {"maxspsummonsturn",I},{"attacks",I},{"maxattacksturn",I},{"damage",I},{"maxdamage1shot",I},
+        {"recovered",I},{"setmonsters",I},{"effects",I},{"setst",I}});
+    Table turns = makeTable("turns",{{"pid",I},{"duel",I},{"turn",I},{"player",T},{"spsummons",I},{"attacks",I},{"damage",I}});
+
+    for(auto duel = batch.cbegin(); duel != batch.cend(); ++duel)
+    {
+        unsigned int numTurns = 0;
+        for(auto lpi = duel->players.cbegin(); lpi != duel->players.cend(); ++lpi)
+        {
+            numTurns = std::max(numTurns,lpi->turns);
+            int c = 0;
+            players[c++].add(pid);
+            players[c++].add(duel->id);
+            players[c++].add(std::string(lpi->name));
+            players[c++].add((int32_t)lpi->type);
+            players[c++].add((int32_t)lpi->turns);
+            players[c++].add((int32_t)lpi->spSummonsDuel);
+            players[c++].add((int32_t)lpi->maxSpSummonTurn);
+            players[c++].add((int32_t)lpi->attacksDuel);
+            players[c++].add((int32_t)lpi->maxAttacksTurn);
+            players[c++].add((int32_t)lpi->damageDuel);
+            players[c++].add((int32_t)lpi->maxDamage1shot);
+            players[c++].add((int32_t)lpi->recoveredDuel);
+            players[c++].add((int32_t)lpi->setMonstersDuel);
+            players[c++].add((int32_t)lpi->effectsDuel);
+            players[c++].add((int32_t)lpi->setSTDuel);
+            players.rows++;
+        }
+        for(auto tr = duel->turns.cbegin(); tr != duel->turns.cend(); ++tr)
+        {
+            int c = 0;
+            turns[c++].add(pid);
+            turns[c++].add(duel->id);
+            turns[c++].add((int32_t)tr->turn);
+            turns[c++].add(tr->player);
+            turns[c++].add((int32_t)tr->spSummons);
+            turns[c++].add((int32_t)tr->attacks);
+            turns[c++].add((int32_t)tr->damage);
+            turns.rows++;
+        }
+        int c = 0;
+        duels[c++].add(pid);
+        duels[c++].add(duel->id);
+        duels[c++].add((int32_t)duel->start);
+        duels[c++].add((int32_t)(duel->end - duel->start));
+        duels[c++].add((int32_t)duel->mode);
+        duels[c++].add((int32_t)duel->lflist);
+        duels[c++].add((int32_t)duel->winner);
+        duels[c++].add((int32_t)numTurns);
+        duels[c++].add((int32_t)duel->players.size());
+        duels.rows++;
+    }
+
+    const std::string& dir = Config::getInstance()->analytics_dir;
+    mkdir(dir.c_str(),0755);
+    char hour[16];
+    time_t now = time(NULL);
+    strftime(hour,sizeof(hour),"%Y%m%d%H",localtime(&now));
+    Table* tables[] = {&duels,&players,&turns};
+    for(Table* table : tables)
+    {
+        if(!table->rows)
+            continue;
+        std::string path = dir + "/" + table->name + "-" + hour + ".col";
+        if(!appendBlock(path,table->block()))
+            log(WARN,"cannot write the duel analytics %s\n",path.c_str());
+    }
+    duelsWritten += batch.size();
+}
+
+bool DuelAnalytics::Query(const std::string& query)
+{
+    std::string pattern = query;
+    std::vector<std::string> wanted;
+    size_t colon = query.rfind(':');
+    if(colon != std::string::npos)
+    {
+        pattern = query.substr(0,colon);
+        std::string list = query.substr(colon + 1);
+        for(size_t start = 0, comma; start <= list.size(); start = comma + 1)
+        {
+            comma = list.find(',',start);
+            if(comma == std::string::npos)
+                comma = list.size();
+            if(comma > start)
+                wanted.push_back(list.substr(start,comma - start));
+        }
+    }
+
+    glob_t files;
+    if(glob(pattern.c_str(),0,nullptr,&files))
+    {
+        fprintf(stderr,"no analytics file matches %s\n",pattern.c_str());
+        return false;
+    }
+
+    //without columns: rows, min/avg/max of the numbers, distinct texts
+    struct Summary
+    {
+        uint8_t type;
+        unsigned long count;
+        int64_t sum;
+        int32_t min;
+        int32_t max;
+        std::set<std::string> distinct;
+        Summary():type(INT_COLUMN),count(0),sum(0),min(INT32_MAX),max(INT32_MIN) {}
+    };
+    std::map<std::string,Summary> summary;
+    std::vector<std::string> order;
+    unsigned long totalRows = 0;
+
+    if(!wanted.empty())
+    {
+        for(unsigned int i = 0; i < wanted.size(); i++)
+            printf("%s%s",i?"\t":"",wanted[i].c_str());
+        printf("\n");
+    }
+    for(size_t f = 0; f < files.gl_pathc; f++)
+    {
+        FILE* fp = fopen(files.gl_pathv[f],"rb");
+        if(!fp)
+            continue;
+        uint32_t rows;
+        std::map<std::string,ColumnData> columns;
+        while(readBlock(fp,wanted,rows,columns))
+        {
+            totalRows += rows;
+            if(!wanted.empty())
+                for(uint32_t r = 0; r < rows; r++)
+                {
+                    for(unsigned int i = 0; i < wanted.size(); i++)
+                    {
+                        printf("%s",i?"\t":"");
+                        auto it = columns.find(wanted[i]);
+                        if(it == columns.end())
+                            continue;
+                        if(it->second.type == INT_COLUMN)
+                            printf("%d",it->second.ints[r]);
+                        else
+                            printf("%s",it->second.texts[r].c_str());
+                    }
+                    printf("\n");
+                }
+            else
+                for(auto it = columns.cbegin(); it != columns.cend(); ++it)
+                {
+                    if(!summary.count(it->first))
+                        order.push_back(it->first);
+                    Summary& s = summary[it->first];
+                    s.type = it->second.type;
+                    for(int32_t v : it->second.ints)
+                    {
+                        s.count++;
+                        s.sum += v;
+                        s.min = std::min(s.min,v);
+                        s.max = std::max(s.max,v);
+                    }
+                    for(const std::string& t : it->second.texts)
+                    {
+                        s.count++;
+                        s.distinct.insert(t);
+                    }
+                }
+            columns.clear();
+        }
+        fclose(fp);
+    }
+    globfree(&files);
+
+    if(wanted.empty())
+    {
+        printf("%lu rows\n",totalRows);
+        for(auto name = order.cbegin(); name != order.cend(); ++name)
+        {
+            Summary& s = summary[*name];
+            if(s.type == INT_COLUMN)
+                printf("%-18s min %d avg %.2f max %d\n",name->c_str(),s.count?s.min:0,s.count?(double)s.sum/s.count:0.0,s.count?s.max:0);
+            else
+                printf("%-18s %lu distinct\n",name->c_str(),(unsigned long)s.distinct.size());
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef _DUELANALYTICS_H_
+#define _DUELANALYTICS_H_
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <ctime>
+#include <stdint.h>
+#include "DuelLogger.h"
+
+namespace ygo
+{
+
+/*
+ * the details of the finished duels, for the statistics of the site.
+ * The network thread only queues the duel, a background thread writes them in
+ * batches to analytics_dir, one file per table and per hour (duels-YYYYMMDDHH.col,
+ * players-..., turns-...), shared by all the gameservers with flock.
+ * A file is a sequence of blocks, each block holds a batch column by column:
+ *   "YGA1", rows (uint32), columns (uint16), then for every column
+ *   type (uint8, 0 int32 1 text), name length (uint8), name, data length (uint32), data
+ * a text value is its length (uint8) and the bytes.
+ * A query reads only the columns it needs and skips the others.
+ */
+class DuelAnalytics
+{
+public:
+    struct Duel
+    {
+        int32_t id;
+        int mode;
+        int lflist;
+        int winner;
+        time_t start;
+        time_t end;
+        std::vector<LoggerPlayerInfo> players;
+        std::vector<TurnRecord> turns;
+    };
+
+    static DuelAnalytics* getInstance();
+    void Record(DuelLogger& logger,int mode,int lflist,int winner);
+    unsigned int getDuelsWritten();
+
+    //-A: "file pattern[:column,column]", the columns as TSV or a summary of all of them
+    static bool Query(const std::string& query);
+
+    static const int INT_COLUMN = 0;
+    static const int TEXT_COLUMN = 1;
+
+private:
+    DuelAnalytics();
+    ~DuelAnalytics();
+    void WriterThread();
+    void WriteBatch(std::vector<Duel>& batch);
+
+    std::thread writer;
+    std::mutex queueMutex;
+    std::condition_variable queueCond;
+    std::deque<Duel> queue;
+    bool isRunning;
+    int32_t duelSeq;
+    volatile unsigned int duelsWritten;
+
+    static const unsigned int MAX_QUEUE = 1000;
+    static const unsigned int BATCH_SIZE = 64;
+    static const int BATCH_SECONDS = 10;
+};
+
+}
+#endif
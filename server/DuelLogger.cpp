@@ -12,7 +12,7 @@ void debugp(const char *format, ...)
 	//vprintf(format, args);
 	va_end(args);
 }
-DuelLogger::DuelLogger()
+DuelLogger::DuelLogger():started(0)
 {
 	debugp("hello from the logger\n");
 	
@@ -117,7 +117,11 @@ void DuelLogger::LogServerMessage(uintptr_t dp,unsigned char proto, char*buffer,
 		{
 			players[dp].ultimo_game_msg = buffer[0];
 			if(buffer[0] == MSG_NEW_TURN)
+			{
+				if(players[dp].hisTurn)
+					EndTurn(players[dp]);
 				players[dp].NewTurn();
+			}
 			if(buffer[0] ==	MSG_SPSUMMONED)
 				players[dp].SpecialSummon();
 			if(buffer[0] ==	MSG_DAMAGE)
@@ -132,7 +136,11 @@ void DuelLogger::LogServerMessage(uintptr_t dp,unsigned char proto, char*buffer,
 				players[dp].Recover(buffer[1],*p);
 			}
 			if(buffer[0] == MSG_START)
+			{
 				players[dp].playerID = buffer[1] & 0x0f;
+				if(!started)
+					started = time(NULL);
+			}
 			if(buffer[0] == MSG_SELECT_IDLECMD)
 					players[dp].MainPhase();
 			break;
@@ -148,4 +156,32 @@ LoggerPlayerInfo* DuelLogger::getPlayerInfo(uintptr_t dp)
 {
 	return &players[dp];
 	
-}
\ No newline at end of file
+}
+
+void DuelLogger::EndTurn(LoggerPlayerInfo& lpi)
+{
+	TurnRecord tr;
+	tr.turn = lpi.turns;
+	tr.player = lpi.name;
+	tr.spSummons = lpi.SpSummonTurn;
+	tr.attacks = lpi.attacksTurn;
+	tr.damage = lpi.damageTurn;
+	turnLog.push_back(tr);
+	lpi.hisTurn = false;
+}
+
+void DuelLogger::TakeDuel(std::vector<LoggerPlayerInfo>& duelists,std::vector<TurnRecord>& turns,time_t& start)
+{
+	for(auto it = players.begin(); it != players.end(); ++it)
+	{
+		if(it->second.type >= NETPLAYER_TYPE_OBSERVER)
+			continue;
+		if(it->second.hisTurn)
+			EndTurn(it->second);
+		duelists.push_back(it->second);
+	}
+	turns.swap(turnLog);
+	turnLog.clear();
+	start = started;
+	started = 0;
+}
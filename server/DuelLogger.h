@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <cstddef>
 #include <map>
+#include <vector>
+#include <string>
+#include <ctime>
 
 void debugp(const char *format, ...);
 
@@ -25,6 +28,10 @@ public:
 	unsigned int setMonstersDuel;
 	unsigned int effectsDuel;
 	unsigned int setSTDuel;
+	unsigned int spSummonsDuel;
+	unsigned int attacksDuel;
+	int damageTurn;
+	int damageDuel;
 	
 	void NewTurn();
 	void MainPhase();
@@ -38,15 +45,30 @@ public:
 	void SetST();
 };
 
+//a finished turn, for the analytics
+struct TurnRecord
+{
+	unsigned int turn;
+	std::string player;
+	unsigned int spSummons;
+	unsigned int attacks;
+	int damage;
+};
+
 class DuelLogger
 {
 	std::map<uintptr_t, LoggerPlayerInfo> players;
+	std::vector<TurnRecord> turnLog;
+	time_t started;
+	void EndTurn(LoggerPlayerInfo& lpi);
 	public:
 	DuelLogger();
 	~DuelLogger();
 	void LogClientMessage(uintptr_t dp,unsigned char, char*buffer,size_t size);
 	void LogServerMessage(uintptr_t dp,unsigned char, char*buffer,size_t size);
 	LoggerPlayerInfo* getPlayerInfo(uintptr_t dp);
+	//the duelists and the turns of the duel, the turn still open is closed
+	void TakeDuel(std::vector<LoggerPlayerInfo>& duelists,std::vector<TurnRecord>& turns,time_t& start);
 	
 };
 #endif
\ No newline at end of file
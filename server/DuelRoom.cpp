@@ -6,6 +6,8 @@
 #include "RoomManager.h"
 #include "debug.h"
 #include "Users.h"
+#include "DuelAnalytics.h"
+#include "Metrics.h"
 #include <algorithm>
 #include <signal.h>
 #include <algorithm> 
@@ -16,6 +18,9 @@ namespace ygo
 DuelRoom::DuelRoom(RoomManager*roomManager,GameServer*gameServer,unsigned char mode)
     :RoomInterface(roomManager,gameServer),mode(mode),duel_mode(0),last_winner(-1),user_timeout(nullptr),lflist(3)
 {
+    usage = &accounting;
+    for(int i = 0; i<4; i++)
+        duelistByType[i]=nullptr;
     createGame();
 }
 
@@ -29,7 +34,7 @@ void DuelRoom::flushPendingMessages()
 
         for(auto i=it->second.pendingMessages.begin(); i != it->second.pendingMessages.end(); i++)
         {
-            RemoteChatToPlayer(it->first,i->second,i->first);
+            SendChatPacket(it->first,i->get());
 
         }
         it->second.pendingMessages.clear();
@@ -70,9 +75,11 @@ void DuelRoom::SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buf
 {
 	if(players.find(dp) == players.end())
 		return;
+	recorder.record(FlightRecorder::OUT, proto, (proto == STOC_GAME_MSG && len) ? *(unsigned char*)buffer : 0, dp->type, len);
 	if(dp->netServer != this)
 	{
 		printf("MEGABUG, ho un giocatore che non dovrebbe esistere\n");
+		BugDetected("SendBufferToPlayer: the player belongs to another room");
 		
 		LeaveGame(dp );
 		setState(ZOMBIE);
@@ -80,6 +87,10 @@ void DuelRoom::SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buf
 		return;
 	}
 	
+	//what the relay has for an observer comes before
+	if(dp->type == NETPLAYER_TYPE_OBSERVER && !muted && relay.isBehind(dp))
+		relay.SendTo(gameServer, dp, SIZE_MAX);
+
 	logger.LogServerMessage((uintptr_t) dp,proto,(char*)buffer,len);
 	
 	if(proto == STOC_TYPE_CHANGE)
@@ -128,6 +139,9 @@ void DuelRoom::SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buf
     if(proto == STOC_GAME_MSG)
     {
         unsigned char* wbuf = (unsigned char*)buffer;
+        //MSG_WIN goes to every duelist, the duel ends once
+        if(wbuf[0] == MSG_WIN && ultimo_game_message != MSG_WIN && !muted)
+            Metrics::getInstance()->counters.duelsFinished++;
         ultimo_game_message = wbuf[0];
         if(wbuf[0] == MSG_WIN && state == PLAYING)
         {
@@ -187,10 +201,21 @@ void DuelRoom::SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buf
 
 DuelPlayer * DuelRoom::getDpFromType(unsigned char type)
 {
+    //the duel modes change dp->type directly, so the cached slot is checked before using it
+    if(type < 4)
+    {
+        DuelPlayer* dp = duelistByType[type];
+        if(dp && dp->type == type && players.count(dp))
+            return dp;
+    }
     for(auto it = players.cbegin(); it!=players.cend(); ++it)
     {
         if(it->first->type == type)
+        {
+            if(type < 4)
+                duelistByType[type] = it->first;
             return it->first;
+        }
     }
     return nullptr;
 
@@ -299,11 +324,31 @@ int DuelRoom::getLfList()
    return lflist;
 }
 
+bool DuelRoom::ReplaceLfList(const uint32_t* replaced)
+{
+    if(!duel_mode)
+        return false;
+    for(int i = 0; i < 2; i++)
+        if(duel_mode->host_info.lflist == replaced[i])
+        {
+            duel_mode->host_info.lflist = deckManager._lfList[i].hash;
+            return true;
+        }
+    return false;
+}
+
 void DuelRoom::clientStarted()
 {
     if(state==FULL)
     {
         setState(PLAYING);
+        int64_t now = IpcFrame::nowMs();
+        for(auto it = players.begin(); it != players.end(); ++it)
+            if(it->second.joinedMs && it->first->type != NETPLAYER_TYPE_OBSERVER)
+            {
+                Metrics::getInstance()->counters.matchmakingWait.observe(now - it->second.joinedMs);
+                it->second.joinedMs = 0;
+            }
         timeval timeout = {TIMEOUT_INTERVAL, 0};
         event_add(user_timeout, &timeout);
         chatReady=false;
@@ -315,23 +360,72 @@ void DuelRoom::clientStarted()
 }
 
 
+void DuelRoom::BugDetected(const char* reason)
+{
+    char line[256];
+    snprintf(line,sizeof(line),"room %p, mode %d, state %d, lflist %d, last game message %d, muted %d\n",
+             (void*)this,mode,state,lflist,ultimo_game_message,muted);
+    std::string description(line);
+    for(auto it = players.cbegin(); it != players.cend(); ++it)
+    {
+        snprintf(line,sizeof(line),"player %d %ls: state 0x%02x, %s%s\n",it->first->type,it->first->namew_low,it->first->state,
+                 it->first->netServer == this ? "in the room" : "netServer of another room",it->second.zombiePlayer ? ", zombie" : "");
+        description += line;
+    }
+    recorder.Dump(reason,description);
+}
+
+std::wstring DuelRoom::getDuelistNames()
+{
+    DuelPlayer* duelists[4] = {nullptr,nullptr,nullptr,nullptr};
+    for(auto it = players.cbegin(); it != players.cend(); ++it)
+        if(it->first->type < 4)
+            duelists[it->first->type] = it->first;
+    //in tag the positions 0 and 1 are the first team
+    int team = (mode == MODE_TAG) ? 2 : 1;
+    std::wstring names;
+    for(int i = 0; i < 4; i++)
+    {
+        if(duelists[i] == nullptr)
+            continue;
+        if(!names.empty())
+            names += (i == team) ? L" vs " : L", ";
+        wchar_t name[20];
+        BufferIO::CopyWStr(duelists[i]->name,name,20);
+        names += name;
+    }
+    return names;
+}
+
 void DuelRoom::setState(State state)
 {
     if(this->state != state)
+    {
+        recorder.record(FlightRecorder::STATE, this->state, state, 0xff, 0);
         roomManager->notifyStateChange(this,this->state,state);
+    }
     this->state=state;
 }
 
 void DuelRoom::destroyGame()
 {
+    if(relay_flush)
+    {
+        FlushObservers(true);
+        relay.Clear();
+        event_free(relay_flush);
+        relay_flush = 0;
+    }
     if(duel_mode)
     {
         if(state != DEAD)
         {
-            auto tempPlayers = players;
+            std::vector<DuelPlayer*> tempPlayers;
+            for(auto it =players.cbegin(); it!=players.cend(); ++it)
+                tempPlayers.push_back(it->first);
             for(auto it =tempPlayers.cbegin(); it!=tempPlayers.cend(); ++it)
             {
-                LeaveGame(it->first);
+                LeaveGame(*it);
             }
         }
         duel_mode->EndDuel();
@@ -367,6 +461,7 @@ int DuelRoom::getMaxDuelPlayers()
 
 void DuelRoom::playerConnected(DuelPlayer *dp)
 {
+    recorder.record(FlightRecorder::JOIN, 0, 0, dp->type, 0);
     if(players.find(dp)==players.end())
         players[dp] = DuelPlayerInfo();
     numPlayers=players.size();
@@ -416,6 +511,8 @@ void DuelRoom::updateServerState()
 
 void DuelRoom::playerDisconnected(DuelPlayer* dp )
 {
+    recorder.record(FlightRecorder::LEAVE, 0, 0, dp->type, 0);
+    relay.Unsubscribe(dp);
     if(players.find(dp)!=players.end())
         players.erase(dp);
     numPlayers=players.size();
@@ -506,6 +603,7 @@ void DuelRoom::createGame()
         duel_mode = new HandicapDuel();
 
     duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, DuelTimer, this);
+    relay_flush = event_new(net_evbase, 0, EV_TIMEOUT, DuelRoom::relay_flush_cb, this);
 
     BufferIO::CopyWStr("", duel_mode->name, 20);
     BufferIO::CopyWStr("", duel_mode->pass, 20);
@@ -542,6 +640,192 @@ void DuelRoom::createGame()
     chatReady=true;
 }
 
+bool DuelRoom::Snapshot(std::string& out, std::vector<DuelPlayer*>& members)
+{
+    if(state != PLAYING || duel_mode == nullptr)
+        return false;
+    for(auto it = players.cbegin(); it != players.cend(); ++it)
+        if(it->second.zombiePlayer)
+            return false;
+    if(!duel_mode->Snapshot(out))
+        return false;
+    for(auto it = players.cbegin(); it != players.cend(); ++it)
+        members.push_back(it->first);
+    return true;
+}
+
+void DuelRoom::Release()
+{
+    //the duel goes on somewhere else: nobody leaves and nobody wins here
+    duel_mode->Detach();
+    muted = true;
+    std::vector<DuelPlayer*> members;
+    for(auto it = players.cbegin(); it != players.cend(); ++it)
+        members.push_back(it->first);
+    for(auto it = members.cbegin(); it != members.cend(); ++it)
+        DisconnectPlayer(*it);
+}
+
+bool DuelRoom::Resume(const std::string& snapshot, std::vector<DuelPlayer*>& members, int lflist)
+{
+    //the re-simulation sends every message again: the room and the logger see them, the clients do not
+    muted = true;
+    this->lflist = lflist;
+    for(auto it = members.cbegin(); it != members.cend(); ++it)
+    {
+        DuelPlayer* dp = *it;
+        playerConnected(dp);
+        dp->netServer = this;
+        dp->game = duel_mode;
+        players[dp].isReady = dp->type != NETPLAYER_TYPE_OBSERVER;
+        players[dp].last_state_in_timeout = dp->state;
+        if(dp->type < 4)
+            duelistByType[dp->type] = dp;
+        STOC_TypeChange sctc;
+        sctc.type = dp->type;
+        SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
+        STOC_HS_PlayerEnter scpe;
+        BufferIO::CopyWStr(dp->name, scpe.name, 20);
+        scpe.pos = dp->type;
+        SendPacketToPlayer(dp, STOC_HS_PLAYER_ENTER, scpe);
+    }
+    bool resumed = duel_mode->Resume(snapshot, members);
+    //the observers already saw the stream rebuilt by the re-simulation
+    for(auto it = members.cbegin(); it != members.cend(); ++it)
+        if((*it)->type == NETPLAYER_TYPE_OBSERVER)
+            relay.Subscribe(*it, false);
+    muted = false;
+    if(!resumed)
+    {
+        //nothing to go back to: the members are disconnected and the room dies with them
+        for(auto it = members.cbegin(); it != members.cend(); ++it)
+            DisconnectPlayer(*it);
+        if(state != DEAD)
+        {
+            destroyGame();
+            setState(DEAD);
+        }
+        return false;
+    }
+    setState(PLAYING);
+    timeval timeout = {TIMEOUT_INTERVAL, 0};
+    event_add(user_timeout, &timeout);
+    chatReady = true;
+    return true;
+}
+
+void DuelRoom::StartObserverStream()
+{
+    //a new duel: the old stream is written to the observers, then it restarts empty
+    FlushObservers(true);
+    relay.Start();
+    if(!muted)
+        Metrics::getInstance()->counters.duelsStarted++;
+    for(auto it = players.cbegin(); it != players.cend(); ++it)
+        if(it->first->type == NETPLAYER_TYPE_OBSERVER && !it->second.zombiePlayer)
+            relay.Subscribe(it->first);
+}
+
+void DuelRoom::ReSendToObservers()
+{
+    //the last packet built, like ReSendToPlayer
+    unsigned char proto = net_server_write[2];
+    if(!relay.isStarted())
+    {
+        for(auto it = players.cbegin(); it != players.cend(); ++it)
+            if(it->first->type == NETPLAYER_TYPE_OBSERVER)
+                ReSendToPlayer(it->first);
+        return;
+    }
+    //never sent, see SendBufferToPlayer
+    if(proto == STOC_DUEL_END)
+        return;
+    relay.Publish(proto, net_server_write + 3, last_sent - 3);
+    scheduleRelay();
+}
+
+void DuelRoom::SendBufferToObservers(unsigned char proto, void* buffer, size_t len)
+{
+    recorder.record(FlightRecorder::OBSERVERS, proto, (proto == STOC_GAME_MSG && len) ? *(unsigned char*)buffer : 0, NETPLAYER_TYPE_OBSERVER, len);
+    if(!relay.isStarted())
+    {
+        for(auto it = players.cbegin(); it != players.cend(); ++it)
+            if(it->first->type == NETPLAYER_TYPE_OBSERVER)
+                SendBufferToPlayer(it->first, proto, buffer, len);
+        return;
+    }
+    relay.Publish(proto, buffer, len);
+    scheduleRelay();
+}
+
+void DuelRoom::scheduleRelay()
+{
+    if(!event_pending(relay_flush, EV_TIMEOUT, NULL))
+    {
+        timeval tick = {0, RELAY_TICK_MS * 1000};
+        event_add(relay_flush, &tick);
+    }
+}
+
+void DuelRoom::relay_flush_cb(evutil_socket_t fd, short events, void* arg)
+{
+    DuelRoom* that = (DuelRoom*)arg;
+    that->FlushObservers();
+}
+
+void DuelRoom::FlushObservers(bool all)
+{
+    //a late observer gets the duel a piece at a time, under the output limit of 043
+    if(muted)
+        return;
+    size_t budget = Config::getInstance()->output_limit_observer / 2;
+    bool behind = false;
+    std::vector<DuelPlayer*> subscribers = relay.getSubscribers();
+    for(auto it = subscribers.cbegin(); it != subscribers.cend(); ++it)
+    {
+        DuelPlayer* dp = *it;
+        size_t queued = evbuffer_get_length(bufferevent_get_output(dp->bev));
+        if(all)
+            relay.SendTo(gameServer, dp, SIZE_MAX);
+        else if(queued < budget)
+            behind |= relay.SendTo(gameServer, dp, budget - queued);
+        else
+            behind = true;
+    }
+    if(behind)
+    {
+        timeval later = {0, RELAY_RETRY_MS * 1000};
+        event_add(relay_flush, &later);
+    }
+}
+
+bool DuelRoom::isWatchable()
+{
+    return state == PLAYING && duel_mode != nullptr && duel_mode->pduel && relay.isStarted() && !muted;
+}
+
+bool DuelRoom::InsertObserver(DuelPlayer* dp)
+{
+    if(!isWatchable())
+        return false;
+    log(VERBOSE,"InsertObserver called, stream of %lu bytes\n",(unsigned long)relay.streamSize());
+    playerConnected(dp);
+    dp->netServer = this;
+    dp->game = duel_mode;
+    dp->type = NETPLAYER_TYPE_OBSERVER;
+    dp->state = CTOS_LEAVE_GAME;
+    players[dp].last_state_in_timeout = dp->state;
+    //the same packets of the observers at the start of the duel, then the relay from MSG_START
+    STOC_TypeChange sctc;
+    sctc.type = NETPLAYER_TYPE_OBSERVER;
+    SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
+    SendPacketToPlayer(dp, STOC_DUEL_START);
+    duel_mode->AddObserver(dp);
+    relay.Subscribe(dp);
+    scheduleRelay();
+    return true;
+}
+
 void DuelRoom::DisconnectPlayer(DuelPlayer* dp)
 {
     log(VERBOSE,"DisconnectPlayer called\n");
@@ -556,12 +840,22 @@ void DuelRoom::DisconnectPlayer(DuelPlayer* dp)
     //dp->netServer=0;
 }
 
-std::map<DuelPlayer*, DuelPlayerInfo> DuelRoom::ExtractAllPlayers()
+PlayerTable DuelRoom::ExtractAllPlayers()
 {
-	std::map<DuelPlayer*, DuelPlayerInfo> p = players;
-	
-	for(auto it = p.cbegin();it!= p.cend();++it)
-		ExtractPlayer(it->first);
+	//the infos are moved, not copied: the pending messages and the decks go with the players
+	std::vector<DuelPlayer*> extracted;
+	for(auto it = players.cbegin();it!= players.cend();++it)
+		extracted.push_back(it->first);
+	PlayerTable p;
+	for(DuelPlayer* dp : extracted)
+	{
+		//already gone with the LeaveGame of another one
+		auto it = players.find(dp);
+		if(it == players.end())
+			continue;
+		p[dp] = std::move(it->second);
+		ExtractPlayer(dp);
+	}
 	return p;
 }
 
@@ -582,6 +876,7 @@ void DuelRoom::InsertPlayer(DuelPlayer* dp)
     //it inserts forcefully the player into the server
     log(VERBOSE,"InsertPlayer called\n");
     playerConnected(dp);
+    players[dp].joinedMs = IpcFrame::nowMs();
     CTOS_JoinGame csjg;
     csjg.version = PRO_VERSION;
     csjg.gameid = 0;
@@ -637,6 +932,7 @@ void DuelRoom::LeaveGame(DuelPlayer* dp)
     if(state == PLAYING && dp->game == duel_mode && mode == MODE_TAG && oldtype != NETPLAYER_TYPE_OBSERVER)
     {
          log(BUG,"player disconnected in tag, inform about duel result\n");
+         BugDetected("LeaveGame: a duelist left the tag duel");
          
          wchar_t nome[40];
          BufferIO::CopyWStr(dp->name,nome,40);
@@ -663,12 +959,14 @@ void DuelRoom::LeaveGame(DuelPlayer* dp)
     {
         //this is a bug in tagduel
         log(BUG,"player left but the duel didn't call DisconnectPlayer\n");
+        BugDetected("LeaveGame: the duel did not call DisconnectPlayer");
         DisconnectPlayer(dp);
     }
 
     if(oldtype != NETPLAYER_TYPE_OBSERVER && state == PLAYING)
     {
         log(BUG,"player left but the game is still playing\n");
+        BugDetected("LeaveGame: the duel is still playing");
         StopServer();
         for(auto it=players.cbegin(); it!= players.cend(); ++it)
         {
@@ -693,13 +991,8 @@ void DuelRoom::Victory(char winner)
         return;
     DuelPlayer* _players[4];
     for(int i = 0; i<4; i++)
-        _players[i]=0;
+        _players[i]=getDpFromType(i);
 
-    for(auto it = players.cbegin(); it!= players.cend(); ++it)
-    {
-        if(it->first->type <= NETPLAYER_TYPE_PLAYER4 && it->first->type >= NETPLAYER_TYPE_PLAYER1)
-            _players[it->first->type] = it->first;
-    }
     if(!_players[0] && mode != MODE_HANDICAP)
         return;
     if(!_players[1])
@@ -717,6 +1010,9 @@ void DuelRoom::Victory(char winner)
     if((mode== MODE_SINGLE || mode == MODE_MATCH) && !strcmp(_players[NETPLAYER_TYPE_PLAYER1]->ip,_players[NETPLAYER_TYPE_PLAYER2]->ip))
         winner = -1;
 
+    //the details of the duel go to the analytics, the database gets only the scores
+    DuelAnalytics::getInstance()->Record(logger,mode,lflist,winner);
+
     if(winner < 0 || winner == 2)
     {
         if(mode == MODE_SINGLE || mode == MODE_MATCH)
@@ -765,18 +1061,9 @@ void DuelRoom::Victory(char winner)
         BufferIO::CopyWStr(_players[winner]->name,win,20);
         BufferIO::CopyWStr(_players[1-winner]->name,lose,20);
         
-		/*log(INFO,"SingleDuel, winner: %s, loser: %s\n",win,lose);
+		log(INFO,"SingleDuel, winner: %s, loser: %s\n",win,lose);
         std::string wins(win), loses(lose);
         Users::getInstance()->Victory(wins,loses);
-		*/
-		
-		if(strcmp(win,logger.getPlayerInfo((uintptr_t) _players[winner])->name))
-			log(BUG,"nome sbagliato %s %s\n",win,logger.getPlayerInfo((uintptr_t) _players[winner])->name);
-		std::vector<LoggerPlayerInfo*> nomi;
-		nomi.push_back(logger.getPlayerInfo((uintptr_t) _players[winner]));
-		nomi.push_back(logger.getPlayerInfo((uintptr_t) _players[1-winner]));
-	
-		Users::getInstance()->UpdateStats(nomi,0);
     }
     else if(mode == MODE_TAG)
     {
@@ -852,15 +1139,19 @@ void DuelRoom::StopServer()
     updateServerState();
 }
 
-void DuelRoom::RemoteChatToPlayer(DuelPlayer* dp, std::wstring msg,int color)
+void DuelRoom::SendChatPacket(DuelPlayer* dp, ChatPacket* packet)
 {
+    if(players.find(dp) == players.end())
+        return;
 	if(chatReady)
     {
-        RoomInterface::RemoteChatToPlayer(dp,msg,color);
+        logger.LogServerMessage((uintptr_t) dp,STOC_CHAT,(char*)packet->data() + 3,packet->size() - 3);
+        RoomInterface::SendChatPacket(dp,packet);
     }
     else
     {
-        players[dp].pendingMessages.push_back(std::pair<int,std::wstring>(color,msg));
+        //the packet is shared, the queue only keeps a reference
+        players[dp].pendingMessages.push_back(ChatPacketRef(packet));
         if(players[dp].pendingMessages.size() > 5)
             players[dp].pendingMessages.pop_front();
     }
@@ -1057,10 +1348,14 @@ void DuelRoom::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
 
 
     unsigned char pktType = BufferIO::ReadUInt8(pdata);
+    recorder.record(FlightRecorder::IN, pktType, 0, dp->type, len);
+    accounting.packetsIn++;
+    accounting.bytesIn += len + 2;
 
     if( players.end() == players.find(dp))
     {
         log(INFO,"BUG: handlectospacket ha ricevuto un pacchetto per un utente inesistente \n");
+        BugDetected("HandleCTOSPacket: the player is not in the room");
         return;
     }
 
@@ -1098,6 +1393,7 @@ void DuelRoom::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
         catch (std::string &errore)
         {
             printf("aiuto!\n");
+            BugDetected("CTOS_RESPONSE: the duel crashed");
             last_winner = -1;
             setState(ZOMBIE);
             updateServerState();
@@ -1137,7 +1433,12 @@ void DuelRoom::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
 
         if(!dp->game)
             return;
-		memcpy(players[dp].deck, data, len);
+		{
+			std::shared_ptr<DeckBuffer> deck = std::make_shared<DeckBuffer>();
+			deck->len = std::min(len,(unsigned int)sizeof(deck->data));
+			memcpy(deck->data, data, deck->len);
+			players[dp].deck = deck;
+		}
         duel_mode->UpdateDeck(dp, pdata);
         break;
     }
@@ -11,6 +11,8 @@
 #include <mutex>
 
 #include "DuelLogger.h"
+#include "SpectatorRelay.h"
+#include "FlightRecorder.h"
 
 
 #define MODE_HANDICAP   0x10
@@ -30,10 +32,13 @@ class DuelRoom:public RoomInterface
 {
 	DuelLogger logger;
     public:
+    DECLARE_POOLED_NEW(DuelRoom)
     unsigned char mode;
     enum State {WAITING,FULL,PLAYING,ZOMBIE,DEAD};
     State state;
     int getLfList();
+    //the banlists were reloaded: false if the room does not use one of the replaced hashes
+    bool ReplaceLfList(const uint32_t* replaced);
 	int getNumDuelPlayers();
 	int getMaxDuelPlayers();
 private:
@@ -68,10 +73,27 @@ private:
     void ShowPlayerScores();
     void flushPendingMessages();
     DuelPlayer * getDpFromType(unsigned char);
+    DuelPlayer* duelistByType[4];
+
+    //the observers get the duel from the relay, written by a timer on the loop of the duelists:
+    //one pass on the subscribers every RELAY_TICK_MS at most, whatever the messages of the duel
+    SpectatorRelay relay;
+    event* relay_flush;
+    static const int RELAY_TICK_MS = 50;
+    static const int RELAY_RETRY_MS = 100;
+    static void relay_flush_cb(evutil_socket_t fd, short events, void* arg);
+    void scheduleRelay();
+    void FlushObservers(bool all = false);
+
+    FlightRecorder recorder;
 	public:
+    //engine time, messages and bytes of the room, for !roomstats and !heavy
+    RoomUsage accounting;
+    //"a vs b", the duelists in order of position
+    std::wstring getDuelistNames();
 	void RoomChat(DuelPlayer* dp, std::wstring messaggio);
     void SystemChatToPlayer(DuelPlayer*dp, const std::wstring,bool isAdmin=false,int color = 0);
-	void RemoteChatToPlayer(DuelPlayer*dp, std::wstring,int color = 0);
+    void SendChatPacket(DuelPlayer* dp, ChatPacket* packet);
     DuelRoom(RoomManager*roomManager,GameServer*,unsigned char mode);
     void LeaveGame(DuelPlayer* dp);
     bool StartServer(unsigned short port);
@@ -84,11 +106,23 @@ private:
     void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
 
     void InsertPlayer(DuelPlayer* dp);
-	std::map<DuelPlayer*, DuelPlayerInfo> ExtractAllPlayers();
+	PlayerTable ExtractAllPlayers();
     void ExtractPlayer(DuelPlayer* dp);
     bool isAvailableToPlayer(DuelPlayer* dp, unsigned char mode);
+    //migration of the duel to another gameserver
+    bool Snapshot(std::string& out, std::vector<DuelPlayer*>& members);
+    void Release();
+    bool Resume(const std::string& snapshot, std::vector<DuelPlayer*>& members, int lflist);
+    //the duel modes publish the packets for the observers once
+    void StartObserverStream();
+    void ReSendToObservers();
+    void SendBufferToObservers(unsigned char proto, void* buffer, size_t len);
+    //an observer that arrives during the duel
+    bool isWatchable();
+    bool InsertObserver(DuelPlayer* dp);
     //using RoomInterface::SendPacketToPlayer;
     void SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buffer, size_t len);
+    void BugDetected(const char* reason);
 };
 
 }
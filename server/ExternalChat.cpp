@@ -10,6 +10,8 @@
 //{"id":"1370101637.4086.51aa178563c099.72780478","sender":"f79556c7709d11e00e774b912b2244ac659987ac","recipient":"channel|xxx","type":"msg","body":"fsd\u2192\u2193","timestamp":1370101637}
 
 #include "MySqlWrapper.h"
+#include "debug.h"
+#include <chrono>
 
 
 
@@ -22,128 +24,171 @@ ExternalChat* ExternalChat::getInstance()
     return &ec;
 }
 
-void ExternalChat::broadcastMessage(GameServerChat* msg)
+void ExternalChat::publish(const ChatMessage& msg)
 {
     if(Config::getInstance()->noExternalChat)
         return;
-    char buffer[1024];
-    char nome[25];
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if(!isRunning)
+        return;
+    if(outgoing.size() >= MAX_QUEUE)
+    {
+        log(WARN,"external chat queue full, message dropped\n");
+        return;
+    }
+    outgoing.push_back(msg);
+    queueCond.notify_one();
+}
+
+void ExternalChat::insertMessage(MySqlWrapper::Lease& con,const ChatMessage& msg)
+{
     const char* localIP = "127.0.0.1";
     std::string binaryIP = "";
     binaryIP.resize(4);
     if(inet_pton(AF_INET,localIP,&binaryIP[0]) != 1)
         return ;
 
-    std::wstring messaggio = msg->messaggio;
-
-
-    auto ago = messaggio.find(L"]: ",1);
-    if(ago != std::wstring::npos and ago < 28)
+    std::string nome;
+    std::string testo;
+    auto ago = msg.text.find("]: ",1);
+    if(ago != std::string::npos and ago < 28)
     {
-        BufferIO::EncodeUTF8(msg->messaggio + ago + 3,buffer);
-        std::wstring temp = messaggio.substr(1,ago-1);
-        BufferIO::CopyWStr(temp.c_str(),nome,25);
-
-
+        testo = msg.text.substr(ago + 3);
+        nome = msg.text.substr(1,ago-1);
     }
     else
     {
-        strcpy(nome,"[---]");
-        BufferIO::EncodeUTF8(msg->messaggio,buffer);
-        std::cout << buffer <<std::endl;
+        nome = "[---]";
+        testo = msg.text;
+        std::cout << testo <<std::endl;
     }
 
+    sql::PreparedStatement* stmt(con.prepare("INSERT INTO ajax_chat_messages(userName,userID,userRole,channel,dateTime,ip,text,pid,chatColor) VALUES (?,3, 1,0,now(),?,?,?,?)"));
+    stmt->setString(1, nome);
+    stmt->setString(2, binaryIP);
+    stmt->setString(3, testo);
+    stmt->setInt(4,pid);
+    stmt->setInt(5,msg.color);
+    stmt->execute();
+}
 
-    try
-    {
-        sql::Connection* con = MySqlWrapper::getInstance()->getConnection();
-        std::unique_ptr<sql::PreparedStatement> stmt(con->prepareStatement("INSERT INTO ajax_chat_messages(userName,userID,userRole,channel,dateTime,ip,text,pid,chatColor) VALUES (?,3, 1,0,now(),?,?,?,?)"));
-        //sql::PreparedStatement *stmt = con->prepareStatement("INSERT INTO users VALUES (?, ?, ?)");
+void ExternalChat::setPushActive(bool active)
+{
+    pushActive = active;
+}
 
+void ExternalChat::readMessages(fd_set* rfds, std::vector<ChatMessage>& messages)
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    messages.insert(messages.end(),incoming.begin(),incoming.end());
+    incoming.clear();
+}
+
+bool ExternalChat::pollMessages(MySqlWrapper::Lease& con)
+{
+    //true if the batch was full and there is more to read
+    if(last_id < 0)
+    {
+        //the history is not sent again, only what is written from now on
+        sql::PreparedStatement* stmt(con.prepare("select coalesce(max(id),0) from ajax_chat_messages"));
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        last_id = res->next()?res->getInt(1):0;
+        return false;
+    }
 
+    std::vector<ChatMessage> lista;
+    sql::PreparedStatement* stmt(con.prepare("select userName,LEFT(text,256),id,chatColor,pid from ajax_chat_messages where id > ? order by id asc limit ?"));
 
-        stmt->setString(1, std::string(nome));
-        stmt->setString(2, binaryIP);
-        stmt->setString(3, buffer);
-        stmt->setInt(4,pid);
-		stmt->setInt(5,msg->chatColor);
-        stmt->execute();
+    stmt->setInt(1, last_id);
+    stmt->setInt(2, POLL_BATCH);
 
-    }
-    catch (sql::SQLException &e)
+    std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+    unsigned int rows = 0;
+    bool deliver = !pushActive;
+    while(res->next())
     {
-        MySqlWrapper::getInstance()->notifyException(e);
-        return;
+        rows++;
+        std::string username = res->getString(1);
+        std::string message = res->getString(2);
+        int id = res->getInt(3);
+        int chatColor = res->getInt(4);
+        if(id>last_id)
+            last_id = id;
+        //the filters are here so that the query only walks the primary key
+        if(!deliver || res->getInt(5) == pid || (!message.empty() && message[0] == '/'))
+            continue;
+        lista.push_back(webMessage(username,message,chatColor));
     }
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    incoming.insert(incoming.end(),lista.begin(),lista.end());
+    return rows == POLL_BATCH;
 }
-std::list<GameServerChat> ExternalChat::getPendingMessages()
-{
 
-    std::list<GameServerChat> lista;
-    if(Config::getInstance()->noExternalChat)
-        return lista;
-		
-	static time_t lastCheck = 0;
-	time_t now = time(NULL);
-	if(now - lastCheck <2)	
-		return lista;
-	lastCheck = now;
-	
-    try
+void ExternalChat::WorkerThread()
+{
+    time_t lastCheck = 0;
+    bool backlog = false;
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while(isRunning)
     {
-        sql::Connection* con = MySqlWrapper::getInstance()->getConnection();
-
-        //std::unique_ptr<sql::PreparedStatement> stmt(con->prepareStatement("SELECT rank from (SELECT username,score, @rownum := @rownum + 1 AS rank FROM stats, (SELECT @rownum := 0) r ORDER BY score DESC) z where username = ?"));
-        std::unique_ptr<sql::PreparedStatement> stmt(con->prepareStatement("select userName,LEFT(text,256),id,chatColor from ajax_chat_messages where text not like '/%' and id > ? and pid != ? order by id desc limit 5"));
-
-        stmt->setInt(1, last_id);
-        stmt->setInt(2, pid);
-
-        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
-        while(res->next())
+        if(!backlog)
+            queueCond.wait_for(lock,std::chrono::seconds(2),[this] {return !outgoing.empty() || !isRunning;});
+        backlog = false;
+        std::deque<ChatMessage> batch;
+        batch.swap(outgoing);
+        lock.unlock();
+
+        if(!Config::getInstance()->disableMysql)
         {
-            std::string username = res->getString(1);
-            std::string message = res->getString(2);
-            int id = res->getInt(3);
-			int chatColor = res->getInt(4);
-            if(id>last_id)
-                last_id = id;
-            wchar_t buffer[1024];
-            GameServerChat gsc;
-            gsc.chatColor = chatColor;
-            gsc.type=MessageType::CHAT;
-            BufferIO::DecodeUTF8(message.c_str(),buffer);
-			if(username.find(">",1) != std::string::npos || chatColor < 0)
-				swprintf(gsc.messaggio,260,L"[%hs]: %ls",username.c_str(),buffer);
-			else
-				swprintf(gsc.messaggio,260,L"[%hs<^_^>]: %ls",username.c_str(),buffer);
-            lista.push_front(gsc);
+            try
+            {
+                //a connection of the pool only for the time of the batch
+                MySqlWrapper::Lease con;
+                for(auto it = batch.cbegin(); it != batch.cend(); ++it)
+                    insertMessage(con,*it);
+                if(time(NULL) - lastCheck >= 2)
+                {
+                    lastCheck = time(NULL);
+                    //a full batch: the next one is read without waiting
+                    if(pollMessages(con))
+                    {
+                        lastCheck = 0;
+                        backlog = true;
+                    }
+                }
+            }
+            catch (sql::SQLException &e)
+            {
+                MySqlWrapper::getInstance()->notifyException(e);
+            }
         }
-
-    }
-    catch (sql::SQLException &e)
-    {
-        MySqlWrapper::getInstance()->notifyException(e);
-
+        lock.lock();
     }
-
-    return lista;
 }
 
-ExternalChat::ExternalChat()
+ExternalChat::ExternalChat():worker(nullptr),isRunning(false),pushActive(false)
 {
-    last_id=0;
+    last_id=-1;
     pid = (int)getpid();
 }
 
 void ExternalChat::connect()
 {
-
+    if(Config::getInstance()->noExternalChat || worker)
+        return;
+    isRunning = true;
+    worker = new std::thread(&ExternalChat::WorkerThread,this);
 }
 
 void ExternalChat::disconnect()
 {
-
+    //called in the gameserver after the fork: the thread exists only in the father,
+    //the queues are not locked because the mutex could be copied locked
+    worker = nullptr;
+    isRunning = false;
+    outgoing.clear();
+    incoming.clear();
 }
 
 void ExternalChat::gen_random(char *s, const int len) {
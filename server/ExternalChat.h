@@ -2,16 +2,31 @@
 #define EXTERNALCHAT_CPP
 
 #include "GameserversManager.h"
-#include <mysql_connection.h>
+#include "ChatSink.h"
+#include "ChatSource.h"
+#include <atomic>
+#include "MySqlWrapper.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 namespace ygo
 {
-class ExternalChat
+/*
+ * the web chat (ajax_chat_messages) as a chat sink and as a chat source.
+ * the inserts and the polling are done by a thread with its own mysql connection,
+ * the select loop of the father only touches the queues.
+ * The polling is the fallback of the push socket: it reads by id in bounded batches,
+ * and while the push socket is active it only moves last_id forward.
+ */
+class ExternalChat: public ChatSink, public ChatSource
 {
     public:
 
-    void broadcastMessage(GameServerChat*);
-    std::list<GameServerChat> getPendingMessages();
+    void publish(const ChatMessage& msg);
+    void readMessages(fd_set* rfds, std::vector<ChatMessage>& messages);
+    void setPushActive(bool active);
     static ExternalChat* getInstance();
     void connect();
     void disconnect();
@@ -24,6 +39,21 @@ class ExternalChat
     ExternalChat();
     void gen_random(char *s, const int len);
 
+    void WorkerThread();
+    void insertMessage(MySqlWrapper::Lease& con,const ChatMessage& msg);
+    bool pollMessages(MySqlWrapper::Lease& con);
+
+    std::thread* worker;
+    std::mutex queueMutex;
+    std::condition_variable queueCond;
+    std::deque<ChatMessage> outgoing;
+    std::vector<ChatMessage> incoming;
+    bool isRunning;
+    std::atomic<bool> pushActive;
+
+    static const unsigned int POLL_BATCH = 50;
+
+    static const unsigned int MAX_QUEUE = 1000;
 };
 
 }
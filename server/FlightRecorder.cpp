@@ -0,0 +1,80 @@
+#include "FlightRecorder.h"
+#include "Metrics.h"
+#include "network.h"
+#include "Config.h"
+#include "debug.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+namespace ygo
+{
+
+unsigned long FlightRecorder::dumps = 0;
+unsigned long FlightRecorder::suppressed = 0;
+
+void FlightRecorder::Dump(const char* reason, const std::string& description)
+{
+    const std::string& dir = Config::getInstance()->flight_recorder_dir;
+    if(dir.empty() || dumped)
+        return;
+    dumped = true;
+
+    //a bug that repeats in every room must not fill the disk
+    static time_t window = 0;
+    static int inWindow = 0;
+    time_t now = time(NULL);
+    if(now - window >= 60)
+    {
+        window = now;
+        inWindow = 0;
+    }
+    if(++inWindow > MAX_DUMPS_PER_MINUTE)
+    {
+        suppressed++;
+        return;
+    }
+
+    mkdir(dir.c_str(),0755);
+    char timestamp[32];
+    strftime(timestamp,sizeof(timestamp),"%Y%m%d-%H%M%S",localtime(&now));
+    char path[512];
+    snprintf(path,sizeof(path),"%s/flight-%s-%d-%lu.txt",dir.c_str(),timestamp,(int)getpid(),dumps);
+    FILE* fp = fopen(path,"w");
+    if(fp == nullptr)
+    {
+        log(WARN,"flight recorder: cannot write %s: %s\n",path,strerror(errno));
+        return;
+    }
+    dumps++;
+
+    static const char* kinds[] = {"in","out","observers","state","join","leave"};
+    static const char* states[] = {"WAITING","FULL","PLAYING","ZOMBIE","DEAD"};
+    fprintf(fp,"reason: %s\n%s",reason,description.c_str());
+    uint32_t count = next < SIZE ? next : SIZE;
+    fprintf(fp,"last %u events of %u, time before the dump:\n",count,next);
+    uint32_t dumpMs = nowMs();
+    for(uint32_t i = next - count; i != next; i++)
+    {
+        const Entry& e = entries[i & (SIZE - 1)];
+        fprintf(fp,"%9.3f %-9s ",-(int32_t)(dumpMs - e.ms) / 1000.0,e.kind < 6 ? kinds[e.kind] : "?");
+        if(e.kind == STATE)
+            fprintf(fp,"%s -> %s\n",e.proto < 5 ? states[e.proto] : "?",e.detail < 5 ? states[e.detail] : "?");
+        else if(e.kind == JOIN || e.kind == LEAVE)
+            fprintf(fp,"player %d\n",e.player);
+        else
+        {
+            const char* name = e.kind == IN ? Metrics::ctosName(e.proto) : Metrics::stocName(e.proto);
+            fprintf(fp,"player %d %s(0x%02x)",e.player,name ? name : "",e.proto);
+            if(e.kind != IN && e.proto == STOC_GAME_MSG)
+                fprintf(fp," msg %d",e.detail);
+            fprintf(fp," len %u\n",e.len);
+        }
+    }
+    fclose(fp);
+    log(WARN,"flight recorder: %s, written to %s\n",reason,path);
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef _FLIGHTRECORDER_H_
+#define _FLIGHTRECORDER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <time.h>
+
+namespace ygo
+{
+
+/*
+ * the last SIZE events of a room: headers of the packets in both directions,
+ * changes of state, players entering and leaving.
+ * A fixed ring inside the room, recording is a few stores and a coarse clock read;
+ * it is written to flight_recorder_dir only when the room hits a bug.
+ */
+class FlightRecorder
+{
+public:
+    enum Kind {IN,OUT,OBSERVERS,STATE,JOIN,LEAVE};
+    struct Entry
+    {
+        uint32_t ms;
+        uint8_t kind;
+        uint8_t proto;
+        //first byte of a STOC_GAME_MSG, new state for STATE
+        uint8_t detail;
+        uint8_t player;
+        uint32_t len;
+    };
+    static const unsigned int SIZE = 256;
+
+    FlightRecorder():next(0),dumped(false) {}
+
+    void record(Kind kind, unsigned char proto, unsigned char detail, unsigned char player, size_t len)
+    {
+        Entry& e = entries[next++ & (SIZE - 1)];
+        e.ms = nowMs();
+        e.kind = kind;
+        e.proto = proto;
+        e.detail = detail;
+        e.player = player;
+        e.len = len;
+    }
+
+    //once for each room, and at most MAX_DUMPS_PER_MINUTE for each gameserver.
+    //description is written before the events
+    void Dump(const char* reason, const std::string& description);
+
+    static const int MAX_DUMPS_PER_MINUTE = 10;
+    static unsigned long dumps;
+    static unsigned long suppressed;
+
+private:
+    Entry entries[SIZE];
+    uint32_t next;
+    bool dumped;
+
+    static uint32_t nowMs()
+    {
+        //the coarse clock is read without a syscall, a few ms of resolution are enough
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+};
+
+}
+#endif
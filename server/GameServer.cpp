@@ -8,6 +8,10 @@
 #include "Statistics.h"
 
 #include "Users.h"
+#include "RateLimiter.h"
+#include "MySqlWrapper.h"
+#include "RankIndex.h"
+#include "Metrics.h"
 
 using ygo::Config;
 namespace ygo
@@ -19,11 +23,23 @@ GameServer::GameServer()
 {
     net_evbase = 0;
     listener = nullptr;
+    handoffListener = nullptr;
+    handoffReceived = 0;
+    duelsReceived = 0;
+    kickScheduled = false;
+    observersDropped = duelistsTimedOut = 0;
+    handshakeEvent = nullptr;
+    handshakesPromoted = handshakesTimedOut = handshakesInvalid = handshakesEvicted = handshakesRefusedFull = refusedPerIp = 0;
+    handshakeMsTotal = 0;
     last_sent = 0;
+    chatFlushEvent = nullptr;
+    ipcBytesIn = ipcBytesOut = 0;
+    chatReceived = 0;
+    chatLatencyTotal = chatLatencyMax = 0;
     MAXPLAYERS = Config::getInstance()->max_users_per_process;
 }
 
-bool GameServer::StartServer(int server_fd,int manager_fd)
+bool GameServer::StartServer(int server_fd,int manager_fd,int handoff_fd)
 {
     if(net_evbase)
         return false;
@@ -48,7 +64,15 @@ bool GameServer::StartServer(int server_fd,int manager_fd)
     manager_buf = bufferevent_socket_new(net_evbase, manager_fd, BEV_OPT_CLOSE_ON_FREE);
     bufferevent_setcb(manager_buf, ManagerRead, NULL, ManagerEvent, this);
     bufferevent_enable(manager_buf, EV_READ|EV_WRITE);
+    chatFlushEvent = event_new(net_evbase, -1, 0, flushChat, this);
 
+    if(handoff_fd >= 0)
+    {
+        evutil_make_socket_nonblocking(handoff_fd);
+        handoffListener = evconnlistener_new(net_evbase, HandoffAccept, this, LEV_OPT_CLOSE_ON_FREE, -1, handoff_fd);
+        if(!handoffListener)
+            log(WARN,"cannot receive the players of an upgrade\n");
+    }
 
     return true;
 }
@@ -58,34 +82,90 @@ void GameServer::ManagerRead(bufferevent *bev, void *ctx)
 
     GameServer* that = (GameServer*)ctx;
     evbuffer* input = bufferevent_get_input(bev);
-    size_t len = evbuffer_get_length(input);
-    unsigned short packet_len = 0;
 
     while(true)
     {
-        if(len < sizeof(MessageType))
+        size_t len = evbuffer_get_length(input);
+        if(len < sizeof(IpcHeader))
             return;
-        MessageType mt;
-        evbuffer_copyout(input, &mt, sizeof(mt));
-        if(mt == MessageType::CHAT && len >= sizeof(GameServerChat))
+        IpcHeader header;
+        evbuffer_copyout(input, &header, sizeof(header));
+        if(header.length > IpcFrame::MAX_PAYLOAD)
         {
-            GameServerChat gsc;
-            evbuffer_remove(input, &gsc, sizeof(gsc));
-
-            len -= sizeof(gsc);
-            that->roomManager.BroadcastMessage(gsc.messaggio,gsc.chatColor);
+            //the rest of the frame would be read as headers: the channel is lost, like the father closed it
+            log(BUG,"frame too long from the father: %u bytes, channel closed\n",header.length);
+            ManagerEvent(bev, BEV_EVENT_ERROR, ctx);
+            return;
         }
-        else
+        if(len < sizeof(header) + header.length)
             return;
+        evbuffer_drain(input, sizeof(header));
+        std::vector<char> payload(header.length);
+        if(header.length)
+            evbuffer_remove(input, &payload[0], header.length);
+        that->ipcBytesIn += sizeof(header) + header.length;
+        that->handleManagerFrame(header, header.length?&payload[0]:nullptr);
+    }
+
+}
 
+void GameServer::handleManagerFrame(IpcHeader& header, const char* payload)
+{
+    if(header.type == CHAT)
+    {
+        std::vector<ChatMessage> messages;
+        if(!IpcFrame::parseChat(payload, header.length, messages))
+            log(BUG,"malformed chat frame from the father\n");
+        int64_t now = IpcFrame::nowMs();
+        for(auto it = messages.cbegin(); it != messages.cend(); ++it)
+        {
+            int64_t latency = std::max<int64_t>(now - it->timestamp, 0);
+            chatReceived++;
+            chatLatencyTotal += latency;
+            chatLatencyMax = std::max(chatLatencyMax, latency);
+            roomManager.BroadcastMessage(it->wtext(),it->color);
+        }
     }
+    else if(header.type == RANK_UPDATE)
+    {
+        std::vector<std::pair<std::string,int>> ranks;
+        if(!IpcFrame::parseRank(payload, header.length, ranks))
+            log(BUG,"malformed rank frame from the father\n");
+        for(auto it = ranks.cbegin(); it != ranks.cend(); ++it)
+            RankIndex::getInstance()->apply(it->first,it->second);
+    }
+    else if(header.type == UPGRADE || header.type == DRAIN)
+        HandOver(std::string(payload, header.length));
+    else if(header.type == CONFIG)
+    {
+        uint32_t replaced[2];
+        if(Config::getInstance()->ApplySnapshot(payload, header.length, replaced))
+        {
+            roomManager.ReplaceLfLists(replaced);
+            ConfigReloaded();
+        }
+    }
+    else
+        log(WARN,"unknown message %u from the father\n",header.type);
+}
 
+void GameServer::ConfigReloaded()
+{
+    //the values copied when the gameserver started
+    MAXPLAYERS = Config::getInstance()->max_users_per_process;
+    WaitingRoom::ConfigReloaded();
+    if(listener != nullptr && users.size() < (size_t)MAXPLAYERS)
+        RestartListen();
 }
+
 void GameServer::ManagerEvent(bufferevent* bev, short events, void* ctx)
 {
+    GameServer* that = (GameServer*)ctx;
     if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
     {
         bufferevent_free(bev);
+        //the stats and the chat are not sent anymore
+        that->manager_buf = nullptr;
     }
 }
 
@@ -142,6 +222,18 @@ void GameServer::StopListen()
 void GameServer::ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx)
 {
     GameServer* that = (GameServer*)ctx;
+    MetricsSnapshot& metrics = Metrics::getInstance()->counters;
+    metrics.connectionsAccepted++;
+
+    //refused before anything is allocated for the connection
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &(((sockaddr_in*)address)->sin_addr), ip, INET_ADDRSTRLEN);
+    //the connections of a proxy are checked when it sends the real ip
+    if(!that->isProxy(ip) && !that->admitIp(ip))
+    {
+        evutil_closesocket(fd);
+        return;
+    }
 
     int optval=1;
     int optlen = sizeof(optval);
@@ -155,44 +247,297 @@ void GameServer::ServerAccept(evconnlistener* listener, evutil_socket_t fd, sock
 	optval = 1;
     setsockopt(fd, SOL_TCP, TCP_NODELAY, &optval, optlen);
 
+    //nothing else until the login: no lookups, no slot in users
     bufferevent* bev = bufferevent_socket_new(that->net_evbase, fd, BEV_OPT_CLOSE_ON_FREE);
-    DuelPlayer dp;
-    dp.name[0] = 0;
-    dp.type = 0xff;
-    dp.bev = bev;
-    dp.netServer=0;
-    dp.loginStatus = Users::LoginResult::NOTENTERED;
-    sockaddr_in* sa = (sockaddr_in*)address;
+    PendingConnection* pc = new PendingConnection;
+    pc->server = that;
+    pc->bev = bev;
+    strcpy(pc->ip,ip);
+    pc->acceptedMs = IpcFrame::nowMs();
+    pc->name[0] = 0;
+    //a flood replaces the oldest handshakes, the players keep their slots
+    if(that->pendingConnections.size() >= (size_t)that->MAXPLAYERS)
+    {
+        that->handshakesEvicted++;
+        that->closePending(that->pendingConnections.front());
+    }
+    pc->position = that->pendingConnections.insert(that->pendingConnections.end(), pc);
+    bufferevent_setcb(bev, PendingRead, NULL, PendingEvent, pc);
+    bufferevent_enable(bev, EV_READ);
+}
+
+bool GameServer::isProxy(const char* ip)
+{
+    const std::string& proxies = Config::getInstance()->proxy_ips;
+    if(proxies.empty())
+        return false;
+    return (" " + proxies + " ").find(" " + std::string(ip) + " ") != std::string::npos;
+}
 
-    inet_ntop(AF_INET, &(sa->sin_addr), dp.ip, INET_ADDRSTRLEN);
+bool GameServer::admitIp(const char* ip)
+{
+    MetricsSnapshot& metrics = Metrics::getInstance()->counters;
+    if(!RateLimiter::getInstance()->allowConnection(ip))
+    {
+        log(INFO,"connection from %s refused by the rate limiter\n",ip);
+        metrics.connectionsRefused[MetricsSnapshot::REFUSED_RATE]++;
+        return false;
+    }
+    if(!addConnection(ip))
+    {
+        log(VERBOSE,"connection from %s refused: too many connections from the same ip\n",ip);
+        refusedPerIp++;
+        metrics.connectionsRefused[MetricsSnapshot::REFUSED_IP]++;
+        return false;
+    }
+    return true;
+}
 
-    dp.countryCode = Users::getInstance()->getCountryCode(std::string(dp.ip));
+bool GameServer::addConnection(const char* ip, bool capped)
+{
+    //the proxy is not a client: its connections are never counted
+    if(isProxy(ip))
+        return true;
+    //counted in the shared table: the cap is for all the gameservers together
+    return RateLimiter::getInstance()->addConnection(ip, capped);
+}
 
-    /*
-        //prendo il reverse hostname
-        char node[NI_MAXHOST];
+void GameServer::releaseConnection(const char* ip)
+{
+    if(isProxy(ip))
+        return;
+    RateLimiter::getInstance()->removeConnection(ip);
+}
 
-        int res = getnameinfo(address, socklen, node, sizeof(node), nullptr, 0, 0);
-        if (res)
+void GameServer::closePending(PendingConnection* pc, bool counted)
+{
+    pendingConnections.erase(pc->position);
+    if(counted)
+        releaseConnection(pc->ip);
+    bufferevent_free(pc->bev);
+    delete pc;
+}
+
+bool GameServer::changeIp(char* ip, const char* packet, bool capped)
+{
+    //the proxy sends "ipchange" followed by the address of the client
+    char realIp[INET_ADDRSTRLEN];
+    if(!inet_ntop(AF_INET, packet + 8, realIp, INET_ADDRSTRLEN))
+        return true;
+    const std::string& proxies = Config::getInstance()->proxy_ips;
+    if(!proxies.empty() && !isProxy(ip))
+    {
+        log(WARN,"ipchange to %s from %s, that is not in proxy_ips: ignored\n",realIp,ip);
+        return true;
+    }
+    releaseConnection(ip);
+    strcpy(ip, realIp);
+    if(capped)
+        return admitIp(ip);
+    addConnection(ip, false);
+    return true;
+}
+
+DuelPlayer* GameServer::PromoteConnection(PendingConnection* pc)
+{
+    //the login arrived: the connection gets everything a player needs
+    bufferevent* bev = pc->bev;
+    DuelPlayer *dp = new DuelPlayer;
+    memcpy(dp->name, pc->name, sizeof(dp->name));
+    dp->type = 0xff;
+    dp->bev = bev;
+    dp->netServer=0;
+    dp->loginStatus = Users::LoginResult::WAITINGJOIN;
+    strcpy(dp->ip,pc->ip);
+    dp->countryCode = Users::getInstance()->getCountryCode(std::string(dp->ip));
+
+    handshakesPromoted++;
+    handshakeMsTotal += IpcFrame::nowMs() - pc->acceptedMs;
+    pendingConnections.erase(pc->position);
+    delete pc;
+
+    users[bev] = dp;
+    setupConnection(bev);
+    if(users.size()>= MAXPLAYERS && isListening)
+        StopListen();
+    Statistics::getInstance()->setNumPlayers(getNumPlayers());
+    return dp;
+}
+
+void GameServer::PendingRead(bufferevent* bev, void* ctx)
+{
+    //only CTOS_PLAYER_INFO and then CTOS_JOIN_GAME, anything else closes the connection
+    PendingConnection* pc = (PendingConnection*)ctx;
+    GameServer* that = pc->server;
+    evbuffer* input = bufferevent_get_input(bev);
+    while(true)
+    {
+        unsigned char header[3];
+        if(evbuffer_copyout(input, header, 3) < 3)
+            return;
+        unsigned short packet_len = header[0] | (header[1] << 8);
+        unsigned char pktType = header[2];
+        if(packet_len == 0 || packet_len > MAX_HANDSHAKE_PACKET)
+            break;
+        if(evbuffer_get_length(input) < (size_t)packet_len + 2)
+            return;
+        if(pktType == CTOS_PLAYER_INFO && packet_len - 1 >= sizeof(CTOS_PlayerInfo))
         {
-            printf("%s\n", gai_strerror(res));
-            //exit(1);
+            char packet[MAX_HANDSHAKE_PACKET + 2];
+            evbuffer_remove(input, packet, packet_len + 2);
+            BufferIO::CopyWStr(((CTOS_PlayerInfo*)&packet[3])->name, pc->name, 20);
+            Metrics::getInstance()->packetIn(pktType, packet_len + 2);
+            continue;
         }
-        else
-        printf("indirizzo: %s\n",node);
-    */
+        if(pktType == CTOS_JOIN_GAME && pc->name[0] != 0)
+        {
+            //the handshakes are not counted in MAXPLAYERS: the last ones can find it full
+            if(that->users.size() >= that->MAXPLAYERS)
+            {
+                that->refuseFull(pc);
+                return;
+            }
+            //the login and what follows it are read by the player
+            that->PromoteConnection(pc);
+            ServerEchoRead(bev, that);
+            return;
+        }
+        //the raw packets of the proxy and of the monitoring, they were accepted before the login
+        char packet[MAX_HANDSHAKE_PACKET + 2];
+        evbuffer_copyout(input, packet, packet_len + 2);
+        const char* data = &packet[2];
+        if(packet_len == 5 && !memcmp(data, "ping", 5))
+        {
+            evbuffer_drain(input, packet_len + 2);
+            bufferevent_write(bev, "pong", 5);
+            continue;
+        }
+        if(packet_len >= 12 && !memcmp(data, "ipchange", 8))
+        {
+            evbuffer_drain(input, packet_len + 2);
+            if(!that->changeIp(pc->ip, data, true))
+            {
+                //the real ip was not counted, the one of the proxy was already released
+                that->closePending(pc, false);
+                return;
+            }
+            continue;
+        }
+        break;
+    }
+    that->handshakesInvalid++;
+    that->closePending(pc);
+}
 
-	DuelPlayer *dpp = new DuelPlayer(dp);
-    that->users[bev] = dpp;
-    bufferevent_setcb(bev, ServerEchoRead, NULL, ServerEchoEvent, ctx);
-    bufferevent_enable(bev, EV_READ);
-    if(that->users.size()>= that->MAXPLAYERS)
+void GameServer::refuseFull(PendingConnection* pc)
+{
+    //the client shows the error instead of a dropped connection and tries again, a full gameserver does not listen
+    char packet[3 + sizeof(STOC_ErrorMsg)];
+    STOC_ErrorMsg scem;
+    scem.msg = ERRMSG_JOINERROR;
+    scem.code = 0;
+    char* p = packet;
+    BufferIO::WriteInt16(p, 1 + sizeof(scem));
+    BufferIO::WriteInt8(p, STOC_ERROR_MSG);
+    memcpy(p, &scem, sizeof(scem));
+    send(bufferevent_getfd(pc->bev), packet, sizeof(packet), MSG_NOSIGNAL | MSG_DONTWAIT);
+    handshakesRefusedFull++;
+    closePending(pc);
+}
+
+void GameServer::PendingEvent(bufferevent* bev, short events, void* ctx)
+{
+    PendingConnection* pc = (PendingConnection*)ctx;
+    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        pc->server->closePending(pc);
+}
+
+void GameServer::handshakeTimeout(evutil_socket_t fd, short events, void* arg)
+{
+    GameServer* that = (GameServer*)arg;
+    int64_t deadline = IpcFrame::nowMs() - Config::getInstance()->handshake_seconds * 1000;
+    while(!that->pendingConnections.empty() && that->pendingConnections.front()->acceptedMs <= deadline)
     {
-        that->StopListen();
+        that->handshakesTimedOut++;
+        that->closePending(that->pendingConnections.front());
+    }
+}
 
+void GameServer::SendMetrics()
+{
+    //the counters of the logs restart every time, the metrics keep the totals
+    MetricsSnapshot& metrics = Metrics::getInstance()->counters;
+    metrics.pid = getpid();
+    metrics.connectionsRefused[MetricsSnapshot::REFUSED_HANDSHAKE_TIMEOUT] += handshakesTimedOut;
+    metrics.connectionsRefused[MetricsSnapshot::REFUSED_HANDSHAKE_INVALID] += handshakesInvalid;
+    metrics.connectionsRefused[MetricsSnapshot::REFUSED_HANDSHAKE_EVICTED] += handshakesEvicted;
+    metrics.connectionsRefused[MetricsSnapshot::REFUSED_FULL] += handshakesRefusedFull;
+    metrics.observersDropped += observersDropped;
+    metrics.duelistsTimedOut += duelistsTimedOut;
+    metrics.dbLatency = MySqlWrapper::getInstance()->getLatency();
+
+    metrics.connectionsOpen = users.size();
+    metrics.connectionsPending = pendingConnections.size();
+    memset(metrics.players, 0, sizeof(metrics.players));
+    memset(metrics.queuedBytes, 0, sizeof(metrics.queuedBytes));
+    memset(metrics.queuedMax, 0, sizeof(metrics.queuedMax));
+    for(auto it = users.cbegin(); it != users.cend(); ++it)
+    {
+        if(it->second->loginStatus < MetricsSnapshot::LOGIN_RESULTS)
+            metrics.players[it->second->loginStatus]++;
+        //the roles of checkBacklog
+        int role = it->second->type == NETPLAYER_TYPE_OBSERVER ? 1 : 0;
+        uint64_t queued = evbuffer_get_length(bufferevent_get_output(it->first));
+        metrics.queuedBytes[role] += queued;
+        metrics.queuedMax[role] = std::max(metrics.queuedMax[role], queued);
     }
+    memset(metrics.rooms, 0, sizeof(metrics.rooms));
+    auto countRoom = [&metrics](DuelRoom* room)
+    {
+        int mode = Metrics::modeIndex(room->mode);
+        if(mode >= 0 && room->state < MetricsSnapshot::ROOM_STATES)
+            metrics.rooms[room->state][mode]++;
+    };
+    for(auto room : roomManager.elencoServer)
+        countRoom(room);
+    for(auto room : roomManager.playingServer)
+        countRoom(room);
+    for(auto room : roomManager.zombieServer)
+        countRoom(room);
+    metrics.rssBytes = Metrics::readRss();
+    memset(metrics.heavyRooms, 0, sizeof(metrics.heavyRooms));
+    auto heavy = roomManager.getHeavyRooms(MetricsSnapshot::HEAVY_ROOMS);
+    for(auto room : heavy)
+    {
+        if(!room->accounting.engineNs)
+            break;
+        MetricsSnapshot::HeavyRoom entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.pid = metrics.pid;
+        entry.mode = room->mode;
+        entry.overBudget = room->accounting.overBudget;
+        entry.engineNs = room->accounting.engineNs;
+        entry.messages = room->accounting.messages;
+        entry.bytesOut[0] = room->accounting.bytesOut[RoomUsage::DUELISTS];
+        entry.bytesOut[1] = room->accounting.bytesOut[RoomUsage::OBSERVERS];
+        std::wstring names = room->getDuelistNames();
+        for(size_t i = 0; i < names.size() && i + 1 < sizeof(entry.players); i++)
+            entry.players[i] = (names[i] > 0 && names[i] < 0x80) ? (char)names[i] : '?';
+        metrics.addHeavyRoom(entry);
+    }
+
+    IpcFrame::write(manager_buf, METRICS, &metrics, sizeof(metrics));
+    ipcBytesOut += sizeof(IpcHeader) + sizeof(metrics);
+}
 
-    Statistics::getInstance()->setNumPlayers(that->getNumPlayers());
+void GameServer::LogHandshakeStats()
+{
+    if(handshakesPromoted || handshakesTimedOut || handshakesInvalid || handshakesEvicted || handshakesRefusedFull || refusedPerIp)
+        log(INFO,"pre-auth: %u logins (avg %d ms), %u timed out, %u invalid, %u evicted, %u refused when full, %u refused by the ip cap, %d pending\n",
+            handshakesPromoted,handshakesPromoted ? (int)(handshakeMsTotal/handshakesPromoted) : 0,handshakesTimedOut,
+            handshakesInvalid,handshakesEvicted,handshakesRefusedFull,refusedPerIp,(int)pendingConnections.size());
+    handshakesPromoted = handshakesTimedOut = handshakesInvalid = handshakesEvicted = handshakesRefusedFull = refusedPerIp = 0;
+    handshakeMsTotal = 0;
 }
 void GameServer::ServerAcceptError(evconnlistener* listener, void* ctx)
 {
@@ -204,25 +549,38 @@ void GameServer::ServerAcceptError(evconnlistener* listener, void* ctx)
 
 void GameServer::callChatCallback(std::wstring message,int color)
 {
-    GameServerChat gsc;
-    gsc.type = CHAT;
-    wcscpy(gsc.messaggio,message.c_str());
-    gsc.chatColor = color;
-    bufferevent_write(manager_buf,&gsc,sizeof(GameServerChat));
+    if(!chatFlushEvent)
+        return;
+    IpcFrame::appendChat(chatBatch, ChatMessage(message,color));
+    if(!event_pending(chatFlushEvent, EV_TIMEOUT, NULL))
+    {
+        timeval tick = {0, CHAT_TICK_MS * 1000};
+        event_add(chatFlushEvent, &tick);
+    }
+}
+
+void GameServer::flushChat(evutil_socket_t fd, short events, void* arg)
+{
+    GameServer *that = (GameServer*) arg;
+    if(that->chatBatch.empty())
+        return;
+    IpcFrame::write(that->manager_buf, CHAT, that->chatBatch.data(), that->chatBatch.size());
+    that->ipcBytesOut += sizeof(IpcHeader) + that->chatBatch.size();
+    that->chatBatch.clear();
 }
 
 
 DuelPlayer* GameServer::findPlayer(std::wstring nome)
 {
-    for(auto it = loggedUsers.begin(); it!=loggedUsers.end(); ++it)
-    {
-        if(it->first ==nome)
-        {
-            return (it->second);
-        }
-    }
-
-    return nullptr;
+    std::transform(nome.begin(), nome.end(), nome.begin(), ::tolower);
+    auto it = loggedUsers.find(nome);
+    if(it == loggedUsers.end())
+        return nullptr;
+#ifndef NDEBUG
+    if(wcsncmp(it->second->namew_low,nome.c_str(),19))
+        log(BUG,"loggedUsers: %Ls is indexed as %Ls\n",it->second->namew_low,nome.c_str());
+#endif
+    return it->second;
 }
 void GameServer::ServerEchoRead(bufferevent *bev, void *ctx)
 {
@@ -262,10 +620,12 @@ void GameServer::ServerEchoEvent(bufferevent* bev, short events, void* ctx)
         DuelPlayer* dp = that->users[bev];
         if(dp->netServer)
         {
-            dp->netServer->LeaveGame(dp);
+            RoomInterface* room = dp->netServer;
+            room->LeaveGame(dp);
             if(that->users.find(bev)!= that->users.end())
             {
                 log(BUG,"BUG: tcp terminated but disconnectplayer not called\n");
+                room->BugDetected("tcp closed: LeaveGame did not call DisconnectPlayer");
                 that->DisconnectPlayer(dp);
             }
 
@@ -274,6 +634,123 @@ void GameServer::ServerEchoEvent(bufferevent* bev, short events, void* ctx)
     }
 }
 
+void GameServer::setupConnection(bufferevent* bev)
+{
+    bufferevent_setcb(bev, ServerEchoRead, ServerEchoWrite, ServerEchoEvent, this);
+    //the write callback comes when the output goes down to half of the smallest limit
+    bufferevent_setwatermark(bev, EV_WRITE, Config::getInstance()->output_limit_observer / 2, 0);
+    bufferevent_enable(bev, EV_READ);
+}
+
+void GameServer::ServerEchoWrite(bufferevent* bev, void* ctx)
+{
+    GameServer* that = (GameServer*)ctx;
+    auto it = that->users.find(bev);
+    if(it == that->users.end() || !it->second->slowSince)
+        return;
+    log(VERBOSE,"%s reads again after %d s\n",it->second->ip,(int)(time(NULL) - it->second->slowSince));
+    it->second->slowSince = 0;
+}
+
+bool GameServer::checkBacklog(DuelPlayer* dp, size_t len)
+{
+    //false if the packet must not be queued
+    if(slowConsumers.find(dp->bev) != slowConsumers.end())
+        return false;
+    Config* config = Config::getInstance();
+    size_t queued = evbuffer_get_length(bufferevent_get_output(dp->bev));
+    bool observer = dp->type == NETPLAYER_TYPE_OBSERVER;
+    size_t limit = observer ? config->output_limit_observer : config->output_limit_duelist;
+    if(queued + len <= limit)
+        return true;
+
+    //an observer is not needed by the duel: it can see it again from the start
+    if(observer)
+    {
+        log(INFO,"observer %s dropped, %lu bytes queued\n",dp->ip,(unsigned long)queued);
+        observersDropped++;
+        kickSlowConsumer(dp);
+        return false;
+    }
+    //a duelist on a bad link gets the grace time, the buffer is bounded anyway
+    time_t now = time(NULL);
+    if(!dp->slowSince)
+    {
+        dp->slowSince = now;
+        log(INFO,"duelist %s is not reading, %lu bytes queued\n",dp->ip,(unsigned long)queued);
+        if(dp->netServer)
+            dp->netServer->SystemChatToPlayer(dp, L"Your connection is too slow, you will be disconnected if it does not recover", true);
+        return true;
+    }
+    if(now - dp->slowSince > config->output_grace_seconds || queued > 4 * limit)
+    {
+        log(INFO,"duelist %s timed out, %lu bytes queued for %d s\n",dp->ip,(unsigned long)queued,(int)(now - dp->slowSince));
+        duelistsTimedOut++;
+        kickSlowConsumer(dp);
+        return false;
+    }
+    return true;
+}
+
+void GameServer::kickSlowConsumer(DuelPlayer* dp)
+{
+    //not from here: the room that is writing would lose the player in the middle of a loop
+    slowConsumers.insert(dp->bev);
+    if(kickScheduled)
+        return;
+    kickScheduled = true;
+    timeval now = {0, 0};
+    event_base_once(net_evbase, -1, EV_TIMEOUT, kickSlowConsumers, this, &now);
+}
+
+void GameServer::kickSlowConsumers(evutil_socket_t fd, short events, void* arg)
+{
+    GameServer* that = (GameServer*)arg;
+    that->kickScheduled = false;
+    //every write to them is refused until they are gone
+    while(!that->slowConsumers.empty())
+    {
+        bufferevent* bev = *that->slowConsumers.begin();
+        auto it = that->users.find(bev);
+        if(it != that->users.end())
+        {
+            //like a closed connection
+            DuelPlayer* dp = it->second;
+            if(dp->netServer)
+                dp->netServer->LeaveGame(dp);
+            if(that->users.find(bev) != that->users.end())
+                that->DisconnectPlayer(dp);
+        }
+        that->slowConsumers.erase(bev);
+    }
+}
+
+void GameServer::LogOutputStats()
+{
+    size_t total = 0;
+    size_t worst = 0;
+    const char* worstIp = "";
+    unsigned int slow = 0;
+    for(auto it = users.cbegin(); it != users.cend(); ++it)
+    {
+        size_t queued = evbuffer_get_length(bufferevent_get_output(it->first));
+        total += queued;
+        if(queued > worst)
+        {
+            worst = queued;
+            worstIp = it->second->ip;
+        }
+        if(it->second->slowSince)
+            slow++;
+        if(queued > (size_t)Config::getInstance()->output_limit_observer / 2)
+            log(VERBOSE,"output: %s has %lu bytes queued\n",it->second->ip,(unsigned long)queued);
+    }
+    if(total || observersDropped || duelistsTimedOut)
+        log(INFO,"output: %lu bytes queued, max %lu (%s), %u slow duelists, %u observers dropped, %u duelists timed out\n",
+            (unsigned long)total,(unsigned long)worst,worstIp,slow,observersDropped,duelistsTimedOut);
+    observersDropped = duelistsTimedOut = 0;
+}
+
 void GameServer::RestartListen()
 {
     if(!isListening && !needsReboot)
@@ -284,6 +761,324 @@ void GameServer::RestartListen()
 }
 
 
+//what is still queued for the client is written now, half a packet in the buffers would be lost
+static bool isQuiet(DuelPlayer* dp)
+{
+    evbuffer* output = bufferevent_get_output(dp->bev);
+    if(evbuffer_get_length(output))
+        evbuffer_write(output, bufferevent_getfd(dp->bev));
+    return !evbuffer_get_length(bufferevent_get_input(dp->bev)) && !evbuffer_get_length(output);
+}
+
+static void fillHandoff(HandoffPlayer& hp, DuelPlayer* dp, uint32_t kind)
+{
+    memset(&hp, 0, sizeof(hp));
+    hp.kind = kind;
+    memcpy(hp.name, dp->name, sizeof(hp.name));
+    hp.cachedRankScore = dp->cachedRankScore;
+    hp.cachedGameScore = dp->cachedGameScore;
+    hp.lflist = dp->lflist;
+    hp.color = dp->color;
+    hp.loginStatus = dp->loginStatus;
+    strncpy(hp.ip, dp->ip, sizeof(hp.ip) - 1);
+    strncpy(hp.countryCode, dp->countryCode.c_str(), sizeof(hp.countryCode) - 1);
+    hp.type = dp->type;
+    hp.state = dp->state;
+}
+
+void GameServer::HandOver(const std::string& path)
+{
+    int64_t start = IpcFrame::nowMs();
+    //the port belongs to the new binary or to the brothers.
+    //Called again with the stats: the players back from a duel and the duels that were busy follow the others
+    upgradePath = path;
+    StopServer();
+    needsReboot = true;
+    if(listener != nullptr)
+    {
+        evconnlistener_free(listener);
+        listener = nullptr;
+    }
+    StopHandoff();
+
+    std::vector<DuelPlayer*> idle = roomManager.getIdlePlayers();
+    std::vector<DuelRoom*> duels(roomManager.playingServer.begin(), roomManager.playingServer.end());
+    if(idle.empty() && duels.empty())
+        return;
+    int sock = HotUpgrade::connect(path);
+    if(sock < 0)
+        return;
+    unsigned int moved = 0;
+    unsigned int movedDuels = 0;
+    for(auto it = idle.cbegin(); it != idle.cend(); ++it)
+    {
+        DuelPlayer* dp = *it;
+        if(!isQuiet(dp))
+            continue;
+        HandoffPlayer hp;
+        fillHandoff(hp, dp, HANDOFF_PLAYER);
+        if(!HotUpgrade::sendFd(sock, bufferevent_getfd(dp->bev), &hp, sizeof(hp)))
+        {
+            log(WARN,"handover: cannot send the players: %s\n",strerror(errno));
+            break;
+        }
+        moved++;
+        //the socket is not registered here anymore, closing our copy does not close the connection
+        bufferevent_disable(dp->bev, EV_READ|EV_WRITE);
+        dp->netServer->ExtractPlayer(dp);
+        DisconnectPlayer(dp);
+    }
+    for(auto it = duels.cbegin(); it != duels.cend(); ++it)
+        if(MoveDuel(sock, *it))
+            movedDuels++;
+    close(sock);
+    log(INFO,"handover: %u idle players and %u duels moved in %d ms, %u players and %u duels kept, %d players left\n",
+        moved,movedDuels,(int)(IpcFrame::nowMs() - start),(unsigned int)idle.size() - moved,
+        (unsigned int)duels.size() - movedDuels,getNumPlayers());
+}
+
+bool GameServer::MoveDuel(int sock, DuelRoom* room)
+{
+    //false if the duel stays here: it is not waiting for a response, or it cannot be sent
+    std::string snapshot;
+    std::vector<DuelPlayer*> members;
+    if(!room->Snapshot(snapshot, members))
+        return false;
+    //the players of the duel travel in one message with their sockets
+    if(members.size() > HotUpgrade::MAX_FDS)
+        return false;
+    for(auto it = members.cbegin(); it != members.cend(); ++it)
+        if(!isQuiet(*it))
+            return false;
+
+    HandoffDuel hd;
+    memset(&hd, 0, sizeof(hd));
+    hd.kind = HANDOFF_DUEL;
+    hd.mode = room->mode;
+    hd.lflist = room->getLfList();
+    hd.length = snapshot.size();
+    hd.members = members.size();
+    if(!HotUpgrade::sendFd(sock, -1, &hd, sizeof(hd)))
+        return false;
+    uint32_t kind = HANDOFF_DUEL_DATA;
+    for(size_t pos = 0; pos < snapshot.size(); pos += HotUpgrade::MAX_CHUNK)
+    {
+        std::string chunk((const char*)&kind, sizeof(kind));
+        chunk.append(snapshot, pos, HotUpgrade::MAX_CHUNK);
+        if(!HotUpgrade::sendFd(sock, -1, chunk.data(), chunk.size()))
+            return false;
+    }
+
+    //one message: the receiver gets all the players or none, and on failure the duel goes on here
+    kind = HANDOFF_DUELISTS;
+    std::string duelists((const char*)&kind, sizeof(kind));
+    std::vector<int> fds;
+    for(auto it = members.cbegin(); it != members.cend(); ++it)
+    {
+        HandoffPlayer hp;
+        fillHandoff(hp, *it, HANDOFF_DUELISTS);
+        duelists.append((const char*)&hp, sizeof(hp));
+        fds.push_back(bufferevent_getfd((*it)->bev));
+    }
+    if(!HotUpgrade::sendFds(sock, fds, duelists.data(), duelists.size()))
+    {
+        log(WARN,"handover: cannot send the players of a duel, it stays here: %s\n",strerror(errno));
+        return false;
+    }
+    for(auto it = members.cbegin(); it != members.cend(); ++it)
+        bufferevent_disable((*it)->bev, EV_READ|EV_WRITE);
+    room->Release();
+    return true;
+}
+
+void GameServer::StopHandoff()
+{
+    if(handoffListener != nullptr)
+    {
+        evconnlistener_free(handoffListener);
+        handoffListener = nullptr;
+    }
+}
+
+void GameServer::HandoffAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx)
+{
+    GameServer* that = (GameServer*)ctx;
+    event* ev = event_new(that->net_evbase, fd, EV_READ | EV_PERSIST, HandoffRead, that);
+    event_add(ev, NULL);
+    that->handoffConnections[fd] = ev;
+    that->handoffReceived = 0;
+    that->duelsReceived = 0;
+}
+
+void GameServer::HandoffRead(evutil_socket_t fd, short events, void* arg)
+{
+    GameServer* that = (GameServer*)arg;
+    char buffer[sizeof(uint32_t) + HotUpgrade::MAX_CHUNK];
+    while(true)
+    {
+        std::vector<int> fds;
+        int len = HotUpgrade::recvFds(fd, fds, buffer, sizeof(buffer));
+        if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if(len <= 0)
+        {
+            log(INFO,"handover: %u players and %u duels received\n",that->handoffReceived,that->duelsReceived);
+            that->closeHandoff(fd);
+            return;
+        }
+        if(!that->handleHandoff(fd, buffer, len, fds) && !fds.empty())
+        {
+            log(WARN,"handover: %u players refused, the connections are closed\n",(unsigned int)fds.size());
+            for(size_t i = 0; i < fds.size(); i++)
+                evutil_closesocket(fds[i]);
+        }
+    }
+}
+
+bool GameServer::handleHandoff(evutil_socket_t fd, const char* data, int len, const std::vector<int>& fds)
+{
+    uint32_t kind = ~0u;
+    if(len >= (int)sizeof(kind))
+        memcpy(&kind, data, sizeof(kind));
+    PendingDuel& pending = pendingDuels[fd];
+    int player_fd = fds.size() == 1 ? fds[0] : -1;
+    if(kind == HANDOFF_PLAYER && len == sizeof(HandoffPlayer) && player_fd >= 0)
+    {
+        HandoffPlayer hp;
+        memcpy(&hp, data, sizeof(hp));
+        DuelPlayer* dp = AdoptPlayer(hp, player_fd);
+        if(dp == nullptr)
+            return false;
+        //the client is already in a room: it accepts a new JOIN_GAME like after a duel
+        roomManager.InsertPlayerInWaitingRoom(dp);
+        handoffReceived++;
+        return true;
+    }
+    if(kind == HANDOFF_DUEL && len == sizeof(HandoffDuel))
+    {
+        dropPendingDuel(fd);
+        memcpy(&pending.header, data, sizeof(HandoffDuel));
+        pending.active = true;
+        return false;
+    }
+    if(kind == HANDOFF_DUEL_DATA && pending.active)
+    {
+        pending.snapshot.append(data + sizeof(kind), len - sizeof(kind));
+        if(pending.snapshot.size() > pending.header.length)
+            dropPendingDuel(fd);
+        return false;
+    }
+    if(kind == HANDOFF_DUELISTS && pending.active && !fds.empty() && fds.size() == pending.header.members &&
+            len == (int)(sizeof(kind) + fds.size() * sizeof(HandoffPlayer)))
+    {
+        for(size_t i = 0; i < fds.size(); i++)
+        {
+            HandoffPlayer hp;
+            memcpy(&hp, data + sizeof(kind) + i * sizeof(hp), sizeof(hp));
+            DuelPlayer* dp = AdoptPlayer(hp, fds[i]);
+            if(dp == nullptr)
+            {
+                //the adopted ones are disconnected with the duel, the others are closed here
+                for(size_t j = i; j < fds.size(); j++)
+                    evutil_closesocket(fds[j]);
+                dropPendingDuel(fd);
+                return true;
+            }
+            pending.members.push_back(dp);
+        }
+        ResumeDuel(fd);
+        return true;
+    }
+    log(BUG,"handover: unexpected message %u, %d bytes\n",kind,len);
+    return false;
+}
+
+void GameServer::ResumeDuel(evutil_socket_t fd)
+{
+    PendingDuel& pending = pendingDuels[fd];
+    DuelRoom* room = nullptr;
+    if(pending.snapshot.size() == pending.header.length)
+        room = roomManager.createServer(pending.header.mode);
+    if(room == nullptr || !room->Resume(pending.snapshot, pending.members, pending.header.lflist))
+    {
+        //Resume disconnects the members it took and leaves the room to removeDeadRooms
+        log(WARN,"handover: the duel cannot be rebuilt, %u players disconnected\n",(unsigned int)pending.members.size());
+        if(room == nullptr)
+        {
+            dropPendingDuel(fd);
+            return;
+        }
+    }
+    else
+    {
+        handoffReceived += pending.members.size();
+        duelsReceived++;
+    }
+    pending = PendingDuel();
+}
+
+void GameServer::dropPendingDuel(evutil_socket_t fd)
+{
+    PendingDuel& pending = pendingDuels[fd];
+    for(auto it = pending.members.cbegin(); it != pending.members.cend(); ++it)
+        DisconnectPlayer(*it);
+    pending = PendingDuel();
+}
+
+void GameServer::closeHandoff(evutil_socket_t fd)
+{
+    auto it = handoffConnections.find(fd);
+    if(it == handoffConnections.end())
+        return;
+    dropPendingDuel(fd);
+    pendingDuels.erase(fd);
+    event_free(it->second);
+    evutil_closesocket(fd);
+    handoffConnections.erase(it);
+}
+
+DuelPlayer* GameServer::AdoptPlayer(const HandoffPlayer& hp, int fd)
+{
+    //the player is connected, in no room
+    if(needsReboot)
+        return nullptr;
+    evutil_make_socket_nonblocking(fd);
+    bufferevent* bev = bufferevent_socket_new(net_evbase, fd, BEV_OPT_CLOSE_ON_FREE);
+    DuelPlayer *dp = new DuelPlayer;
+    memcpy(dp->name, hp.name, sizeof(dp->name));
+    dp->name[19] = 0;
+    dp->type = hp.type;
+    dp->state = hp.state;
+    dp->bev = bev;
+    dp->netServer = 0;
+    dp->loginStatus = (Users::LoginResult)hp.loginStatus;
+    dp->cachedRankScore = hp.cachedRankScore;
+    dp->cachedGameScore = hp.cachedGameScore;
+    dp->lflist = hp.lflist;
+    dp->color = hp.color;
+    memcpy(dp->ip, hp.ip, sizeof(dp->ip));
+    dp->ip[INET_ADDRSTRLEN - 1] = 0;
+    dp->countryCode.assign(hp.countryCode, strnlen(hp.countryCode, sizeof(hp.countryCode)));
+    //already connected: counted even over the cap
+    addConnection(dp->ip, false);
+
+    wchar_t nome[25];
+    BufferIO::CopyWStr(dp->name,nome,20);
+    std::wstring nomes(nome);
+    std::transform(nomes.begin(), nomes.end(), nomes.begin(), ::tolower);
+    BufferIO::CopyWStr(nomes.c_str(),dp->namew_low,20);
+
+    users[bev] = dp;
+    setupConnection(bev);
+    if(dp->loginStatus == Users::LoginResult::NOPASSWORD || dp->loginStatus == Users::LoginResult::AUTHENTICATED)
+        loggedUsers[nomes] = dp;
+    //over the limit if needed: the players are already connected, the father spawns another gameserver
+    if(users.size() >= MAXPLAYERS && isListening)
+        StopListen();
+    Statistics::getInstance()->setNumPlayers(getNumPlayers());
+    return dp;
+}
+
 void GameServer::keepAlive(evutil_socket_t fd, short events, void* arg)
 {
     GameServer*that = (GameServer*) arg;
@@ -298,9 +1093,36 @@ void GameServer::sendStats(evutil_socket_t fd, short events, void* arg)
     GameServerStats gss;
     gss.rooms = Statistics::getInstance()->getNumRooms();
     gss.players = Statistics::getInstance()->getNumPlayers();
+    gss.duels = that->roomManager.playingServer.size();
     gss.isAlive = that->listener != nullptr && !needsReboot;
-    gss.type = STATS;
-    bufferevent_write(that->manager_buf, &gss,sizeof(GameServerStats));
+    IpcFrame::write(that->manager_buf, STATS, &gss, sizeof(GameServerStats));
+    that->ipcBytesOut += sizeof(IpcHeader) + sizeof(GameServerStats);
+    std::string ranks;
+    if(RankIndex::getInstance()->takeUpdates(ranks))
+    {
+        IpcFrame::write(that->manager_buf, RANK_UPDATE, ranks.data(), ranks.size());
+        that->ipcBytesOut += sizeof(IpcHeader) + ranks.size();
+    }
+    if(that->chatReceived)
+    {
+        log(INFO,"chat bus: %u messages, latency avg %d ms max %d ms, ipc bytes in %lu out %lu\n",
+            that->chatReceived,(int)(that->chatLatencyTotal/that->chatReceived),(int)that->chatLatencyMax,
+            that->ipcBytesIn,that->ipcBytesOut);
+        that->chatReceived = 0;
+        that->chatLatencyTotal = that->chatLatencyMax = 0;
+    }
+    that->SendMetrics();
+    that->LogOutputStats();
+    that->LogHandshakeStats();
+    ObjectPoolBase::TrimAll();
+    ObjectPoolBase::LogStats();
+    RateLimiter::getInstance()->LogStats();
+    MySqlWrapper::getInstance()->LogStats();
+    Users::getInstance()->LogStats();
+    log(VERBOSE,"chat packets: %lu encoded, %lu sent\n",ChatPacket::encoded,ChatPacket::sent);
+    log(VERBOSE,"spectator relay: %lu packets published, %lu blocks written\n",SpectatorRelay::published,SpectatorRelay::relayed);
+    if(FlightRecorder::dumps || FlightRecorder::suppressed)
+        log(INFO,"flight recorder: %lu rooms written, %lu suppressed\n",FlightRecorder::dumps,FlightRecorder::suppressed);
 
     if(!gss.isAlive && !that->getNumPlayers())
         event_base_loopbreak(that->net_evbase);
@@ -310,6 +1132,10 @@ void GameServer::sendStats(evutil_socket_t fd, short events, void* arg)
 		that->listener = nullptr;
 	
 	}
+    if(needsReboot)
+        that->StopHandoff();
+    if(!that->upgradePath.empty())
+        that->HandOver(that->upgradePath);
 }
 
 
@@ -326,6 +1152,11 @@ int GameServer::ServerThread(void* parama)
     timeval statstimeout = {5, 0};
     event_add(statsEvent, &statstimeout);
 
+    that->handshakeEvent = event_new(that->net_evbase, 0, EV_TIMEOUT | EV_PERSIST, handshakeTimeout, that);
+    timeval handshaketimeout = {1, 0};
+    event_add(that->handshakeEvent, &handshaketimeout);
+    Metrics::getInstance()->StartLagProbe(that->net_evbase);
+
     /*event* cicle_injected = event_new(that->net_evbase, 0, EV_TIMEOUT | EV_PERSIST, checkInjectedMessages_cb, parama);
     timeval timeout2 = {0, 200000};
     event_add(cicle_injected, &timeout2);
@@ -340,6 +1171,16 @@ int GameServer::ServerThread(void* parama)
 	}
     event_free(keepAliveEvent);
     event_free(statsEvent);
+    event_free(that->handshakeEvent);
+    that->handshakeEvent = nullptr;
+    Metrics::getInstance()->StopLagProbe();
+    while(!that->pendingConnections.empty())
+        that->closePending(that->pendingConnections.front());
+    event_free(that->chatFlushEvent);
+    that->chatFlushEvent = nullptr;
+    that->StopHandoff();
+    while(!that->handoffConnections.empty())
+        that->closeHandoff(that->handoffConnections.begin()->first);
     //event_free(cicle_injected);
     event_base_free(that->net_evbase);
     that->net_evbase = 0;
@@ -385,6 +1226,8 @@ void GameServer::DisconnectPlayer(DuelPlayer* dp)
         }
 
         dp->netServer=NULL;
+        slowConsumers.erase(dp->bev);
+        releaseConnection(dp->ip);
         bufferevent_flush(dp->bev, EV_WRITE, BEV_FLUSH);
         bufferevent_disable(dp->bev, EV_READ);
         bufferevent_free(dp->bev);
@@ -399,12 +1242,32 @@ void GameServer::DisconnectPlayer(DuelPlayer* dp)
     Statistics::getInstance()->setNumPlayers(users.size());
 }
 
+void GameServer::accountOutput(DuelPlayer* dp, size_t len, unsigned int packets)
+{
+    dp->bytesOut += len;
+    dp->packetsOut += packets;
+    RoomUsage* usage = dp->netServer ? dp->netServer->usage : nullptr;
+    if(usage == nullptr)
+        return;
+    int recipient = (dp->type == NETPLAYER_TYPE_OBSERVER) ? RoomUsage::OBSERVERS : RoomUsage::DUELISTS;
+    usage->bytesOut[recipient] += len;
+    Metrics::getInstance()->counters.roomBytes[recipient] += len;
+}
+
 void GameServer::safe_bufferevent_write(DuelPlayer* dp, void* buffer, size_t len)
 {
 	bufferevent* bev = dp->bev;
 	
 	if(users.find(dp->bev) != users.end() && users[bev] == dp)
-		bufferevent_write(dp->bev, buffer, len);
+	{
+		if(checkBacklog(dp, len))
+		{
+			bufferevent_write(dp->bev, buffer, len);
+			if(len >= 3)
+				Metrics::getInstance()->packetOut(((unsigned char*)buffer)[2], len);
+			accountOutput(dp, len, 1);
+		}
+	}
 	else
 	{
 		printf("MEGABUG, bufferevent per un utente inesistente\n");
@@ -413,10 +1276,56 @@ void GameServer::safe_bufferevent_write(DuelPlayer* dp, void* buffer, size_t len
 	
 }
 
+void GameServer::safe_bufferevent_write(DuelPlayer* dp, ChatPacket* packet)
+{
+	bufferevent* bev = dp->bev;
+
+	if(users.find(dp->bev) != users.end() && users[bev] == dp)
+	{
+		if(checkBacklog(dp, packet->size()))
+		{
+			packet->sendTo(bev);
+			Metrics::getInstance()->packetOut(STOC_CHAT, packet->size());
+			accountOutput(dp, packet->size(), 1);
+		}
+	}
+	else
+	{
+		printf("MEGABUG, bufferevent per un utente inesistente\n");
+		print_trace();
+	}
+
+}
+
+void GameServer::safe_bufferevent_write(DuelPlayer* dp, RelayBlock* block, size_t offset, size_t len)
+{
+	bufferevent* bev = dp->bev;
+
+	if(users.find(dp->bev) != users.end() && users[bev] == dp)
+	{
+		if(checkBacklog(dp, len))
+		{
+			block->sendTo(bev, offset, len);
+			Metrics::getInstance()->counters.relayBytes += len;
+			//a piece of the stream holds many packets, only the bytes are counted
+			accountOutput(dp, len, 0);
+		}
+	}
+	else
+	{
+		printf("MEGABUG, bufferevent per un utente inesistente\n");
+		print_trace();
+	}
+
+}
+
 void GameServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
 {
     char* pdata = data;
     unsigned char pktType = BufferIO::ReadUInt8(pdata);
+    Metrics::getInstance()->packetIn(pktType, len + 2);
+    dp->packetsIn++;
+    dp->bytesIn += len + 2;
 
     if(dp->loginStatus == Users::LoginResult::NOTENTERED || dp->loginStatus == Users::LoginResult::WAITINGJOIN)
     {
@@ -439,24 +1348,31 @@ void GameServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
             if(passc > 0 && strchr(loginstring,'$') == nullptr)
                 ;//loginstring[c1] = '$';
 
+            int64_t loginStart = IpcFrame::nowMs();
             auto result = Users::getInstance()->login(std::string(loginstring),dp->ip);
 
             BufferIO::CopyWStr(result.first.c_str(), dp->name, 20);
             dp->loginStatus = result.second;
             dp->color = result.color;
+            Metrics::getInstance()->counters.logins++;
 
             auto score = Users::getInstance()->getFullScore(result.first);
             dp->cachedRankScore = score.first;
             dp->cachedGameScore = score.second;
+            //the login runs on the network thread: a slow database stops every room
+            int64_t loginTime = IpcFrame::nowMs() - loginStart;
+            if(loginTime > 100)
+                log(WARN,"login of %s blocked the event loop for %ld ms\n",loginstring,(long)loginTime);
+
+            wchar_t nome[25];
+            BufferIO::CopyWStr(dp->name,nome,20);
+            std::wstring nomes(nome);
+            std::transform(nomes.begin(), nomes.end(), nomes.begin(), ::tolower);
+            //the rooms index the players by namew_low, it must be set before the insertion
+            BufferIO::CopyWStr(nomes.c_str(),dp->namew_low,20);
 
             if(roomManager.InsertPlayerInWaitingRoom(dp))
             {
-                wchar_t nome[25];
-                BufferIO::CopyWStr(dp->name,nome,20);
-                std::wstring nomes(nome);
-                std::transform(nomes.begin(), nomes.end(), nomes.begin(), ::tolower);
-                BufferIO::CopyWStr(nomes.c_str(),dp->namew_low,20);
-
                 if(dp->loginStatus == Users::LoginResult::NOPASSWORD || dp->loginStatus == Users::LoginResult::AUTHENTICATED)
                 {
                     loggedUsers[nomes] = dp;
@@ -472,9 +1388,10 @@ void GameServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
             bufferevent_flush(dp->bev, EV_WRITE, BEV_FLUSH);
 
         }
-        else if(!strncmp(data,"ipchange",8))
+        else if(len >= 12 && !strncmp(data,"ipchange",8))
         {
-            inet_ntop(AF_INET, &data[8], dp->ip, INET_ADDRSTRLEN);
+            //already connected: counted even over the cap
+            changeIp(dp->ip, data, false);
         }
         else
         {
@@ -7,30 +7,27 @@
 #include "deck_manager.h"
 #include <set>
 #include <unordered_map>
+#include <list>
 #include "RoomManager.h"
 
 #include "DuelRoom.h"
+#include "IpcFrame.h"
+#include "HotUpgrade.h"
+#include "SpectatorRelay.h"
 namespace ygo
 {
 
-enum MessageType{STATS,CHAT};
+//payload of the STATS frames
 struct GameServerStats
 {
-    MessageType type;
     int pid;
     int rooms;
     int players;
+    int duels;
     bool isAlive;
     GameServerStats();
 };
 
-struct GameServerChat
-{
-    MessageType type;
-    int chatColor;
-    wchar_t messaggio[260];
-};
-
 
 
 
@@ -41,7 +38,7 @@ private:
     struct bufferevent * manager_buf;
     int MAXPLAYERS;
     std::map<bufferevent*, DuelPlayer *> users;
-    std::map<std::wstring,DuelPlayer*> loggedUsers;
+    std::unordered_map<std::wstring,DuelPlayer*> loggedUsers;
 
 
     evconnlistener* listener;
@@ -52,10 +49,103 @@ private:
     volatile bool isAlive;
     static void keepAlive(evutil_socket_t fd, short events, void* arg);
     static void sendStats(evutil_socket_t fd, short events, void* arg);
+
+    /* chat bus: the messages of a tick are sent to the father in a single frame */
+    static const int CHAT_TICK_MS = 50;
+    std::string chatBatch;
+    event* chatFlushEvent;
+    static void flushChat(evutil_socket_t fd, short events, void* arg);
+    void handleManagerFrame(IpcHeader& header, const char* payload);
+    void ConfigReloaded();
+    unsigned long ipcBytesIn;
+    unsigned long ipcBytesOut;
+    unsigned int chatReceived;
+    int64_t chatLatencyTotal;
+    int64_t chatLatencyMax;
     //static int CheckAliveThread(void* parama);
     void RestartListen();
     bool isListening;
 
+    /* hot upgrade and drain: the idle players and the duels received from another gameserver */
+    struct PendingDuel
+    {
+        bool active;
+        HandoffDuel header;
+        std::string snapshot;
+        std::vector<DuelPlayer*> members;
+        PendingDuel():active(false) {}
+    };
+    evconnlistener* handoffListener;
+    std::map<evutil_socket_t,event*> handoffConnections;
+    std::map<evutil_socket_t,PendingDuel> pendingDuels;
+    unsigned int handoffReceived;
+    unsigned int duelsReceived;
+    std::string upgradePath;
+    static void HandoffAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx);
+    static void HandoffRead(evutil_socket_t fd, short events, void* arg);
+    //false if the descriptors were not taken
+    bool handleHandoff(evutil_socket_t fd, const char* data, int len, const std::vector<int>& fds);
+    void closeHandoff(evutil_socket_t fd);
+    void dropPendingDuel(evutil_socket_t fd);
+    void ResumeDuel(evutil_socket_t fd);
+    void StopHandoff();
+    DuelPlayer* AdoptPlayer(const HandoffPlayer& hp, int fd);
+    void HandOver(const std::string& path);
+    bool MoveDuel(int sock, DuelRoom* room);
+
+    /* slow consumers: clients that do not read what the duel sends them */
+    std::set<bufferevent*> slowConsumers;
+    bool kickScheduled;
+    unsigned int observersDropped;
+    unsigned int duelistsTimedOut;
+    bool checkBacklog(DuelPlayer* dp, size_t len);
+    void kickSlowConsumer(DuelPlayer* dp);
+    static void kickSlowConsumers(evutil_socket_t fd, short events, void* arg);
+    static void ServerEchoWrite(bufferevent* bev, void* ctx);
+    //the totals of the player and of its duel room
+    void accountOutput(DuelPlayer* dp, size_t len, unsigned int packets);
+    void setupConnection(bufferevent* bev);
+    void LogOutputStats();
+
+    /* pre-auth: a connection becomes a DuelPlayer only when it sends the login */
+    struct PendingConnection
+    {
+        GameServer* server;
+        bufferevent* bev;
+        char ip[INET_ADDRSTRLEN];
+        int64_t acceptedMs;
+        uint16_t name[20];
+        std::list<PendingConnection*>::iterator position;
+        DECLARE_POOLED_NEW(PendingConnection)
+    };
+    static const unsigned short MAX_HANDSHAKE_PACKET = 256;
+    //oldest first: the deadlines expire in order
+    std::list<PendingConnection*> pendingConnections;
+    event* handshakeEvent;
+    unsigned int handshakesPromoted;
+    unsigned int handshakesTimedOut;
+    unsigned int handshakesInvalid;
+    unsigned int handshakesEvicted;
+    unsigned int handshakesRefusedFull;
+    unsigned int refusedPerIp;
+    int64_t handshakeMsTotal;
+    static bool isProxy(const char* ip);
+    //the rate limiter and the cap, false if the connection must be closed
+    bool admitIp(const char* ip);
+    bool addConnection(const char* ip, bool capped = true);
+    void releaseConnection(const char* ip);
+    //ipchange of the proxy: the count moves to the real ip, false if its cap refuses it
+    bool changeIp(char* ip, const char* packet, bool capped);
+    void closePending(PendingConnection* pc, bool counted = true);
+    void refuseFull(PendingConnection* pc);
+    DuelPlayer* PromoteConnection(PendingConnection* pc);
+    static void PendingRead(bufferevent* bev, void* ctx);
+    static void PendingEvent(bufferevent* bev, short events, void* ctx);
+    static void handshakeTimeout(evutil_socket_t fd, short events, void* arg);
+    void LogHandshakeStats();
+    //the snapshot for /metrics, with the stats
+    void SendMetrics();
+
 
     bool dispatchPM(std::wstring,std::wstring);
 
@@ -70,7 +160,7 @@ public:
     RoomManager roomManager;
     GameServer();
     ~GameServer();
-    bool StartServer(int,int);
+    bool StartServer(int,int,int);
     void StopServer();
     void StopListen();
     static void ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx);
@@ -87,6 +177,8 @@ public:
 
     bool sendPM(std::wstring,std::wstring);
 	void safe_bufferevent_write(DuelPlayer* dp, void* buffer, size_t len);
+	void safe_bufferevent_write(DuelPlayer* dp, ChatPacket* packet);
+	void safe_bufferevent_write(DuelPlayer* dp, RelayBlock* block, size_t offset, size_t len);
 
 };
 
@@ -6,9 +6,15 @@
 #include "debug.h"
 #include "Statistics.h"
 #include <time.h>
+#include <errno.h>
+#include <string.h>
 
 #include "ExternalChat.h"
 #include "MySqlWrapper.h"
+#include "RateLimiter.h"
+#include "RankIndex.h"
+#include "HotUpgrade.h"
+#include "Metrics.h"
 using namespace std;
 namespace ygo
 {
@@ -34,28 +40,14 @@ void sigterm_handler(int signum)
         kill(getpid(),SIGTERM);
 }
 
-GameServerStats::GameServerStats(): rooms(0),players(0)
+void sighup_handler(int signum)
 {
-    pid = getpid();
+    Config::reloadRequested = 1;
 }
 
-bool GameserversManager::serversAlmostFull()
-{
-    int threeshold = Config::getInstance()->max_users_per_process/10;
-    threeshold = max(threeshold,1);
-    threeshold = min(threeshold,5);
-    log(VERBOSE,"high threeshold = %d\n",threeshold);
-    bool isAlmostFull = getNumPlayersInAliveChildren()+threeshold > getNumAliveChildren()*Config::getInstance()->max_users_per_process;
-    return isAlmostFull;
-}
-bool GameserversManager::serversAlmostEmpty()
+GameServerStats::GameServerStats(): rooms(0),players(0),duels(0)
 {
-    int threeshold = 0.5*Config::getInstance()->max_users_per_process;
-    threeshold = min(threeshold,30);
-    threeshold = max(threeshold,1);
-    log(VERBOSE,"low threeshold = %d\n",threeshold);
-    bool isAlmostEmpty = getNumPlayersInAliveChildren() <= (getNumAliveChildren()-1) * Config::getInstance()->max_users_per_process -threeshold;
-    return isAlmostEmpty;
+    pid = getpid();
 }
 
 int GameserversManager::getNumAliveChildren()
@@ -84,8 +76,9 @@ void GameserversManager::ShowStats()
         last_showstats = time(NULL);
         for(auto it = children.cbegin(); it != children.cend(); ++it)
         {
-            ChildInfo gss = it->second;
-            printf("pid: %5d, rooms: %3d, users %3d",gss.pid,gss.rooms,gss.players);
+            const ChildInfo& gss = it->second;
+            printf("pid: %5d, rooms: %3d, users %3d, ipc in %lu out %lu queued %d",gss.pid,gss.rooms,gss.players,
+                   gss.bytesIn,gss.bytesOut,(int)gss.outBuf.size());
             if(!it->second.isAlive)
                 printf("  *dying*");
             printf("\n");
@@ -93,6 +86,7 @@ void GameserversManager::ShowStats()
         }
         printf("children: %2d, alive %2d, rooms: %3d, players alive:%3d, players: %3d\n",
                (int)children.size(),getNumAliveChildren(),getNumRooms(),getNumPlayersInAliveChildren(),getNumPlayers());
+        MySqlWrapper::getInstance()->LogStats();
         for(auto it = children.cbegin(); it != children.cend(); ++it)
         {
             ChildInfo gss = it->second;
@@ -104,10 +98,12 @@ void GameserversManager::ShowStats()
     }
 }
 
-GameserversManager::GameserversManager():maxchildren(4)
+GameserversManager::GameserversManager():maxchildren(4),lastAutoscale(0),lastProfileSave(0),loadTrace(nullptr),upgrade_fd(-1),handoff_fd(-1),upgradeStart(0),chatSocket(nullptr),metricsEndpoint(nullptr)
 {
+    memset(&retiredMetrics,0,sizeof(retiredMetrics));
    // signal(SIGTERM, sigterm_handler);
     signal(SIGINT, sigterm_handler);
+    signal(SIGHUP, sighup_handler);
     prepara_segnali();
 }
 
@@ -135,7 +131,7 @@ void GameserversManager::child_loop(int receive_fd)
     ygo::GameServer* gameServer = new ygo::GameServer();
     close(0);
 
-    if(!gameServer->StartServer(server_fd,receive_fd))
+    if(!gameServer->StartServer(server_fd,receive_fd,handoff_fd))
     {
         printf("cannot start the gameserver\n");
         exit(1);
@@ -159,9 +155,7 @@ int GameserversManager::spawn_gameserver()
     int s_pair[2];
     socketpair(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0, s_pair);
 
-    MySqlWrapper::getInstance()->disconnect();
     pid = fork();
-    MySqlWrapper::getInstance()->connect();
 
     if(pid)
     {
@@ -170,6 +164,7 @@ int GameserversManager::spawn_gameserver()
         gss.pid = pid;
         gss.isAlive=true;
         gss.last_update=time(NULL);
+        gss.spawnedAt = gss.last_update;
         children[s_pair[0]] = gss;
         //gss.players=0;
         //aliveChildren.insert(pipefd[0]);
@@ -177,11 +172,23 @@ int GameserversManager::spawn_gameserver()
         return pid;
     }
 
+    MySqlWrapper::getInstance()->resetAfterFork();
+    MySqlWrapper::getInstance()->connect();
     ExternalChat::getInstance()->disconnect();
+    for(auto it = chatSources.cbegin(); it != chatSources.cend(); ++it)
+        (*it)->afterFork();
+    chatSources.clear();
+    chatSinks.clear();
+    if(metricsEndpoint != nullptr)
+        metricsEndpoint->afterFork();
+    metricsEndpoint = nullptr;
     Statistics::getInstance()->StopThread();
     Statistics::getInstance()->setNumPlayers(0);
     Statistics::getInstance()->setNumRooms(0);
     close (s_pair[0]);
+    if(upgrade_fd >= 0)
+        close(upgrade_fd);
+    upgrade_fd = -1;
     for(auto it = children.cbegin(); it != children.cend(); ++it)
         closeChild(it->first);
     children.clear();
@@ -209,67 +216,139 @@ int GameserversManager::getNumPlayers()
 bool GameserversManager::handleChildMessage(int child_fd)
 {
     //true is OK
-    byte buffer[sizeof(GameServerChat)];
-    int bytesread = read(child_fd,buffer,sizeof(MessageType));
-    if(bytesread != sizeof(MessageType))
-        return false;
-
-    MessageType type = *((MessageType *)buffer);
-
-    int remaining;
-    switch(type)
+    ChildInfo& child = children[child_fd];
+    char buffer[16384];
+    while(true)
     {
-    case STATS:
-        remaining = sizeof(GameServerStats)-sizeof(MessageType);
-        break;
-    case CHAT:
-        remaining = sizeof(GameServerChat)-sizeof(MessageType);
-        break;
-
-    default:
-        return false;
+        int bytesread = read(child_fd,buffer,sizeof(buffer));
+        if(bytesread == 0)
+            return false;
+        if(bytesread < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        child.inBuf.append(buffer,bytesread);
+        child.bytesIn += bytesread;
     }
 
-    bytesread = read(child_fd,buffer+sizeof(MessageType),remaining);
-
-    if((int)bytesread < remaining)
-        return false;
+    size_t pos = 0;
+    while(child.inBuf.size() - pos >= sizeof(IpcHeader))
+    {
+        IpcHeader header;
+        memcpy(&header,child.inBuf.data() + pos,sizeof(header));
+        if(header.length > IpcFrame::MAX_PAYLOAD)
+        {
+            log(BUG,"frame too long from the child %d: %u bytes, channel closed\n",child.pid,header.length);
+            return false;
+        }
+        if(child.inBuf.size() - pos < sizeof(header) + header.length)
+            break;
+        handleChildFrame(child_fd,header,child.inBuf.data() + pos + sizeof(header));
+        pos += sizeof(header) + header.length;
+    }
+    children[child_fd].inBuf.erase(0,pos);
+    return true;
+}
 
-    if(type == STATS)
+void GameserversManager::handleChildFrame(int child_fd,IpcHeader& header,const char* payload)
+{
+    if(header.type == STATS && header.length == sizeof(GameServerStats))
     {
-        GameServerStats* gss = (GameServerStats*)buffer;
+        GameServerStats* gss = (GameServerStats*)payload;
 
         log(VERBOSE,"il figlio ha spedito un messaggio\n");
         children[child_fd].players = gss->players;
         children[child_fd].rooms= gss->rooms;
+        children[child_fd].duels = gss->duels;
         children[child_fd].isAlive= gss->isAlive;
         children[child_fd].last_update = time(NULL);
         Statistics::getInstance()->setNumPlayers(getNumPlayers());
         Statistics::getInstance()->setNumRooms(getNumRooms());
     }
-    else if(type == CHAT)
+    else if(header.type == CHAT)
     {
-        GameServerChat* gss = (GameServerChat*)buffer;
+        std::vector<ChatMessage> messages;
+        if(!IpcFrame::parseChat(payload,header.length,messages))
+        {
+            log(BUG,"malformed chat frame from the child %d\n",children[child_fd].pid);
+            return;
+        }
 
+        //the batch is forwarded as it is, without decoding it again
+        std::string frame;
+        IpcFrame::append(frame,CHAT,payload,header.length);
         for(auto it = children.cbegin(); it != children.cend(); ++it)
         {
             if(it->first == child_fd)
                 continue;
-            write(it->first,buffer,sizeof(GameServerChat));
+            sendToChild(it->first,frame);
         }
-        ExternalChat::getInstance()->broadcastMessage((GameServerChat*) gss);
-
-        /*FILE* fp = fopen("cm-error.log", "at");
-        if(fp)
+        for(auto sink = chatSinks.cbegin(); sink != chatSinks.cend(); ++sink)
+            for(auto it = messages.cbegin(); it != messages.cend(); ++it)
+                (*sink)->publish(*it);
+    }
+    else if(header.type == METRICS && header.length == sizeof(MetricsSnapshot))
+    {
+        ChildInfo& child = children[child_fd];
+        memcpy(&child.metrics,payload,sizeof(MetricsSnapshot));
+        child.hasMetrics = true;
+    }
+    else if(header.type == RANK_UPDATE)
+    {
+        std::vector<std::pair<std::string,int>> ranks;
+        if(!IpcFrame::parseRank(payload,header.length,ranks))
         {
-            fprintf(fp, "server crashato pid: %d\n", (int) getpid());
-            fclose(fp);
-        } */
-
+            log(BUG,"malformed rank frame from the child %d\n",children[child_fd].pid);
+            return;
+        }
+        //the copy of the father is the one inherited by the next children
+        for(auto it = ranks.cbegin(); it != ranks.cend(); ++it)
+            RankIndex::getInstance()->apply(it->first,it->second);
+        std::string frame;
+        IpcFrame::append(frame,RANK_UPDATE,payload,header.length);
+        for(auto it = children.cbegin(); it != children.cend(); ++it)
+        {
+            if(it->first == child_fd)
+                continue;
+            sendToChild(it->first,frame);
+        }
+    }
+    else
+        log(WARN,"unknown message %u from the child %d\n",header.type,children[child_fd].pid);
+}
 
+void GameserversManager::sendToChild(int child_fd,const std::string& frame)
+{
+    ChildInfo& child = children[child_fd];
+    if(child.outBuf.size() + frame.size() > MAX_CHILD_QUEUE)
+    {
+        log(WARN,"the child %d is not reading, message dropped\n",child.pid);
+        return;
+    }
+    child.outBuf.append(frame);
+    flushChild(child_fd);
+}
 
+bool GameserversManager::flushChild(int child_fd)
+{
+    //never blocks: what cannot be written now stays in the queue until select says the child is writable
+    ChildInfo& child = children[child_fd];
+    while(!child.outBuf.empty())
+    {
+        int written = write(child_fd,child.outBuf.data(),child.outBuf.size());
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        child.outBuf.erase(0,written);
+        child.bytesOut += written;
     }
-    // while(1);
     return true;
 }
 
@@ -277,26 +356,63 @@ void GameserversManager::parent_loop()
 {
     maxchildren = Config::getInstance()->max_processes;
 
-
     spawn_gameserver();
 
     fd_set rfds;
+    fd_set wfds;
     Statistics::getInstance()->StartThread();
-    ExternalChat::getInstance()->connect();
-    MySqlWrapper::getInstance()->connect();
+    if(!Config::getInstance()->noExternalChat)
+    {
+        ExternalChat::getInstance()->connect();
+        chatSinks.push_back(ExternalChat::getInstance());
+        chatSources.push_back(ExternalChat::getInstance());
+    }
+    if(!Config::getInstance()->chat_socket.empty())
+    {
+        chatSocket = new ChatSocketSource(Config::getInstance()->chat_socket);
+        if(chatSocket->isOpen())
+            chatSources.push_back(chatSocket);
+    }
+    if(Config::getInstance()->metrics_port > 0)
+        metricsEndpoint = new MetricsEndpoint(Config::getInstance()->metrics_port,renderMetrics,this);
+    autoscaler.LoadProfile(Config::getInstance()->autoscale_profile);
+    lastProfileSave = time(NULL);
 
     while(true)
     {
         FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
         int max_fd=0;
         for(auto it = children.cbegin(); it != children.cend(); ++it)
         {
             max_fd = max(max_fd,it->first);
             FD_SET(it->first,&rfds);
+            if(!it->second.outBuf.empty())
+                FD_SET(it->first,&wfds);
+        }
+        if(metricsEndpoint != nullptr)
+            max_fd = max(max_fd,metricsEndpoint->prepareSelect(&rfds,&wfds));
+        for(auto it = chatSources.cbegin(); it != chatSources.cend(); ++it)
+            max_fd = max(max_fd,(*it)->prepareSelect(&rfds));
+        if(upgrade_fd >= 0)
+        {
+            FD_SET(upgrade_fd,&rfds);
+            max_fd = max(max_fd,upgrade_fd);
         }
         timeval timeout = {2, 0};
-        auto retval = select(max_fd + 1, &rfds, NULL, NULL, &timeout);
+        auto retval = select(max_fd + 1, &rfds, &wfds, NULL, &timeout);
+        if(retval <= 0)
+        {
+            FD_ZERO(&rfds);
+            FD_ZERO(&wfds);
+        }
+        if(metricsEndpoint != nullptr)
+            metricsEndpoint->handle(&rfds,&wfds);
 
+        if(upgrade_fd >= 0 && FD_ISSET(upgrade_fd,&rfds))
+            acceptUpgrade();
+        if(Config::reloadRequested)
+            reloadConfig();
         if(needsReboot && server_fd )
         {
             close(server_fd);
@@ -306,23 +422,27 @@ void GameserversManager::parent_loop()
         if(retval > 0)
         {
 
-            int child_fd = 0;
-            for(auto it = children.cbegin(); it != children.cend(); ++it)
+            std::vector<int> closed;
+            for(auto it = children.begin(); it != children.end(); ++it)
             {
-                if(FD_ISSET(it->first,&rfds))
-                {
-                    child_fd = it->first;
-                    break;
-                }
+                //a flush does not skip the read of the same round
+                bool alive = !FD_ISSET(it->first,&wfds) || flushChild(it->first);
+                if(alive && FD_ISSET(it->first,&rfds))
+                    alive = handleChildMessage(it->first);
+                if(!alive)
+                    closed.push_back(it->first);
             }
 
 
-            if(!handleChildMessage(child_fd))
+            for(int child_fd : closed)
             {
                 //il figlio ha chiuso
                 printf("figlio terminato,fd: %d, pid: %d\n",child_fd,children[child_fd].pid);
                 int status;
                 //waitpid(children[child_fd].pid,&status,WNOHANG);
+                //its connections are gone with it, also when it crashed
+                RateLimiter::getInstance()->releaseProcess(children[child_fd].pid);
+                retireChild(child_fd);
                 closeChild(child_fd);
                 children.erase(child_fd);
 
@@ -331,18 +451,29 @@ void GameserversManager::parent_loop()
 
                 if(needsReboot && children.size() == 0)
                 {
+                    if(upgradeStart)
+                        log(INFO,"upgrade: cutover completed in %d s\n",(int)((IpcFrame::nowMs() - upgradeStart)/1000));
                     printf("PADRE:figli terminati. esco\n");
                     exit(0);
                 }
             }
         }
-        std::list<GameServerChat> lista =  ExternalChat::getInstance()->getPendingMessages();
+        std::vector<ChatMessage> lista;
+        for(auto source = chatSources.cbegin(); source != chatSources.cend(); ++source)
+            (*source)->readMessages(&rfds,lista);
+        if(chatSocket != nullptr)
+            ExternalChat::getInstance()->setPushActive(chatSocket->isActive());
 
-        for(auto lit = lista.cbegin(); lit!= lista.cend(); ++lit)
+        if(!lista.empty())
+        {
+            std::string payload;
+            for(auto lit = lista.cbegin(); lit!= lista.cend(); ++lit)
+                IpcFrame::appendChat(payload,*lit);
+            std::string frame;
+            IpcFrame::append(frame,CHAT,payload.data(),payload.size());
             for(auto it = children.cbegin(); it != children.cend(); ++it)
-            {
-                write(it->first,&(*lit),sizeof(GameServerChat));
-            }
+                sendToChild(it->first,frame);
+        }
 
 
         ShowStats();
@@ -365,36 +496,92 @@ void GameserversManager::parent_loop()
 
         if(needsReboot)
             continue;
-        if(!needsReboot && serversAlmostFull() && getNumAliveChildren()<maxchildren)
+        if(now - lastAutoscale >= Autoscaler::TICK)
         {
-            spawn_gameserver();
-            printf("figli vivi %d, utenti vivi %d\n",getNumAliveChildren(),getNumPlayersInAliveChildren());
+            lastAutoscale = now;
+            autoscale(now);
         }
-        if(serversAlmostEmpty())
-        {
+    }
 
-            int chosen_one = 0;
-            int chosen_one_players = Config::getInstance()->max_users_per_process +1;
-            int chosen_pid=0;
-            for(auto it = children.cbegin(); it != children.cend(); ++it)
-                if(it->second.isAlive && it->second.players<chosen_one_players)
-                {
-                    chosen_one = it->first;
-                    chosen_pid=it->second.pid;
-                    chosen_one_players = it->second.players;
-                }
+    exit(0);
 
-            children[chosen_one].isAlive = false;
-            kill(chosen_pid,SIGINT);
-            if(children.size()-getNumAliveChildren() > Config::getInstance()->max_processes)
-                killOneTerminatingServer();
+
+}
+void GameserversManager::autoscale(time_t now)
+{
+    Config* config = Config::getInstance();
+    uint64_t logins = retiredMetrics.logins;
+    for(auto it = children.cbegin(); it != children.cend(); ++it)
+        if(it->second.hasMetrics)
+            logins += it->second.metrics.logins;
+    autoscaler.Observe(now,getNumPlayers(),logins);
+    if(!config->autoscale_trace.empty())
+    {
+        if(loadTrace == nullptr)
+            loadTrace = fopen(config->autoscale_trace.c_str(),"a");
+        if(loadTrace != nullptr)
+        {
+            //flushed now: a child must not inherit a full buffer and write it again at exit
+            autoscaler.Record(loadTrace);
+            fflush(loadTrace);
         }
     }
+    if(now - lastProfileSave >= Autoscaler::SLOT_SECONDS)
+    {
+        autoscaler.SaveProfile(config->autoscale_profile);
+        lastProfileSave = now;
+    }
 
-    exit(0);
-
+    switch(autoscaler.Decide(now,getNumAliveChildren(),config->max_users_per_process,maxchildren))
+    {
+    case Autoscaler::SPAWN:
+        log(INFO,"autoscale: new gameserver, %d players, %.0f expected, %.1f arrivals and %.1f departures a minute\n",
+            getNumPlayers(),autoscaler.Forecast(now),autoscaler.arrivalRate,autoscaler.departureRate);
+        spawn_gameserver();
+        break;
+    case Autoscaler::RETIRE:
+    {
+        std::vector<int> fds;
+        std::vector<Autoscaler::Child> candidates;
+        for(auto it = children.cbegin(); it != children.cend(); ++it)
+        {
+            Autoscaler::Child c = {it->second.players,it->second.duels,it->second.spawnedAt,it->second.isAlive};
+            fds.push_back(it->first);
+            candidates.push_back(c);
+        }
+        int victim = autoscaler.ChooseVictim(candidates,now);
+        if(victim < 0)
+        {
+            log(VERBOSE,"autoscale: the load is low but every gameserver is too young\n");
+            break;
+        }
+        log(INFO,"autoscale: draining %d with %d duels and %d players, %.0f players expected\n",
+            children[fds[victim]].pid,candidates[victim].duels,candidates[victim].players,autoscaler.Forecast(now));
+        drainChild(fds[victim]);
+        break;
+    }
+    default:
+        break;
+    }
+}
 
+void GameserversManager::drainChild(int child_fd)
+{
+    ChildInfo& child = children[child_fd];
+    child.isAlive = false;
+    //its players and duels move to the brothers, it exits when empty
+    if(handoff_fd >= 0)
+    {
+        std::string frame;
+        IpcFrame::append(frame,DRAIN,handoffPath.data(),handoffPath.size());
+        sendToChild(child_fd,frame);
+    }
+    else
+        kill(child.pid,SIGINT);
+    if(children.size()-getNumAliveChildren() > Config::getInstance()->max_processes)
+        killOneTerminatingServer();
 }
+
 void GameserversManager::killOneTerminatingServer()
 {
     printf("troppi figli morenti, ne uccido uno\n");
@@ -413,34 +600,145 @@ void GameserversManager::killOneTerminatingServer()
 
 
 }
+void GameserversManager::reloadConfig()
+{
+    Config::reloadRequested = 0;
+    std::string snapshot;
+    if(!Config::getInstance()->Reload(snapshot))
+        return;
+    maxchildren = Config::getInstance()->max_processes;
+    //the children spawned from now on have it already
+    std::string frame;
+    IpcFrame::append(frame,CONFIG,snapshot.data(),snapshot.size());
+    for(auto it = children.cbegin(); it != children.cend(); ++it)
+        sendToChild(it->first,frame);
+}
+
+void GameserversManager::retireChild(int child_fd)
+{
+    //the counters do not go back when a gameserver exits
+    ChildInfo& child = children[child_fd];
+    if(child.hasMetrics)
+        retiredMetrics.mergeCounters(child.metrics);
+}
+
+void GameserversManager::renderMetrics(std::string& body, void* ctx)
+{
+    GameserversManager* that = (GameserversManager*)ctx;
+    MetricsSnapshot total = that->retiredMetrics;
+    int reporting = 0;
+    for(auto it = that->children.cbegin(); it != that->children.cend(); ++it)
+    {
+        if(!it->second.hasMetrics)
+            continue;
+        total.mergeCounters(it->second.metrics);
+        total.mergeGauges(it->second.metrics);
+        reporting++;
+    }
+    Metrics::Render(body,total,reporting,Metrics::readRss());
+}
+
 void GameserversManager::closeChild(int child)
 {
     close(child);
     //close(children[child].child_fd);
 
 }
+void GameserversManager::acceptUpgrade()
+{
+    int sock = accept(upgrade_fd,NULL,NULL);
+    if(sock < 0)
+        return;
+    timeval tv = {HotUpgrade::TIMEOUT_SECONDS, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    //the new binary sends the path of its handoff socket and receives the port
+    char path[108];
+    int unused;
+    int len = HotUpgrade::recvFd(sock,unused,path,sizeof(path) - 1);
+    if(unused >= 0)
+        close(unused);
+    char ok = 1;
+    if(len <= 0 || needsReboot || server_fd <= 0 || !HotUpgrade::sendFd(sock,server_fd,&ok,1))
+    {
+        log(WARN,"upgrade: the listening socket was not handed over\n");
+        close(sock);
+        return;
+    }
+    close(sock);
+    upgradeStart = IpcFrame::nowMs();
+    log(INFO,"upgrade: listening socket handed to the new server, idle players go to %.*s\n",len,path);
+
+    //the file now belongs to the new father, like the port of the metrics
+    close(upgrade_fd);
+    upgrade_fd = -1;
+    delete metricsEndpoint;
+    metricsEndpoint = nullptr;
+    if(handoff_fd >= 0)
+    {
+        close(handoff_fd);
+        unlink(handoffPath.c_str());
+        handoff_fd = -1;
+    }
+    std::string frame;
+    IpcFrame::append(frame,UPGRADE,path,len);
+    for(auto it = children.cbegin(); it != children.cend(); ++it)
+        sendToChild(it->first,frame);
+    //like a reboot: no new children, the father exits with the last one
+    needsReboot = true;
+}
+
 void GameserversManager::StartServer(int port)
 {
-    sockaddr_in sin;
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_addr.s_addr = htonl(INADDR_ANY);
-    sin.sin_port = htons(port);
+    Config* config = Config::getInstance();
+    //before the first fork: the table is shared with the children, the rank index is copied.
+    //Before the port too: during an upgrade the old binary stops accepting when it is handed over
+    RateLimiter::getInstance()->init();
+    MySqlWrapper::getInstance()->connect();
+    RankIndex::getInstance()->load();
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(!config->upgrade_socket.empty())
+    {
+        //before the port is taken: the old gameservers start sending players at once
+        handoffPath = HotUpgrade::handoffPath(config->upgrade_socket,getpid());
+        handoff_fd = HotUpgrade::listen(handoffPath);
+    }
 
-    int optval = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
-    if (::bind(server_fd, (struct sockaddr *) &sin, sizeof(struct sockaddr_in)) == -1)
+    if(config->hotUpgrade)
     {
-        printf("errore bind\n");
-        return ;
+        int64_t start = IpcFrame::nowMs();
+        server_fd = HotUpgrade::takeListener(config->upgrade_socket,handoffPath);
+        if(server_fd < 0)
+        {
+            printf("errore upgrade: nessun server su %s\n",config->upgrade_socket.c_str());
+            return ;
+        }
+        log(INFO,"upgrade: listening socket received in %d ms\n",(int)(IpcFrame::nowMs() - start));
+    }
+    else
+    {
+        sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_ANY);
+        sin.sin_port = htons(port);
+
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        int optval = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+        if (::bind(server_fd, (struct sockaddr *) &sin, sizeof(struct sockaddr_in)) == -1)
+        {
+            printf("errore bind\n");
+            return ;
+        }
     }
     evutil_make_socket_nonblocking(server_fd);
+    if(!config->upgrade_socket.empty())
+        upgrade_fd = HotUpgrade::listen(config->upgrade_socket);
 
     parent_loop();
 
 }
 }
-
-
@@ -2,6 +2,11 @@
 #define _GAMESERVERMANAGER_H_
 
 #include "GameServer.h"
+#include "ChatSink.h"
+#include "ChatSocketSource.h"
+#include "MetricsEndpoint.h"
+#include "Metrics.h"
+#include "Autoscaler.h"
 namespace ygo
 {
 
@@ -11,9 +16,18 @@ struct ChildInfo
     int pid;
     int rooms;
     int players;
+    //rooms with a duel in progress
+    int duels;
     bool isAlive;
     time_t last_update;
-    ChildInfo():rooms(0),players(0),isAlive(true){};
+    time_t spawnedAt;
+    std::string inBuf;
+    std::string outBuf;
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    bool hasMetrics;
+    MetricsSnapshot metrics;
+    ChildInfo():rooms(0),players(0),duels(0),isAlive(true),spawnedAt(0),bytesIn(0),bytesOut(0),hasMetrics(false){};
 
 };
 
@@ -40,11 +54,36 @@ private:
     int getNumPlayers();
     int getNumAliveChildren();
     int getNumPlayersInAliveChildren();
-    bool serversAlmostFull();
-    bool serversAlmostEmpty();
+    /* how many gameservers, see Autoscaler */
+    Autoscaler autoscaler;
+    time_t lastAutoscale;
+    time_t lastProfileSave;
+    FILE* loadTrace;
+    void autoscale(time_t now);
+    void drainChild(int);
     void killOneTerminatingServer();
     bool handleChildMessage(int);
+    void handleChildFrame(int,IpcHeader&,const char*);
+    void sendToChild(int,const std::string&);
+    bool flushChild(int);
     void closeChild(int);
+    /* hot upgrade */
+    int upgrade_fd;
+    int handoff_fd;
+    std::string handoffPath;
+    int64_t upgradeStart;
+    void acceptUpgrade();
+    /* SIGHUP */
+    void reloadConfig();
+    std::vector<ChatSink*> chatSinks;
+    std::vector<ChatSource*> chatSources;
+    ChatSocketSource* chatSocket;
+    /* /metrics: the last snapshot of each child, the counters of the children that exited */
+    MetricsEndpoint* metricsEndpoint;
+    MetricsSnapshot retiredMetrics;
+    void retireChild(int);
+    static void renderMetrics(std::string& body, void* ctx);
+    static const size_t MAX_CHILD_QUEUE = 4 << 20;
 public:
     void StartServer(int port);
     GameserversManager();
@@ -0,0 +1,182 @@
+#include "HotUpgrade.h"
+#include "debug.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace ygo
+{
+
+static bool unixAddress(const std::string& path, sockaddr_un& addr)
+{
+    if(path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        log(WARN,"invalid upgrade socket path: %s\n",path.c_str());
+        return false;
+    }
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path,path.c_str());
+    return true;
+}
+
+int HotUpgrade::listen(const std::string& path)
+{
+    sockaddr_un addr;
+    if(!unixAddress(path,addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(fd < 0)
+        return -1;
+    //the file of the previous binary: its socket is already closed
+    unlink(path.c_str());
+    if(bind(fd,(sockaddr*)&addr,sizeof(addr)) || ::listen(fd,16))
+    {
+        log(WARN,"cannot listen on %s: %s\n",path.c_str(),strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int HotUpgrade::connect(const std::string& path)
+{
+    sockaddr_un addr;
+    if(!unixAddress(path,addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(fd < 0)
+        return -1;
+    //blocking with a timeout: the other side can be slow, not stuck
+    timeval tv = {TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if(::connect(fd,(sockaddr*)&addr,sizeof(addr)))
+    {
+        log(WARN,"cannot connect to %s: %s\n",path.c_str(),strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool HotUpgrade::sendFd(int sock, int fd, const void* data, size_t len)
+{
+    std::vector<int> fds;
+    if(fd >= 0)
+        fds.push_back(fd);
+    return sendFds(sock,fds,data,len);
+}
+
+bool HotUpgrade::sendFds(int sock, const std::vector<int>& fds, const void* data, size_t len)
+{
+    if(fds.size() > MAX_FDS)
+        return false;
+    iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = len;
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(!fds.empty())
+    {
+        memset(control,0,sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg),&fds[0],sizeof(int) * fds.size());
+    }
+    while(true)
+    {
+        ssize_t sent = sendmsg(sock,&msg,MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR)
+            continue;
+        return sent == (ssize_t)len;
+    }
+}
+
+int HotUpgrade::recvFd(int sock, int& fd, void* data, size_t len)
+{
+    std::vector<int> fds;
+    int received = recvFds(sock,fds,data,len);
+    fd = -1;
+    for(size_t i = 0; i < fds.size(); i++)
+    {
+        if(i == 0)
+            fd = fds[i];
+        else
+            close(fds[i]);
+    }
+    return received;
+}
+
+int HotUpgrade::recvFds(int sock, std::vector<int>& fds, void* data, size_t len)
+{
+    fds.clear();
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do
+        received = recvmsg(sock,&msg,MSG_CMSG_CLOEXEC);
+    while(received < 0 && errno == EINTR);
+    if(received <= 0)
+        return received;
+
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg,cmsg))
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(size_t i = 0; i < count; i++)
+            {
+                int fd;
+                memcpy(&fd,CMSG_DATA(cmsg) + i * sizeof(int),sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+    if(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    {
+        log(BUG,"truncated upgrade message\n");
+        for(size_t i = 0; i < fds.size(); i++)
+            close(fds[i]);
+        fds.clear();
+        return -1;
+    }
+    return received;
+}
+
+int HotUpgrade::takeListener(const std::string& upgradePath, const std::string& handoffPath)
+{
+    int sock = connect(upgradePath);
+    if(sock < 0)
+        return -1;
+    int listener = -1;
+    char ok;
+    if(!sendFd(sock,-1,handoffPath.data(),handoffPath.size()) || recvFd(sock,listener,&ok,1) != 1 || listener < 0)
+        log(WARN,"the running server did not send the listening socket\n");
+    close(sock);
+    return listener;
+}
+
+std::string HotUpgrade::handoffPath(const std::string& upgradePath, int pid)
+{
+    return upgradePath + "." + std::to_string(pid);
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef _HOTUPGRADE_H_
+#define _HOTUPGRADE_H_
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <netinet/in.h>
+
+namespace ygo
+{
+
+/*
+ * upgrade of the binary without closing the port.
+ * The father listens on upgrade_socket. A new binary started with -U connects there,
+ * sends the path of its own handoff socket and receives the listening socket
+ * with SCM_RIGHTS: from that moment the new connections are accepted by the new
+ * gameservers. The old father sends UPGRADE (with the path) to its gameservers,
+ * they stop listening and pass the idle players of the waiting room to the
+ * handoff socket, one HandoffPlayer with the tcp socket attached for each one.
+ * The handoff socket is inherited by the new gameservers like the port:
+ * the first free one takes the connection.
+ * Both sockets are SOCK_SEQPACKET, so a message and its descriptor never split.
+ * A gameserver that is drained (DRAIN) does the same towards its brothers.
+ * A duel waiting for a response moves too: a HandoffDuel, the snapshot of the room
+ * in HANDOFF_DUEL_DATA chunks, then one HANDOFF_DUELISTS with a HandoffPlayer for each
+ * player and observer and all their sockets: the duel moves whole or stays here.
+ * The receiver rebuilds it replaying the responses of the snapshot.
+ * Only the single and match duels can be moved, the tag and handicap ones stay.
+ * Every message starts with its kind.
+ */
+enum HandoffKind {HANDOFF_PLAYER,HANDOFF_DUEL,HANDOFF_DUEL_DATA,HANDOFF_DUELISTS};
+
+struct HandoffPlayer
+{
+    uint32_t kind;
+    uint16_t name[20];
+    uint32_t cachedRankScore;
+    uint32_t cachedGameScore;
+    int32_t lflist;
+    int8_t color;
+    uint8_t loginStatus;
+    char ip[INET_ADDRSTRLEN];
+    char countryCode[8];
+    //position and protocol state in the duel
+    uint8_t type;
+    uint8_t state;
+};
+
+struct HandoffDuel
+{
+    uint32_t kind;
+    uint8_t mode;
+    int32_t lflist;
+    uint32_t length;
+    uint32_t members;
+};
+
+class HotUpgrade
+{
+public:
+    static int listen(const std::string& path);
+    static int connect(const std::string& path);
+
+    //fd < 0 sends only the data
+    static bool sendFd(int sock, int fd, const void* data, size_t len);
+    //all the descriptors in the same message, at most MAX_FDS
+    static bool sendFds(int sock, const std::vector<int>& fds, const void* data, size_t len);
+    //-1 on error, 0 at the end, otherwise the bytes read; fd is -1 if nothing was attached
+    static int recvFd(int sock, int& fd, void* data, size_t len);
+    static int recvFds(int sock, std::vector<int>& fds, void* data, size_t len);
+
+    //the new father: asks the listening socket to the running one, -1 if it fails
+    static int takeListener(const std::string& upgradePath, const std::string& handoffPath);
+    static std::string handoffPath(const std::string& upgradePath, int pid);
+
+    static const int TIMEOUT_SECONDS = 5;
+    static const unsigned int MAX_CHUNK = 16384;
+    //the members of a moved duel: their HandoffPlayers fit in a chunk
+    static const unsigned int MAX_FDS = 128;
+};
+
+}
+#endif
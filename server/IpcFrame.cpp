@@ -0,0 +1,135 @@
+#include "IpcFrame.h"
+#include "config.h"
+#include <event2/bufferevent.h>
+#include <sys/time.h>
+#include <string.h>
+#include <algorithm>
+
+namespace ygo
+{
+
+ChatMessage::ChatMessage(const std::wstring& message,int color):color(color)
+{
+    char buffer[256 * 4 + 1];
+    std::wstring msg = message.substr(0,256);
+    int len = BufferIO::EncodeUTF8(msg.c_str(),buffer);
+    text.assign(buffer,len);
+    timestamp = IpcFrame::nowMs();
+}
+
+std::wstring ChatMessage::wtext() const
+{
+    wchar_t buffer[IpcFrame::MAX_CHAT_TEXT + 1];
+    BufferIO::DecodeUTF8(text.c_str(),buffer);
+    return std::wstring(buffer);
+}
+
+void IpcFrame::append(std::string& out, MessageType type, const void* payload, uint32_t len)
+{
+    IpcHeader header;
+    header.type = type;
+    header.length = len;
+    out.append((const char*)&header,sizeof(header));
+    out.append((const char*)payload,len);
+}
+
+void IpcFrame::write(bufferevent* bev, MessageType type, const void* payload, uint32_t len)
+{
+    //the channel with the father can be closed
+    if(!bev)
+        return;
+    IpcHeader header;
+    header.type = type;
+    header.length = len;
+    bufferevent_write(bev,&header,sizeof(header));
+    bufferevent_write(bev,payload,len);
+}
+
+size_t IpcFrame::utf8Length(const std::string& text, size_t max)
+{
+    //DecodeUTF8 takes the length of a sequence from its first byte: a cut one reads past the end
+    size_t len = std::min(text.size(),max);
+    size_t lead = len;
+    while(lead > 0 && ((unsigned char)text[lead - 1] & 0xc0) == 0x80)
+        lead--;
+    if(lead == 0)
+        return len;
+    unsigned char c = text[lead - 1];
+    size_t need = (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 1;
+    return len - (lead - 1) < need ? lead - 1 : len;
+}
+
+void IpcFrame::appendChat(std::string& payload, const ChatMessage& msg)
+{
+    int32_t color = msg.color;
+    int64_t timestamp = msg.timestamp;
+    uint16_t len = utf8Length(msg.text,MAX_CHAT_TEXT);
+    payload.append((const char*)&color,sizeof(color));
+    payload.append((const char*)&timestamp,sizeof(timestamp));
+    payload.append((const char*)&len,sizeof(len));
+    payload.append(msg.text.data(),len);
+}
+
+bool IpcFrame::parseChat(const char* payload, uint32_t len, std::vector<ChatMessage>& out)
+{
+    const uint32_t fixed = sizeof(int32_t) + sizeof(int64_t) + sizeof(uint16_t);
+    uint32_t pos = 0;
+    while(pos < len)
+    {
+        if(len - pos < fixed)
+            return false;
+        ChatMessage msg;
+        int32_t color;
+        uint16_t textlen;
+        memcpy(&color,payload + pos,sizeof(color));
+        memcpy(&msg.timestamp,payload + pos + sizeof(color),sizeof(msg.timestamp));
+        memcpy(&textlen,payload + pos + sizeof(color) + sizeof(msg.timestamp),sizeof(textlen));
+        pos += fixed;
+        if(textlen > MAX_CHAT_TEXT || len - pos < textlen)
+            return false;
+        msg.color = color;
+        msg.text.assign(payload + pos,textlen);
+        pos += textlen;
+        out.push_back(msg);
+    }
+    return true;
+}
+
+void IpcFrame::appendRank(std::string& payload, const std::string& username, int score)
+{
+    int32_t value = score;
+    uint8_t len = std::min<size_t>(username.size(),255);
+    payload.append((const char*)&value,sizeof(value));
+    payload.append((const char*)&len,sizeof(len));
+    payload.append(username.data(),len);
+}
+
+bool IpcFrame::parseRank(const char* payload, uint32_t len, std::vector<std::pair<std::string,int>>& out)
+{
+    const uint32_t fixed = sizeof(int32_t) + sizeof(uint8_t);
+    uint32_t pos = 0;
+    while(pos < len)
+    {
+        if(len - pos < fixed)
+            return false;
+        int32_t score;
+        uint8_t namelen;
+        memcpy(&score,payload + pos,sizeof(score));
+        memcpy(&namelen,payload + pos + sizeof(score),sizeof(namelen));
+        pos += fixed;
+        if(len - pos < namelen)
+            return false;
+        out.push_back(std::make_pair(std::string(payload + pos,namelen),(int)score));
+        pos += namelen;
+    }
+    return true;
+}
+
+int64_t IpcFrame::nowMs()
+{
+    timeval tv;
+    gettimeofday(&tv,NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef _IPCFRAME_H_
+#define _IPCFRAME_H_
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+struct bufferevent;
+
+namespace ygo
+{
+
+/*
+ * messages between the father and the gameservers.
+ * every message is a frame: IpcHeader followed by length bytes of payload.
+ * CHAT frames carry a batch of chat messages, each one is
+ * color (int32), timestamp in ms (int64), text length (uint16), UTF-8 text
+ * RANK_UPDATE frames carry a batch of new scores, each one is
+ * score (int32), username length (uint8), username
+ * UPGRADE (father to gameservers) carries the path of the handoff socket of the new binary,
+ * DRAIN the path of the handoff socket of the brothers
+ * METRICS (gameservers to father) carries a MetricsSnapshot
+ * CONFIG (father to gameservers) carries a ConfigSnapshotHeader and the text of the config file
+ */
+enum MessageType {STATS,CHAT,RANK_UPDATE,UPGRADE,DRAIN,METRICS,CONFIG};
+
+struct IpcHeader
+{
+    uint32_t type;
+    uint32_t length;
+};
+
+struct ChatMessage
+{
+    int color;
+    int64_t timestamp;
+    std::string text;
+    ChatMessage():color(0),timestamp(0) {}
+    ChatMessage(const std::wstring& message,int color);
+    std::wstring wtext() const;
+};
+
+class IpcFrame
+{
+public:
+    static const uint32_t MAX_PAYLOAD = 1 << 20;
+    static const unsigned int MAX_CHAT_TEXT = 1024;
+
+    static void append(std::string& out, MessageType type, const void* payload, uint32_t len);
+    static void write(bufferevent* bev, MessageType type, const void* payload, uint32_t len);
+
+    //the longest prefix of text within max bytes that does not end inside a UTF-8 sequence
+    static size_t utf8Length(const std::string& text, size_t max);
+    static void appendChat(std::string& payload, const ChatMessage& msg);
+    static bool parseChat(const char* payload, uint32_t len, std::vector<ChatMessage>& out);
+
+    static void appendRank(std::string& payload, const std::string& username, int score);
+    static bool parseRank(const char* payload, uint32_t len, std::vector<std::pair<std::string,int>>& out);
+
+    static int64_t nowMs();
+};
+
+}
+#endif
@@ -2,10 +2,10 @@
 #include <stdio.h>
 #include "DuelLogger.h"
 
-LoggerPlayerInfo::LoggerPlayerInfo():type(7),turns(0),maxSpSummonTurn(0),maxAttacksTurn(0),maxDamage1shot(0),recoveredDuel(0),
-setMonstersDuel(0),effectsDuel(0),setSTDuel(0)
+LoggerPlayerInfo::LoggerPlayerInfo():type(7),hisTurn(false),turns(0),SpSummonTurn(0),maxSpSummonTurn(0),maxAttacksTurn(0),attacksTurn(0),playerID(0),maxDamage1shot(0),recoveredDuel(0),
+setMonstersDuel(0),effectsDuel(0),setSTDuel(0),spSummonsDuel(0),attacksDuel(0),damageTurn(0),damageDuel(0)
 {
-	
+	name[0] = 0;
 }
 
 void LoggerPlayerInfo::NewTurn()
@@ -14,6 +14,7 @@ void LoggerPlayerInfo::NewTurn()
 	turns++;
 	SpSummonTurn = 0;
 	attacksTurn = 0;
+	damageTurn = 0;
 }
 	void LoggerPlayerInfo::MainPhase()
 	{
@@ -24,6 +25,7 @@ void LoggerPlayerInfo::SpecialSummon()
 	if(!hisTurn)
 		return;
 	SpSummonTurn++;
+	spSummonsDuel++;
 	if(SpSummonTurn > maxSpSummonTurn)
 		maxSpSummonTurn = SpSummonTurn;
 	debugp("%s special summons\n",name);
@@ -59,6 +61,7 @@ void LoggerPlayerInfo::attack()
 	if(!hisTurn)
 		return;
 	attacksTurn++;
+	attacksDuel++;
 	if(attacksTurn > maxAttacksTurn)
 		maxAttacksTurn = attacksTurn;
 	debugp("%s attacks summons\n",name);
@@ -70,6 +73,8 @@ void LoggerPlayerInfo::Damage(signed char ID, int damage)
 		return;
 	if(ID == (1-playerID))
 	{
+	damageTurn += damage;
+	damageDuel += damage;
 	if(maxDamage1shot < damage)
 		maxDamage1shot = damage;
 	debugp("%s inflicts %d damage\n",name,damage);
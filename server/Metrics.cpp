@@ -0,0 +1,357 @@
+#include "Metrics.h"
+#include "DuelRoom.h"
+#include "IpcFrame.h"
+#include <event2/event.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace ygo
+{
+
+const uint32_t Histogram::BOUNDS[Histogram::BUCKETS] = {1,5,10,25,50,100,250,500,1000,2500,5000,10000,30000,60000,180000,600000};
+
+void Histogram::observe(int64_t ms)
+{
+    if(ms < 0)
+        ms = 0;
+    int i = 0;
+    while(i < BUCKETS && (uint64_t)ms > BOUNDS[i])
+        i++;
+    counts[i]++;
+    count++;
+    sumMs += ms;
+}
+
+void Histogram::merge(const Histogram& other)
+{
+    for(int i = 0; i <= BUCKETS; i++)
+        counts[i] += other.counts[i];
+    count += other.count;
+    sumMs += other.sumMs;
+}
+
+void MetricsSnapshot::mergeCounters(const MetricsSnapshot& other)
+{
+    connectionsAccepted += other.connectionsAccepted;
+    for(int i = 0; i < REFUSALS; i++)
+        connectionsRefused[i] += other.connectionsRefused[i];
+    logins += other.logins;
+    duelsStarted += other.duelsStarted;
+    duelsFinished += other.duelsFinished;
+    observersDropped += other.observersDropped;
+    duelistsTimedOut += other.duelistsTimedOut;
+    for(int i = 0; i < 256; i++)
+    {
+        ctosPackets[i] += other.ctosPackets[i];
+        ctosBytes[i] += other.ctosBytes[i];
+        stocPackets[i] += other.stocPackets[i];
+        stocBytes[i] += other.stocBytes[i];
+    }
+    relayBytes += other.relayBytes;
+    engineNs += other.engineNs;
+    roomBytes[0] += other.roomBytes[0];
+    roomBytes[1] += other.roomBytes[1];
+    roomsOverBudget += other.roomsOverBudget;
+    matchmakingWait.merge(other.matchmakingWait);
+    dbLatency.merge(other.dbLatency);
+    loopLag.merge(other.loopLag);
+}
+
+void MetricsSnapshot::mergeGauges(const MetricsSnapshot& other)
+{
+    connectionsOpen += other.connectionsOpen;
+    connectionsPending += other.connectionsPending;
+    for(int i = 0; i < LOGIN_RESULTS; i++)
+        players[i] += other.players[i];
+    for(int i = 0; i < ROOM_STATES; i++)
+        for(int j = 0; j < ROOM_MODES; j++)
+            rooms[i][j] += other.rooms[i][j];
+    rssBytes += other.rssBytes;
+    for(int i = 0; i < 2; i++)
+    {
+        queuedBytes[i] += other.queuedBytes[i];
+        queuedMax[i] = std::max(queuedMax[i], other.queuedMax[i]);
+    }
+    for(int i = 0; i < HEAVY_ROOMS && other.heavyRooms[i].engineNs; i++)
+        addHeavyRoom(other.heavyRooms[i]);
+}
+
+void MetricsSnapshot::addHeavyRoom(const HeavyRoom& room)
+{
+    int i = HEAVY_ROOMS;
+    while(i > 0 && heavyRooms[i - 1].engineNs < room.engineNs)
+        i--;
+    if(i == HEAVY_ROOMS)
+        return;
+    memmove(&heavyRooms[i + 1],&heavyRooms[i],(HEAVY_ROOMS - i - 1) * sizeof(HeavyRoom));
+    heavyRooms[i] = room;
+}
+
+Metrics::Metrics():lagProbe(nullptr),lagExpected(0)
+{
+    memset(&counters,0,sizeof(counters));
+}
+
+Metrics* Metrics::getInstance()
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+int Metrics::modeIndex(unsigned char mode)
+{
+    switch(mode)
+    {
+    case MODE_SINGLE:
+        return 0;
+    case MODE_MATCH:
+        return 1;
+    case MODE_TAG:
+        return 2;
+    case MODE_HANDICAP:
+        return 3;
+    }
+    return -1;
+}
+
+void Metrics::StartLagProbe(event_base* base)
+{
+    lagProbe = event_new(base, -1, EV_TIMEOUT | EV_PERSIST, lagProbe_cb, this);
+    timeval interval = {0, LAG_PROBE_MS * 1000};
+    event_add(lagProbe, &interval);
+    lagExpected = IpcFrame::nowMs() + LAG_PROBE_MS;
+}
+
+void Metrics::StopLagProbe()
+{
+    if(lagProbe == nullptr)
+        return;
+    event_free(lagProbe);
+    lagProbe = nullptr;
+}
+
+void Metrics::lagProbe_cb(evutil_socket_t fd, short events, void* arg)
+{
+    Metrics* that = (Metrics*)arg;
+    int64_t now = IpcFrame::nowMs();
+    that->counters.loopLag.observe(now - that->lagExpected);
+    that->lagExpected = now + LAG_PROBE_MS;
+}
+
+uint64_t Metrics::readRss()
+{
+    FILE* statm = fopen("/proc/self/statm","r");
+    if(statm == nullptr)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    if(fscanf(statm,"%lu %lu",&size,&resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+const char* Metrics::ctosName(int type)
+{
+    switch(type)
+    {
+    case CTOS_RESPONSE: return "response";
+    case CTOS_UPDATE_DECK: return "update_deck";
+    case CTOS_HAND_RESULT: return "hand_result";
+    case CTOS_TP_RESULT: return "tp_result";
+    case CTOS_PLAYER_INFO: return "player_info";
+    case CTOS_CREATE_GAME: return "create_game";
+    case CTOS_JOIN_GAME: return "join_game";
+    case CTOS_LEAVE_GAME: return "leave_game";
+    case CTOS_SURRENDER: return "surrender";
+    case CTOS_TIME_CONFIRM: return "time_confirm";
+    case CTOS_CHAT: return "chat";
+    case CTOS_HS_TODUELIST: return "hs_toduelist";
+    case CTOS_HS_TOOBSERVER: return "hs_toobserver";
+    case CTOS_HS_READY: return "hs_ready";
+    case CTOS_HS_NOTREADY: return "hs_notready";
+    case CTOS_HS_KICK: return "hs_kick";
+    case CTOS_HS_START: return "hs_start";
+    }
+    return nullptr;
+}
+
+const char* Metrics::stocName(int type)
+{
+    switch(type)
+    {
+    case STOC_GAME_MSG: return "game_msg";
+    case STOC_ERROR_MSG: return "error_msg";
+    case STOC_SELECT_HAND: return "select_hand";
+    case STOC_SELECT_TP: return "select_tp";
+    case STOC_HAND_RESULT: return "hand_result";
+    case STOC_TP_RESULT: return "tp_result";
+    case STOC_CHANGE_SIDE: return "change_side";
+    case STOC_WAITING_SIDE: return "waiting_side";
+    case STOC_CREATE_GAME: return "create_game";
+    case STOC_JOIN_GAME: return "join_game";
+    case STOC_TYPE_CHANGE: return "type_change";
+    case STOC_LEAVE_GAME: return "leave_game";
+    case STOC_DUEL_START: return "duel_start";
+    case STOC_DUEL_END: return "duel_end";
+    case STOC_REPLAY: return "replay";
+    case STOC_TIME_LIMIT: return "time_limit";
+    case STOC_CHAT: return "chat";
+    case STOC_HS_PLAYER_ENTER: return "hs_player_enter";
+    case STOC_HS_PLAYER_CHANGE: return "hs_player_change";
+    case STOC_HS_WATCH_CHANGE: return "hs_watch_change";
+    }
+    return nullptr;
+}
+
+static void header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+static void sample(std::string& out, const char* name, const char* labels, uint64_t value)
+{
+    char line[256];
+    if(labels != nullptr && labels[0])
+        snprintf(line,sizeof(line),"%s{%s} %llu\n",name,labels,(unsigned long long)value);
+    else
+        snprintf(line,sizeof(line),"%s %llu\n",name,(unsigned long long)value);
+    out += line;
+}
+
+static void histogram(std::string& out, const char* name, const char* help, const Histogram& h)
+{
+    header(out,name,"histogram",help);
+    char line[256];
+    uint64_t cumulative = 0;
+    for(int i = 0; i < Histogram::BUCKETS; i++)
+    {
+        cumulative += h.counts[i];
+        snprintf(line,sizeof(line),"%s_bucket{le=\"%g\"} %llu\n",name,Histogram::BOUNDS[i] / 1000.0,(unsigned long long)cumulative);
+        out += line;
+    }
+    snprintf(line,sizeof(line),"%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.3f\n%s_count %llu\n",name,(unsigned long long)h.count,
+             name,h.sumMs / 1000.0,name,(unsigned long long)h.count);
+    out += line;
+}
+
+static void packets(std::string& out, const char* name, const char* help, const uint64_t* values, const char* (*typeName)(int))
+{
+    header(out,name,"counter",help);
+    char labels[64];
+    for(int i = 0; i < 256; i++)
+    {
+        if(!values[i])
+            continue;
+        const char* type = typeName(i);
+        if(type != nullptr)
+            snprintf(labels,sizeof(labels),"type=\"%s\"",type);
+        else
+            snprintf(labels,sizeof(labels),"type=\"0x%02x\"",i);
+        sample(out,name,labels,values[i]);
+    }
+}
+
+//the names of the players go in a label: nothing that needs escaping
+static void labelValue(char* out, size_t size, const char* value)
+{
+    size_t i = 0;
+    for(; value[i] && i + 1 < size; i++)
+        out[i] = (value[i] >= 0x20 && value[i] < 0x7f && value[i] != '"' && value[i] != '\\') ? value[i] : '_';
+    out[i] = 0;
+}
+
+void Metrics::Render(std::string& out, const MetricsSnapshot& total, int gameservers, uint64_t fatherRss)
+{
+    static const char* refusals[] = {"rate_limit","ip_cap","handshake_timeout","handshake_invalid","handshake_evicted","full"};
+    static const char* logins[] = {"notentered","waitingjoin","unranked","invalidusername","invalidpassword","nopassword","authenticated"};
+    static const char* states[] = {"waiting","full","playing","zombie","dead"};
+    static const char* modes[] = {"single","match","tag","handicap"};
+    char labels[64];
+
+    header(out,"ygo_gameservers","gauge","gameservers that sent their metrics");
+    sample(out,"ygo_gameservers",nullptr,gameservers);
+    header(out,"ygo_connections_accepted_total","counter","tcp connections accepted");
+    sample(out,"ygo_connections_accepted_total",nullptr,total.connectionsAccepted);
+    header(out,"ygo_connections_refused_total","counter","connections closed before the login");
+    for(int i = 0; i < MetricsSnapshot::REFUSALS; i++)
+    {
+        snprintf(labels,sizeof(labels),"reason=\"%s\"",refusals[i]);
+        sample(out,"ygo_connections_refused_total",labels,total.connectionsRefused[i]);
+    }
+    header(out,"ygo_connections","gauge","open connections");
+    sample(out,"ygo_connections","stage=\"pending\"",total.connectionsPending);
+    sample(out,"ygo_connections","stage=\"player\"",total.connectionsOpen);
+    header(out,"ygo_logins_total","counter","logins completed");
+    sample(out,"ygo_logins_total",nullptr,total.logins);
+    header(out,"ygo_players","gauge","players by login result");
+    for(int i = 0; i < MetricsSnapshot::LOGIN_RESULTS; i++)
+    {
+        snprintf(labels,sizeof(labels),"login=\"%s\"",logins[i]);
+        sample(out,"ygo_players",labels,total.players[i]);
+    }
+    header(out,"ygo_rooms","gauge","duel rooms by state and mode");
+    for(int i = 0; i < MetricsSnapshot::ROOM_STATES; i++)
+        for(int j = 0; j < MetricsSnapshot::ROOM_MODES; j++)
+        {
+            snprintf(labels,sizeof(labels),"state=\"%s\",mode=\"%s\"",states[i],modes[j]);
+            sample(out,"ygo_rooms",labels,total.rooms[i][j]);
+        }
+    header(out,"ygo_duels_started_total","counter","duels started (MSG_START)");
+    sample(out,"ygo_duels_started_total",nullptr,total.duelsStarted);
+    header(out,"ygo_duels_finished_total","counter","duels ended by MSG_WIN, the others were abandoned");
+    sample(out,"ygo_duels_finished_total",nullptr,total.duelsFinished);
+    histogram(out,"ygo_matchmaking_wait_seconds","from the entry in a room to the start of the duel",total.matchmakingWait);
+    header(out,"ygo_slow_consumers_total","counter","clients disconnected because they did not read");
+    sample(out,"ygo_slow_consumers_total","role=\"observer\"",total.observersDropped);
+    sample(out,"ygo_slow_consumers_total","role=\"duelist\"",total.duelistsTimedOut);
+    header(out,"ygo_output_queued_bytes","gauge","bytes queued for the clients and not written yet");
+    sample(out,"ygo_output_queued_bytes","role=\"duelist\"",total.queuedBytes[0]);
+    sample(out,"ygo_output_queued_bytes","role=\"observer\"",total.queuedBytes[1]);
+    header(out,"ygo_output_queued_bytes_max","gauge","bytes queued for the slowest client");
+    sample(out,"ygo_output_queued_bytes_max","role=\"duelist\"",total.queuedMax[0]);
+    sample(out,"ygo_output_queued_bytes_max","role=\"observer\"",total.queuedMax[1]);
+    packets(out,"ygo_packets_received_total","packets from the clients",total.ctosPackets,ctosName);
+    packets(out,"ygo_bytes_received_total","bytes from the clients, headers included",total.ctosBytes,ctosName);
+    packets(out,"ygo_packets_sent_total","packets written to a single client",total.stocPackets,stocName);
+    packets(out,"ygo_bytes_sent_total","bytes written to a single client, headers included",total.stocBytes,stocName);
+    header(out,"ygo_relay_bytes_total","counter","bytes written to the observers by the spectator relay");
+    sample(out,"ygo_relay_bytes_total",nullptr,total.relayBytes);
+    header(out,"ygo_engine_seconds_total","counter","time spent in the duel engine");
+    char seconds[64];
+    snprintf(seconds,sizeof(seconds),"ygo_engine_seconds_total %.3f\n",total.engineNs / 1e9);
+    out += seconds;
+    header(out,"ygo_room_bytes_sent_total","counter","bytes written by the duel rooms, relay included");
+    sample(out,"ygo_room_bytes_sent_total","to=\"duelists\"",total.roomBytes[0]);
+    sample(out,"ygo_room_bytes_sent_total","to=\"observers\"",total.roomBytes[1]);
+    header(out,"ygo_rooms_over_budget_total","counter","rooms over room_budget_engine_ms or room_budget_kbytes in a minute");
+    sample(out,"ygo_rooms_over_budget_total",nullptr,total.roomsOverBudget);
+    header(out,"ygo_heavy_room_engine_seconds","gauge","engine time of the heaviest duels in progress");
+    for(int i = 0; i < MetricsSnapshot::HEAVY_ROOMS && total.heavyRooms[i].engineNs; i++)
+    {
+        const MetricsSnapshot::HeavyRoom& room = total.heavyRooms[i];
+        int mode = modeIndex(room.mode);
+        char players[sizeof(room.players)];
+        labelValue(players,sizeof(players),room.players);
+        char line[256];
+        snprintf(line,sizeof(line),"ygo_heavy_room_engine_seconds{rank=\"%d\",pid=\"%d\",mode=\"%s\",players=\"%s\",over_budget=\"%d\"} %.3f\n",
+                 i + 1,room.pid,mode >= 0 ? modes[mode] : "other",players,room.overBudget,room.engineNs / 1e9);
+        out += line;
+    }
+    histogram(out,"ygo_db_lease_seconds","mysql: from the request of a connection to its release",total.dbLatency);
+    histogram(out,"ygo_event_loop_lag_seconds","delay of a timer of the gameservers",total.loopLag);
+    header(out,"ygo_resident_memory_bytes","gauge","resident set size");
+    sample(out,"ygo_resident_memory_bytes","process=\"father\"",fatherRss);
+    sample(out,"ygo_resident_memory_bytes","process=\"gameservers\"",total.rssBytes);
+}
+
+}
@@ -0,0 +1,137 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+#include <stdint.h>
+#include <string>
+#include <event2/util.h>
+
+struct event_base;
+struct event;
+
+namespace ygo
+{
+
+/*
+ * cumulative histogram in milliseconds, with the buckets of Prometheus:
+ * counts[i] are the observations <= BOUNDS[i], the last one is +Inf
+ */
+struct Histogram
+{
+    static const int BUCKETS = 16;
+    static const uint32_t BOUNDS[BUCKETS];
+    uint64_t counts[BUCKETS + 1];
+    uint64_t count;
+    uint64_t sumMs;
+
+    void observe(int64_t ms);
+    void merge(const Histogram& other);
+};
+
+/*
+ * everything a gameserver reports to the father for /metrics, sent as it is
+ * in a METRICS frame: the father and its gameservers are the same binary.
+ * The counters only grow, the gauges are read when the snapshot is sent.
+ */
+struct MetricsSnapshot
+{
+    static const int LOGIN_RESULTS = 7;
+    static const int ROOM_STATES = 5;
+    //single, match, tag, handicap
+    static const int ROOM_MODES = 4;
+    enum Refusal {REFUSED_RATE,REFUSED_IP,REFUSED_HANDSHAKE_TIMEOUT,REFUSED_HANDSHAKE_INVALID,REFUSED_HANDSHAKE_EVICTED,REFUSED_FULL,REFUSALS};
+    static const int HEAVY_ROOMS = 5;
+    //a room with a lot of engine time, players is "a vs b" in ascii
+    struct HeavyRoom
+    {
+        int32_t pid;
+        uint8_t mode;
+        uint8_t overBudget;
+        uint64_t engineNs;
+        uint64_t messages;
+        uint64_t bytesOut[2];
+        char players[96];
+    };
+
+    int32_t pid;
+    //counters
+    uint64_t connectionsAccepted;
+    uint64_t connectionsRefused[REFUSALS];
+    uint64_t logins;
+    uint64_t duelsStarted;
+    uint64_t duelsFinished;
+    uint64_t observersDropped;
+    uint64_t duelistsTimedOut;
+    uint64_t ctosPackets[256];
+    uint64_t ctosBytes[256];
+    uint64_t stocPackets[256];
+    uint64_t stocBytes[256];
+    uint64_t relayBytes;
+    //the duel rooms: engine time, bytes to duelists and observers, rooms flagged by checkBudgets
+    uint64_t engineNs;
+    uint64_t roomBytes[2];
+    uint64_t roomsOverBudget;
+    Histogram matchmakingWait;
+    Histogram dbLatency;
+    Histogram loopLag;
+    //gauges
+    uint32_t connectionsOpen;
+    uint32_t connectionsPending;
+    uint32_t players[LOGIN_RESULTS];
+    uint32_t rooms[ROOM_STATES][ROOM_MODES];
+    uint64_t rssBytes;
+    //bytes waiting in the output buffers, of the duelists and of the observers: the total and the worst client
+    uint64_t queuedBytes[2];
+    uint64_t queuedMax[2];
+    //sorted by engine time, the unused entries are zero
+    HeavyRoom heavyRooms[HEAVY_ROOMS];
+
+    //the counters of a gameserver that exited stay in the totals of the father
+    void mergeCounters(const MetricsSnapshot& other);
+    void mergeGauges(const MetricsSnapshot& other);
+    //keeps the HEAVY_ROOMS heaviest
+    void addHeavyRoom(const HeavyRoom& room);
+};
+
+/*
+ * the counters of this gameserver. They are plain fields written by the network thread,
+ * the father gets a copy every few seconds with the stats: nothing is shared or locked.
+ */
+class Metrics
+{
+public:
+    static Metrics* getInstance();
+    MetricsSnapshot counters;
+
+    void packetIn(unsigned char type, size_t len)
+    {
+        counters.ctosPackets[type]++;
+        counters.ctosBytes[type] += len;
+    }
+    void packetOut(unsigned char type, size_t len)
+    {
+        counters.stocPackets[type]++;
+        counters.stocBytes[type] += len;
+    }
+    static int modeIndex(unsigned char mode);
+    //nullptr for the unknown types
+    static const char* ctosName(int type);
+    static const char* stocName(int type);
+
+    //a timer that measures how late the event loop runs it
+    void StartLagProbe(event_base* base);
+    void StopLagProbe();
+    static uint64_t readRss();
+
+    //text format of Prometheus, version 0.0.4
+    static void Render(std::string& out, const MetricsSnapshot& total, int gameservers, uint64_t fatherRss);
+
+    static const int LAG_PROBE_MS = 250;
+
+private:
+    Metrics();
+    event* lagProbe;
+    int64_t lagExpected;
+    static void lagProbe_cb(evutil_socket_t fd, short events, void* arg);
+};
+
+}
+#endif
@@ -0,0 +1,196 @@
+#include "MetricsEndpoint.h"
+#include "debug.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+namespace ygo
+{
+
+MetricsEndpoint::MetricsEndpoint(int port, RenderCallback render, void* ctx):port(port),listen_fd(-1),lastAttempt(0),render(render),ctx(ctx)
+{
+    tryListen();
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+    for(auto it = clients.cbegin(); it != clients.cend(); ++it)
+        close(it->first);
+    if(listen_fd >= 0)
+        close(listen_fd);
+}
+
+void MetricsEndpoint::tryListen()
+{
+    lastAttempt = time(NULL);
+    sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return;
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+    if(bind(fd,(sockaddr*)&addr,sizeof(addr)) || listen(fd,MAX_CLIENTS))
+    {
+        log(WARN,"metrics: cannot listen on port %d: %s\n",port,strerror(errno));
+        close(fd);
+        return;
+    }
+    listen_fd = fd;
+    log(INFO,"metrics on http://127.0.0.1:%d/metrics\n",port);
+}
+
+int MetricsEndpoint::prepareSelect(fd_set* rfds, fd_set* wfds)
+{
+    if(listen_fd < 0)
+    {
+        if(time(NULL) - lastAttempt >= RETRY_INTERVAL)
+            tryListen();
+        if(listen_fd < 0)
+            return -1;
+    }
+    int max_fd = listen_fd;
+    FD_SET(listen_fd,rfds);
+    for(auto it = clients.cbegin(); it != clients.cend(); ++it)
+    {
+        if(it->second.out.empty())
+            FD_SET(it->first,rfds);
+        else
+            FD_SET(it->first,wfds);
+        max_fd = std::max(max_fd,it->first);
+    }
+    return max_fd;
+}
+
+void MetricsEndpoint::handle(fd_set* rfds, fd_set* wfds)
+{
+    if(listen_fd < 0)
+        return;
+    if(FD_ISSET(listen_fd,rfds))
+        acceptClients();
+    time_t now = time(NULL);
+    for(auto it = clients.begin(); it != clients.end();)
+    {
+        bool ok = true;
+        if(FD_ISSET(it->first,wfds))
+            ok = writeClient(it->first,it->second);
+        else if(FD_ISSET(it->first,rfds))
+            ok = readClient(it->first,it->second);
+        if(ok && now - it->second.since > CLIENT_TIMEOUT)
+            ok = false;
+        if(!ok)
+        {
+            close(it->first);
+            it = clients.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void MetricsEndpoint::acceptClients()
+{
+    while(true)
+    {
+        int fd = accept4(listen_fd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+            return;
+        if(clients.size() >= MAX_CLIENTS)
+        {
+            close(fd);
+            continue;
+        }
+        Client& client = clients[fd];
+        client.since = time(NULL);
+    }
+}
+
+bool MetricsEndpoint::readClient(int fd, Client& client)
+{
+    char data[1024];
+    bool closed = false;
+    while(true)
+    {
+        int bytesread = read(fd,data,sizeof(data));
+        if(bytesread == 0)
+        {
+            //the client can close its side after the request
+            closed = true;
+            break;
+        }
+        if(bytesread < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        client.in.append(data,bytesread);
+        if(client.in.size() > MAX_REQUEST)
+            return false;
+    }
+    if(client.in.find("\r\n\r\n") == std::string::npos && client.in.find("\n\n") == std::string::npos)
+        return !closed;
+    respond(client);
+    return writeClient(fd,client);
+}
+
+void MetricsEndpoint::respond(Client& client)
+{
+    std::string body;
+    const char* status = "200 OK";
+    const char* type = "text/plain; version=0.0.4; charset=utf-8";
+    if(!client.in.compare(0,13,"GET /metrics ") || !client.in.compare(0,13,"GET /metrics?"))
+        render(body,ctx);
+    else
+    {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "only GET /metrics\n";
+    }
+    char head[256];
+    snprintf(head,sizeof(head),"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+             status,type,(int)body.size());
+    client.out = head;
+    client.out += body;
+    client.in.clear();
+}
+
+bool MetricsEndpoint::writeClient(int fd, Client& client)
+{
+    while(!client.out.empty())
+    {
+        int written = send(fd,client.out.data(),client.out.size(),MSG_NOSIGNAL);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client.out.erase(0,written);
+    }
+    //the answer is complete
+    return false;
+}
+
+void MetricsEndpoint::afterFork()
+{
+    for(auto it = clients.cbegin(); it != clients.cend(); ++it)
+        close(it->first);
+    clients.clear();
+    if(listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef _METRICSENDPOINT_H_
+#define _METRICSENDPOINT_H_
+#include <sys/select.h>
+#include <map>
+#include <string>
+#include <ctime>
+
+namespace ygo
+{
+
+/*
+ * GET /metrics on 127.0.0.1:metrics_port, served by the select loop of the father.
+ * Only a minimal HTTP/1.0: one request per connection, closed after the answer.
+ * The body is built by the callback when a request is complete.
+ * A port still taken (the old binary during an upgrade) is tried again later.
+ */
+class MetricsEndpoint
+{
+public:
+    typedef void (*RenderCallback)(std::string& body, void* ctx);
+    MetricsEndpoint(int port, RenderCallback render, void* ctx);
+    ~MetricsEndpoint();
+
+    int prepareSelect(fd_set* rfds, fd_set* wfds);
+    void handle(fd_set* rfds, fd_set* wfds);
+    void afterFork();
+
+    static const unsigned int MAX_CLIENTS = 8;
+    static const unsigned int MAX_REQUEST = 4096;
+    static const int CLIENT_TIMEOUT = 10;
+    static const int RETRY_INTERVAL = 10;
+
+private:
+    struct Client
+    {
+        std::string in;
+        std::string out;
+        time_t since;
+    };
+    int port;
+    int listen_fd;
+    time_t lastAttempt;
+    RenderCallback render;
+    void* ctx;
+    std::map<int,Client> clients;
+
+    void tryListen();
+    void acceptClients();
+    //false when the connection is finished
+    bool readClient(int fd, Client& client);
+    bool writeClient(int fd, Client& client);
+    void respond(Client& client);
+};
+
+}
+#endif
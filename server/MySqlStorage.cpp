@@ -0,0 +1,420 @@
+#include "MySqlStorage.h"
+#include "Config.h"
+#include <memory> //unique_ptr
+#include <cppconn/prepared_statement.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "MySqlWrapper.h"
+#include "Rating.h"
+#include <strings.h>
+namespace ygo
+{
+int MySqlStorage::getRank(std::string username)
+{
+
+    try
+    {
+        MySqlWrapper::Lease con;
+        //std::unique_ptr<sql::PreparedStatement> stmt(con->prepareStatement("SELECT rank from (SELECT username,score, @rownum := @rownum + 1 AS rank FROM stats, (SELECT @rownum := 0) r ORDER BY score DESC) z where username = ?"));
+        sql::PreparedStatement* stmt(con.prepare("SELECT rank from ranking where username = ?"));
+
+        stmt->setString(1, username);
+
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        if(!res->next())
+            return 0;
+        int rank = res->getInt(1);
+        return rank;
+    }
+    catch (sql::SQLException &e)
+    {
+        return 0;
+    }
+}
+
+bool MySqlStorage::loadScores(std::vector<std::pair<std::string,int>>& scores)
+{
+    try
+    {
+        MySqlWrapper::Lease con;
+        std::unique_ptr<sql::Statement> stmt(con.connection()->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT username, score from stats"));
+        scores.reserve(res->rowsCount());
+        while(res->next())
+            scores.push_back(std::make_pair(std::string(res->getString(1)),res->getInt(2)));
+        return true;
+    }
+    catch (sql::SQLException &e)
+    {
+        MySqlWrapper::getInstance()->notifyException(e);
+        return false;
+    }
+}
+
+std::string MySqlStorage::getCountryCode(std::string ip)
+{
+
+
+
+    std::string binaryIP = "";
+    binaryIP.resize(4);
+    if(inet_pton(AF_INET,ip.c_str(),&binaryIP[0]) != 1)
+        return "UNK";
+
+    try
+    {
+        MySqlWrapper::Lease con;
+
+        sql::PreparedStatement* stmt(con.prepare("select country from `dbip_lookup` where addr_type = 'ipv4' and ip_start <= ? order by ip_start desc limit 1"));
+
+        stmt->setString(1, binaryIP);
+
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        if(!res->next())
+            return "UNK";
+        std::string country = res->getString(1);
+        return country;
+    }
+
+    catch (sql::SQLException &e)
+    {
+        return "UNK";
+
+    }
+
+
+
+}
+
+std::pair<int,int> MySqlStorage::getScore(std::string username)
+{
+
+    try
+    {
+                MySqlWrapper::Lease con;
+
+        //std::unique_ptr<sql::PreparedStatement> stmt(con->prepareStatement("SELECT rank from (SELECT username,score, @rownum := @rownum + 1 AS rank FROM stats, (SELECT @rownum := 0) r ORDER BY score DESC) z where username = ?"));
+        sql::PreparedStatement* stmt(con.prepare("select ranking.score,stats.score from ranking join stats where ranking.username=stats.username and ranking.username = ?"));
+
+        stmt->setString(1, username);
+
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        if(!res->next())
+            return std::pair<int,int>(0,0);
+        int score = res->getInt(1);
+        int gameScore = res->getInt(2);
+        return std::pair<int,int>(score,gameScore);
+    }
+    catch (sql::SQLException &e)
+    {
+        return std::pair<int,int>(0,0);
+
+    }
+}
+
+bool MySqlStorage::setUserStats(UserStats &us)
+{
+
+    //true is success
+    int retries = 3;
+    do
+    {
+        try
+        {
+                    MySqlWrapper::Lease con;
+
+            sql::PreparedStatement* stmt(con.prepare("UPDATE stats SET score = ?, wins = ?, losses = ?, draws = ?,tags = ? WHERE username = ?"));
+            //stmt->setQueryTimeout(5);
+            stmt->setString(6, us.username);
+            stmt->setInt(1, us.score);
+            stmt->setInt(2, us.wins);
+            stmt->setInt(3, us.losses);
+            stmt->setInt(4, us.draws);
+            stmt->setInt(5, us.tags);
+            int updateCount = stmt->executeUpdate();
+            return updateCount > 0;
+        }
+        catch (sql::SQLException &e)
+        {
+            MySqlWrapper::getInstance()->notifyException(e);
+        }
+    }
+    while (--retries > 0);
+    return false;
+}
+
+static const char* ratingColumns[] = {"score","wins","losses","draws","tags"};
+
+static int ratingValue(const UserStats& us,int column)
+{
+    int values[] = {(int)us.score,(int)us.wins,(int)us.losses,(int)us.draws,(int)us.tags};
+    return values[column];
+}
+
+//called inside the transaction, the players stay locked until the commit
+static bool lockAndRate(MySqlWrapper::Lease& con,RatingUpdate& ru)
+{
+    unsigned int n = ru.names.size();
+    std::string in = "(?";
+    for(unsigned int i = 1; i < n; i++)
+        in += ",?";
+    in += ")";
+
+    sql::PreparedStatement* select(con.prepare("SELECT username,score,wins,losses,draws,tags FROM stats WHERE username IN " + in + " FOR UPDATE"));
+    for(unsigned int i = 0; i < n; i++)
+        select->setString(i + 1, ru.names[i]);
+    std::unique_ptr<sql::ResultSet> res(select->executeQuery());
+    ru.statements++;
+
+    //the same player can be twice (handicap)
+    ru.before.assign(n,UserStats());
+    std::vector<bool> found(n,false);
+    while(res->next())
+    {
+        UserStats us;
+        us.username =res->getString(1);
+        us.score = res->getInt(2);
+        us.wins = res->getInt(3);
+        us.losses = res->getInt(4);
+        us.draws =res->getInt(5);
+        us.tags =res->getInt(6);
+        for(unsigned int i = 0; i < n; i++)
+            if(!strcasecmp(us.username.c_str(),ru.names[i].c_str()))
+            {
+                ru.before[i] = us;
+                found[i] = true;
+            }
+    }
+    for(unsigned int i = 0; i < n; i++)
+        if(!found[i])
+            ru.missing.push_back(ru.names[i]);
+    if(!ru.missing.empty())
+        return false;
+
+    ru.after = Rating::update(ru.before,ru.risultato);
+
+    //CASE takes only the first WHEN that matches: a player twice keeps the result of his
+    //last position, like the old UPDATE for each player
+    std::vector<unsigned int> rows;
+    for(unsigned int i = 0; i < n; i++)
+    {
+        unsigned int r = 0;
+        while(r < rows.size() && strcasecmp(ru.after[rows[r]].username.c_str(),ru.after[i].username.c_str()))
+            r++;
+        if(r < rows.size())
+            rows[r] = i;
+        else
+            rows.push_back(i);
+    }
+    std::string rowsIn = "(?";
+    for(unsigned int r = 1; r < rows.size(); r++)
+        rowsIn += ",?";
+    rowsIn += ")";
+
+    //one UPDATE for all the players: column = CASE username WHEN ? THEN ? ... END
+    std::string query = "UPDATE stats SET ";
+    for(unsigned int c = 0; c < sizeof(ratingColumns)/sizeof(ratingColumns[0]); c++)
+    {
+        query += std::string(c?", ":"") + ratingColumns[c] + " = CASE username";
+        for(unsigned int r = 0; r < rows.size(); r++)
+            query += " WHEN ? THEN ?";
+        query += " END";
+    }
+    query += " WHERE username IN " + rowsIn;
+
+    sql::PreparedStatement* update(con.prepare(query));
+    int pos = 1;
+    for(unsigned int c = 0; c < sizeof(ratingColumns)/sizeof(ratingColumns[0]); c++)
+        for(unsigned int r = 0; r < rows.size(); r++)
+        {
+            update->setString(pos++, ru.after[rows[r]].username);
+            update->setInt(pos++, ratingValue(ru.after[rows[r]],c));
+        }
+    for(unsigned int r = 0; r < rows.size(); r++)
+        update->setString(pos++, ru.after[rows[r]].username);
+    update->executeUpdate();
+    ru.statements++;
+    return true;
+}
+
+bool MySqlStorage::updateRatings(RatingUpdate& ru)
+{
+    //START TRANSACTION, SELECT ... FOR UPDATE, UPDATE, COMMIT: 4 round trips for any number of players
+    int retries = 3;
+    do
+    {
+        ru.statements = 0;
+        try
+        {
+            MySqlWrapper::Lease con;
+            std::unique_ptr<sql::Statement> tx(con.connection()->createStatement());
+            tx->execute("START TRANSACTION");
+            ru.statements++;
+            try
+            {
+                bool ok = lockAndRate(con,ru);
+                tx->execute(ok?"COMMIT":"ROLLBACK");
+                ru.statements++;
+                return ok;
+            }
+            catch (sql::SQLException &e)
+            {
+                //the connection goes back to the pool: no transaction left open
+                try
+                {
+                    tx->execute("ROLLBACK");
+                }
+                catch (sql::SQLException &e2)
+                {
+                }
+                throw;
+            }
+        }
+        catch (sql::SQLException &e)
+        {
+            MySqlWrapper::getInstance()->notifyException(e);
+        }
+    }
+    while (--retries > 0);
+    return false;
+}
+
+UserStats MySqlStorage::getUserStats(std::string username)
+{
+
+    //true is success
+    try
+    {
+                MySqlWrapper::Lease con;
+
+        sql::PreparedStatement* stmt(con.prepare("SELECT username,score,wins,losses,draws,tags FROM stats where username = ?"));
+        //sql::PreparedStatement *stmt = con->prepareStatement("INSERT INTO users VALUES (?, ?, ?)");
+        stmt->setString(1, username);
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        if(!res->next())
+            throw std::exception();
+        UserStats us;
+        us.username =res->getString(1);
+        us.score = res->getInt(2);
+        us.wins = res->getInt(3);
+        us.losses = res->getInt(4);
+        us.draws =res->getInt(5);
+        us.tags =res->getInt(6);
+        return us;
+
+    }
+    catch (sql::SQLException &e)
+    {
+        MySqlWrapper::getInstance()->notifyException(e);
+        throw std::exception();
+    }
+
+}
+
+
+bool MySqlStorage::createUser(std::string username, std::string password, int score,int wins,int losses,int draws)
+{
+
+    try
+    {
+                MySqlWrapper::Lease con;
+
+        sql::PreparedStatement* stmt(con.prepare("INSERT INTO users(username,password) VALUES (?, ?)"));
+        //sql::PreparedStatement *stmt = con->prepareStatement("INSERT INTO users VALUES (?, ?, ?)");
+        stmt->setString(1, username);
+        stmt->setString(2, password);
+        stmt->execute();
+        sql::PreparedStatement* stmt_stats(con.prepare("INSERT INTO stats(username,score,wins,losses,draws) VALUES (?, ?, ?,?,?)"));
+        stmt_stats->setString(1, username);
+        stmt_stats->setInt(2,score);
+        stmt_stats->setInt(3,wins);
+        stmt_stats->setInt(4,losses);
+        stmt_stats->setInt(5,draws);
+        stmt_stats->execute();
+    }
+    catch (sql::SQLException &e)
+    {
+        MySqlWrapper::getInstance()->notifyException(e);
+        return false;
+    }
+    return true;
+}
+
+bool MySqlStorage::userExists(std::string username)
+{
+
+    try
+    {
+                MySqlWrapper::Lease con;
+
+        sql::PreparedStatement* stmt(con.prepare("select count(*) FROM users WHERE username = ?"));
+        stmt->setString(1, username);
+
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        res->next();
+        int trovato = res->getInt(1);
+        return (trovato>0);
+    }
+    catch (sql::SQLException &e)
+    {
+        std::cout<<"errore in userexists\n";
+        return false;
+    }
+    return true;
+}
+
+int MySqlStorage::login(std::string username,std::string password,char*ip)
+{
+
+    try
+    {
+                MySqlWrapper::Lease con;
+
+        sql::PreparedStatement* stmt(con.prepare("select password,color FROM users WHERE username = ?"));
+        stmt->setString(1, username);
+        //stmt->setString(2, password);
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        if(!res->next())
+            return createUser(username,password)?1:-1;
+
+        int risultato = 1;
+        std::string realPassword = res->getString(1);
+        if(realPassword != "" && password != realPassword)
+            return 0;
+        else if(realPassword != "" && password == realPassword)
+            risultato = 1+res->getInt(2);
+        //login success
+
+        sql::PreparedStatement* stmt2(con.prepare("UPDATE users set password = ?, last_login = CURRENT_TIMESTAMP,last_ip = ? WHERE username = ?"));
+        stmt2->setString(1,password);
+        stmt2->setString(2,ip);
+        stmt2->setString(3, username);
+
+        stmt2->execute();
+        return risultato;
+    }
+    catch (sql::SQLException &e)
+    {
+        MySqlWrapper::getInstance()->notifyException(e);
+        std::cout<<"errore in userexists\n";
+        return -1;
+    }
+}
+
+bool MySqlStorage::isAvailable()
+{
+    return MySqlWrapper::getInstance()->isAvailable();
+}
+
+MySqlStorage::MySqlStorage()
+{
+
+}
+MySqlStorage::~MySqlStorage()
+{
+
+}
+
+
+}
@@ -0,0 +1,31 @@
+#ifndef _MYSQLSTORAGE_H_
+#define _MYSQLSTORAGE_H_
+#include <mysql_connection.h>
+#include "mysql_driver.h"
+#include <cppconn/driver.h>
+#include <cppconn/exception.h>
+#include <cppconn/resultset.h>
+#include "StorageBackend.h"
+namespace ygo
+{
+
+class MySqlStorage: public StorageBackend
+{
+public:
+    MySqlStorage();
+    ~MySqlStorage();
+    bool isAvailable();
+    bool createUser(std::string username, std::string password, int score=default_score,int wins=0,int losses=0,int draws=0);
+    bool userExists(std::string username);
+    int login(std::string username,std::string password,char*ip);
+    UserStats getUserStats(std::string username);
+    bool setUserStats(UserStats&);
+    bool updateRatings(RatingUpdate& update);
+    int getRank(std::string username);
+    bool loadScores(std::vector<std::pair<std::string,int>>& scores);
+    std::pair<int,int> getScore(std::string username);
+    std::string getCountryCode(std::string);
+};
+
+}
+#endif
@@ -1,31 +1,30 @@
 #include "MySqlWrapper.h"
 #include "Config.h"
+#include "debug.h"
 #include <cppconn/driver.h>
 #include "mysql_driver.h"
+#include <chrono>
+#include <string.h>
 
 
 namespace ygo
 {
 
+static thread_local MySqlWrapper::Lease* currentLease = nullptr;
+//taken by reference by chrono
+const int MySqlWrapper::PROBE_INTERVAL;
 
-
-MySqlWrapper::MySqlWrapper():con(nullptr),connectRequested(false),backoff(0)
+MySqlWrapper::MySqlWrapper():connectRequested(false),backoff(0),acquisitions(0),waits(0),waitTimeMs(0),maxWaitMs(0),
+    inUse(0),prepareHits(0),prepareMisses(0),reconnects(0),rejected(0),timeouts(0),circuit(CLOSED),consecutiveFailures(0),probeThread(nullptr)
 {
-
+    poolMutex = new std::mutex();
+    poolCond = new std::condition_variable();
+    memset(&latency,0,sizeof(latency));
 }
 
 MySqlWrapper::~MySqlWrapper()
 {
-    if(con)
-    {
-        delete con;
-        con = nullptr;
-    }
-}
-
-bool MySqlWrapper::connectionEstablished()
-{
-    return con && (!con->isClosed());
+    //the static destructors run also in the children: nothing is closed here
 }
 
 void MySqlWrapper::notifyException(sql::SQLException &e)
@@ -41,23 +40,101 @@ void MySqlWrapper::notifyException(sql::SQLException &e)
         }
         if(1205 == e.getErrorCode() )
             backoff = time(NULL);
+        //server gone away, lost connection: the connection of this thread is not reused
+        if(e.getErrorCode() == 2006 || e.getErrorCode() == 2013 || e.getErrorCode() == 2055)
+            if(currentLease != nullptr && currentLease->connection() != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(*poolMutex);
+                for(auto pc : pool)
+                    if(pc->con == currentLease->connection())
+                        pc->broken = true;
+            }
 
 }
 
 
 void MySqlWrapper::connect()
 {
+    //the connections are opened when they are needed
     connectRequested = true;
-    if(con && !con->isClosed())
-        return;
+    networkThread = std::this_thread::get_id();
+    if(probeThread == nullptr)
+        probeThread = new std::thread(&MySqlWrapper::ProbeThread,this);
+}
+
+bool MySqlWrapper::isAvailable()
+{
+    return connectRequested && !Config::getInstance()->disableMysql && circuit != OPEN;
+}
 
-    if(con && con->isClosed())
+MySqlWrapper::CircuitState MySqlWrapper::getCircuitState()
+{
+    return (CircuitState)circuit.load();
+}
+
+void MySqlWrapper::addHealthyCallback(HealthyCallback callback)
+{
+    std::lock_guard<std::mutex> lock(*poolMutex);
+    healthyCallbacks.push_back(callback);
+}
+
+void MySqlWrapper::recordSuccess()
+{
+    consecutiveFailures = 0;
+    if(circuit != CLOSED)
+    {
+        log(INFO,"mysql is back, circuit closed\n");
+        circuit = CLOSED;
+    }
+}
+
+void MySqlWrapper::recordFailure()
+{
+    if(circuit == HALF_OPEN || ++consecutiveFailures >= FAILURE_THRESHOLD)
+    {
+        if(circuit != OPEN)
+            log(WARN,"mysql is not answering, circuit open: the queries fail at once until a probe succeeds\n");
+        circuit = OPEN;
+    }
+}
+
+void MySqlWrapper::ProbeThread()
+{
+    //never returns, the thread is not joined (like the one of the external chat)
+    while(true)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(PROBE_INTERVAL));
+        if(!connectRequested || Config::getInstance()->disableMysql)
+            continue;
+        if(circuit == OPEN)
         {
+            sql::Connection* con = openConnection();
+            if(con != nullptr && con->isValid())
+            {
+                log(INFO,"mysql probe succeeded, circuit half open\n");
+                circuit = HALF_OPEN;
+            }
             delete con;
-            con = nullptr;
         }
+        else if(circuit == CLOSED)
+        {
+            std::vector<HealthyCallback> callbacks;
+            {
+                std::lock_guard<std::mutex> lock(*poolMutex);
+                callbacks = healthyCallbacks;
+            }
+            for(auto callback : callbacks)
+                callback();
+        }
+    }
+}
+
+sql::Connection * MySqlWrapper::openConnection()
+{
+    //a new connection, not shared: used also by the threads that need their own
     Config* config = Config::getInstance();
     std::string host = "tcp://" + config->mysql_host + ":3306";
+    sql::Connection *con = nullptr;
     try
     {
         /* Create a connection */
@@ -86,13 +163,58 @@ void MySqlWrapper::connect()
     }
     catch (sql::SQLException &e)
     {
-        MySqlWrapper::getInstance()->notifyException(e);
+        if(Config::getInstance()->debugSql)
+            std::cout << "# ERR: cannot connect to mysql: " << e.what() << " (MySQL error code: " << e.getErrorCode() << ")" << std::endl;
+        if(con)
+            delete con;
+        con = nullptr;
+    }
+    return con;
+}
+
+void MySqlWrapper::closeConnection(PooledConnection* pc)
+{
+    for(auto it = pc->statements.begin(); it != pc->statements.end(); ++it)
+        delete it->second;
+    pc->statements.clear();
+    if(pc->con)
+    {
+        try
+        {
+            pc->con->close();
+        }
+        catch (sql::SQLException &e)
+        {
+        }
+        delete pc->con;
+        pc->con = nullptr;
+    }
+    pc->broken = false;
+}
 
+bool MySqlWrapper::ensureConnected(PooledConnection* pc)
+{
+    //called without the lock, the connection is already reserved
+    time_t now = time(NULL);
+    if(pc->con && (pc->broken || pc->con->isClosed()))
+        closeConnection(pc);
+    else if(pc->con && now - pc->lastUsed > HEALTH_CHECK_INTERVAL && !pc->con->isValid())
+    {
+        log(INFO,"mysql connection not valid anymore, reconnecting\n");
+        closeConnection(pc);
     }
+    if(pc->con)
+        return true;
 
+    pc->con = openConnection();
+    if(pc->con == nullptr)
+        return false;
+    if(pc->lastUsed)
+        reconnects++;
+    return true;
 }
 
-sql::Connection * MySqlWrapper::getConnection()
+MySqlWrapper::PooledConnection* MySqlWrapper::acquire()
 {
     if(backoff)
     {
@@ -106,20 +228,165 @@ sql::Connection * MySqlWrapper::getConnection()
         throw sql::SQLException();
     if(!connectRequested)
         throw sql::SQLException();
-    if(!connectionEstablished())
-        connect();
-    if(!connectionEstablished())
+    if(circuit == OPEN)
+    {
+        //no connect on the network thread while mysql is down
+        rejected++;
         throw sql::SQLException();
-    return con;
+    }
+
+    PooledConnection* pc = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(*poolMutex);
+        if(pool.empty())
+            for(int i = 0; i < std::max(1,Config::getInstance()->mysql_pool_size); i++)
+                pool.push_back(new PooledConnection());
+
+        auto start = std::chrono::steady_clock::now();
+        int maxWait = std::this_thread::get_id() == networkThread ? NETWORK_WAIT_MS : MAX_WAIT_MS;
+        bool waited = false;
+        while(true)
+        {
+            //an open connection first, then one to open
+            for(auto p : pool)
+                if(!p->inUse && p->con)
+                {
+                    pc = p;
+                    break;
+                }
+            if(pc == nullptr)
+                for(auto p : pool)
+                    if(!p->inUse)
+                    {
+                        pc = p;
+                        break;
+                    }
+            if(pc != nullptr)
+                break;
+            waited = true;
+            if(poolCond->wait_until(lock,start + std::chrono::milliseconds(maxWait)) == std::cv_status::timeout)
+            {
+                timeouts++;
+                log(WARN,"no mysql connection available after %d ms\n",maxWait);
+                throw sql::SQLException();
+            }
+        }
+        pc->inUse = true;
+        pc->leasedAt = start;
+        inUse++;
+        acquisitions++;
+        if(waited)
+        {
+            unsigned long waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            waits++;
+            waitTimeMs += waitMs;
+            maxWaitMs = std::max(maxWaitMs,waitMs);
+        }
+    }
+
+    if(!ensureConnected(pc))
+    {
+        recordFailure();
+        release(pc);
+        throw sql::SQLException();
+    }
+    return pc;
+}
+
+void MySqlWrapper::release(PooledConnection* pc)
+{
+    std::lock_guard<std::mutex> lock(*poolMutex);
+    if(pc->broken)
+    {
+        recordFailure();
+        closeConnection(pc);
+    }
+    else if(pc->con)
+        recordSuccess();
+    pc->lastUsed = time(NULL);
+    pc->inUse = false;
+    inUse--;
+    latency.observe(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - pc->leasedAt).count());
+    poolCond->notify_one();
+}
+
+MySqlWrapper::Lease::Lease():pc(nullptr),owner(false)
+{
+    if(currentLease != nullptr)
+    {
+        pc = currentLease->pc;
+        return;
+    }
+    pc = MySqlWrapper::getInstance()->acquire();
+    owner = true;
+    currentLease = this;
+}
+
+MySqlWrapper::Lease::~Lease()
+{
+    if(!owner)
+        return;
+    currentLease = nullptr;
+    MySqlWrapper::getInstance()->release(pc);
+}
+
+sql::Connection* MySqlWrapper::Lease::connection()
+{
+    return pc->con;
+}
+
+sql::PreparedStatement* MySqlWrapper::Lease::prepare(const std::string& query)
+{
+    MySqlWrapper* wrapper = MySqlWrapper::getInstance();
+    auto it = pc->statements.find(query);
+    if(it != pc->statements.end())
+    {
+        wrapper->prepareHits++;
+        return it->second;
+    }
+    sql::PreparedStatement* stmt = pc->con->prepareStatement(query);
+    pc->statements[query] = stmt;
+    wrapper->prepareMisses++;
+    return stmt;
 }
 
 void MySqlWrapper::disconnect()
 {
     connectRequested = false;
-    if(con == nullptr)
-        return;
-    con->close();
+    std::lock_guard<std::mutex> lock(*poolMutex);
+    for(auto pc : pool)
+        if(!pc->inUse)
+            closeConnection(pc);
+
+}
+
+void MySqlWrapper::resetAfterFork()
+{
+    //the sockets are shared with the father and another thread could have had the lock:
+    //everything is left as it is and a new pool is started
+    poolMutex = new std::mutex();
+    poolCond = new std::condition_variable();
+    pool.clear();
+    inUse = 0;
+    memset(&latency,0,sizeof(latency));
+    currentLease = nullptr;
+    //the probe thread exists only in the father, connect() starts the one of the child
+    probeThread = nullptr;
+}
+
+void MySqlWrapper::LogStats()
+{
+    std::lock_guard<std::mutex> lock(*poolMutex);
+    static const char* states[] = {"closed","open","half open"};
+    log(VERBOSE,"mysql pool: %d connections, %u in use, %lu leases, %lu waits (%lu ms, max %lu ms), prepare %lu hits %lu misses, %lu reconnects, %lu timeouts, circuit %s (%lu rejected)\n",
+        (int)pool.size(),inUse,acquisitions,waits,waitTimeMs,maxWaitMs,prepareHits.load(),prepareMisses.load(),reconnects,
+        timeouts,states[circuit.load()],rejected);
+}
 
+Histogram MySqlWrapper::getLatency()
+{
+    std::lock_guard<std::mutex> lock(*poolMutex);
+    return latency;
 }
 
 MySqlWrapper* MySqlWrapper::getInstance()
@@ -3,25 +3,125 @@
 
 #include <mysql_connection.h>
 #include <cppconn/statement.h>
+#include <cppconn/prepared_statement.h>
 #include <cppconn/exception.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "Metrics.h"
 namespace ygo
 {
+/*
+ * pool of mysql connections, each one with its cache of prepared statements.
+ * A Lease takes a connection for the lifetime of the object:
+ *     MySqlWrapper::Lease con;
+ *     sql::PreparedStatement* stmt = con.prepare("select ...");
+ * the statements belong to the connection, they must not be deleted.
+ * A thread that already holds a lease gets the same connection again,
+ * so the functions that call each other do not need two connections.
+ * When all the connections are leased the lease waits for one: MAX_WAIT_MS on the
+ * worker threads, NETWORK_WAIT_MS on the thread that called connect(), the event loop,
+ * where every player waits with it. After the wait the lease throws like a failed query.
+ *
+ * Circuit breaker: after FAILURE_THRESHOLD failures in a row the circuit opens and
+ * every lease fails at once, without touching the network. A background thread tries
+ * a connection every PROBE_INTERVAL seconds, when it works the circuit is half open:
+ * the next lease decides if it closes or opens again.
+ */
 class MySqlWrapper
 {
+    struct PooledConnection
+    {
+        sql::Connection* con;
+        std::unordered_map<std::string,sql::PreparedStatement*> statements;
+        bool inUse;
+        bool broken;
+        time_t lastUsed;
+        std::chrono::steady_clock::time_point leasedAt;
+        PooledConnection():con(nullptr),inUse(false),broken(false),lastUsed(0) {}
+    };
+
     public:
 
+    enum CircuitState {CLOSED,OPEN,HALF_OPEN};
+    typedef void (*HealthyCallback)();
+
+    class Lease
+    {
+        public:
+        Lease();
+        ~Lease();
+        sql::PreparedStatement* prepare(const std::string& query);
+        sql::Connection* connection();
+        private:
+        PooledConnection* pc;
+        bool owner;
+        Lease(const Lease&);
+        Lease& operator=(const Lease&);
+    };
+
     static MySqlWrapper* getInstance();
     void connect();
     void disconnect();
-    sql::Connection * getConnection();
+    //in the gameserver after the fork: the connections of the father are forgotten, not closed
+    void resetAfterFork();
+    sql::Connection * openConnection();
     void notifyException(sql::SQLException &e);
+    void LogStats();
+    //how long the leases lasted, waits included
+    Histogram getLatency();
+    //false if a query would fail at once: circuit open or mysql disabled
+    bool isAvailable();
+    CircuitState getCircuitState();
+    //called by the probe thread while the circuit is closed (replay of the offline work)
+    void addHealthyCallback(HealthyCallback callback);
+
+    static const int HEALTH_CHECK_INTERVAL = 30;
+    static const int MAX_WAIT_MS = 5000;
+    static const int NETWORK_WAIT_MS = 100;
+    static const int FAILURE_THRESHOLD = 3;
+    static const int PROBE_INTERVAL = 5;
 
     private:
     time_t backoff;
-    sql::Connection *con;
     bool connectRequested;
+    std::thread::id networkThread;
+
+    std::vector<PooledConnection*> pool;
+    //pointers: after the fork the child makes new ones, the old ones could be locked
+    std::mutex* poolMutex;
+    std::condition_variable* poolCond;
+
+    //metrics
+    unsigned long acquisitions;
+    unsigned long waits;
+    unsigned long waitTimeMs;
+    unsigned long maxWaitMs;
+    unsigned int inUse;
+    std::atomic<unsigned long> prepareHits;
+    std::atomic<unsigned long> prepareMisses;
+    unsigned long reconnects;
+    unsigned long rejected;
+    unsigned long timeouts;
+    Histogram latency;
+
+    std::atomic<int> circuit;
+    std::atomic<int> consecutiveFailures;
+    std::thread* probeThread;
+    std::vector<HealthyCallback> healthyCallbacks;
+    void recordSuccess();
+    void recordFailure();
+    void ProbeThread();
 
-    bool connectionEstablished();
+    PooledConnection* acquire();
+    void release(PooledConnection* pc);
+    bool ensureConnected(PooledConnection* pc);
+    void closeConnection(PooledConnection* pc);
 
     MySqlWrapper();
     public:
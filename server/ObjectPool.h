@@ -0,0 +1,186 @@
+#ifndef _OBJECTPOOL_H_
+#define _OBJECTPOOL_H_
+#include <stddef.h>
+#include <malloc.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+#include "debug.h"
+
+namespace ygo
+{
+
+/*
+ * Free list allocators for the objects created and destroyed all the time
+ * (players, rooms, duels, replay buffers).
+ * The memory is taken in slabs: a freed object goes in the free list and the next new
+ * of the same class takes it, the constructor resets it.
+ * Trim gives back the slabs left empty by a spike, keeping a quarter of the objects in
+ * use (at least a slab) free for the next ones. new and delete stay O(1), the trim walks
+ * the free list and runs from the stats timer.
+ * Not thread safe, each gameserver uses them only from its event loop.
+ */
+class ObjectPoolBase
+{
+public:
+    const char* name;
+    unsigned int inUse;
+    unsigned int highWater;
+    unsigned int capacity;
+    unsigned int allocations;
+    unsigned int released;
+
+    //the slabs given back, 0 if nothing was free enough
+    virtual size_t Trim() = 0;
+
+    static void TrimAll()
+    {
+        size_t count = 0;
+        for(auto pool : getPools())
+            count += pool->Trim();
+        //a small slab goes back to the free lists of malloc, not to the system
+        if(count)
+            malloc_trim(0);
+    }
+    static void LogStats()
+    {
+        for(auto pool : getPools())
+            log(VERBOSE,"pool %s: %u in use, %u max, %u allocated, %u new, %u released\n",pool->name,
+                pool->inUse,pool->highWater,pool->capacity,pool->allocations,pool->released);
+    }
+    static std::vector<ObjectPoolBase*>& getPools()
+    {
+        static std::vector<ObjectPoolBase*> pools;
+        return pools;
+    }
+
+protected:
+    ObjectPoolBase(const char* name):name(name),inUse(0),highWater(0),capacity(0),allocations(0),released(0)
+    {
+        getPools().push_back(this);
+    }
+};
+
+template<class T, size_t SLAB_SIZE = 32>
+class ObjectPool: public ObjectPoolBase
+{
+    union Chunk
+    {
+        Chunk* next;
+        alignas(T) char storage[sizeof(T)];
+    };
+    Chunk* freeList;
+    std::vector<Chunk*> slabs;
+
+    ObjectPool(const char* name):ObjectPoolBase(name),freeList(nullptr) {}
+
+    //slabs sorted by address
+    size_t slabOf(Chunk* c) const
+    {
+        return std::upper_bound(slabs.begin(), slabs.end(), c, std::less<Chunk*>()) - slabs.begin() - 1;
+    }
+
+public:
+    static ObjectPool* getInstance(const char* name)
+    {
+        //never destroyed: objects can still be deleted by the static destructors
+        static ObjectPool* pool = new ObjectPool(name);
+        return pool;
+    }
+
+    void* allocate(size_t size)
+    {
+        //a derived class without its own pool
+        if(size != sizeof(T))
+            return ::operator new(size);
+        if(freeList == nullptr)
+        {
+            Chunk* slab = new Chunk[SLAB_SIZE];
+            slabs.push_back(slab);
+            for(size_t i = 0; i < SLAB_SIZE; i++)
+            {
+                slab[i].next = freeList;
+                freeList = &slab[i];
+            }
+            capacity += SLAB_SIZE;
+        }
+        Chunk* c = freeList;
+        freeList = c->next;
+        allocations++;
+        if(++inUse > highWater)
+            highWater = inUse;
+        return c;
+    }
+
+    void deallocate(void* p, size_t size)
+    {
+        if(p == nullptr)
+            return;
+        if(size != sizeof(T))
+        {
+            ::operator delete(p);
+            return;
+        }
+        Chunk* c = (Chunk*)p;
+        c->next = freeList;
+        freeList = c;
+        inUse--;
+    }
+
+    size_t Trim()
+    {
+        size_t reserve = std::max(SLAB_SIZE, (size_t)inUse / 4);
+        size_t spare = capacity - inUse;
+        if(spare < reserve + SLAB_SIZE)
+            return 0;
+        std::sort(slabs.begin(), slabs.end(), std::less<Chunk*>());
+        std::vector<size_t> freeChunks(slabs.size(), 0);
+        for(Chunk* c = freeList; c != nullptr; c = c->next)
+            freeChunks[slabOf(c)]++;
+        std::vector<bool> empty(slabs.size(), false);
+        size_t count = 0;
+        for(size_t i = 0; i < slabs.size() && spare >= reserve + SLAB_SIZE; i++)
+            if(freeChunks[i] == SLAB_SIZE)
+            {
+                empty[i] = true;
+                spare -= SLAB_SIZE;
+                count++;
+            }
+        if(!count)
+            return 0;
+        //the free list without the chunks of the empty slabs, then the slabs
+        for(Chunk** link = &freeList; *link != nullptr;)
+        {
+            if(empty[slabOf(*link)])
+                *link = (*link)->next;
+            else
+                link = &(*link)->next;
+        }
+        size_t kept = 0;
+        for(size_t i = 0; i < slabs.size(); i++)
+        {
+            if(empty[i])
+                delete[] slabs[i];
+            else
+                slabs[kept++] = slabs[i];
+        }
+        slabs.resize(kept);
+        capacity -= count * SLAB_SIZE;
+        released += count;
+        return count;
+    }
+};
+
+}
+
+#define DECLARE_POOLED_NEW(CLASS) \
+    static void* operator new(size_t size) \
+    { \
+        return ObjectPool<CLASS>::getInstance(#CLASS)->allocate(size); \
+    } \
+    static void operator delete(void* p, size_t size) \
+    { \
+        ObjectPool<CLASS>::getInstance(#CLASS)->deallocate(p,size); \
+    }
+
+#endif
@@ -0,0 +1,151 @@
+#include "RankIndex.h"
+#include "UsersDatabase.h"
+#include "IpcFrame.h"
+#include "debug.h"
+#include <algorithm>
+
+namespace ygo
+{
+
+RankIndex::RankIndex():tree(MAX_SCORE + 1,0),loaded(false)
+{
+}
+
+RankIndex* RankIndex::getInstance()
+{
+    static RankIndex ri;
+    return &ri;
+}
+
+bool RankIndex::load()
+{
+    int64_t start = IpcFrame::nowMs();
+    std::vector<std::pair<std::string,int>> all;
+    {
+        UsersDatabase database;
+        if(!database.loadScores(all))
+        {
+            log(WARN,"cannot load the rank index, the ranks are read from the database\n");
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    scores.clear();
+    ordered.clear();
+    std::fill(tree.begin(),tree.end(),0);
+    for(auto it = all.cbegin(); it != all.cend(); ++it)
+        insert(it->first,it->second);
+    loaded = true;
+    log(INFO,"rank index: %u players loaded in %d ms\n",(unsigned int)scores.size(),(int)(IpcFrame::nowMs() - start));
+    return true;
+}
+
+bool RankIndex::isLoaded()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return loaded;
+}
+
+void RankIndex::update(const std::string& username,int score)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!loaded)
+        return;
+    insert(username,score);
+    //the father could be gone: the queue does not grow forever
+    if(pending.size() > IpcFrame::MAX_PAYLOAD / 2)
+    {
+        log(WARN,"rank update of %s not sent, the queue is full\n",username.c_str());
+        return;
+    }
+    IpcFrame::appendRank(pending,username,score);
+}
+
+void RankIndex::apply(const std::string& username,int score)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(loaded)
+        insert(username,score);
+}
+
+bool RankIndex::takeUpdates(std::string& payload)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(pending.empty())
+        return false;
+    payload.swap(pending);
+    pending.clear();
+    return true;
+}
+
+int RankIndex::getRank(const std::string& username)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = scores.find(key(username));
+    if(it == scores.end())
+        return 0;
+    return 1 + scores.size() - countAtMost(it->second.score);
+}
+
+std::vector<std::pair<std::string,int>> RankIndex::top(unsigned int n)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<std::string,int>> result;
+    for(auto it = ordered.cbegin(); it != ordered.cend() && result.size() < n; ++it)
+        result.push_back(std::make_pair(it->second,it->first));
+    return result;
+}
+
+unsigned int RankIndex::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return scores.size();
+}
+
+void RankIndex::insert(const std::string& username,int score)
+{
+    if(username.empty() || username[0] == '-')
+        return;
+    Entry& entry = scores[key(username)];
+    if(!entry.name.empty())
+    {
+        if(entry.score == score)
+            return;
+        ordered.erase(std::make_pair(entry.score,entry.name));
+        add(entry.score,-1);
+    }
+    entry.score = score;
+    entry.name = username;
+    ordered.insert(std::make_pair(score,username));
+    add(score,1);
+}
+
+void RankIndex::add(int score,int delta)
+{
+    for(int i = bucket(score); i <= MAX_SCORE; i += i & -i)
+        tree[i] += delta;
+}
+
+unsigned int RankIndex::countAtMost(int score)
+{
+    unsigned int count = 0;
+    for(int i = bucket(score); i > 0; i -= i & -i)
+        count += tree[i];
+    return count;
+}
+
+int RankIndex::bucket(int score)
+{
+    //the tree starts from 1, the scores over MAX_SCORE share the last bucket
+    return std::min(std::max(score,0),MAX_SCORE - 1) + 1;
+}
+
+std::string RankIndex::key(const std::string& username)
+{
+    std::string k(username);
+    std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+    return k;
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef _RANKINDEX_H_
+#define _RANKINDEX_H_
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <unordered_map>
+
+namespace ygo
+{
+
+/*
+ * rank of the players kept in memory, so that the rank and the top players
+ * never touch the database.
+ * The father loads it before the first fork, every gameserver inherits a copy.
+ * The results of the duels update the copy of the gameserver at once and are sent
+ * to the father with RANK_UPDATE frames (with the stats, every 5 seconds),
+ * the father applies them and forwards them to the other gameservers.
+ * The rank is 1 + the number of better scores: a Fenwick tree with a bucket
+ * for every score gives it in O(log MAX_SCORE).
+ */
+class RankIndex
+{
+public:
+    static RankIndex* getInstance();
+
+    bool load();
+    bool isLoaded();
+    //a score written by this process: it is also sent to the others
+    void update(const std::string& username,int score);
+    //a score received from another process
+    void apply(const std::string& username,int score);
+    bool takeUpdates(std::string& payload);
+
+    int getRank(const std::string& username);
+    std::vector<std::pair<std::string,int>> top(unsigned int n);
+    unsigned int size();
+
+    static const int MAX_SCORE = 1 << 14;
+
+private:
+    RankIndex();
+
+    struct Entry
+    {
+        int score;
+        std::string name;
+    };
+    struct Better
+    {
+        bool operator()(const std::pair<int,std::string>& a,const std::pair<int,std::string>& b) const
+        {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+
+    std::unordered_map<std::string,Entry> scores;
+    std::set<std::pair<int,std::string>,Better> ordered;
+    std::vector<unsigned int> tree;
+    std::string pending;
+    std::mutex mutex;
+    bool loaded;
+
+    void insert(const std::string& username,int score);
+    void add(int score,int delta);
+    unsigned int countAtMost(int score);
+    static int bucket(int score);
+    static std::string key(const std::string& username);
+};
+
+}
+#endif
@@ -0,0 +1,319 @@
+#include "RateLimiter.h"
+#include "Config.h"
+#include "IpcFrame.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <wchar.h>
+
+namespace ygo
+{
+
+RateLimiter::RateLimiter():table(nullptr),isShared(false)
+{
+}
+
+RateLimiter* RateLimiter::getInstance()
+{
+    static RateLimiter rateLimiter;
+    if(rateLimiter.table == nullptr)
+        rateLimiter.init();
+    return &rateLimiter;
+}
+
+void RateLimiter::init()
+{
+    if(table != nullptr)
+        return;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+
+    void* mem = mmap(NULL, sizeof(Table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+    {
+        log(WARN,"cannot map the rate limiter table, each gameserver will use its own\n");
+        mem = calloc(1,sizeof(Table));
+    }
+    else
+    {
+        isShared = true;
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        //a child killed while holding the lock must not block the others
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    }
+    table = (Table*)mem;
+    pthread_mutex_init(&table->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    //the seed of the keys, the children get it with the table
+    int fd = open("/dev/urandom", O_RDONLY);
+    if(fd < 0 || read(fd, &table->seed, sizeof(table->seed)) != sizeof(table->seed))
+    {
+        log(WARN,"rate limiter: cannot read /dev/urandom, the keys are seeded with the time\n");
+        table->seed = ((uint64_t)time(NULL) << 32) ^ getpid() ^ (uint64_t)IpcFrame::nowMs();
+    }
+    if(fd >= 0)
+        close(fd);
+}
+
+void RateLimiter::lock()
+{
+    if(pthread_mutex_lock(&table->mutex) == EOWNERDEAD)
+    {
+        log(WARN,"rate limiter: a gameserver died holding the lock\n");
+        pthread_mutex_consistent(&table->mutex);
+    }
+}
+
+void RateLimiter::unlock()
+{
+    pthread_mutex_unlock(&table->mutex);
+}
+
+RateLimiter::Slot* RateLimiter::lookup(uint64_t key, int64_t now, float burst)
+{
+    unsigned int start = key & (TABLE_SIZE - 1);
+    Slot* reusable = nullptr;
+    Slot* oldest = nullptr;
+    for(unsigned int i = 0; i < MAX_PROBE; i++)
+    {
+        Slot* slot = &table->slots[(start + i) & (TABLE_SIZE - 1)];
+        if(slot->key == key)
+            return slot;
+        if(reusable == nullptr && (slot->key == 0 || now - slot->lastMs > IDLE_MS))
+            reusable = slot;
+        if(oldest == nullptr || slot->lastMs < oldest->lastMs)
+            oldest = slot;
+    }
+    if(reusable == nullptr)
+    {
+        reusable = oldest;
+        table->evictions++;
+    }
+    reusable->key = key;
+    reusable->tokens = burst;
+    reusable->lastMs = now;
+    reusable->lastStrike = 0;
+    return reusable;
+}
+
+void RateLimiter::setBan(uint64_t key, int64_t until, int64_t now)
+{
+    unsigned int start = key & (BAN_TABLE_SIZE - 1);
+    Ban* target = nullptr;
+    Ban* first = nullptr;
+    for(unsigned int i = 0; i < MAX_PROBE; i++)
+    {
+        Ban* ban = &table->bans[(start + i) & (BAN_TABLE_SIZE - 1)];
+        if(ban->key == key)
+        {
+            target = ban;
+            break;
+        }
+        if(target == nullptr && (ban->key == 0 || ban->until <= now / 1000))
+            target = ban;
+        if(first == nullptr || ban->until < first->until)
+            first = ban;
+    }
+    if(target == nullptr)
+    {
+        //the window is all bans still running: the one that ends first goes
+        target = first;
+        table->banEvictions++;
+    }
+    target->key = key;
+    target->until = until;
+}
+
+bool RateLimiter::allow(uint64_t key, float rate, float burst, float cost)
+{
+    int64_t now = IpcFrame::nowMs();
+    lock();
+    Slot* slot = lookup(key, now, burst);
+    slot->tokens += (now - slot->lastMs) * rate / 1000;
+    if(slot->tokens > burst)
+        slot->tokens = burst;
+    slot->lastMs = now;
+    bool allowed = slot->tokens >= cost;
+    if(allowed)
+        slot->tokens -= cost;
+    else
+        table->denied++;
+    table->checks++;
+    unlock();
+    return allowed;
+}
+
+bool RateLimiter::strike(uint64_t key, int banSeconds)
+{
+    int64_t now = IpcFrame::nowMs();
+    lock();
+    Slot* slot = lookup(key, now, 0);
+    slot->lastMs = now;
+    bool banned = false;
+    if(slot->lastStrike && now / 1000 - slot->lastStrike <= STRIKE_INTERVAL)
+    {
+        setBan(key, now / 1000 + banSeconds, now);
+        banned = true;
+    }
+    slot->lastStrike = now / 1000;
+    unlock();
+    return banned || isBanned(key);
+}
+
+void RateLimiter::ban(uint64_t key, int banSeconds)
+{
+    int64_t now = IpcFrame::nowMs();
+    lock();
+    setBan(key, now / 1000 + banSeconds, now);
+    unlock();
+}
+
+bool RateLimiter::isBanned(uint64_t key)
+{
+    int64_t now = IpcFrame::nowMs();
+    unsigned int start = key & (BAN_TABLE_SIZE - 1);
+    bool banned = false;
+    lock();
+    for(unsigned int i = 0; i < MAX_PROBE; i++)
+    {
+        Ban* ban = &table->bans[(start + i) & (BAN_TABLE_SIZE - 1)];
+        if(ban->key == key)
+        {
+            banned = ban->until > now / 1000;
+            break;
+        }
+    }
+    unlock();
+    return banned;
+}
+
+bool RateLimiter::allowConnection(const char* ip)
+{
+    if(isIpBanned(ip))
+        return false;
+    float perMinute = Config::getInstance()->max_connections_per_minute;
+    return allow(ipKey(CONNECTION,ip), perMinute / 60, perMinute);
+}
+
+bool RateLimiter::isIpBanned(const char* ip)
+{
+    return isBanned(ipKey(BAN,ip));
+}
+
+bool RateLimiter::addConnection(const char* ip, bool capped)
+{
+    uint64_t key = ipKey(CONNECTION,ip);
+    pid_t pid = getpid();
+    unsigned int start = key & (CONNECTION_TABLE_SIZE - 1);
+    unsigned int total = 0;
+    Connections* own = nullptr;
+    Connections* empty = nullptr;
+    lock();
+    for(unsigned int i = 0; i < MAX_PROBE; i++)
+    {
+        Connections* c = &table->connections[(start + i) & (CONNECTION_TABLE_SIZE - 1)];
+        if(c->count && c->key == key)
+        {
+            total += c->count;
+            if(c->pid == pid)
+                own = c;
+        }
+        else if(!c->count && empty == nullptr)
+            empty = c;
+    }
+    bool allowed = !capped || total < (unsigned int)Config::getInstance()->max_connections_per_ip;
+    if(allowed && own != nullptr)
+        own->count++;
+    else if(allowed && empty != nullptr)
+    {
+        empty->key = key;
+        empty->pid = pid;
+        empty->count = 1;
+    }
+    else if(allowed)
+        table->uncounted++;
+    unlock();
+    return allowed;
+}
+
+void RateLimiter::removeConnection(const char* ip)
+{
+    uint64_t key = ipKey(CONNECTION,ip);
+    pid_t pid = getpid();
+    unsigned int start = key & (CONNECTION_TABLE_SIZE - 1);
+    lock();
+    for(unsigned int i = 0; i < MAX_PROBE; i++)
+    {
+        Connections* c = &table->connections[(start + i) & (CONNECTION_TABLE_SIZE - 1)];
+        if(c->count && c->key == key && c->pid == pid)
+        {
+            c->count--;
+            break;
+        }
+    }
+    unlock();
+}
+
+void RateLimiter::releaseProcess(pid_t pid)
+{
+    unsigned int released = 0;
+    lock();
+    for(unsigned int i = 0; i < CONNECTION_TABLE_SIZE; i++)
+        if(table->connections[i].count && table->connections[i].pid == pid)
+        {
+            released += table->connections[i].count;
+            table->connections[i].count = 0;
+        }
+    unlock();
+    if(released)
+        log(INFO,"rate limiter: %u connections of the gameserver %d released\n",released,(int)pid);
+}
+
+uint64_t RateLimiter::finish(uint64_t hash)
+{
+    //the mixer of murmur3: every bit of the seed reaches the bits of the slot
+    hash ^= getInstance()->table->seed;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    //0 is the empty slot
+    return hash ? hash : 1;
+}
+
+uint64_t RateLimiter::ipKey(KeyKind kind, const char* ip)
+{
+    //FNV-1a from the seed, then mixed
+    uint64_t hash = 14695981039346656037ULL ^ getInstance()->table->seed;
+    hash = (hash ^ (unsigned char)kind) * 1099511628211ULL;
+    for(; *ip; ip++)
+        hash = (hash ^ (unsigned char)*ip) * 1099511628211ULL;
+    return finish(hash);
+}
+
+uint64_t RateLimiter::accountKey(KeyKind kind, const wchar_t* name)
+{
+    uint64_t hash = 14695981039346656037ULL ^ getInstance()->table->seed;
+    hash = (hash ^ (unsigned char)kind) * 1099511628211ULL;
+    hash = (hash ^ '@') * 1099511628211ULL;
+    for(; *name; name++)
+        hash = (hash ^ (uint32_t)*name) * 1099511628211ULL;
+    return finish(hash);
+}
+
+void RateLimiter::LogStats()
+{
+    log(VERBOSE,"rate limiter (%s): %lu checks, %lu denied, %lu evictions, %lu bans replaced, %lu connections not counted\n",
+        isShared?"shared":"local",(unsigned long)table->checks,(unsigned long)table->denied,(unsigned long)table->evictions,
+        (unsigned long)table->banEvictions,(unsigned long)table->uncounted);
+}
+
+}
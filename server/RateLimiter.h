@@ -0,0 +1,106 @@
+#ifndef _RATELIMITER_H_
+#define _RATELIMITER_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace ygo
+{
+
+/*
+ * Token buckets and bans shared by all the gameservers.
+ * The table is in a shared anonymous mapping created by the father before the fork,
+ * so a spammer that reconnects to another child keeps his bucket and his ban.
+ * Open addressing with a bounded probe: check and update are O(1), when the probe
+ * window is full the least recently used bucket is replaced, so a full window lets the
+ * traffic through. The bans have their own table: new keys never push out a ban,
+ * a full ban window replaces the ban that ends first.
+ * The keys are hashes of a kind character and an ip or an account name, seeded with a
+ * random value at every start: the slot of a key cannot be computed from outside.
+ * The open connections of an ip are counted here too, one entry for each gameserver that
+ * has some: the cap holds across the children, and the father clears the entries of a
+ * child that exits. A full window lets the connection in without counting it.
+ */
+class RateLimiter
+{
+public:
+    enum KeyKind {CONNECTION='c', CHAT='m', BAN='b'};
+
+    static RateLimiter* getInstance();
+    //must be called by the father before the first fork
+    void init();
+
+    bool allow(uint64_t key, float rate, float burst, float cost = 1);
+    //a spam strike: two strikes within STRIKE_INTERVAL seconds ban the key, returns true if banned
+    bool strike(uint64_t key, int banSeconds);
+    bool isBanned(uint64_t key);
+    void ban(uint64_t key, int banSeconds);
+
+    bool allowConnection(const char* ip);
+    bool isIpBanned(const char* ip);
+    //the open connections of an ip in all the gameservers, false if the cap refuses one more
+    bool addConnection(const char* ip, bool capped);
+    void removeConnection(const char* ip);
+    //the father, when a child exits: its connections are closed
+    void releaseProcess(pid_t pid);
+
+    static uint64_t ipKey(KeyKind kind, const char* ip);
+    static uint64_t accountKey(KeyKind kind, const wchar_t* name);
+
+    void LogStats();
+
+    static const unsigned int TABLE_SIZE = 16384;
+    static const unsigned int BAN_TABLE_SIZE = 4096;
+    static const unsigned int CONNECTION_TABLE_SIZE = 16384;
+    static const unsigned int MAX_PROBE = 32;
+    static const int STRIKE_INTERVAL = 30;
+    static const int64_t IDLE_MS = 10 * 60 * 1000;
+
+private:
+    struct Slot
+    {
+        uint64_t key;
+        float tokens;
+        int64_t lastMs;
+        int64_t lastStrike;
+    };
+    struct Ban
+    {
+        uint64_t key;
+        int64_t until;
+    };
+    struct Connections
+    {
+        uint64_t key;
+        pid_t pid;
+        //0 is a free entry
+        uint32_t count;
+    };
+    struct Table
+    {
+        pthread_mutex_t mutex;
+        uint64_t seed;
+        uint64_t checks;
+        uint64_t denied;
+        uint64_t evictions;
+        uint64_t banEvictions;
+        uint64_t uncounted;
+        Slot slots[TABLE_SIZE];
+        Ban bans[BAN_TABLE_SIZE];
+        Connections connections[CONNECTION_TABLE_SIZE];
+    };
+
+    RateLimiter();
+    Slot* lookup(uint64_t key, int64_t now, float burst);
+    //called with the lock
+    void setBan(uint64_t key, int64_t until, int64_t now);
+    static uint64_t finish(uint64_t hash);
+    void lock();
+    void unlock();
+
+    Table* table;
+    bool isShared;
+};
+
+}
+#endif
@@ -0,0 +1,85 @@
+#include "Rating.h"
+#include <math.h>
+
+namespace ygo
+{
+
+float Rating::win_exp(float delta)
+{
+    //delta is my_score - opponent score
+    return 1.0/(exp((-delta)/400.0)+1.0);
+}
+
+int Rating::k(const UserStats &us)
+{
+    int tempK = 50;
+    int threeshold = 10;
+    if(us.wins + us.losses+us.draws <= threeshold)
+    {
+        tempK += tempK/2;
+        if(us.score <= 800 && us.score >= 200)
+            tempK +=tempK/2;
+    }
+    else if(us.score >= 2000 && us.score < 3000 )
+        tempK /=2;
+    else if(us.score >= 3000)
+        tempK /=3;
+    return tempK;
+}
+
+std::vector<UserStats> Rating::update(const std::vector<UserStats>& players,int risultato)
+{
+	std::vector<UserStats> result(players);
+	if(players.size() < 2)
+		return result;
+
+	unsigned int num_squadra1 = players.size()/2;
+	unsigned int num_squadra2 = players.size() - num_squadra1;
+
+	unsigned int media_squadra1=0;
+	unsigned int media_squadra2=0;
+	for(unsigned int i = 0;i<players.size();i++)
+	{
+		if(i < num_squadra1)
+			media_squadra1 += players[i].score;
+		else
+			media_squadra2 += players[i].score;
+	}
+	media_squadra1 /= num_squadra1;
+	media_squadra2 /= num_squadra2;
+	int delta = media_squadra1 - media_squadra2;
+
+	for(unsigned int i = 0;i<players.size();i++)
+	{
+		UserStats& us_tmp = result[i];
+
+		if(i<num_squadra1 && risultato == 0)
+		{
+			us_tmp.score += k(players[i]) * (1.0-win_exp(delta))  * 1.0*players[i].score/media_squadra1;
+			us_tmp.wins++;
+		}
+		else if(i>=num_squadra1 && risultato == 0)
+		{
+			us_tmp.score += k(players[i]) * (0.0-win_exp(-delta))  * 1.0*players[i].score/media_squadra2;
+			us_tmp.losses++;
+		}
+		else if(i<num_squadra1 && risultato == 2)
+		{
+			us_tmp.score += k(players[i]) * (0.5-win_exp(delta))  * 1.0*players[i].score/media_squadra1;
+			us_tmp.draws++;
+		}
+		else if(i>=num_squadra1 && risultato == 2)
+		{
+			us_tmp.score += k(players[i]) * (0.5-win_exp(-delta))  * 1.0*players[i].score/media_squadra2;
+			us_tmp.draws++;
+		}
+
+		if(num_squadra2 > 1)
+			us_tmp.tags++;
+		if(us_tmp.score < MIN_SCORE)
+			us_tmp.score = MIN_SCORE;
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef _RATING_H_
+#define _RATING_H_
+#include "StorageBackend.h"
+#include <vector>
+
+namespace ygo
+{
+
+/*
+ * the Elo of the server, without any state: the storage reads the players,
+ * calls update() and writes the result in the same transaction.
+ * The first half of the players is the first team,
+ * risultato is 0 if the first team won, 2 for a draw.
+ */
+class Rating
+{
+public:
+    static std::vector<UserStats> update(const std::vector<UserStats>& players,int risultato);
+    static float win_exp(float delta);
+    static int k(const UserStats& us);
+
+    static const unsigned int MIN_SCORE = 100;
+};
+
+}
+#endif
@@ -1,5 +1,6 @@
 #include "RematchRoom.h"
 #include "GameServer.h"
+#include "debug.h"
 namespace ygo
 {
 
@@ -23,20 +24,32 @@ void RematchRoom::killRoom(std::list<VirtualRoom>::iterator r)
 		bufferevent_write(it->first->bev, buffer, 3);
 		
 	}
-	virtualRooms.erase(r);
+	eraseRoom(r);
 	
 	
+}
+void RematchRoom::eraseRoom(std::list<VirtualRoom>::iterator r)
+{
+	for(auto it = r->players.cbegin();it!=r->players.cend();++it)
+		roomByDp.erase(it->first);
+	virtualRooms.erase(r);
 }
 std::list<VirtualRoom>::iterator RematchRoom::getRoomByDp(DuelPlayer* dp)
 {
-	for(auto it = virtualRooms.begin();it!=virtualRooms.end();++it)
-		if(it->players.find(dp) != it->players.end())
-			return it;
+	auto it = roomByDp.find(dp);
+	if(it != roomByDp.end())
+	{
+#ifndef NDEBUG
+		if(!it->second->players.count(dp))
+			log(BUG,"RematchRoom: the player is indexed in the wrong room\n");
+#endif
+		return it->second;
+	}
 	dp->netServer = nullptr;
 	gameServer->DisconnectPlayer(dp);
 	return virtualRooms.end();
 }
-void RematchRoom::createRoom(std::map<DuelPlayer*, DuelPlayerInfo> p, unsigned char mode,int required)
+void RematchRoom::createRoom(PlayerTable& p, unsigned char mode,int required)
 {
 	int count = 0;
 	for(auto it = p.begin();it!=p.end();++it)
@@ -47,8 +60,12 @@ void RematchRoom::createRoom(std::map<DuelPlayer*, DuelPlayerInfo> p, unsigned c
 		it->first->netServer = this;
 	}
 
-	VirtualRoom vr = {p,mode};
-	virtualRooms.push_front(vr);
+	virtualRooms.push_front(VirtualRoom());
+	virtualRooms.front().mode = mode;
+	virtualRooms.front().players.swap(p);
+	PlayerTable& vp = virtualRooms.front().players;
+	for(auto it = vp.cbegin();it!=vp.cend();++it)
+		roomByDp[it->first] = virtualRooms.begin();
 	
 	if(count != required)
 		killRoom(virtualRooms.begin());
@@ -62,7 +79,7 @@ void RematchRoom::createRoom(std::map<DuelPlayer*, DuelPlayerInfo> p, unsigned c
 		buffer[4] = 0;
 		buffer[5] = 30;
 		buffer[6] = buffer[7] = buffer[8] = 0;
-		for(auto it = p.begin();it!=p.end();++it)
+		for(auto it = vp.begin();it!=vp.end();++it)
 		{
 			if(it->first->type < NETPLAYER_TYPE_OBSERVER)
 			{
@@ -81,7 +98,10 @@ void RematchRoom::LeaveGame(DuelPlayer* dp)
 		return;
 	
 	if(dp->type == NETPLAYER_TYPE_OBSERVER)
+	{
 		it->players.erase(dp);
+		roomByDp.erase(dp);
+	}
 	else
 		killRoom(it);
 	gameServer->DisconnectPlayer(dp);
@@ -134,13 +154,14 @@ void RematchRoom::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)
 				{
 					
 					i->first->state = 0;
-					dr->HandleCTOSPacket(i->first,i->second.deck,1024);
+					if(i->second.deck)
+						dr->HandleCTOSPacket(i->first,i->second.deck->data,i->second.deck->len);
 					dr->HandleCTOSPacket(i->first,&readyMSG,1);
 					
 				}
 					
 		printf("--rematch richiesto\n");
-		virtualRooms.erase(it);
+		eraseRoom(it);
 	}
 	
    
@@ -4,12 +4,13 @@
 #include "RoomInterface.h"
 #include "RoomManager.h"
 #include <list>
+#include <unordered_map>
 
 namespace ygo
 {
 	struct VirtualRoom
 	{
-		std::map<DuelPlayer*, DuelPlayerInfo> players;
+		PlayerTable players;
 		unsigned char mode;
 		
 	};
@@ -18,6 +19,7 @@ namespace ygo
 	class RematchRoom:public RoomInterface
 	{
 		std::list<VirtualRoom> virtualRooms;
+		std::unordered_map<DuelPlayer*,std::list<VirtualRoom>::iterator> roomByDp;
 		public:
 		RematchRoom(RoomManager*roomManager,GameServer*gameServer);
 		void LeaveGame(DuelPlayer* dp);
@@ -25,11 +27,12 @@ namespace ygo
 		void ExtractPlayer(DuelPlayer* dp);
 		void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
 		void RoomChat(DuelPlayer* dp, std::wstring messaggio);
-		void createRoom(std::map<DuelPlayer*, DuelPlayerInfo>, unsigned char mode,int required);
+		void createRoom(PlayerTable& p, unsigned char mode,int required);
 		~RematchRoom();
 	private:
 		void killRoom(std::list<VirtualRoom>::iterator r);
 		std::list<VirtualRoom>::iterator getRoomByDp(DuelPlayer*);
+		void eraseRoom(std::list<VirtualRoom>::iterator r);
 	};
 	
 }
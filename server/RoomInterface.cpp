@@ -2,6 +2,9 @@
 #include "debug.h"
 #include "RoomManager.h"
 #include "GameServer.h"
+#include "CardDatabase.h"
+#include "RateLimiter.h"
+#include "RankIndex.h"
 namespace ygo
 {
 
@@ -10,7 +13,7 @@ char RoomInterface::net_server_read[0x20000];
 char RoomInterface::net_server_write[0x20000];
 
 RoomInterface::RoomInterface(RoomManager* roomManager,GameServer*gameServer):
-    roomManager(roomManager),gameServer(gameServer),last_sent(0),isShouting(false)
+    roomManager(roomManager),gameServer(gameServer),last_sent(0),isShouting(false),muted(false),usage(nullptr)
 {
 
 }
@@ -30,10 +33,16 @@ void RoomInterface::SendMessageToPlayer(DuelPlayer*dp, char*msg)
 }
 
 void RoomInterface::BroadcastRemoteChat(std::wstring msg,int color)
+{
+    ChatPacketRef packet(ChatPacket::create(msg,color));
+    BroadcastChatPacket(packet.get());
+}
+
+void RoomInterface::BroadcastChatPacket(ChatPacket* packet)
 {
 	for(auto it = players.cbegin(); it!=players.cend(); ++it)
     {
-        RemoteChatToPlayer(it->first,msg,color);
+        SendChatPacket(it->first,packet);
     }
 }
 
@@ -52,33 +61,15 @@ void RoomInterface::BroadcastSystemChat(std::wstring msg,bool isAdmin)
 
 void RoomInterface::RemoteChatToPlayer(DuelPlayer* dp, std::wstring msg,int color)
 {
-	if(msg.length() > 256)
-        msg.resize(256);
-    STOC_Chat scc;
-
-    if(color == -1) //[System]: 
-    {
-        scc.player=8;
-    }
-	else if(color == -2) //checkmate admin
-    {
-        
-
-        scc.player=14;
-    }
-    else if(color > 0) //colored chat
-    {
-        scc.player = 11+color;
-    }
-	else //[---]: [name] guest
-	{
-		scc.player = 10;
-	}
+    ChatPacketRef packet(ChatPacket::create(msg,color));
+    SendChatPacket(dp,packet.get());
+}
 
-    int msglen = BufferIO::CopyWStr(msg.c_str(), scc.msg, 256);
-    SendBufferToPlayer(dp, STOC_CHAT, &scc, 4 + msglen * 2);
-	
-	
+void RoomInterface::SendChatPacket(DuelPlayer* dp, ChatPacket* packet)
+{
+    if( players.end() == players.find(dp))
+        return;
+    gameServer->safe_bufferevent_write(dp,packet);
 }
 void RoomInterface::SystemChatToPlayer(DuelPlayer*dp, std::wstring msg,bool isAdmin,int color)
 {
@@ -115,12 +106,9 @@ void RoomInterface::SendPacketToPlayer(DuelPlayer* dp, unsigned char proto)
 DuelPlayer* RoomInterface::findPlayerByName(std::wstring user)
 {
     std::transform(user.begin(), user.end(), user.begin(), ::tolower);
-    for(auto it = players.cbegin(); it != players.cend(); ++it)
-    {
-        if(!wcsncmp(user.c_str(),it->first->namew_low,20))
-            return it->first;
-    }
-    return nullptr;
+    if(user.size() >= 20)
+        user.resize(19);
+    return players.findByName(user);
 
 }
 
@@ -143,7 +131,8 @@ void RoomInterface::SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void
     if(len > 0)
         memcpy(p, buffer, std::min(len,(size_t) 0x20000));
     last_sent = len + 3;
-	gameServer->safe_bufferevent_write(dp,net_server_write,last_sent);
+    if(!muted)
+        gameServer->safe_bufferevent_write(dp,net_server_write,last_sent);
     
 
 }
@@ -153,38 +142,25 @@ int RoomInterface::detectDeckCompatibleLflist(void* pdata)
     //ocg = 1, tcg =2, both = 3, none = 0
 
     char* deckbuf = (char*)pdata;
-    Deck deck;
     int mainc = BufferIO::ReadInt32(deckbuf);
     int sidec = BufferIO::ReadInt32(deckbuf);
-    deckManager.LoadDeck(deck, (int*)deckbuf, mainc, sidec);
 
     int compatible =0;
 
-    int err1 = deckManager.CheckLFList(deck, deckManager._lfList[0].hash, true, true);
+    CardDatabase* cdb = CardDatabase::getInstance();
+    CardDatabase::Deck deck;
+    cdb->LoadDeck(deck, (int*)deckbuf, mainc, sidec);
+
+    int err1 = cdb->CheckLFList(deck, deckManager._lfList[0].hash, true, true);
     compatible += (err1)?0:1;
-    int err2 = deckManager.CheckLFList(deck, deckManager._lfList[1].hash, true, true);
+    int err2 = cdb->CheckLFList(deck, deckManager._lfList[1].hash, true, true);
     compatible += (err2)?0:2;
 
     int err3=0;
-
-    for(size_t i = 0; i < deck.main.size(); ++i)
-    {
-        code_pointer cit = deck.main[i];
-        if(cit->second.ot>0x3)
-            err3 =cit->first;
-    }
-    for(size_t i = 0; i < deck.side.size(); ++i)
-    {
-        code_pointer cit = deck.side[i];
-        if(cit->second.ot>0x3)
-            err3= cit->first;
-    }
-    for(size_t i = 0; i < deck.extra.size(); ++i)
-    {
-        code_pointer cit = deck.extra[i];
-        if(cit->second.ot>0x3)
-            err3 = cit->first;
-    }
+    for(const std::vector<const CardDatabase::CardRecord*>* part : {&deck.main, &deck.side, &deck.extra})
+        for(const CardDatabase::CardRecord* cr : *part)
+            if(cr->ot>0x3)
+                err3 = cr->code;
 
     //printf("valori: %d %d %d\n",err1,err2,err3);
     if(err3)
@@ -259,7 +235,8 @@ bool RoomInterface::handleChatCommand(DuelPlayer* dp,wchar_t* msg)
 		std::string tmp(msg);
         if (tmp.length() < 5)
 			return false;
-		roomManager->ban(tmp);
+		printf("scatta il ban per %s\n",tmp.c_str());
+		RateLimiter::getInstance()->ban(RateLimiter::ipKey(RateLimiter::BAN,tmp.c_str()),Config::getInstance()->ban_seconds);
         
         return true;
     }
@@ -278,6 +255,84 @@ bool RoomInterface::handleChatCommand(DuelPlayer* dp,wchar_t* msg)
         
         return true;
     }
+    else if(!wcscmp(messaggio,L"!top") || !wcsncmp(messaggio,L"!top ",5))
+    {
+        //the chat of the client shows about ten lines
+        long n = 5;
+        if(messaggio[4] == L' ')
+            n = std::min(std::max(wcstol(&messaggio[5],nullptr,10),1L),10L);
+        auto lista = RankIndex::getInstance()->top(n);
+        if(lista.empty())
+        {
+            SystemChatToPlayer(dp,L"The ranking is not available",true);
+            return true;
+        }
+        for(unsigned int i = 0; i < lista.size(); i++)
+        {
+            wchar_t riga[64];
+            std::wstring nome(lista[i].first.begin(),lista[i].first.end());
+            swprintf(riga,64,L"%u. %ls %d",i + 1,nome.c_str(),lista[i].second);
+            SystemChatToPlayer(dp,riga,true);
+        }
+        return true;
+    }
+    else if(!wcscmp(messaggio,L"!roomstats"))
+    {
+        char name[20];
+        BufferIO::CopyWStr(dp->name,name,20);
+        std::string nome(name);
+        std::transform(nome.begin(), nome.end(), nome.begin(), ::tolower);
+        if(nome != "checkmate")
+            return false;
+        wchar_t riga[256];
+        if(usage != nullptr)
+        {
+            swprintf(riga,256,L"room: %ld s, engine %llu ms, %llu messages, in %llu packets %llu KB, out %llu KB to the duelists %llu KB to the observers%ls",
+                     (long)(time(NULL) - usage->since),(unsigned long long)usage->engineNs / 1000000,(unsigned long long)usage->messages,
+                     (unsigned long long)usage->packetsIn,(unsigned long long)usage->bytesIn / 1024,
+                     (unsigned long long)usage->bytesOut[RoomUsage::DUELISTS] / 1024,(unsigned long long)usage->bytesOut[RoomUsage::OBSERVERS] / 1024,
+                     usage->overBudget ? L", over budget" : L"");
+            SystemChatToPlayer(dp,riga,true);
+        }
+        for(auto it = players.cbegin(); it != players.cend(); ++it)
+        {
+            wchar_t giocatore[20];
+            BufferIO::CopyWStr(it->first->name,giocatore,20);
+            swprintf(riga,256,L"%ls (%d): in %u packets %llu KB, out %u packets %llu KB",giocatore,it->first->type,
+                     it->first->packetsIn,it->first->bytesIn / 1024,it->first->packetsOut,it->first->bytesOut / 1024);
+            SystemChatToPlayer(dp,riga,true);
+        }
+        return true;
+    }
+    else if(!wcscmp(messaggio,L"!heavy") || !wcsncmp(messaggio,L"!heavy ",7))
+    {
+        char name[20];
+        BufferIO::CopyWStr(dp->name,name,20);
+        std::string nome(name);
+        std::transform(nome.begin(), nome.end(), nome.begin(), ::tolower);
+        if(nome != "checkmate")
+            return false;
+        long n = 5;
+        if(messaggio[6] == L' ')
+            n = std::min(std::max(wcstol(&messaggio[7],nullptr,10),1L),10L);
+        auto lista = roomManager->getHeavyRooms(n);
+        if(lista.empty())
+        {
+            SystemChatToPlayer(dp,L"No duels",true);
+            return true;
+        }
+        for(unsigned int i = 0; i < lista.size(); i++)
+        {
+            const RoomUsage& u = lista[i]->accounting;
+            wchar_t riga[256];
+            swprintf(riga,256,L"%u. %ls: engine %llu ms, %llu messages, out %llu KB + %llu KB to the observers%ls",i + 1,
+                     lista[i]->getDuelistNames().c_str(),(unsigned long long)u.engineNs / 1000000,(unsigned long long)u.messages,
+                     (unsigned long long)u.bytesOut[RoomUsage::DUELISTS] / 1024,(unsigned long long)u.bytesOut[RoomUsage::OBSERVERS] / 1024,
+                     u.overBudget ? L", over budget" : L"");
+            SystemChatToPlayer(dp,riga,true);
+        }
+        return true;
+    }
     else if(!wcsncmp(messaggio,L"!pm ",3) )
     {
         wchar_t mittente[20];
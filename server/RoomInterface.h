@@ -2,39 +2,223 @@
 #define _NetServerInterface_H_
 #include "network.h"
 #include <list>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "debug.h"
+#include "ChatPacket.h"
+#include "RoomUsage.h"
 
 namespace ygo
 {
 class DuelPlayer;
 
 class GameServer;
+
+//the last CTOS_UPDATE_DECK of a player, shared between the room and the rematch room
+struct DeckBuffer
+{
+    unsigned int len;
+    char data[1024];
+};
+
 struct DuelPlayerInfo
 {
-    DuelPlayerInfo():zombiePlayer(false),isReady(false),secondsWaiting(0)
+    DuelPlayerInfo():zombiePlayer(false),isReady(false),secondsWaiting(0),joinedMs(0)
     {
     };
 bool isReady;
 float secondsWaiting;
+//entry in the room, for the wait before the duel
+int64_t joinedMs;
 unsigned char last_state_in_timeout;
 bool zombiePlayer;
-char deck[1024];
+std::shared_ptr<DeckBuffer> deck;
+
+
+std::list<ChatPacketRef> pendingMessages;
+
+};
+
+/*
+ * the players of a room, with the interface of the std::map it replaces.
+ * The entries are kept in a vector, DuelPlayer::roomSlot remembers the position
+ * of the player in the last table it was inserted in, so find() is usually a
+ * single check.
+ * An erase moves the last entry into the hole, so the only erase allowed while
+ * iterating is it = erase(it), which visits the moved entry next. erase(dp) or
+ * LeaveGame() inside a loop on the table would skip a player: collect the
+ * players first (like the deadUsers of DuelRoom::user_timeout_cb). Without NDEBUG an
+ * iterator that survives an erase logs a BUG when it is advanced.
+ * With enableNameIndex() the table also keeps a hash of the players by namew_low,
+ * namew_low must be set before the player is inserted.
+ */
+class PlayerTable
+{
+public:
+    struct Entry
+    {
+        DuelPlayer* first;
+        DuelPlayerInfo second;
+        Entry(DuelPlayer* dp):first(dp) {}
+    };
+
+    template<class E, class T>
+    class Iterator
+    {
+        T* table;
+        size_t i;
+        unsigned int erasures;
+        void checkErasures()
+        {
+#ifndef NDEBUG
+            if(erasures != table->erasures)
+            {
+                log(BUG,"PlayerTable: a player was erased while iterating\n");
+                erasures = table->erasures;
+            }
+#endif
+        }
+    public:
+        Iterator(T* table,size_t i):table(table),i(i),erasures(table->erasures) {}
+        E& operator*() const { return table->entries[i]; }
+        E* operator->() const { return &table->entries[i]; }
+        Iterator& operator++() { checkErasures(); i++; return *this; }
+        Iterator operator++(int) { checkErasures(); Iterator old(*this); i++; return old; }
+        size_t index() const { return (i < table->entries.size())? i : NPOS; }
+        bool operator==(const Iterator& o) const { return index() == o.index(); }
+        bool operator!=(const Iterator& o) const { return index() != o.index(); }
+    };
+    typedef Iterator<Entry,PlayerTable> iterator;
+    typedef Iterator<const Entry,const PlayerTable> const_iterator;
+    static const size_t NPOS = (size_t)-1;
+
+    iterator begin() { return iterator(this,0); }
+    iterator end() { return iterator(this,NPOS); }
+    const_iterator begin() const { return const_iterator(this,0); }
+    const_iterator end() const { return const_iterator(this,NPOS); }
+    const_iterator cbegin() const { return const_iterator(this,0); }
+    const_iterator cend() const { return const_iterator(this,NPOS); }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    void clear() { entries.clear(); byName.clear(); }
+    void swap(PlayerTable& o) { entries.swap(o.entries); byName.swap(o.byName); std::swap(nameIndex,o.nameIndex); }
+    void enableNameIndex() { nameIndex = true; }
+    PlayerTable():nameIndex(false),erasures(0) {}
+    PlayerTable(const PlayerTable& o):entries(o.entries),byName(o.byName),nameIndex(o.nameIndex),erasures(0) {}
+    PlayerTable& operator=(const PlayerTable& o)
+    {
+        entries = o.entries;
+        byName = o.byName;
+        nameIndex = o.nameIndex;
+        return *this;
+    }
 
+    DuelPlayer* findByName(const std::wstring& name_low)
+    {
+        if(nameIndex)
+        {
+            auto it = byName.find(name_low);
+            return (it == byName.end())? nullptr : it->second;
+        }
+        for(size_t i = 0; i < entries.size(); i++)
+            if(!wcsncmp(name_low.c_str(),entries[i].first->namew_low,20))
+                return entries[i].first;
+        return nullptr;
+    }
+
+    iterator find(DuelPlayer* dp) { return iterator(this,indexOf(dp)); }
+    size_t count(DuelPlayer* dp) { return indexOf(dp) != NPOS; }
+    DuelPlayerInfo& operator[](DuelPlayer* dp)
+    {
+        size_t i = indexOf(dp);
+        if(i != NPOS)
+            return entries[i].second;
+        dp->roomSlot = entries.size();
+        entries.push_back(Entry(dp));
+        if(nameIndex)
+            byName.insert(std::make_pair(std::wstring(dp->namew_low),dp));
+        checkInvariants(dp);
+        return entries.back().second;
+    }
+    size_t erase(DuelPlayer* dp)
+    {
+        size_t i = indexOf(dp);
+        if(i == NPOS)
+            return 0;
+        eraseAt(i);
+        return 1;
+    }
+    iterator erase(iterator it)
+    {
+        size_t i = it.index();
+        if(i != NPOS)
+            eraseAt(i);
+        return iterator(this,i);
+    }
 
-std::list< std::pair<int,std::wstring> > pendingMessages;
+private:
+    std::vector<Entry> entries;
+    std::unordered_multimap<std::wstring,DuelPlayer*> byName;
+    bool nameIndex;
+    //only to catch the loops that erase
+    unsigned int erasures;
 
+    size_t indexOf(DuelPlayer* dp)
+    {
+        if(dp->roomSlot < entries.size() && entries[dp->roomSlot].first == dp)
+            return dp->roomSlot;
+        for(size_t i = 0; i < entries.size(); i++)
+            if(entries[i].first == dp)
+            {
+                dp->roomSlot = i;
+                return i;
+            }
+        return NPOS;
+    }
+    void eraseAt(size_t i)
+    {
+        if(nameIndex)
+        {
+            DuelPlayer* dp = entries[i].first;
+            auto range = byName.equal_range(std::wstring(dp->namew_low));
+            for(auto it = range.first; it != range.second; ++it)
+                if(it->second == dp)
+                {
+                    byName.erase(it);
+                    break;
+                }
+        }
+        if(i + 1 != entries.size())
+        {
+            entries[i] = std::move(entries.back());
+            entries[i].first->roomSlot = i;
+        }
+        entries.pop_back();
+        erasures++;
+        checkInvariants(i < entries.size()? entries[i].first : nullptr);
+    }
+    void checkInvariants(DuelPlayer* dp)
+    {
+#ifndef NDEBUG
+        if(nameIndex && byName.size() != entries.size())
+            log(BUG,"PlayerTable: %d players but %d names\n",(int)entries.size(),(int)byName.size());
+        if(dp != nullptr && (dp->roomSlot >= entries.size() || entries[dp->roomSlot].first != dp))
+            log(BUG,"PlayerTable: wrong slot for a player\n");
+#endif
+    }
 };
 
 class RoomManager;
 
 class RoomInterface
 {
-private:
-    unsigned short last_sent;
 protected:
+    unsigned short last_sent;
     RoomManager* roomManager;
     static char net_server_read[0x20000];
     static char net_server_write[0x20000];
-    std::map<DuelPlayer*, DuelPlayerInfo> players;
+    PlayerTable players;
     GameServer* gameServer;
     void playerReadinessChange(DuelPlayer *dp, bool isReady);
 
@@ -49,6 +233,8 @@ public:
     virtual void LeaveGame(DuelPlayer* dp)=0;
     virtual void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len)=0;
     virtual bool handleChatCommand(DuelPlayer* dp,wchar_t* msg);
+    //a protocol bug involving the room: the rooms with a flight recorder write it
+    virtual void BugDetected(const char* reason) {}
     DuelPlayer* getFirstPlayer();
 
     DuelPlayer* findPlayerByName(std::wstring);
@@ -65,8 +251,14 @@ public:
 
     }
     bool isShouting;
+    //the packets are built but not written: a duel rebuilt after a migration
+    bool muted;
+    //the accounting of the duel rooms, nullptr for the others
+    RoomUsage* usage;
     void BroadcastSystemChat(std::wstring,bool isAdmin = false);
 	void BroadcastRemoteChat(std::wstring,int color=0);
+    void BroadcastChatPacket(ChatPacket* packet);
+    virtual void SendChatPacket(DuelPlayer* dp, ChatPacket* packet);
     virtual void SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buffer, size_t len);
     void ReSendToPlayer(DuelPlayer* dp);
     int getNumPlayers();
@@ -2,6 +2,10 @@
 #include "RoomManager.h"
 #include "debug.h"
 #include "Statistics.h"
+#include "RateLimiter.h"
+#include "Metrics.h"
+#include "Config.h"
+#include <algorithm>
 
 namespace ygo
 {
@@ -44,11 +48,71 @@ void RoomManager::keepAlive(evutil_socket_t fd, short events, void* arg)
     if(needRemove == 0)
         that->removeDeadRooms();
     that->FillAllRooms();
+    that->checkBudgets();
+}
+
+std::vector<DuelRoom*> RoomManager::getHeavyRooms(size_t k)
+{
+    //only the rooms with a duel run the engine
+    std::vector<DuelRoom*> rooms(playingServer.begin(),playingServer.end());
+    rooms.insert(rooms.end(),zombieServer.begin(),zombieServer.end());
+    k = std::min(k,rooms.size());
+    std::partial_sort(rooms.begin(),rooms.begin() + k,rooms.end(),[](DuelRoom* a,DuelRoom* b)
+    {
+        return a->accounting.engineNs > b->accounting.engineNs;
+    });
+    rooms.resize(k);
+    return rooms;
+}
+
+void RoomManager::ReplaceLfLists(const uint32_t* replaced)
+{
+    //the deck checks look the list up by hash: an old hash is no list, and no check
+    if(replaced[0] == deckManager._lfList[0].hash && replaced[1] == deckManager._lfList[1].hash)
+        return;
+    int moved = 0;
+    for(auto room : elencoServer)
+        moved += room->ReplaceLfList(replaced);
+    for(auto room : playingServer)
+        moved += room->ReplaceLfList(replaced);
+    for(auto room : zombieServer)
+        moved += room->ReplaceLfList(replaced);
+    log(INFO,"banlists reloaded, %d rooms moved to the new lists\n",moved);
+}
+
+void RoomManager::checkBudgets()
+{
+    uint64_t engineBudget = Config::getInstance()->room_budget_engine_ms;
+    uint64_t bytesBudget = (uint64_t)Config::getInstance()->room_budget_kbytes * 1024;
+    time_t now = time(NULL);
+    for(auto room : playingServer)
+    {
+        RoomUsage& usage = room->accounting;
+        time_t elapsed = now - usage.windowStart;
+        if(elapsed < BUDGET_WINDOW)
+            continue;
+        //the keepalive can be late, the budgets are per minute
+        uint64_t engineMs = (usage.engineNs - usage.windowEngineNs) / 1000000 * BUDGET_WINDOW / elapsed;
+        uint64_t bytes = (usage.bytesSent() - usage.windowBytes) * BUDGET_WINDOW / elapsed;
+        usage.windowStart = now;
+        usage.windowEngineNs = usage.engineNs;
+        usage.windowBytes = usage.bytesSent();
+        if(usage.overBudget)
+            continue;
+        if((engineBudget && engineMs > engineBudget) || (bytesBudget && bytes > bytesBudget))
+        {
+            usage.overBudget = true;
+            Metrics::getInstance()->counters.roomsOverBudget++;
+            log(WARN,"room %p of %ls is over budget: %llu ms of engine and %llu KB in the last minute, %llu messages in total\n",
+                (void*)room,room->getDuelistNames().c_str(),(unsigned long long)engineMs,(unsigned long long)bytes / 1024,
+                (unsigned long long)usage.messages);
+        }
+    }
 }
 
 void RoomManager::tryToInsertPlayerInServer(DuelPlayer*dp,DuelRoom* serv)
 {
-    if(std::find(elencoServer.begin(), elencoServer.end(), serv) == elencoServer.end() ||!serv->isAvailableToPlayer(dp,MODE_ANY))
+    if(elencoIndex.find(serv) == elencoIndex.end() ||!serv->isAvailableToPlayer(dp,MODE_ANY))
     {
         printf("Server non disponibile\n");
         waitingRoom->ToObserverPressed(dp);
@@ -64,7 +128,7 @@ void RoomManager::notifyStateChange(DuelRoom* room,DuelRoom::State oldstate,Duel
 {
     if(newstate == DuelRoom::PLAYING)
     {
-        elencoServer.remove(room);
+        removeFromElenco(room);
         playingServer.insert(room);
     }
     else if(newstate == DuelRoom::ZOMBIE || newstate == DuelRoom::DEAD)
@@ -72,11 +136,24 @@ void RoomManager::notifyStateChange(DuelRoom* room,DuelRoom::State oldstate,Duel
         if(oldstate == DuelRoom::PLAYING)
             playingServer.erase(room);
         else
-            elencoServer.remove(room);
+            removeFromElenco(room);
         zombieServer.insert(room);
     }
 }
 
+void RoomManager::removeFromElenco(DuelRoom* room)
+{
+    auto it = elencoIndex.find(room);
+    if(it == elencoIndex.end())
+        return;
+    elencoServer.erase(it->second);
+    elencoIndex.erase(it);
+#ifndef NDEBUG
+    if(elencoIndex.size() != elencoServer.size())
+        log(BUG,"elencoServer has %d rooms but %d are indexed\n",(int)elencoServer.size(),(int)elencoIndex.size());
+#endif
+}
+
 std::vector<DuelRoom *> RoomManager::getCompatibleRoomsList(DuelPlayer *referencePlayer)
 {
     std::vector<DuelRoom *> lista;
@@ -192,20 +269,25 @@ void RoomManager::BroadcastMessage(std::wstring message, int color,RoomInterface
 {
 	if(message.length() > 250)
         return;
+    //encoded once, every player gets a reference to the same packet
+    ChatPacketRef packet(ChatPacket::create(message,color));
 	for(auto it =elencoServer.begin(); it!=elencoServer.end(); ++it)
     {
         if((*it) != origin)
-            (*it)->BroadcastRemoteChat(message,color);
+            (*it)->BroadcastChatPacket(packet.get());
 			if((*it)->state == DuelRoom::State::ZOMBIE )
+			{
+				(*it)->BugDetected("BroadcastMessage: a zombie room in elencoServer");
 				break; //MEGABUG DETECTED
+			}
     }
     for(auto it =playingServer.begin(); it!=playingServer.end(); ++it)
     {
         if((*it) != origin)
-            (*it)->BroadcastRemoteChat(message,color);
+            (*it)->BroadcastChatPacket(packet.get());
     }
     if(waitingRoom != origin)
-        waitingRoom->BroadcastRemoteChat(message,color);
+        waitingRoom->BroadcastChatPacket(packet.get());
 	if(origin != nullptr)
         gameServer->callChatCallback(message,color);
 }
@@ -221,7 +303,10 @@ bool RoomManager::FillAllRooms()
         {
             bool result = FillRoom(p);
 			if(p->state != DuelRoom::State::WAITING && p->state != DuelRoom::State::FULL )
+			{
+				p->BugDetected("FillAllRooms: the room left WAITING while it was filled");
 				return false; //MEGABUG DETECTED
+			}
 				
             //if(!result)
             //  return false;
@@ -231,63 +316,41 @@ bool RoomManager::FillAllRooms()
 
 }
 
-void RoomManager::ban(std::string ip)
-{
-	time_t now = time(NULL);
-	int interval = 30;
-	
-	for(auto it = bannedIPs.begin();it!=bannedIPs.end();)
-		if(now - it->second > interval)
-			it = bannedIPs.erase(it);
-		else
-			++it;
-			
-	printf("scatta il ban per %s\n",ip.c_str());
-   bannedIPs.insert(std::pair<std::string,time_t>(ip,now));
-}
-bool RoomManager::isBanned(std::string ip)
-{
-	
-	auto ret = bannedIPs.equal_range(ip);
-	int count = 0;
-	for(auto it = ret.first;it!=ret.second;++it)
-		count++;
-	
-    return count>1;
-}
-
 bool RoomManager::checkSpam(DuelPlayer*dp,std::wstring messaggio)
 {
-	dp->chatTimestamp.push_back(std::pair<time_t,std::wstring>(time(NULL),messaggio));
-	if(dp->chatTimestamp.size() < 3)
-		return false;
-	
-	auto it = dp->chatTimestamp.begin();
-	auto primo = *(++it);
-	auto secondo = *(++it);
-	
+	RateLimiter* limiter = RateLimiter::getInstance();
 	bool daBannare = false;
-	
-	
-	if(messaggio == primo.second && messaggio == secondo.second)
-	{
+
+	//the buckets are shared by all the gameservers, by ip and by account
+	if(!limiter->allow(RateLimiter::ipKey(RateLimiter::CHAT,dp->ip),CHAT_RATE,CHAT_BURST))
 		daBannare = true;
-	}
-	else if(dp->chatTimestamp.size() > 5)
-	{	
-		if(dp->chatTimestamp.back().first - dp->chatTimestamp.front().first <5)
-			daBannare = true;
+	if(dp->loginStatus == Users::LoginResult::AUTHENTICATED &&
+		!limiter->allow(RateLimiter::accountKey(RateLimiter::CHAT,dp->namew_low),CHAT_RATE,CHAT_BURST))
+		daBannare = true;
+
+	//the same message three times
+	dp->chatTimestamp.push_back(std::pair<time_t,std::wstring>(time(NULL),messaggio));
+	if(dp->chatTimestamp.size() > 3)
 		dp->chatTimestamp.pop_front();
-	} 
+	if(dp->chatTimestamp.size() == 3)
+	{
+		auto it = dp->chatTimestamp.begin();
+		auto primo = *(it++);
+		auto secondo = *(it++);
+		if(messaggio == primo.second && messaggio == secondo.second)
+			daBannare = true;
+	}
+
 	if(daBannare)
 	{
 		wchar_t name[20];
 
 		BufferIO::CopyWStr(dp->name, name, 20);
-		ban(std::string(dp->ip));
+		printf("scatta il ban per %s\n",dp->ip);
+		bool banned = limiter->strike(RateLimiter::ipKey(RateLimiter::BAN,dp->ip),Config::getInstance()->ban_seconds);
 		dp->color = -3;
 		std::wstring banmessage;
-		if(isBanned(dp->ip))
+		if(banned)
 			banmessage = std::wstring(name) + std::wstring(L" is BANNED for spamming!");
 		else
 			banmessage = std::wstring(name) + std::wstring(L" is muted for spamming!");
@@ -304,7 +367,7 @@ bool RoomManager::InsertPlayerInWaitingRoom(DuelPlayer*dp)
     //true is success
 
     RoomInterface* netServer = waitingRoom;
-    if(netServer == nullptr || isBanned(std::string(dp->ip)))
+    if(netServer == nullptr || RateLimiter::getInstance()->isIpBanned(dp->ip))
     {
         gameServer->DisconnectPlayer(dp);
         return false;
@@ -313,6 +376,13 @@ bool RoomManager::InsertPlayerInWaitingRoom(DuelPlayer*dp)
     return true;
 }
 
+std::vector<DuelPlayer*> RoomManager::getIdlePlayers()
+{
+    if(waitingRoom == nullptr)
+        return std::vector<DuelPlayer*>();
+    return waitingRoom->getIdlePlayers();
+}
+
 bool RoomManager::InsertPlayer(DuelPlayer*dp,unsigned char mode)
 {
 
@@ -338,6 +408,7 @@ DuelRoom* RoomManager::createServer(unsigned char mode)
     DuelRoom *netServer = new DuelRoom(this,gameServer,mode);
 
     elencoServer.push_back(netServer);
+    elencoIndex[netServer] = std::prev(elencoServer.end());
 
     Statistics::getInstance()->setNumRooms(getNumRooms());
 
@@ -2,6 +2,7 @@
 #ifndef ROOMMANAGER_H
 #define ROOMMANAGER_H
 #include <list>
+#include <unordered_map>
 #include <mutex>
 #include "WaitingRoom.h"
 #include "DuelRoom.h"
@@ -16,13 +17,6 @@ namespace ygo {
         private:
         event* keepAliveEvent;
 
-        std::multimap<std::string,time_t> bannedIPs;
-
-        public:
-        void ban(std::string);
-        private:
-        bool isBanned(std::string);
-
 
         static const int SecondsBeforeFillAllRooms = 3;
         static const int RemoveDeadRoomsRatio = 2;
@@ -37,6 +31,9 @@ namespace ygo {
         public:
         event_base* net_evbase;
         std::list<DuelRoom *> elencoServer;
+        //position of each room in elencoServer, so a room can be checked and removed in O(1)
+        std::unordered_map<DuelRoom *,std::list<DuelRoom *>::iterator> elencoIndex;
+        void removeFromElenco(DuelRoom* room);
         std::set<DuelRoom *> playingServer;
         std::set<DuelRoom *> zombieServer;
         GameServer* gameServer;
@@ -52,15 +49,26 @@ namespace ygo {
         
 		void notifyStateChange(DuelRoom* room,DuelRoom::State oldstate,DuelRoom::State newstate);
         bool InsertPlayerInWaitingRoom(DuelPlayer*dp);
+        std::vector<DuelPlayer*> getIdlePlayers();
         bool InsertPlayer(DuelPlayer*dp);
         bool InsertPlayer(DuelPlayer*dp,unsigned char mode);
         DuelRoom* getFirstAvailableServer(DuelPlayer* referencePlayer);
         DuelRoom* getFirstAvailableServer(DuelPlayer* referencePlayer,unsigned char mode,bool);
         int getNumPlayers();
         int getNumRooms();
+        //the rooms with the most engine time, first the heaviest
+        std::vector<DuelRoom*> getHeavyRooms(size_t k);
+        //flags the rooms over room_budget_engine_ms or room_budget_kbytes in the last minute
+        void checkBudgets();
+        static const int BUDGET_WINDOW = 60;
+        //after a reload of the banlists: the rooms that use the old first two move to the new ones
+        void ReplaceLfLists(const uint32_t* replaced);
         void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
 
 		bool checkSpam(DuelPlayer*dp,std::wstring messaggio);
+		//six messages in five seconds were already too many
+		static constexpr float CHAT_RATE = 1;
+		static constexpr float CHAT_BURST = 5;
         std::vector<DuelRoom *> getCompatibleRoomsList(DuelPlayer* dp);
         void tryToInsertPlayerInServer(DuelPlayer*dp,DuelRoom* serv);
         static int maxScoreDifference(int referenceScore){return std::max(400,(referenceScore>3000)?(referenceScore/3):(referenceScore/4));}
@@ -0,0 +1,55 @@
+#ifndef _ROOMUSAGE_H_
+#define _ROOMUSAGE_H_
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+namespace ygo
+{
+
+/*
+ * what a duel room costs to the gameserver: time spent inside the engine,
+ * messages analysed, bytes written to its duelists and to its observers, packets read.
+ * Plain counters of the network thread, read by !roomstats, !heavy and the metrics.
+ * RoomManager::checkBudgets compares the last minute with room_budget_*
+ * and flags the room the first time it goes over.
+ */
+struct RoomUsage
+{
+    enum Recipient {DUELISTS,OBSERVERS,RECIPIENTS};
+
+    uint64_t engineNs;
+    uint64_t messages;
+    uint64_t bytesOut[RECIPIENTS];
+    uint64_t bytesIn;
+    uint64_t packetsIn;
+    time_t since;
+
+    //the budget window: the totals at its start
+    time_t windowStart;
+    uint64_t windowEngineNs;
+    uint64_t windowBytes;
+    bool overBudget;
+
+    RoomUsage()
+    {
+        memset(this,0,sizeof(RoomUsage));
+        since = windowStart = time(NULL);
+    }
+
+    uint64_t bytesSent() const
+    {
+        return bytesOut[DUELISTS] + bytesOut[OBSERVERS];
+    }
+
+    //the engine runs for microseconds at a time, the coarse clock is too coarse here
+    static uint64_t nowNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+};
+
+}
+#endif
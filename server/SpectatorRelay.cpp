@@ -0,0 +1,185 @@
+#include "SpectatorRelay.h"
+#include "GameServer.h"
+#include "debug.h"
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <algorithm>
+#include <string.h>
+
+namespace ygo
+{
+
+const size_t SpectatorRelay::BLOCK_SIZE;
+unsigned long SpectatorRelay::published = 0;
+unsigned long SpectatorRelay::relayed = 0;
+
+RelayBlock::RelayBlock(size_t capacity):refs(0),len(0),capacity(capacity)
+{
+    buffer = new char[capacity];
+}
+
+RelayBlock::~RelayBlock()
+{
+    delete[] buffer;
+}
+
+RelayBlock* RelayBlock::create(size_t capacity)
+{
+    RelayBlock* block = new RelayBlock(capacity);
+    block->retain();
+    return block;
+}
+
+bool RelayBlock::append(unsigned char proto, const void* data, size_t datalen)
+{
+    if(len + 3 + datalen > capacity)
+        return false;
+    char* p = buffer + len;
+    BufferIO::WriteInt16(p, 1 + datalen);
+    BufferIO::WriteInt8(p, proto);
+    if(datalen)
+        memcpy(p, data, datalen);
+    len += 3 + datalen;
+    return true;
+}
+
+void RelayBlock::sendTo(bufferevent* bev, size_t offset, size_t count)
+{
+    retain();
+    if(evbuffer_add_reference(bufferevent_get_output(bev),buffer + offset,count,cleanup,this))
+        release();
+}
+
+size_t RelayBlock::fit(size_t offset, size_t limit, bool first) const
+{
+    size_t end = offset;
+    while(end < len)
+    {
+        size_t packet = 2 + (unsigned char)buffer[end] + ((unsigned char)buffer[end + 1] << 8);
+        if(end + packet - offset > limit && !(first && end == offset))
+            break;
+        end += packet;
+    }
+    return end - offset;
+}
+
+void RelayBlock::cleanup(const void* data,size_t datalen,void* extra)
+{
+    ((RelayBlock*)extra)->release();
+}
+
+SpectatorRelay::SpectatorRelay():started(false),total(0)
+{
+
+}
+
+SpectatorRelay::~SpectatorRelay()
+{
+    Clear();
+}
+
+void SpectatorRelay::Start()
+{
+    Clear();
+    started = true;
+}
+
+void SpectatorRelay::Clear()
+{
+    //the blocks still queued in an evbuffer live until they are written
+    for(auto it = stream.cbegin(); it != stream.cend(); ++it)
+        (*it)->release();
+    if(total)
+        log(VERBOSE,"spectator relay: stream of %lu bytes released, %d subscribers\n",(unsigned long)total,(int)subscribers.size());
+    stream.clear();
+    subscribers.clear();
+    total = 0;
+    started = false;
+}
+
+void SpectatorRelay::Publish(unsigned char proto, const void* data, size_t len)
+{
+    if(!started)
+        return;
+    if(stream.empty() || !stream.back()->append(proto, data, len))
+    {
+        //a replay can be bigger than a block
+        stream.push_back(RelayBlock::create(std::max(BLOCK_SIZE, len + 3)));
+        stream.back()->append(proto, data, len);
+    }
+    total += len + 3;
+    published++;
+}
+
+void SpectatorRelay::Subscribe(DuelPlayer* dp, bool fromStart)
+{
+    Cursor& cursor = subscribers[dp];
+    cursor = Cursor();
+    if(!fromStart && !stream.empty())
+    {
+        cursor.block = stream.size() - 1;
+        cursor.offset = stream.back()->size();
+    }
+}
+
+void SpectatorRelay::Unsubscribe(DuelPlayer* dp)
+{
+    subscribers.erase(dp);
+}
+
+bool SpectatorRelay::isSubscribed(DuelPlayer* dp) const
+{
+    return subscribers.find(dp) != subscribers.end();
+}
+
+bool SpectatorRelay::isBehind(const Cursor& cursor) const
+{
+    if(cursor.block >= stream.size())
+        return false;
+    return cursor.block + 1 < stream.size() || cursor.offset < stream[cursor.block]->size();
+}
+
+bool SpectatorRelay::isBehind(DuelPlayer* dp) const
+{
+    auto it = subscribers.find(dp);
+    return it != subscribers.end() && isBehind(it->second);
+}
+
+std::vector<DuelPlayer*> SpectatorRelay::getSubscribers() const
+{
+    std::vector<DuelPlayer*> lista;
+    for(auto it = subscribers.cbegin(); it != subscribers.cend(); ++it)
+        lista.push_back(it->first);
+    return lista;
+}
+
+bool SpectatorRelay::SendTo(GameServer* gameServer, DuelPlayer* dp, size_t budget)
+{
+    auto it = subscribers.find(dp);
+    if(it == subscribers.end())
+        return false;
+    Cursor& cursor = it->second;
+    size_t sent = 0;
+    while(cursor.block < stream.size())
+    {
+        RelayBlock* block = stream[cursor.block];
+        //a block always ends with a whole packet, a big one is cut at the last packet that fits
+        size_t count = block->size() - cursor.offset;
+        if(count && sent + count > budget)
+            count = block->fit(cursor.offset, budget - sent, sent == 0);
+        if(count)
+        {
+            gameServer->safe_bufferevent_write(dp, block, cursor.offset, count);
+            cursor.offset += count;
+            sent += count;
+            relayed++;
+        }
+        if(cursor.offset < block->size() || cursor.block + 1 == stream.size() || sent >= budget)
+            break;
+        cursor.block++;
+        cursor.offset = 0;
+    }
+    return isBehind(cursor);
+}
+
+}
@@ -0,0 +1,111 @@
+#ifndef _SPECTATORRELAY_H_
+#define _SPECTATORRELAY_H_
+#include <vector>
+#include <unordered_map>
+#include <stddef.h>
+
+struct bufferevent;
+
+namespace ygo
+{
+struct DuelPlayer;
+class GameServer;
+
+/*
+ * a piece of the stream of a duel, packets already encoded for the wire.
+ * It is written to the observers by reference, like ChatPacket, and it only grows:
+ * the bytes already referenced by an evbuffer never change.
+ */
+class RelayBlock
+{
+public:
+    static RelayBlock* create(size_t capacity);
+
+    void retain()
+    {
+        refs++;
+    }
+    void release()
+    {
+        if(--refs == 0)
+            delete this;
+    }
+    size_t size() const
+    {
+        return len;
+    }
+    //false if the packet does not fit
+    bool append(unsigned char proto, const void* data, size_t datalen);
+    void sendTo(bufferevent* bev, size_t offset, size_t count);
+    //the bytes of the whole packets from offset that fit in limit, at least one packet if first
+    size_t fit(size_t offset, size_t limit, bool first) const;
+
+private:
+    RelayBlock(size_t capacity);
+    ~RelayBlock();
+    static void cleanup(const void* data,size_t datalen,void* extra);
+
+    unsigned int refs;
+    size_t len;
+    size_t capacity;
+    char* buffer;
+};
+
+/*
+ * the messages of a duel for its observers.
+ * The duel publishes each packet once, whatever the number of observers, and the room
+ * writes to every subscriber the part of the stream it has not received yet when the
+ * duel has finished its messages.
+ * The stream restarts with every duel (MSG_START): an observer that subscribes later
+ * starts from there and sees the duel again up to the current message.
+ */
+class SpectatorRelay
+{
+public:
+    SpectatorRelay();
+    ~SpectatorRelay();
+
+    void Start();
+    void Clear();
+    bool isStarted() const
+    {
+        return started;
+    }
+    size_t streamSize() const
+    {
+        return total;
+    }
+    void Publish(unsigned char proto, const void* data, size_t len);
+
+    //from the start of the duel, or from the current message
+    void Subscribe(DuelPlayer* dp, bool fromStart = true);
+    void Unsubscribe(DuelPlayer* dp);
+    bool isSubscribed(DuelPlayer* dp) const;
+    bool isBehind(DuelPlayer* dp) const;
+    std::vector<DuelPlayer*> getSubscribers() const;
+
+    //writes at least a packet if there is one, then stops at budget bytes.
+    //It stops only at the end of a packet, also inside a block. true if the subscriber is still behind
+    bool SendTo(GameServer* gameServer, DuelPlayer* dp, size_t budget);
+
+    static const size_t BLOCK_SIZE = 16384;
+    static unsigned long published;
+    static unsigned long relayed;
+
+private:
+    struct Cursor
+    {
+        size_t block;
+        size_t offset;
+        Cursor():block(0),offset(0) {}
+    };
+    bool isBehind(const Cursor& cursor) const;
+
+    bool started;
+    size_t total;
+    std::vector<RelayBlock*> stream;
+    std::unordered_map<DuelPlayer*,Cursor> subscribers;
+};
+
+}
+#endif
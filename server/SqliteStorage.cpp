@@ -0,0 +1,388 @@
+#include "SqliteStorage.h"
+#include "debug.h"
+#include "Rating.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+namespace ygo
+{
+
+//a statement left active keeps the read transaction open and the reads would not see the new writes
+struct StatementReset
+{
+    sqlite3_stmt* stmt;
+    StatementReset(sqlite3_stmt* stmt):stmt(stmt) {}
+    ~StatementReset()
+    {
+        if(stmt)
+            sqlite3_reset(stmt);
+    }
+};
+
+static const char* schema =
+    "CREATE TABLE IF NOT EXISTS users(username TEXT PRIMARY KEY COLLATE NOCASE, password TEXT NOT NULL DEFAULT '',"
+    " color INTEGER NOT NULL DEFAULT 0, last_login TEXT, last_ip TEXT);"
+    "CREATE TABLE IF NOT EXISTS stats(username TEXT PRIMARY KEY COLLATE NOCASE, score INTEGER NOT NULL DEFAULT 1000,"
+    " wins INTEGER NOT NULL DEFAULT 0, losses INTEGER NOT NULL DEFAULT 0, draws INTEGER NOT NULL DEFAULT 0, tags INTEGER NOT NULL DEFAULT 0,"
+    " maxspsummonsturn INTEGER NOT NULL DEFAULT 0, longestduel INTEGER NOT NULL DEFAULT 0, maxattacksturn INTEGER NOT NULL DEFAULT 0,"
+    " maxdamage1shot INTEGER NOT NULL DEFAULT 0, recoveredduel INTEGER NOT NULL DEFAULT 0, setmonstersduel INTEGER NOT NULL DEFAULT 0,"
+    " effectsduel INTEGER NOT NULL DEFAULT 0, setstduel INTEGER NOT NULL DEFAULT 0);"
+    "CREATE INDEX IF NOT EXISTS stats_score ON stats(score);"
+    //the rank is the number of better scores, the index makes it a range count
+    "CREATE VIEW IF NOT EXISTS ranking AS SELECT username, score,"
+    " (SELECT count(*) FROM stats better WHERE better.score > stats.score) + 1 AS rank FROM stats;";
+
+static const char* selectStats = "SELECT username,score,wins,losses,draws,tags FROM stats where username = ?";
+static const char* updateStats = "UPDATE stats SET score = ?, wins = ?, losses = ?, draws = ?,tags = ? WHERE username = ?";
+
+SqliteStorage::SqliteStorage(const std::string& path):path(path),db(nullptr),writerDb(nullptr),writer(nullptr),
+    queued(0),done(0),isRunning(false)
+{
+    db = openDatabase(path);
+    writerDb = openDatabase(path);
+    if(db == nullptr || writerDb == nullptr || !createSchema(writerDb))
+    {
+        log(BUG,"cannot open the sqlite storage %s\n",path.c_str());
+        return;
+    }
+    isRunning = true;
+    writer = new std::thread(&SqliteStorage::WriterThread,this);
+    log(INFO,"sqlite storage %s opened\n",path.c_str());
+}
+
+SqliteStorage::~SqliteStorage()
+{
+    if(writer)
+    {
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            isRunning = false;
+            writeCond.notify_one();
+        }
+        writer->join();
+        delete writer;
+    }
+    for(auto it = statements.begin(); it != statements.end(); ++it)
+        sqlite3_finalize(it->second);
+    sqlite3_close(db);
+    sqlite3_close(writerDb);
+}
+
+sqlite3* SqliteStorage::openDatabase(const std::string& path)
+{
+    sqlite3* db = nullptr;
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+    {
+        log(BUG,"sqlite: %s\n",db?sqlite3_errmsg(db):"out of memory");
+        sqlite3_close(db);
+        return nullptr;
+    }
+    sqlite3_busy_timeout(db, BUSY_TIMEOUT_MS);
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", nullptr, nullptr, nullptr);
+    return db;
+}
+
+bool SqliteStorage::createSchema(sqlite3* db)
+{
+    char* error = nullptr;
+    if(sqlite3_exec(db, schema, nullptr, nullptr, &error) != SQLITE_OK)
+    {
+        log(BUG,"sqlite schema: %s\n",error);
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+bool SqliteStorage::isAvailable()
+{
+    return isRunning;
+}
+
+void SqliteStorage::bind(sqlite3_stmt* stmt, const std::vector<Param>& params)
+{
+    for(size_t i = 0; i < params.size(); i++)
+    {
+        if(params[i].isText)
+            sqlite3_bind_text(stmt, i + 1, params[i].text.data(), params[i].text.size(), SQLITE_TRANSIENT);
+        else
+            sqlite3_bind_int64(stmt, i + 1, params[i].number);
+    }
+}
+
+sqlite3_stmt* SqliteStorage::prepare(const std::string& query)
+{
+    auto it = statements.find(query);
+    if(it != statements.end())
+    {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+    sqlite3_stmt* stmt = nullptr;
+    if(db == nullptr || sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return nullptr;
+    statements[query] = stmt;
+    return stmt;
+}
+
+void SqliteStorage::queueWrite(const std::string& query, const std::vector<Param>& params)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if(!isRunning)
+        return;
+    Write write;
+    write.query = query;
+    write.params = params;
+    writes.push_back(write);
+    queued++;
+    writeCond.notify_one();
+}
+
+void SqliteStorage::waitForWrites()
+{
+    std::unique_lock<std::mutex> lock(writeMutex);
+    unsigned long long target = queued;
+    drainedCond.wait(lock,[this,target] {return done >= target || !isRunning;});
+}
+
+void SqliteStorage::WriterThread()
+{
+    std::unordered_map<std::string,sqlite3_stmt*> writeStatements;
+    std::unique_lock<std::mutex> lock(writeMutex);
+    while(isRunning || !writes.empty())
+    {
+        writeCond.wait(lock,[this] {return !writes.empty() || !isRunning;});
+        std::vector<Write> batch;
+        while(!writes.empty() && batch.size() < MAX_BATCH)
+        {
+            batch.push_back(writes.front());
+            writes.pop_front();
+        }
+        lock.unlock();
+
+        //one transaction per batch: one fsync of the WAL for many updates
+        sqlite3_exec(writerDb, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr);
+        for(auto it = batch.cbegin(); it != batch.cend(); ++it)
+        {
+            sqlite3_stmt*& stmt = writeStatements[it->query];
+            if(stmt == nullptr && sqlite3_prepare_v2(writerDb, it->query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                log(BUG,"sqlite: %s\n",sqlite3_errmsg(writerDb));
+                continue;
+            }
+            bind(stmt, it->params);
+            if(sqlite3_step(stmt) != SQLITE_DONE)
+                log(WARN,"sqlite write failed: %s\n",sqlite3_errmsg(writerDb));
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+        if(sqlite3_exec(writerDb, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK)
+        {
+            log(BUG,"sqlite commit failed: %s\n",sqlite3_errmsg(writerDb));
+            sqlite3_exec(writerDb, "ROLLBACK", nullptr, nullptr, nullptr);
+        }
+
+        lock.lock();
+        done += batch.size();
+        drainedCond.notify_all();
+    }
+    for(auto it = writeStatements.begin(); it != writeStatements.end(); ++it)
+        sqlite3_finalize(it->second);
+}
+
+int SqliteStorage::getRank(std::string username)
+{
+    std::lock_guard<std::mutex> lock(readMutex);
+    sqlite3_stmt* stmt = prepare("SELECT rank from ranking where username = ?");
+    if(stmt == nullptr)
+        return 0;
+    StatementReset reset(stmt);
+    bind(stmt, {Param(username)});
+    return sqlite3_step(stmt) == SQLITE_ROW?sqlite3_column_int(stmt, 0):0;
+}
+
+bool SqliteStorage::loadScores(std::vector<std::pair<std::string,int>>& scores)
+{
+    waitForWrites();
+    std::lock_guard<std::mutex> lock(readMutex);
+    sqlite3_stmt* stmt = prepare("SELECT username, score from stats");
+    if(stmt == nullptr)
+        return false;
+    StatementReset reset(stmt);
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        scores.push_back(std::make_pair(std::string((const char*)sqlite3_column_text(stmt, 0)),sqlite3_column_int(stmt, 1)));
+    return rc == SQLITE_DONE;
+}
+
+std::string SqliteStorage::getCountryCode(std::string ip)
+{
+    std::string binaryIP = "";
+    binaryIP.resize(4);
+    if(inet_pton(AF_INET,ip.c_str(),&binaryIP[0]) != 1)
+        return "UNK";
+
+    //the table is optional, without it every country is unknown
+    std::lock_guard<std::mutex> lock(readMutex);
+    sqlite3_stmt* stmt = prepare("select country from dbip_lookup where addr_type = 'ipv4' and ip_start <= ? order by ip_start desc limit 1");
+    if(stmt == nullptr)
+        return "UNK";
+    StatementReset reset(stmt);
+    sqlite3_bind_blob(stmt, 1, binaryIP.data(), binaryIP.size(), SQLITE_TRANSIENT);
+    if(sqlite3_step(stmt) != SQLITE_ROW)
+        return "UNK";
+    return std::string((const char*)sqlite3_column_text(stmt, 0));
+}
+
+std::pair<int,int> SqliteStorage::getScore(std::string username)
+{
+    std::lock_guard<std::mutex> lock(readMutex);
+    sqlite3_stmt* stmt = prepare("select ranking.score,stats.score from ranking join stats on ranking.username=stats.username where ranking.username = ?");
+    if(stmt == nullptr)
+        return std::pair<int,int>(0,0);
+    StatementReset reset(stmt);
+    bind(stmt, {Param(username)});
+    if(sqlite3_step(stmt) != SQLITE_ROW)
+        return std::pair<int,int>(0,0);
+    return std::pair<int,int>(sqlite3_column_int(stmt, 0),sqlite3_column_int(stmt, 1));
+}
+
+bool SqliteStorage::setUserStats(UserStats &us)
+{
+    queueWrite(updateStats,statsParams(us));
+    return true;
+}
+
+UserStats SqliteStorage::getUserStats(std::string username)
+{
+    //the new score is computed from these: the previous update must be written
+    waitForWrites();
+    std::lock_guard<std::mutex> lock(readMutex);
+    sqlite3_stmt* stmt = prepare(selectStats);
+    if(stmt == nullptr)
+        throw std::exception();
+    UserStats us;
+    if(!readStats(stmt,username,us))
+        throw std::exception();
+    return us;
+}
+
+bool SqliteStorage::readStats(sqlite3_stmt* stmt,const std::string& username,UserStats& us,bool* missing)
+{
+    StatementReset reset(stmt);
+    bind(stmt, {Param(username)});
+    int rc = sqlite3_step(stmt);
+    if(missing != nullptr)
+        *missing = rc == SQLITE_DONE;
+    if(rc != SQLITE_ROW)
+        return false;
+    us.username = (const char*)sqlite3_column_text(stmt, 0);
+    us.score = sqlite3_column_int(stmt, 1);
+    us.wins = sqlite3_column_int(stmt, 2);
+    us.losses = sqlite3_column_int(stmt, 3);
+    us.draws = sqlite3_column_int(stmt, 4);
+    us.tags = sqlite3_column_int(stmt, 5);
+    return true;
+}
+
+std::vector<SqliteStorage::Param> SqliteStorage::statsParams(const UserStats& us)
+{
+    return {Param(us.score),Param(us.wins),Param(us.losses),Param(us.draws),Param(us.tags),Param(us.username)};
+}
+
+bool SqliteStorage::updateRatings(RatingUpdate& ru)
+{
+    //no round trips here: the point is the atomicity. BEGIN IMMEDIATE takes the write lock
+    //before the reads, another gameserver cannot change these players in between
+    waitForWrites();
+    std::lock_guard<std::mutex> lock(readMutex);
+    if(db == nullptr || sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK)
+        return false;
+    ru.statements = 1;
+    bool ok = true;
+    ru.before.assign(ru.names.size(),UserStats());
+    sqlite3_stmt* select = prepare(selectStats);
+    for(unsigned int i = 0; ok && i < ru.names.size(); i++, ru.statements++)
+    {
+        bool missing = false;
+        ok = select != nullptr && readStats(select,ru.names[i],ru.before[i],&missing);
+        if(missing)
+            ru.missing.push_back(ru.names[i]);
+    }
+    if(ok)
+    {
+        ru.after = Rating::update(ru.before,ru.risultato);
+        sqlite3_stmt* update = prepare(updateStats);
+        ok = update != nullptr;
+        for(unsigned int i = 0; ok && i < ru.after.size(); i++, ru.statements++)
+        {
+            StatementReset reset(update);
+            bind(update, statsParams(ru.after[i]));
+            ok = sqlite3_step(update) == SQLITE_DONE;
+        }
+    }
+    ru.statements++;
+    if(ok && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK)
+        return true;
+    //a player without stats is not an error of the storage
+    if(ru.missing.empty())
+        log(WARN,"sqlite rating update failed: %s\n",sqlite3_errmsg(db));
+    sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    return false;
+}
+
+bool SqliteStorage::createUser(std::string username, std::string password, int score,int wins,int losses,int draws)
+{
+    queueWrite("INSERT INTO users(username,password) VALUES (?, ?)",{Param(username),Param(password)});
+    queueWrite("INSERT INTO stats(username,score,wins,losses,draws) VALUES (?, ?, ?,?,?)",
+               {Param(username),Param(score),Param(wins),Param(losses),Param(draws)});
+    return isRunning;
+}
+
+bool SqliteStorage::userExists(std::string username)
+{
+    waitForWrites();
+    std::lock_guard<std::mutex> lock(readMutex);
+    sqlite3_stmt* stmt = prepare("select count(*) FROM users WHERE username = ?");
+    if(stmt == nullptr)
+        return false;
+    StatementReset reset(stmt);
+    bind(stmt, {Param(username)});
+    return sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+}
+
+int SqliteStorage::login(std::string username,std::string password,char*ip)
+{
+    //a user created by the previous login must be visible
+    waitForWrites();
+    std::string realPassword;
+    int color;
+    {
+        std::lock_guard<std::mutex> lock(readMutex);
+        sqlite3_stmt* stmt = prepare("select password,color FROM users WHERE username = ?");
+        if(stmt == nullptr)
+            return -1;
+        StatementReset reset(stmt);
+        bind(stmt, {Param(username)});
+        if(sqlite3_step(stmt) != SQLITE_ROW)
+        {
+            createUser(username,password);
+            return 1;
+        }
+        realPassword = (const char*)sqlite3_column_text(stmt, 0);
+        color = sqlite3_column_int(stmt, 1);
+    }
+
+    int risultato = 1;
+    if(realPassword != "" && password != realPassword)
+        return 0;
+    else if(realPassword != "" && password == realPassword)
+        risultato = 1+color;
+    //login success
+
+    queueWrite("UPDATE users set password = ?, last_login = CURRENT_TIMESTAMP,last_ip = ? WHERE username = ?",
+               {Param(password),Param(std::string(ip)),Param(username)});
+    return risultato;
+}
+
+}
@@ -0,0 +1,87 @@
+#ifndef _SQLITESTORAGE_H_
+#define _SQLITESTORAGE_H_
+#include "StorageBackend.h"
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+namespace ygo
+{
+
+/*
+ * embedded storage on a sqlite file in WAL mode, same tables of the mysql schema
+ * (ranking is a view on stats).
+ * The reads are done on the calling thread with cached prepared statements,
+ * the writes are queued to a single writer thread with its own connection and
+ * committed in batches. A read that must see the previous writes (the stats
+ * before a score update, a login) waits for the queue to be empty.
+ * Every gameserver opens the file, sqlite serializes the writers of different processes.
+ */
+class SqliteStorage: public StorageBackend
+{
+public:
+    SqliteStorage(const std::string& path);
+    ~SqliteStorage();
+    bool isAvailable();
+    bool createUser(std::string username, std::string password, int score=default_score,int wins=0,int losses=0,int draws=0);
+    bool userExists(std::string username);
+    int login(std::string username,std::string password,char*ip);
+    UserStats getUserStats(std::string username);
+    bool setUserStats(UserStats&);
+    bool updateRatings(RatingUpdate& update);
+    int getRank(std::string username);
+    bool loadScores(std::vector<std::pair<std::string,int>>& scores);
+    std::pair<int,int> getScore(std::string username);
+    std::string getCountryCode(std::string);
+
+    static const int BUSY_TIMEOUT_MS = 5000;
+    static const unsigned int MAX_BATCH = 256;
+
+private:
+    struct Param
+    {
+        bool isText;
+        long long number;
+        std::string text;
+        Param(long long number):isText(false),number(number) {}
+        Param(const std::string& text):isText(true),number(0),text(text) {}
+    };
+    struct Write
+    {
+        std::string query;
+        std::vector<Param> params;
+    };
+
+    std::string path;
+    sqlite3* db;
+    std::unordered_map<std::string,sqlite3_stmt*> statements;
+    std::mutex readMutex;
+
+    sqlite3* writerDb;
+    std::thread* writer;
+    std::mutex writeMutex;
+    std::condition_variable writeCond;
+    std::condition_variable drainedCond;
+    std::deque<Write> writes;
+    unsigned long long queued;
+    unsigned long long done;
+    bool isRunning;
+
+    static sqlite3* openDatabase(const std::string& path);
+    static bool createSchema(sqlite3* db);
+    static void bind(sqlite3_stmt* stmt, const std::vector<Param>& params);
+    static bool readStats(sqlite3_stmt* stmt,const std::string& username,UserStats& us,bool* missing = nullptr);
+    static std::vector<Param> statsParams(const UserStats& us);
+    //called with readMutex taken
+    sqlite3_stmt* prepare(const std::string& query);
+    void queueWrite(const std::string& query, const std::vector<Param>& params);
+    void waitForWrites();
+    void WriterThread();
+};
+
+}
+#endif
@@ -17,9 +17,9 @@ void Statistics::SendStatisticsRow(ServerStats serverStats)
 
         try
         {
-            sql::Connection *con = MySqlWrapper::getInstance()->getConnection();
+            MySqlWrapper::Lease con;
 
-            std::unique_ptr<sql::PreparedStatement> stmt(con->prepareStatement("insert into serverstats_instances(PID,users,rooms,max_users,status) values(?,?,?,?,?) ON DUPLICATE KEY UPDATE users=?,rooms=?,max_users=?,status=?"));
+            sql::PreparedStatement* stmt(con.prepare("insert into serverstats_instances(PID,users,rooms,max_users,status) values(?,?,?,?,?) ON DUPLICATE KEY UPDATE users=?,rooms=?,max_users=?,status=?"));
             //stmt->setQueryTimeout(5);
             stmt->setInt(1, serverStats.PID);
             stmt->setInt(2, serverStats.users);
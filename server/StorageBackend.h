@@ -0,0 +1,68 @@
+#ifndef _STORAGEBACKEND_H_
+#define _STORAGEBACKEND_H_
+#include <string>
+#include <utility>
+#include <vector>
+#include <exception>
+namespace ygo
+{
+
+struct UserStats
+{
+    std::string username;
+    unsigned int score;
+    unsigned int wins;
+    unsigned int losses;
+    unsigned int draws;
+    unsigned int tags;
+};
+
+/*
+ * the result of a finished duel: updateRatings reads the players (before),
+ * computes the new scores with Rating::update and writes them (after)
+ * in one transaction. statements is the number of statements sent for it.
+ * missing are the players without a row in stats, when the update fails because of them.
+ */
+struct RatingUpdate
+{
+    std::vector<std::string> names;
+    int risultato;
+    std::vector<UserStats> before;
+    std::vector<UserStats> after;
+    int statements;
+    std::vector<std::string> missing;
+    RatingUpdate():risultato(0),statements(0) {}
+};
+
+/*
+ * where users, stats and ranking are stored.
+ * The semantics are the ones of the mysql schema: stats keeps the score and the
+ * results of a user, ranking gives the rank and the ranking score.
+ * The details of the duels are not here, they go to DuelAnalytics.
+ * getUserStats throws std::exception if the user does not exist or the storage fails.
+ */
+class StorageBackend
+{
+public:
+    static const int default_score = 1000;
+
+    virtual ~StorageBackend() {}
+    //false if every call would fail at once (the offline mode of Users)
+    virtual bool isAvailable() = 0;
+    virtual bool createUser(std::string username, std::string password, int score=default_score,int wins=0,int losses=0,int draws=0) = 0;
+    virtual bool userExists(std::string username) = 0;
+    //0 wrong password, 1 + color if logged (a new user is created), -1 if the storage failed
+    virtual int login(std::string username,std::string password,char*ip) = 0;
+    virtual UserStats getUserStats(std::string username) = 0;
+    virtual bool setUserStats(UserStats&) = 0;
+    //false if a player does not exist (in missing) or the transaction failed: nothing is written
+    virtual bool updateRatings(RatingUpdate& update) = 0;
+    virtual int getRank(std::string username) = 0;
+    //username and score of every row of stats, for the rank index
+    virtual bool loadScores(std::vector<std::pair<std::string,int>>& scores) = 0;
+    virtual std::pair<int,int> getScore(std::string username) = 0;
+    virtual std::string getCountryCode(std::string) = 0;
+};
+
+}
+#endif
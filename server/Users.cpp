@@ -9,11 +9,22 @@
 #include <list>
 #include <math.h>
 #include "debug.h"
+#include "Config.h"
+#include "MySqlWrapper.h"
+#include "RankIndex.h"
+#include "Rating.h"
+#include "IpcFrame.h"
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 namespace ygo
 {
 Users::Users()
 {
     database = new UsersDatabase();
+    MySqlWrapper::getInstance()->addHealthyCallback(ReplayJournal);
 }
 
 Users::~Users()
@@ -96,8 +107,23 @@ Users::LoginResultTuple Users::login(std::string username, std::string password,
     if(username[0] == '-')
         return Users::LoginResultTuple (username,Users::LoginResult::UNRANKED,0);
 
-    if(int color = database->login(username,password,ip))
+    if(!database->isAvailable())
+        return offlineLogin(username,password);
+
+    int color = database->login(username,password,ip);
+    //no connection in time or a failed query: not a wrong password
+    if(color < 0)
+        return offlineLogin(username,password);
+    if(color)
     {
+        {
+            std::lock_guard<std::mutex> lock(credentialsMutex);
+            if(credentials.size() >= MAX_CACHED_CREDENTIALS && !credentials.count(usernamel))
+                credentials.erase(credentials.begin());
+            CachedCredential& cred = credentials[usernamel];
+            cred.password = password;
+            cred.color = color-1;
+        }
         if(password != "")
             return Users::LoginResultTuple (username,Users::LoginResult::AUTHENTICATED,color-1);
         else
@@ -111,14 +137,43 @@ Users::LoginResultTuple Users::login(std::string username, std::string password,
     }
 }
 
+Users::LoginResultTuple Users::offlineLogin(std::string username, std::string password)
+{
+    //mysql is down: nobody is authenticated, who has a cached login keeps the name
+    std::string usernamel=username;
+    std::transform(usernamel.begin(), usernamel.end(), usernamel.begin(), ::tolower);
+    std::lock_guard<std::mutex> lock(credentialsMutex);
+    auto it = credentials.find(usernamel);
+    if(it != credentials.end() && it->second.password == password)
+    {
+        log(INFO,"mysql down, %s admitted as unranked from the cache\n",username.c_str());
+        return Users::LoginResultTuple (username,Users::LoginResult::UNRANKED,it->second.color);
+    }
+    log(INFO,"mysql down, %s admitted as guest\n",username.c_str());
+    return Users::LoginResultTuple ("-" + username,Users::LoginResult::UNRANKED,0);
+}
+
 std::pair<int,int> Users::getFullScore(std::string username)
 {
     if(username[0] == '-')
         return std::pair<int,int>(0,0);
 
+    std::string usernamel=username;
+    std::transform(usernamel.begin(), usernamel.end(), usernamel.begin(), ::tolower);
+    if(!database->isAvailable())
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex);
+        auto it = credentials.find(usernamel);
+        return it != credentials.end()?it->second.score:std::pair<int,int>(0,0);
+    }
+
     try
     {
         std::pair<int,int> score = database->getScore(username);
+        std::lock_guard<std::mutex> lock(credentialsMutex);
+        auto it = credentials.find(usernamel);
+        if(it != credentials.end())
+            it->second.score = score;
         return score;
     }
     catch(std::exception)
@@ -141,33 +196,15 @@ int Users::getRank(std::string username)
 {
     if(username[0] == '-')
         return 0;
+    if(RankIndex::getInstance()->isLoaded())
+        return RankIndex::getInstance()->getRank(username);
     return database->getRank(username);
 }
 
 
 float Users::win_exp(float delta)
 {
-    //delta is my_score - opponent score
-    return 1.0/(exp((-delta)/400.0)+1.0);
-}
-
-
-
-static int k(const UserStats &us)
-{
-    int tempK = 50;
-    int threeshold = 10;
-    if(us.wins + us.losses+us.draws <= threeshold)
-    {
-        tempK += tempK/2;
-        if(us.score <= 800 && us.score >= 200)
-            tempK +=tempK/2;
-    }
-    else if(us.score >= 2000 && us.score < 3000 )
-        tempK /=2;
-    else if(us.score >= 3000)
-        tempK /=3;
-    return tempK;
+    return Rating::win_exp(delta);
 }
 
 void Users::Draw(std::string win, std::string los)
@@ -190,146 +227,73 @@ std::string Users::getCountryCode(std::string ip)
 
 void Users::UpdateScore(std::vector<std::string> nomi, int risultato) //0= vittoria, 2 = pareggio
 {
-	std::vector<UserStats> us;
-	
-	unsigned int num_squadra1 = nomi.size()/2;
-	unsigned int num_squadra2 = nomi.size() - num_squadra1;
-	
-	unsigned int media_squadra1=0;
-	unsigned int media_squadra2=0;
-	int delta = 0;
-	try
-    {
-		int pos = 0;
-		for(auto nome = nomi.cbegin(); nome != nomi.cend();++nome,++pos)
-		{
-			if((*nome)[0] == '-')
-				return;
-			UserStats us_tmp = database->getUserStats(*nome);
-			us.push_back(us_tmp);
-			if(pos < num_squadra1)
-				media_squadra1 += us_tmp.score;
-			else
-				media_squadra2 += us_tmp.score;
-		}
-		media_squadra1 /= num_squadra1;
-		media_squadra2 /= num_squadra2;
-		delta = media_squadra1 - media_squadra2;
-			
-		
-		for(int i = 0;i<nomi.size();i++)
-		{
-			UserStats us_tmp = us[i];
-			
-			if(i<num_squadra1 && risultato == 0)
-			{
-				us_tmp.score += k(us_tmp) * (1.0-win_exp(delta))  * 1.0*us_tmp.score/media_squadra1;
-				us_tmp.wins++;
-			}
-			else if(i>=num_squadra1 && risultato == 0)
-			{
-				us_tmp.score += k(us_tmp) * (0.0-win_exp(-delta))  * 1.0*us_tmp.score/media_squadra2;
-				us_tmp.losses++;
-			}
-			else if(i<num_squadra1 && risultato == 2)
-			{
-				us_tmp.score += k(us_tmp) * (0.5-win_exp(delta))  * 1.0*us_tmp.score/media_squadra1;
-				us_tmp.draws++;
-			}
-			else if(i>=num_squadra1 && risultato == 2)
-			{
-				us_tmp.score += k(us_tmp) * (0.5-win_exp(-delta))  * 1.0*us_tmp.score/media_squadra2;
-				us_tmp.draws++;
-			}
-
-			if(num_squadra2 > 1)
-				us_tmp.tags++;
-			if(us_tmp.score < 100)
-				us_tmp.score = 100;
-			database->setUserStats(us_tmp);
-			
-			log(INFO,"%s score: %d >(%+d)-> %d\n",us_tmp.username.c_str(),us[i].score,(us_tmp.score-us[i].score),us_tmp.score);
-			
-		}
-		
+	//any failure keeps the result, not only when the circuit is already open
+	CommitResult result = CommitScore(nomi,risultato);
+	if(result == COMMITTED)
+		return;
+	std::string line = journalLine(nomi,risultato);
+	if(line.empty())
+		return;
+	if(result == RETRY)
+	{
+		if(appendJournal(Config::getInstance()->stats_journal,line))
+			log(INFO,"rating failed, duel result journaled: %s\n",line.c_str());
 	}
-    catch (std::exception e)
-    {
+	else if(appendJournal(Config::getInstance()->stats_journal + ".dead",line))
+		log(WARN,"rating failed, a player does not exist: %s\n",line.c_str());
+}
 
-    }
-	
+Users::CommitResult Users::CommitScore(const std::vector<std::string>& nomi, int risultato)
+{
+	for(auto nome = nomi.cbegin(); nome != nomi.cend();++nome)
+		if((*nome)[0] == '-')
+			return COMMITTED;
+	if(!database->isAvailable())
+		return RETRY;
+	RatingUpdate ru;
+	ru.names = nomi;
+	ru.risultato = risultato;
+	//in a transaction: if it fails nothing was written
+	if(Rate(ru))
+		return COMMITTED;
+	return ru.missing.empty()?RETRY:UNKNOWN_PLAYER;
 }
 
-void Users::UpdateStats(std::vector<LoggerPlayerInfo *> nomi, int risultato) //0= vittoria, 2 = pareggio
+bool Users::Rate(RatingUpdate& ru)
 {
-	std::vector<UserStats> us;
-	
-	unsigned int num_squadra1 = nomi.size()/2;
-	unsigned int num_squadra2 = nomi.size() - num_squadra1;
-	
-	unsigned int media_squadra1=0;
-	unsigned int media_squadra2=0;
-	int delta = 0;
-	try
-    {
-		int pos = 0;
-		for(auto nome = nomi.cbegin(); nome != nomi.cend();++nome,++pos)
-		{
-			if((*nome)->name[0] == '-')
-				return;
-			UserStats us_tmp = database->getUserStats((*nome)->name);
-			us.push_back(us_tmp);
-			if(pos < num_squadra1)
-				media_squadra1 += us_tmp.score;
-			else
-				media_squadra2 += us_tmp.score;
-		}
-		media_squadra1 /= num_squadra1;
-		media_squadra2 /= num_squadra2;
-		delta = media_squadra1 - media_squadra2;
-			
-		
-		for(int i = 0;i<nomi.size();i++)
-		{
-			UserStats us_tmp = us[i];
-			
-			if(i<num_squadra1 && risultato == 0)
-			{
-				us_tmp.score += k(us_tmp) * (1.0-win_exp(delta))  * 1.0*us_tmp.score/media_squadra1;
-				us_tmp.wins++;
-			}
-			else if(i>=num_squadra1 && risultato == 0)
-			{
-				us_tmp.score += k(us_tmp) * (0.0-win_exp(-delta))  * 1.0*us_tmp.score/media_squadra2;
-				us_tmp.losses++;
-			}
-			else if(i<num_squadra1 && risultato == 2)
-			{
-				us_tmp.score += k(us_tmp) * (0.5-win_exp(delta))  * 1.0*us_tmp.score/media_squadra1;
-				us_tmp.draws++;
-			}
-			else if(i>=num_squadra1 && risultato == 2)
-			{
-				us_tmp.score += k(us_tmp) * (0.5-win_exp(-delta))  * 1.0*us_tmp.score/media_squadra2;
-				us_tmp.draws++;
-			}
-
-			if(num_squadra2 > 1)
-				us_tmp.tags++;
-			if(us_tmp.score < 100)
-				us_tmp.score = 100;
-			database->setUserStats(us_tmp,nomi[i]);
-			
-			log(INFO,"%s score: %d >(%+d)-> %d\n",us_tmp.username.c_str(),us[i].score,(us_tmp.score-us[i].score),us_tmp.score);
-			
-		}
-		
+	int64_t start = IpcFrame::nowMs();
+	bool ok = database->updateRatings(ru);
+	int64_t elapsed = IpcFrame::nowMs() - start;
+	{
+		std::lock_guard<std::mutex> lock(ratingStatsMutex);
+		RatingStats& rs = ratingStats[ru.names.size()];
+		rs.duels++;
+		if(!ok)
+			rs.failed++;
+		rs.statements += ru.statements;
+		rs.totalMs += elapsed;
+		rs.maxMs = std::max(rs.maxMs,elapsed);
 	}
-    catch (std::exception e)
-    {
+	if(!ok)
+		return false;
 
-    }
-	
+	for(unsigned int i = 0;i<ru.after.size();i++)
+	{
+		RankIndex::getInstance()->update(ru.after[i].username,ru.after[i].score);
+		log(INFO,"%s score: %d >(%+d)-> %d\n",ru.after[i].username.c_str(),ru.before[i].score,(ru.after[i].score-ru.before[i].score),ru.after[i].score);
+	}
+	return true;
+}
+
+void Users::LogStats()
+{
+	std::lock_guard<std::mutex> lock(ratingStatsMutex);
+	for(auto it = ratingStats.begin(); it != ratingStats.end(); ++it)
+	{
+		const RatingStats& rs = it->second;
+		log(VERBOSE,"ratings, %u players: %lu duels (%lu failed), %.1f statements and %d ms per duel, max %d ms\n",
+			it->first,rs.duels,rs.failed,(double)rs.statements/rs.duels,(int)(rs.totalMs/rs.duels),(int)rs.maxMs);
+	}
 }
 
 void Users::Draw(std::string win1, std::string win2,std::string los1, std::string los2)
@@ -367,6 +331,161 @@ void Users::Victory(std::string win1, std::string win2,std::string los1, std::st
 
 }
 
+std::string Users::journalLine(const std::vector<std::string>& nomi, int risultato)
+{
+    //one line per duel: S result count names; empty for the guests, never rated
+    std::ostringstream line;
+    line<<"S "<<risultato<<" "<<nomi.size();
+    for(auto nome = nomi.cbegin(); nome != nomi.cend(); ++nome)
+    {
+        if(nome->empty() || (*nome)[0] == '-')
+            return "";
+        line<<" "<<*nome;
+    }
+    return line.str();
+}
+
+bool Users::appendJournal(const std::string& path, const std::string& line)
+{
+    //shared by all the gameservers: one write under flock, synced because it is the only copy
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        log(BUG,"cannot open %s, result lost: %s\n",path.c_str(),line.c_str());
+        return false;
+    }
+    std::string data = line + "\n";
+    bool ok = true;
+    flock(fd, LOCK_EX);
+    if(write(fd, data.data(), data.size()) != (ssize_t)data.size())
+    {
+        log(BUG,"cannot write %s, result lost: %s\n",path.c_str(),line.c_str());
+        ok = false;
+    }
+    fdatasync(fd);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ok;
+}
+
+static bool emptyFile(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) || st.st_size == 0;
+}
+
+void Users::ReplayJournal()
+{
+    //probe thread of MySqlWrapper, with the circuit closed
+    std::string path = Config::getInstance()->stats_journal;
+    std::string replayPath = path + ".replay";
+    //every 5 seconds in every gameserver: nothing to open when there is nothing to replay
+    if(emptyFile(path) && emptyFile(replayPath))
+        return;
+    int rfd = open(replayPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if(rfd < 0)
+        return;
+    //only one gameserver replays, the others find the lock taken
+    if(flock(rfd, LOCK_EX | LOCK_NB))
+    {
+        close(rfd);
+        return;
+    }
+
+    //the new lines are moved after the ones left by the last replay, synced before the journal is emptied
+    int fd = open(path.c_str(), O_RDWR);
+    if(fd >= 0)
+    {
+        char buffer[4096];
+        int bytesread;
+        bool moved = true;
+        flock(fd, LOCK_EX);
+        lseek(rfd, 0, SEEK_END);
+        while((bytesread = read(fd, buffer, sizeof(buffer))) > 0)
+            if(write(rfd, buffer, bytesread) != bytesread)
+                moved = false;
+        if(moved && !fdatasync(rfd))
+        {
+            if(ftruncate(fd, 0))
+                log(BUG,"cannot truncate the stats journal\n");
+        }
+        else
+            log(BUG,"cannot move the stats journal to %s, replayed next time\n",replayPath.c_str());
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    std::string data;
+    char buffer[4096];
+    int bytesread;
+    lseek(rfd, 0, SEEK_SET);
+    while((bytesread = read(rfd, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, bytesread);
+
+    //in order, each line marked done (D) only after its transaction; at the first failure the rest waits.
+    //a result with a player that does not exist is moved to the .dead file, it would stop the others forever
+    int replayed = 0, left = 0, dead = 0;
+    size_t offset = 0;
+    while(offset < data.size())
+    {
+        size_t end = data.find('\n', offset);
+        if(end == std::string::npos)
+            end = data.size();
+        std::string line = data.substr(offset, end - offset);
+        size_t lineOffset = offset;
+        offset = end + 1;
+        if(line.empty() || line[0] == 'D')
+            continue;
+        if(left)
+        {
+            left++;
+            continue;
+        }
+        std::istringstream fields(line);
+        char type;
+        int risultato;
+        unsigned int count;
+        std::vector<std::string> nomi;
+        if((fields>>type>>risultato>>count) && count <= 4 && (type == 'S' || type == 'T'))
+        {
+            nomi.resize(count);
+            for(unsigned int i = 0; i < count; i++)
+            {
+                fields>>nomi[i];
+                //written by the older versions: the stats of the duel are not kept anymore
+                int stats[8];
+                if(type == 'T')
+                    for(int j = 0; j < 8; j++)
+                        fields>>stats[j];
+            }
+            if(fields.fail())
+                nomi.clear();
+        }
+        //a line that cannot be read is dropped as if it was done
+        CommitResult result = nomi.empty()?COMMITTED:getInstance()->CommitScore(nomi, risultato);
+        if(result == RETRY || (result == UNKNOWN_PLAYER && !appendJournal(path + ".dead", line)))
+        {
+            left++;
+            continue;
+        }
+        if(pwrite(rfd, "D", 1, lineOffset) != 1 || fdatasync(rfd))
+            log(BUG,"cannot mark a replayed line of %s, it may be counted twice\n",replayPath.c_str());
+        if(result == UNKNOWN_PLAYER)
+        {
+            log(WARN,"stats journal: a player does not exist, moved to %s.dead: %s\n",path.c_str(),line.c_str());
+            dead++;
+        }
+        else if(!nomi.empty())
+            replayed++;
+    }
+    if(!left && ftruncate(rfd, 0))
+        log(BUG,"cannot truncate %s\n",replayPath.c_str());
+    flock(rfd, LOCK_UN);
+    close(rfd);
+    if(replayed || left || dead)
+        log(INFO,"stats journal: %d duel results replayed, %d left for the next time, %d dead\n",replayed,left,dead);
+}
+
 Users* Users::getInstance()
 {
     static Users u;
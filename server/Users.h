@@ -5,10 +5,12 @@
 #include "debug.h"
 #include <map>
 #include <ctime>
+#include <stdint.h>
 #include <mutex>
 #include <thread>
 #include <vector>
-#include "DuelLogger.h"
+#include <unordered_map>
+#include "StorageBackend.h"
 namespace ygo
 {
 
@@ -76,6 +78,41 @@ private:
 
     UsersDatabase* database;
 
+    //the last good login of every user, used while mysql is down
+    struct CachedCredential
+    {
+        std::string password;
+        int color;
+        std::pair<int,int> score;
+        CachedCredential():color(0),score(0,0) {}
+    };
+    std::unordered_map<std::string,CachedCredential> credentials;
+    std::mutex credentialsMutex;
+    static const unsigned int MAX_CACHED_CREDENTIALS = 20000;
+    LoginResultTuple offlineLogin(std::string username, std::string password);
+
+    //results of the duels played while mysql is down, replayed when it is back.
+    //a player that does not exist will never be rated: that result goes to the .dead file
+    enum CommitResult {COMMITTED,RETRY,UNKNOWN_PLAYER};
+    CommitResult CommitScore(const std::vector<std::string>& nomi, int risultato);
+    static std::string journalLine(const std::vector<std::string>& nomi, int risultato);
+    static bool appendJournal(const std::string& path, const std::string& line);
+    static void ReplayJournal();
+
+    //rating transactions, by number of players
+    struct RatingStats
+    {
+        unsigned long duels;
+        unsigned long failed;
+        unsigned long statements;
+        int64_t totalMs;
+        int64_t maxMs;
+        RatingStats():duels(0),failed(0),statements(0),totalMs(0),maxMs(0) {}
+    };
+    std::map<unsigned int,RatingStats> ratingStats;
+    std::mutex ratingStatsMutex;
+    bool Rate(RatingUpdate& ru);
+
 public:
 
     std::string getCountryCode(std::string);
@@ -91,7 +128,7 @@ public:
     void Victory(std::string, std::string);
     void Victory(std::string, std::string,std::string, std::string);
 	void UpdateScore(std::vector<std::string> nomi, int risultato);
-	void UpdateStats(std::vector<LoggerPlayerInfo *> nomi, int risultato);
+    void LogStats();
 
 };
 
@@ -1,44 +1,36 @@
-#include <mysql_connection.h>
-#include "mysql_driver.h"
-#include <cppconn/driver.h>
-#include <cppconn/exception.h>
-#include <cppconn/resultset.h>
-#include <exception>      // std::exception
-#include "DuelLogger.h"
+#ifndef _USERSDATABASE_H_
+#define _USERSDATABASE_H_
+#include "StorageBackend.h"
 namespace ygo
 {
 
-struct UserStats
-{
-    std::string username;
-    unsigned int score;
-    unsigned int wins;
-    unsigned int losses;
-    unsigned int draws;
-    unsigned int tags;
-};
-
-
+/*
+ * the users database of the server, on the backend chosen with storage_backend:
+ * "mysql" (default) or "sqlite" (embedded, for small deployments and tests)
+ */
 class UsersDatabase
 {
 public:
-    static const int default_score = 1000;
+    static const int default_score = StorageBackend::default_score;
 
     UsersDatabase();
     ~UsersDatabase();
+    bool isAvailable();
     bool createUser(std::string username, std::string password, int score=default_score,int wins=0,int losses=0,int draws=0);
     bool userExists(std::string username);
     int login(std::string username,std::string password,char*ip);
     UserStats getUserStats(std::string username);
     bool setUserStats(UserStats&);
-	bool setUserStats(UserStats&,LoggerPlayerInfo *);
+    bool updateRatings(RatingUpdate& update);
     int getRank(std::string username);
+    bool loadScores(std::vector<std::pair<std::string,int>>& scores);
     std::pair<int,int> getScore(std::string username);
     std::string getCountryCode(std::string);
 
 private:
-
+    StorageBackend* backend;
 };
 
 
 }
+#endif
@@ -13,11 +13,17 @@ int WaitingRoom::minSecondsWaiting;
 int WaitingRoom::maxSecondsWaiting;
 const std::string WaitingRoom::banner = "[Checkmate Server!]";
 
-WaitingRoom::WaitingRoom(RoomManager*roomManager,GameServer*gameServer):
-    RoomInterface(roomManager,gameServer),cicle_users(0)
+void WaitingRoom::ConfigReloaded()
 {
     WaitingRoom::minSecondsWaiting=Config::getInstance()->waitingroom_min_waiting;
     WaitingRoom::maxSecondsWaiting=Config::getInstance()->waitingroom_max_waiting;
+}
+
+WaitingRoom::WaitingRoom(RoomManager*roomManager,GameServer*gameServer):
+    RoomInterface(roomManager,gameServer),cicle_users(0)
+{
+    players.enableNameIndex();
+    ConfigReloaded();
     event_base* net_evbase=roomManager->net_evbase;
     cicle_users = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, cicle_users_cb, const_cast<WaitingRoom*>(this));
     periodic_updates_ev = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, periodic_updates, const_cast<WaitingRoom*>(this));
@@ -91,6 +97,19 @@ void WaitingRoom::ExtractPlayer(DuelPlayer* dp)
     updateObserversNum();
 }
 
+std::vector<DuelPlayer*> WaitingRoom::getIdlePlayers()
+{
+    //on the stats page and not in a challenge: a new InsertPlayer shows the same thing
+    std::vector<DuelPlayer*> idle;
+    for(auto it=players.begin(); it!=players.end(); ++it)
+    {
+        auto status = player_status.find(it->first);
+        if(status != player_status.end() && status->second.status == DuelPlayerStatus::STATS && status->second.challenger == nullptr)
+            idle.push_back(it->first);
+    }
+    return idle;
+}
+
 void WaitingRoom::updateObserversNum()
 {
     int num = players.size() -1;
@@ -50,11 +50,14 @@ public:
     //DuelPlayer* ExtractBestMatchPlayer(int referenceScore);
     WaitingRoom(RoomManager*roomManager,GameServer*);
     ~WaitingRoom();
+    //the waiting times, after a reload of the config
+    static void ConfigReloaded();
     void ChatWithPlayer(DuelPlayer*dp, std::string sender,std::wstring message);
     void ChatWithPlayer(DuelPlayer*dp, std::string sender,std::string message);
     void ExtractPlayer(DuelPlayer* dp);
     void InsertPlayer(DuelPlayer* dp);
     void LeaveGame(DuelPlayer* dp);
+    std::vector<DuelPlayer*> getIdlePlayers();
     void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
 
     /* FRONTEND */
@@ -81,7 +81,10 @@ void WaitingRoom::ShowStats(DuelPlayer* dp)
     switch (dp->loginStatus)
     {
     case Users::LoginResult::AUTHENTICATED:
-        swprintf(wmessage,20, L"Score: %d, rank:?",score);
+        if(rank)
+            swprintf(wmessage,20, L"Score: %d, #%d",score,rank);
+        else
+            swprintf(wmessage,20, L"Score: %d, rank:?",score);
         SendNameToPlayer(dp,2,wmessage);
         sprintf(message, "www.ygopro.it");
         //sprintf(message, "Score: %d(%+d)",score,dp->cachedGameScore-score);
@@ -521,6 +524,25 @@ bool WaitingRoom::handleChatCommand(DuelPlayer* dp,wchar_t* messaggio)
 		
         return true;
     }*/
+    else if(!wcsncmp(messaggio,L"!watch ",7) )
+    {
+        if(wcslen(messaggio) < 8)
+        {
+            SystemChatToPlayer(dp,L"I need a username",true);
+            return true;
+        }
+        DuelPlayer* duelist = gameServer->findPlayer(std::wstring(&messaggio[7]));
+        DuelRoom* room = duelist ? dynamic_cast<DuelRoom*>(duelist->netServer) : nullptr;
+        if(room == nullptr || !room->isWatchable())
+        {
+            SystemChatToPlayer(dp,L"The player is not in a duel on this server",true);
+            return true;
+        }
+        //the relay of the room sends the duel from the start
+        ExtractPlayer(dp);
+        room->InsertObserver(dp);
+        return true;
+    }
     else if(!wcscmp(messaggio,L"!single") || !wcscmp(messaggio,L"!s") || !wcscmp(messaggio,L"single!"))
     {
         SystemChatToPlayer(dp,L"http://ygopro.it/help.php",true);
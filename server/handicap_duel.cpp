@@ -1,5 +1,7 @@
 #include "handicap_duel.h"
 #include "DuelRoom.h"
+#include "Metrics.h"
+#include "CardDatabase.h"
 #include "game.h"
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/card.h"
@@ -154,8 +156,7 @@ void HandicapDuel::LeaveGame(DuelPlayer* dp) {
 			netServer->SendPacketToPlayer(players[1], STOC_DUEL_END);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			netServer->StopServer();
 		}
 	}
@@ -228,13 +229,23 @@ void HandicapDuel::ToObserver(DuelPlayer* dp) {
 	sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
 	netServer->SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
 }
+void HandicapDuel::AddObserver(DuelPlayer* dp) {
+	observers.insert(dp);
+	STOC_HS_WatchChange scwc;
+	scwc.watch_count = observers.size();
+	for(int i = 0; i < 4; ++i)
+		if(players[i])
+			netServer->SendPacketToPlayer(players[i], STOC_HS_WATCH_CHANGE, scwc);
+	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
+		netServer->SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+}
 void HandicapDuel::PlayerReady(DuelPlayer* dp, bool is_ready) {
 	if(dp->type > 3 || ready[dp->type] == is_ready)
 		return;
 	if(is_ready) {
 		bool allow_ocg = host_info.rule == 0 || host_info.rule == 2;
 		bool allow_tcg = host_info.rule == 1 || host_info.rule == 2;
-		int res = host_info.no_check_deck ? false : deckManager.CheckLFList(pdeck[dp->type], host_info.lflist, allow_ocg, allow_tcg);
+		int res = host_info.no_check_deck ? false : CardDatabase::getInstance()->CheckLFList(pdeck[dp->type], host_info.lflist, allow_ocg, allow_tcg);
 		if(res) {
 			STOC_HS_PlayerChange scpc;
 			scpc.status = (dp->type << 4) | PLAYERCHANGE_NOTREADY;
@@ -269,7 +280,7 @@ void HandicapDuel::UpdateDeck(DuelPlayer* dp, void* pdata) {
 	char* deckbuf = (char*)pdata;
 	int mainc = BufferIO::ReadInt32(deckbuf);
 	int sidec = BufferIO::ReadInt32(deckbuf);
-	deckManager.LoadDeck(pdeck[dp->type], (int*)deckbuf, mainc, sidec);
+	CardDatabase::getInstance()->LoadDeck(pdeck[dp->type], (int*)deckbuf, mainc, sidec);
 }
 void HandicapDuel::StartDuel(DuelPlayer* dp) {
 	if(dp != host_player)
@@ -310,8 +321,7 @@ void HandicapDuel::HandResult(DuelPlayer* dp, unsigned char res) {
 		schr.res2 = hand_result[1];
 		netServer->SendPacketToPlayer(players[0], STOC_HAND_RESULT, schr);
 		//netServer->ReSendToPlayer(players[1]);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			netServer->ReSendToPlayer(*oit);
+		netServer->ReSendToObservers();
 		schr.res1 = hand_result[1];
 		schr.res2 = hand_result[0];
 		netServer->SendPacketToPlayer(players[2], STOC_HAND_RESULT, schr);
@@ -383,7 +393,7 @@ void HandicapDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	}
 	time_limit[0] = host_info.time_limit;
 	time_limit[1] = host_info.time_limit;
-	set_card_reader((card_reader)DataManager::CardReader);
+	set_card_reader((card_reader)CardDatabase::CardReader);
 	set_message_handler((message_handler)HandicapDuel::MessageHandler);
 	rnd.reset(seed);
 	pduel = create_duel(rnd.rand());
@@ -403,46 +413,46 @@ void HandicapDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	//
 	last_replay.WriteInt32(pdeck[0].main.size(), false);
 	for(int i = pdeck[0].main.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[0].main[i]->first, 0, 0, LOCATION_DECK, 0, 0);
-		last_replay.WriteInt32(pdeck[0].main[i]->first, false);
+		new_card(pduel, pdeck[0].main[i]->code, 0, 0, LOCATION_DECK, 0, 0);
+		last_replay.WriteInt32(pdeck[0].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[0].extra.size(), false);
 	for(int i = pdeck[0].extra.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[0].extra[i]->first, 0, 0, LOCATION_EXTRA, 0, 0);
-		last_replay.WriteInt32(pdeck[0].extra[i]->first, false);
+		new_card(pduel, pdeck[0].extra[i]->code, 0, 0, LOCATION_EXTRA, 0, 0);
+		last_replay.WriteInt32(pdeck[0].extra[i]->code, false);
 	}
 	//
 	last_replay.WriteInt32(pdeck[1].main.size(), false);
 	for(int i = pdeck[1].main.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[1].main[i]->first, 0, LOCATION_DECK);
-		last_replay.WriteInt32(pdeck[1].main[i]->first, false);
+		new_tag_card(pduel, pdeck[1].main[i]->code, 0, LOCATION_DECK);
+		last_replay.WriteInt32(pdeck[1].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[1].extra.size(), false);
 	for(int i = pdeck[1].extra.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[1].extra[i]->first, 0, LOCATION_EXTRA);
-		last_replay.WriteInt32(pdeck[1].extra[i]->first, false);
+		new_tag_card(pduel, pdeck[1].extra[i]->code, 0, LOCATION_EXTRA);
+		last_replay.WriteInt32(pdeck[1].extra[i]->code, false);
 	}
 	//
 	last_replay.WriteInt32(pdeck[3].main.size(), false);
 	for(int i = pdeck[3].main.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[3].main[i]->first, 1, 1, LOCATION_DECK, 0, 0);
-		last_replay.WriteInt32(pdeck[3].main[i]->first, false);
+		new_card(pduel, pdeck[3].main[i]->code, 1, 1, LOCATION_DECK, 0, 0);
+		last_replay.WriteInt32(pdeck[3].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[3].extra.size(), false);
 	for(int i = pdeck[3].extra.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[3].extra[i]->first, 1, 1, LOCATION_EXTRA, 0, 0);
-		last_replay.WriteInt32(pdeck[3].extra[i]->first, false);
+		new_card(pduel, pdeck[3].extra[i]->code, 1, 1, LOCATION_EXTRA, 0, 0);
+		last_replay.WriteInt32(pdeck[3].extra[i]->code, false);
 	}
 	//
 	last_replay.WriteInt32(pdeck[2].main.size(), false);
 	for(int i = pdeck[2].main.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[2].main[i]->first, 1, LOCATION_DECK);
-		last_replay.WriteInt32(pdeck[2].main[i]->first, false);
+		new_tag_card(pduel, pdeck[2].main[i]->code, 1, LOCATION_DECK);
+		last_replay.WriteInt32(pdeck[2].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[2].extra.size(), false);
 	for(int i = pdeck[2].extra.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[2].extra[i]->first, 1, LOCATION_EXTRA);
-		last_replay.WriteInt32(pdeck[2].extra[i]->first, false);
+		new_tag_card(pduel, pdeck[2].extra[i]->code, 1, LOCATION_EXTRA);
+		last_replay.WriteInt32(pdeck[2].extra[i]->code, false);
 	}
 	last_replay.Flush();
 	char startbuf[32], *pbuf = startbuf;
@@ -462,8 +472,8 @@ void HandicapDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	if(!swapped)
 		startbuf[1] = 0x10;
 	else startbuf[1] = 0x11;
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 18);
+	netServer->StartObserverStream();
+	netServer->SendBufferToObservers(STOC_GAME_MSG, startbuf, 18);
 	RefreshExtra(0);
 	RefreshExtra(1);
 	start_duel(pduel, opt);
@@ -476,7 +486,11 @@ void HandicapDuel::Process() {
 	while (!stop) {
 		if (engFlag == 2)
 			break;
+		uint64_t engineStart = RoomUsage::nowNs();
 		int result = process(pduel);
+		uint64_t engineNs = RoomUsage::nowNs() - engineStart;
+		netServer->accounting.engineNs += engineNs;
+		Metrics::getInstance()->counters.engineNs += engineNs;
 		engLen = result & 0xffff;
 		engFlag = result >> 16;
 		if (engLen > 0) {
@@ -492,8 +506,7 @@ void HandicapDuel::DuelEndProc() {
 	//netServer->ReSendToPlayer(players[1]);
 	netServer->ReSendToPlayer(players[2]);
 	netServer->ReSendToPlayer(players[3]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->ReSendToPlayer(*oit);
+	netServer->ReSendToObservers();
 	netServer->StopServer();
 }
 void HandicapDuel::Surrender(DuelPlayer* dp) {
@@ -505,6 +518,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 	while (pbuf - msgbuffer < len) {
 		offset = pbuf;
 		unsigned char engType = BufferIO::ReadUInt8(pbuf);
+		netServer->accounting.messages++;
 		switch (engType) {
 		case MSG_RETRY: {
 			WaitforResponse(last_response);
@@ -532,8 +546,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 				for(int i = 1; i < 4; ++i)
 					if(players[i] != cur_player[player])
 						netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 				break;
 			}
 			}
@@ -546,8 +559,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			EndDuel();
 			return 2;
 		}
@@ -691,8 +703,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CONFIRM_CARDS: {
@@ -704,8 +715,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 				//netServer->ReSendToPlayer(players[1]);
 				netServer->ReSendToPlayer(players[2]);
 				netServer->ReSendToPlayer(players[3]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			} else {
 				pbuf += count * 7;
 				netServer->SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, offset, pbuf - offset);
@@ -718,8 +728,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SHUFFLE_HAND: {
@@ -731,8 +740,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 1; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshHand(player, 0x181fff, 0);
 			break;
 		}
@@ -742,8 +750,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SWAP_GRAVE_DECK: {
@@ -752,8 +759,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshGrave(player);
 			break;
 		}
@@ -762,8 +768,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DECK_TOP: {
@@ -772,8 +777,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SHUFFLE_SET_CARD: {
@@ -783,8 +787,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0, 0x181fff, 0);
 			RefreshMzone(1, 0x181fff, 0);
 			break;
@@ -797,8 +800,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 
 			if(turn_count > 0) {
 			    swap_single_tag(pduel);
@@ -823,8 +825,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -850,8 +851,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 				netServer->ReSendToPlayer(players[1]);
 				netServer->ReSendToPlayer(players[2]);
 				netServer->ReSendToPlayer(players[3]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			} else {
 				netServer->SendBufferToPlayer(cur_player[cc], STOC_GAME_MSG, offset, pbuf - offset);
 				if (!(cl & 0xb0) && !((cl & 0xc) && (cp & POS_FACEUP)))
@@ -859,8 +859,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 				for(int i = 1; i < 4; ++i)
 					if(players[i] != cur_player[cc])
 						netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			}
 			if (cl != 0 && (cl & 0x80) == 0 && (cl != pl || pc != cc))
 				RefreshSingle(cc, cl, cs);
@@ -877,8 +876,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -890,8 +888,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SWAP: {
@@ -900,8 +897,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_FIELD_DISABLED: {
@@ -910,8 +906,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SUMMONING: {
@@ -920,8 +915,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SUMMONED: {
@@ -929,8 +923,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -943,8 +936,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SPSUMMONED: {
@@ -952,8 +944,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -967,8 +958,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_FLIPSUMMONED: {
@@ -976,8 +966,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -990,8 +979,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAINED: {
@@ -1000,8 +988,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1016,8 +1003,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAIN_SOLVED: {
@@ -1026,8 +1012,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1041,8 +1026,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1057,8 +1041,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAIN_DISABLED: {
@@ -1067,8 +1050,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CARD_SELECTED: {
@@ -1085,8 +1067,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_BECOME_TARGET: {
@@ -1096,8 +1077,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DRAW: {
@@ -1115,8 +1095,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 1; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DAMAGE: {
@@ -1125,8 +1104,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_RECOVER: {
@@ -1135,8 +1113,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_EQUIP: {
@@ -1145,8 +1122,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_LPUPDATE: {
@@ -1155,8 +1131,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_UNEQUIP: {
@@ -1165,8 +1140,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CARD_TARGET: {
@@ -1175,8 +1149,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CANCEL_TARGET: {
@@ -1185,8 +1158,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_PAY_LPCOST: {
@@ -1195,8 +1167,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ADD_COUNTER: {
@@ -1205,8 +1176,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_REMOVE_COUNTER: {
@@ -1215,8 +1185,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ATTACK: {
@@ -1225,8 +1194,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_BATTLE: {
@@ -1235,8 +1203,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ATTACK_DISABLED: {
@@ -1244,8 +1211,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DAMAGE_STEP_START: {
@@ -1253,8 +1219,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			break;
@@ -1264,8 +1229,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			break;
@@ -1284,8 +1248,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_TOSS_DICE: {
@@ -1296,8 +1259,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ANNOUNCE_RACE: {
@@ -1334,8 +1296,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			//netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_TAG_SWAP: {
@@ -1365,8 +1326,7 @@ int HandicapDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 1; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshExtra(player);
 			RefreshMzone(0, 0x81fff, 0);
 			RefreshMzone(1, 0x81fff, 0);
@@ -1412,8 +1372,7 @@ void HandicapDuel::EndDuel() {
 	//netServer->ReSendToPlayer(players[1]);
 	netServer->ReSendToPlayer(players[2]);
 	netServer->ReSendToPlayer(players[3]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->ReSendToPlayer(*oit);
+	netServer->ReSendToObservers();
 	end_duel(pduel);
 	pduel = 0;
 }
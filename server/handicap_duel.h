@@ -4,11 +4,13 @@
 #include "config.h"
 #include "network.h"
 #include "replay.h"
+#include "CardDatabase.h"
 
 namespace ygo {
 
 class HandicapDuel: public DuelMode {
 public:
+	DECLARE_POOLED_NEW(HandicapDuel)
 	HandicapDuel();
 	virtual ~HandicapDuel();
 	virtual void Chat(DuelPlayer* dp, void* pdata, int len);
@@ -16,6 +18,7 @@ public:
 	virtual void LeaveGame(DuelPlayer* dp);
 	virtual void ToDuelist(DuelPlayer* dp);
 	virtual void ToObserver(DuelPlayer* dp);
+	virtual void AddObserver(DuelPlayer* dp);
 	virtual void PlayerReady(DuelPlayer* dp, bool ready);
 	virtual void PlayerKick(DuelPlayer* dp, unsigned char pos);
 	virtual void UpdateDeck(DuelPlayer* dp, void* pdata);
@@ -47,7 +50,7 @@ protected:
 	DuelPlayer* cur_player[2];
 	std::set<DuelPlayer*> observers;
 	bool ready[4];
-	Deck pdeck[4];
+	CardDatabase::Deck pdeck[4];
 	unsigned char hand_result[2];
 	unsigned char last_response;
 	Replay last_replay;
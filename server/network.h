@@ -9,6 +9,7 @@
 #include <event2/buffer.h>
 #include <event2/thread.h>
 #include "Users.h"
+#include "ObjectPool.h"
 #include <list>
 
 namespace ygo {
@@ -113,6 +114,7 @@ struct DuelPlayer {
     unsigned int cachedGameScore;
     signed char color;
     Users::LoginResult loginStatus;
+    size_t roomSlot;
 	DuelPlayer() {
 		game = 0;
 		type = 0;
@@ -121,10 +123,23 @@ struct DuelPlayer {
         netServer=0;
         lflist=2;
         color = 0;
+        roomSlot = 0;
+        namew_low[0] = 0;
+        slowSince = 0;
+        bytesIn = bytesOut = 0;
+        packetsIn = packetsOut = 0;
 	}
+    DECLARE_POOLED_NEW(DuelPlayer)
     int lflist;
     std::string countryCode;
     std::list<std::pair<time_t,std::wstring> > chatTimestamp;
+    //since when its output is over the limit, 0 if it reads
+    time_t slowSince;
+    //everything read from and written to the player since the connection
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+    unsigned int packetsIn;
+    unsigned int packetsOut;
 };
 
 
@@ -159,6 +174,13 @@ public:
 	virtual void GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {}
 	virtual void TimeConfirm(DuelPlayer* dp) {}
 	virtual void EndDuel() {};
+	//migration to another process: the state of a duel waiting for a response,
+	//rebuilt there by replaying the responses. Detach frees the engine without ending the duel
+	virtual bool Snapshot(std::string& out) { return false; }
+	virtual bool Resume(const std::string& snapshot, std::vector<DuelPlayer*>& members) { return false; }
+	virtual void Detach() {}
+	//an observer that arrives during the duel: the room sends it the duel from the relay
+	virtual void AddObserver(DuelPlayer* dp) {}
 
 public:
 	event* etimer;
@@ -4,18 +4,25 @@
 #include <algorithm>
 #include "lzma/LzmaLib.h"
 
+#include "ObjectPool.h"
+
 #define REPLAY_DATA_SIZE 0x20000
 namespace ygo {
 
+struct ReplayBuffer {
+	unsigned char data[REPLAY_DATA_SIZE];
+};
+typedef ObjectPool<ReplayBuffer, 4> ReplayBufferPool;
+
 Replay::Replay() {
 	is_recording = false;
 	is_replaying = false;
-	replay_data = new unsigned char[REPLAY_DATA_SIZE];
+	replay_data = (unsigned char*)ReplayBufferPool::getInstance("ReplayBuffer")->allocate(sizeof(ReplayBuffer));
 	comp_data = replay_data;
 	//comp_data = new unsigned char[0x2000];
 }
 Replay::~Replay() {
-	delete [] replay_data;
+	ReplayBufferPool::getInstance("ReplayBuffer")->deallocate(replay_data, sizeof(ReplayBuffer));
 	//delete [] comp_data;
 }
 void Replay::BeginRecord() {
@@ -1,11 +1,16 @@
 #include "single_duel.h"
 #include "DuelRoom.h"
+#include "Metrics.h"
+#include "CardDatabase.h"
+#include "DeckArchive.h"
 #include "game.h"
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/card.h"
 #include "../ocgcore/duel.h"
 #include "../ocgcore/field.h"
 #include "../ocgcore/mtrandom.h"
+#include "debug.h"
+#include "IpcFrame.h"
 #include <algorithm>
 namespace ygo {
 
@@ -182,13 +187,11 @@ void SingleDuel::LeaveGame(DuelPlayer* dp) {
 			wbuf[2] = 0;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, wbuf, 3);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			EndDuel();
 			netServer->SendPacketToPlayer(players[0], STOC_DUEL_END);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			netServer->StopServer();
 			netServer->DisconnectPlayer(dp);
 		}
@@ -246,6 +249,16 @@ void SingleDuel::ToObserver(DuelPlayer* dp) {
 	sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
 	netServer->SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
 }
+void SingleDuel::AddObserver(DuelPlayer* dp) {
+	observers.insert(dp);
+	STOC_HS_WatchChange scwc;
+	scwc.watch_count = observers.size();
+	for(int i = 0; i < 2; ++i)
+		if(players[i])
+			netServer->SendPacketToPlayer(players[i], STOC_HS_WATCH_CHANGE, scwc);
+	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
+		netServer->SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+}
 void SingleDuel::PlayerReady(DuelPlayer* dp, bool is_ready) {
 	if(dp->type > 1)
 		return;
@@ -254,7 +267,7 @@ void SingleDuel::PlayerReady(DuelPlayer* dp, bool is_ready) {
 	if(is_ready) {
 		bool allow_ocg = host_info.rule == 0 || host_info.rule == 2;
 		bool allow_tcg = host_info.rule == 1 || host_info.rule == 2;
-		int res = host_info.no_check_deck ? false : deckManager.CheckLFList(pdeck[dp->type], host_info.lflist, allow_ocg, allow_tcg);
+		int res = host_info.no_check_deck ? false : CardDatabase::getInstance()->CheckLFList(pdeck[dp->type], host_info.lflist, allow_ocg, allow_tcg);
 		if(res) {
 			STOC_HS_PlayerChange scpc;
 			scpc.status = (dp->type << 4) | PLAYERCHANGE_NOTREADY;
@@ -287,27 +300,30 @@ void SingleDuel::UpdateDeck(DuelPlayer* dp, void* pdata) {
 	int mainc = BufferIO::ReadInt32(deckbuf);
 	int sidec = BufferIO::ReadInt32(deckbuf);
 	if(duel_count == 0) {
-		deckManager.LoadDeck(pdeck[dp->type], (int*)deckbuf, mainc, sidec);
+		CardDatabase::getInstance()->LoadDeck(pdeck[dp->type], (int*)deckbuf, mainc, sidec);
 
     if(dp->cachedRankScore > 2100)
     {
-        char filename[80],name[20],name2[20],names[30],names2[30];
-
-        int len = BufferIO::CopyWStr(dp->name,name,20);
-        for(int i = 0;i<len;i++)
-            if(!isalnum(name[i]))
-                name[i]='_';
-
-        sprintf(names,"%d%s",dp->cachedRankScore,name);
-
-        std::string n1(names);
-        std::wstring namew1(n1.begin(),n1.end());
-        deckManager.SaveDeck(pdeck[dp->type], namew1.c_str());
+        wchar_t wname[20];
+        char name[80];
+        BufferIO::CopyWStr(dp->name,wname,20);
+        BufferIO::EncodeUTF8(wname,name);
+        DeckArchive::Entry entry;
+        entry.player = name;
+        entry.score = dp->cachedRankScore;
+        entry.date = time(0);
+        for(size_t i = 0; i < pdeck[dp->type].main.size(); ++i)
+            entry.main.push_back(pdeck[dp->type].main[i]->code);
+        for(size_t i = 0; i < pdeck[dp->type].extra.size(); ++i)
+            entry.extra.push_back(pdeck[dp->type].extra[i]->code);
+        for(size_t i = 0; i < pdeck[dp->type].side.size(); ++i)
+            entry.side.push_back(pdeck[dp->type].side[i]->code);
+        DeckArchive::getInstance()->Archive(entry);
     }
 
 
 	} else {
-		if(deckManager.LoadSide(pdeck[dp->type], (int*)deckbuf, mainc, sidec)) {
+		if(CardDatabase::getInstance()->LoadSide(pdeck[dp->type], (int*)deckbuf, mainc, sidec)) {
 			ready[dp->type] = true;
 			netServer->SendPacketToPlayer(dp, STOC_DUEL_START);
 			if(ready[0] && ready[1]) {
@@ -354,8 +370,7 @@ void SingleDuel::HandResult(DuelPlayer* dp, unsigned char res) {
 		schr.res1 = hand_result[0];
 		schr.res2 = hand_result[1];
 		netServer->SendPacketToPlayer(players[0], STOC_HAND_RESULT, schr);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			netServer->ReSendToPlayer(*oit);
+		netServer->ReSendToObservers();
 		schr.res1 = hand_result[1];
 		schr.res2 = hand_result[0];
 		netServer->SendPacketToPlayer(players[1], STOC_HAND_RESULT, schr);
@@ -394,7 +409,7 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 		players[1] = p;
 		players[0]->type = 0;
 		players[1]->type = 1;
-		Deck d = pdeck[0];
+		CardDatabase::Deck d = pdeck[0];
 		pdeck[0] = pdeck[1];
 		pdeck[1] = d;
 		swapped = true;
@@ -425,7 +440,7 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	}
 	time_limit[0] = host_info.time_limit;
 	time_limit[1] = host_info.time_limit;
-	set_card_reader((card_reader)DataManager::CardReader);
+	set_card_reader((card_reader)CardDatabase::CardReader);
 	set_message_handler((message_handler)SingleDuel::MessageHandler);
 	rnd.reset(seed);
 	pduel = create_duel(rnd.rand());
@@ -443,25 +458,30 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	last_replay.Flush();
 	last_replay.WriteInt32(pdeck[0].main.size(), false);
 	for(int i = pdeck[0].main.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[0].main[i]->first, 0, 0, LOCATION_DECK, 0, 0);
-		last_replay.WriteInt32(pdeck[0].main[i]->first, false);
+		new_card(pduel, pdeck[0].main[i]->code, 0, 0, LOCATION_DECK, 0, 0);
+		last_replay.WriteInt32(pdeck[0].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[0].extra.size(), false);
 	for(int i = pdeck[0].extra.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[0].extra[i]->first, 0, 0, LOCATION_EXTRA, 0, 0);
-		last_replay.WriteInt32(pdeck[0].extra[i]->first, false);
+		new_card(pduel, pdeck[0].extra[i]->code, 0, 0, LOCATION_EXTRA, 0, 0);
+		last_replay.WriteInt32(pdeck[0].extra[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[1].main.size(), false);
 	for(int i = pdeck[1].main.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[1].main[i]->first, 1, 1, LOCATION_DECK, 0, 0);
-		last_replay.WriteInt32(pdeck[1].main[i]->first, false);
+		new_card(pduel, pdeck[1].main[i]->code, 1, 1, LOCATION_DECK, 0, 0);
+		last_replay.WriteInt32(pdeck[1].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[1].extra.size(), false);
 	for(int i = pdeck[1].extra.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[1].extra[i]->first, 1, 1, LOCATION_EXTRA, 0, 0);
-		last_replay.WriteInt32(pdeck[1].extra[i]->first, false);
+		new_card(pduel, pdeck[1].extra[i]->code, 1, 1, LOCATION_EXTRA, 0, 0);
+		last_replay.WriteInt32(pdeck[1].extra[i]->code, false);
 	}
 	last_replay.Flush();
+	SendStart(swapped);
+	start_duel(pduel, opt);
+	Process();
+}
+void SingleDuel::SendStart(bool swapped) {
 	char startbuf[32], *pbuf = startbuf;
 	BufferIO::WriteInt8(pbuf, MSG_START);
 	BufferIO::WriteInt8(pbuf, 0);
@@ -477,12 +497,10 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	if(!swapped)
 		startbuf[1] = 0x10;
 	else startbuf[1] = 0x11;
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 18);
+	netServer->StartObserverStream();
+	netServer->SendBufferToObservers(STOC_GAME_MSG, startbuf, 18);
 	RefreshExtra(0);
 	RefreshExtra(1);
-	start_duel(pduel, opt);
-	Process();
 }
 void SingleDuel::Process() {
 	char engineBuffer[0x1000];
@@ -491,7 +509,11 @@ void SingleDuel::Process() {
 	while (!stop) {
 		if (engFlag == 2)
 			break;
+		uint64_t engineStart = RoomUsage::nowNs();
 		int result = process(pduel);
+		uint64_t engineNs = RoomUsage::nowNs() - engineStart;
+		netServer->accounting.engineNs += engineNs;
+		Metrics::getInstance()->counters.engineNs += engineNs;
 		engLen = result & 0xffff;
 		engFlag = result >> 16;
 		if (engLen > 0) {
@@ -506,8 +528,7 @@ void SingleDuel::DuelEndProc() {
 	if(!match_mode) {
 		netServer->SendPacketToPlayer(players[0], STOC_DUEL_END);
 		netServer->ReSendToPlayer(players[1]);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			netServer->ReSendToPlayer(*oit);
+		netServer->ReSendToObservers();
 		netServer->StopServer();
 	} else {
 		int winc[3] = {0, 0, 0};
@@ -519,8 +540,7 @@ void SingleDuel::DuelEndProc() {
 		        || (winc[2] == 3 || (winc[0] == 1 && winc[1] == 1 && winc[2] == 1)) ) {
 			netServer->SendPacketToPlayer(players[0], STOC_DUEL_END);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			netServer->StopServer();
 		} else {
 			if(players[0] != pplayer[0]) {
@@ -528,7 +548,7 @@ void SingleDuel::DuelEndProc() {
 				players[1] = pplayer[1];
 				players[0]->type = 0;
 				players[1]->type = 1;
-				Deck d = pdeck[0];
+				CardDatabase::Deck d = pdeck[0];
 				pdeck[0] = pdeck[1];
 				pdeck[1] = d;
 			}
@@ -553,8 +573,7 @@ void SingleDuel::Surrender(DuelPlayer* dp) {
 	wbuf[2] = 0;
 	netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, wbuf, 3);
 	netServer->ReSendToPlayer(players[1]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->ReSendToPlayer(*oit);
+	netServer->ReSendToObservers();
 	if(players[player] == pplayer[player]) {
 		match_result[duel_count++] = 1 - player;
 		tp_player = player;
@@ -572,6 +591,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 	while (pbuf - msgbuffer < len) {
 		offset = pbuf;
 		unsigned char engType = BufferIO::ReadUInt8(pbuf);
+		netServer->accounting.messages++;
 		switch (engType) {
 		case MSG_RETRY: {
 			WaitforResponse(last_response);
@@ -596,15 +616,13 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			case 8:
 			case 9: {
 				netServer->SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 				break;
 			}
 			case 10: {
 				netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 				netServer->SendBufferToPlayer(players[1], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 				break;
 			}
 			}
@@ -615,8 +633,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			type = BufferIO::ReadInt8(pbuf);
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			if(player > 1) {
 				match_result[duel_count++] = 2;
 				tp_player = 1 - tp_player;
@@ -768,8 +785,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 7;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CONFIRM_CARDS: {
@@ -779,8 +795,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				pbuf += count * 7;
 				netServer->SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 				netServer->ReSendToPlayer(players[1 - player]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			} else {
 				pbuf += count * 7;
 				netServer->SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
@@ -791,8 +806,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			player = BufferIO::ReadInt8(pbuf);
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SHUFFLE_HAND: {
@@ -802,8 +816,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < count; ++i)
 				BufferIO::WriteInt32(pbuf, 0);
 			netServer->SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshHand(player, 0x181fff, 0);
 			break;
 		}
@@ -811,32 +824,28 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SWAP_GRAVE_DECK: {
 			player = BufferIO::ReadInt8(pbuf);
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshGrave(player);
 			break;
 		}
 		case MSG_REVERSE_DECK: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DECK_TOP: {
 			pbuf += 6;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SHUFFLE_SET_CARD: {
@@ -844,8 +853,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0, 0x181fff, 0);
 			RefreshMzone(1, 0x181fff, 0);
 			break;
@@ -862,16 +870,14 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			time_limit[1] = host_info.time_limit;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_NEW_PHASE: {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -895,15 +901,13 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				BufferIO::WriteInt32(pbufw, 0);
 				netServer->SendBufferToPlayer(players[cc], STOC_GAME_MSG, offset, pbuf - offset);
 				netServer->ReSendToPlayer(players[1 - cc]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			} else {
 				netServer->SendBufferToPlayer(players[cc], STOC_GAME_MSG, offset, pbuf - offset);
 				if (!(cl & 0xb0) && !((cl & 0xc) && (cp & POS_FACEUP)))
 					BufferIO::WriteInt32(pbufw, 0);
 				netServer->SendBufferToPlayer(players[1 - cc], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			}
 			if (cl != 0 && (cl & 0x80) == 0 && (cl != pl || pc != cc))
 				RefreshSingle(cc, cl, cs);
@@ -918,8 +922,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 9;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -929,39 +932,34 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 4;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SWAP: {
 			pbuf += 16;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_FIELD_DISABLED: {
 			pbuf += 4;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SUMMONING: {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SUMMONED: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -972,15 +970,13 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SPSUMMONED: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -992,15 +988,13 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_FLIPSUMMONED: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1011,16 +1005,14 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 16;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAINED: {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1033,16 +1025,14 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAIN_SOLVED: {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1054,8 +1044,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 		case MSG_CHAIN_END: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1068,16 +1057,14 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAIN_DISABLED: {
 			pbuf++;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CARD_SELECTED: {
@@ -1092,8 +1079,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 4;
 			netServer->SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_BECOME_TARGET: {
@@ -1101,8 +1087,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 4;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DRAW: {
@@ -1118,118 +1103,103 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 					pbufw += 4;
 			}
 			netServer->SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DAMAGE: {
 			pbuf += 5;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_RECOVER: {
 			pbuf += 5;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_EQUIP: {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_LPUPDATE: {
 			pbuf += 5;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_UNEQUIP: {
 			pbuf += 4;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CARD_TARGET: {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CANCEL_TARGET: {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_PAY_LPCOST: {
 			pbuf += 5;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ADD_COUNTER: {
 			pbuf += 6;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_REMOVE_COUNTER: {
 			pbuf += 6;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ATTACK: {
 			pbuf += 8;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_BATTLE: {
 			pbuf += 26;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ATTACK_DISABLED: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DAMAGE_STEP_START: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			break;
@@ -1237,8 +1207,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 		case MSG_DAMAGE_STEP_END: {
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			break;
@@ -1255,8 +1224,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_TOSS_DICE: {
@@ -1265,8 +1233,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ANNOUNCE_RACE: {
@@ -1301,8 +1268,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 9;
 			netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			netServer->ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_MATCH_KILL: {
@@ -1311,8 +1277,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				match_kill = code;
 				netServer->SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 				netServer->ReSendToPlayer(players[1]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			}
 			break;
 		}
@@ -1345,8 +1310,7 @@ void SingleDuel::EndDuel() {
 	memcpy(pbuf, last_replay.comp_data, last_replay.comp_size);
 	netServer->SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
 	netServer->ReSendToPlayer(players[1]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->ReSendToPlayer(*oit);
+	netServer->ReSendToObservers();
     if(players[0]->cachedRankScore > 2000)
     {
         char filename[80],name[20],name2[20],names[30],names2[30];
@@ -1376,6 +1340,188 @@ void SingleDuel::EndDuel() {
 	end_duel(pduel);
 	pduel = 0;
 }
+//the state of a duel moved to another process, followed by the codes of the decks
+//(main, extra and side of both players) and by the replay recorded so far
+struct SingleDuelSnapshot {
+	HostInfo host_info;
+	ReplayHeader header;
+	int32_t match_kill;
+	uint8_t duel_count;
+	uint8_t tp_player;
+	uint8_t match_result[3];
+	uint8_t swapped;
+	uint8_t last_response;
+	uint8_t state[2];
+	uint16_t time_limit[2];
+	uint16_t time_elapsed;
+	uint32_t deck_size[2][3];
+	uint32_t replay_size;
+};
+//replay.cpp stops writing at 0x20000 bytes: such a replay has lost the last responses
+static const size_t MAX_MIGRATED_REPLAY = 0x20000 - 0x100;
+
+static void AppendCodes(std::string& out, std::vector<const CardDatabase::CardRecord*>& cards) {
+	for(auto it = cards.begin(); it != cards.end(); ++it) {
+		int32_t code = (*it)->code;
+		out.append((const char*)&code, sizeof(code));
+	}
+}
+bool SingleDuel::Snapshot(std::string& out) {
+	if(!pduel || !players[0] || !players[1] || last_response > 1)
+		return false;
+	//only while the engine waits for a response: nothing is half processed
+	unsigned char waiting = players[last_response]->state;
+	if(waiting != CTOS_RESPONSE && waiting != CTOS_TIME_CONFIRM)
+		return false;
+	//the record is closed to read it and opened again: the duel could stay here
+	last_replay.EndRecord();
+	std::string replay((const char*)last_replay.comp_data, last_replay.comp_size);
+	ReplayHeader header = last_replay.pheader;
+	last_replay.BeginRecord();
+	last_replay.WriteHeader(header);
+	last_replay.WriteData(replay.data(), replay.size(), false);
+	if(replay.size() >= MAX_MIGRATED_REPLAY)
+		return false;
+
+	SingleDuelSnapshot ss;
+	memset(&ss, 0, sizeof(ss));
+	ss.host_info = host_info;
+	ss.header = header;
+	ss.match_kill = match_kill;
+	ss.duel_count = duel_count;
+	ss.tp_player = tp_player;
+	memcpy(ss.match_result, match_result, 3);
+	ss.swapped = players[0] != pplayer[0];
+	ss.last_response = last_response;
+	ss.state[0] = players[0]->state;
+	ss.state[1] = players[1]->state;
+	ss.time_limit[0] = time_limit[0];
+	ss.time_limit[1] = time_limit[1];
+	ss.time_elapsed = time_elapsed;
+	for(int i = 0; i < 2; ++i) {
+		ss.deck_size[i][0] = pdeck[i].main.size();
+		ss.deck_size[i][1] = pdeck[i].extra.size();
+		ss.deck_size[i][2] = pdeck[i].side.size();
+	}
+	ss.replay_size = replay.size();
+	out.assign((const char*)&ss, sizeof(ss));
+	for(int i = 0; i < 2; ++i) {
+		AppendCodes(out, pdeck[i].main);
+		AppendCodes(out, pdeck[i].extra);
+		AppendCodes(out, pdeck[i].side);
+	}
+	out.append(replay);
+	return true;
+}
+bool SingleDuel::Resume(const std::string& snapshot, std::vector<DuelPlayer*>& members) {
+	SingleDuelSnapshot ss;
+	if(pduel || snapshot.size() < sizeof(ss))
+		return false;
+	memcpy(&ss, snapshot.data(), sizeof(ss));
+	size_t codes = 0;
+	for(int i = 0; i < 2; ++i)
+		codes += ss.deck_size[i][0] + ss.deck_size[i][1] + ss.deck_size[i][2];
+	if(codes > 1000 || ss.last_response > 1 || snapshot.size() != sizeof(ss) + codes * 4 + ss.replay_size)
+		return false;
+	for(auto it = members.begin(); it != members.end(); ++it) {
+		if((*it)->type <= NETPLAYER_TYPE_PLAYER2)
+			players[(*it)->type] = *it;
+		else
+			observers.insert(*it);
+	}
+	if(!players[0] || !players[1])
+		return false;
+
+	host_info = ss.host_info;
+	match_kill = ss.match_kill;
+	duel_count = ss.duel_count;
+	tp_player = ss.tp_player;
+	memcpy(match_result, ss.match_result, 3);
+	pplayer[0] = ss.swapped ? players[1] : players[0];
+	pplayer[1] = ss.swapped ? players[0] : players[1];
+	const char* pcodes = snapshot.data() + sizeof(ss);
+	for(int i = 0; i < 2; ++i) {
+		int mainc = ss.deck_size[i][0] + ss.deck_size[i][1];
+		int sidec = ss.deck_size[i][2];
+		std::vector<int> dbuf(mainc + sidec);
+		if(!dbuf.empty())
+			memcpy(&dbuf[0], pcodes, dbuf.size() * 4);
+		pcodes += dbuf.size() * 4;
+		CardDatabase::getInstance()->LoadDeck(pdeck[i], dbuf.empty() ? nullptr : &dbuf[0], mainc, sidec);
+	}
+	int64_t start = IpcFrame::nowMs();
+	last_replay.BeginRecord();
+	last_replay.WriteHeader(ss.header);
+	last_replay.WriteData(pcodes, ss.replay_size, false);
+
+	//the steps of TPResult, with the names, the options and the decks read from the replay
+	char* p = const_cast<char*>(pcodes) + 80;
+	char* end = const_cast<char*>(pcodes) + ss.replay_size;
+	if(end - p < 16)
+		return false;
+	int start_lp = BufferIO::ReadInt32(p);
+	int start_hand = BufferIO::ReadInt32(p);
+	int draw_count = BufferIO::ReadInt32(p);
+	int opt = BufferIO::ReadInt32(p);
+	mtrandom rnd;
+	rnd.reset(ss.header.seed);
+	set_card_reader((card_reader)CardDatabase::CardReader);
+	set_message_handler((message_handler)SingleDuel::MessageHandler);
+	pduel = create_duel(rnd.rand());
+	set_player_info(pduel, 0, start_lp, start_hand, draw_count);
+	set_player_info(pduel, 1, start_lp, start_hand, draw_count);
+	for(int i = 0; i < 2; ++i) {
+		int locations[2] = {LOCATION_DECK, LOCATION_EXTRA};
+		for(int l = 0; l < 2; ++l) {
+			int count = end - p >= 4 ? BufferIO::ReadInt32(p) : -1;
+			if(count < 0 || end - p < count * 4) {
+				Detach();
+				return false;
+			}
+			for(int c = 0; c < count; ++c)
+				new_card(pduel, BufferIO::ReadInt32(p), i, i, locations[l], 0, 0);
+		}
+	}
+	SendStart(ss.swapped);
+	start_duel(pduel, opt);
+	Process();
+	unsigned int responses = 0;
+	while(p < end && pduel) {
+		unsigned char len = *p++;
+		if(len > 64 || end - p < len)
+			break;
+		byte resb[64];
+		memcpy(resb, p, len);
+		p += len;
+		set_responseb(pduel, resb);
+		Process();
+		responses++;
+	}
+	if(p != end || !pduel || last_response != ss.last_response) {
+		log(BUG,"the duel diverged after %u of the replayed responses\n", responses);
+		Detach();
+		return false;
+	}
+	log(INFO,"duel rebuilt: %u responses (%u bytes of replay) in %d ms\n", responses, ss.replay_size, (int)(IpcFrame::nowMs() - start));
+	time_limit[0] = ss.time_limit[0];
+	time_limit[1] = ss.time_limit[1];
+	time_elapsed = ss.time_elapsed;
+	players[0]->state = ss.state[0];
+	players[1]->state = ss.state[1];
+	//the timer was running in the old process
+	if(host_info.time_limit && players[last_response]->state == CTOS_RESPONSE) {
+		timeval timeout = {1, 0};
+		event_add(etimer, &timeout);
+	}
+	return true;
+}
+void SingleDuel::Detach() {
+	if(!pduel)
+		return;
+	event_del(etimer);
+	end_duel(pduel);
+	pduel = 0;
+}
 void SingleDuel::WaitforResponse(int playerid) {
 	last_response = playerid;
 	unsigned char msg = MSG_WAITING;
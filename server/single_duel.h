@@ -4,11 +4,13 @@
 #include "config.h"
 #include "network.h"
 #include "replay.h"
+#include "CardDatabase.h"
 
 namespace ygo {
 
 class SingleDuel: public DuelMode {
 public:
+	DECLARE_POOLED_NEW(SingleDuel)
 	SingleDuel(bool is_match);
 	virtual ~SingleDuel();
 	virtual void Chat(DuelPlayer* dp, void* pdata, int len);
@@ -16,6 +18,7 @@ public:
 	virtual void LeaveGame(DuelPlayer* dp);
 	virtual void ToDuelist(DuelPlayer* dp);
 	virtual void ToObserver(DuelPlayer* dp);
+	virtual void AddObserver(DuelPlayer* dp);
 	virtual void PlayerReady(DuelPlayer* dp, bool ready);
 	virtual void PlayerKick(DuelPlayer* dp, unsigned char pos);
 	virtual void UpdateDeck(DuelPlayer* dp, void* pdata);
@@ -28,8 +31,12 @@ public:
 	virtual void GetResponse(DuelPlayer* dp, void* pdata, unsigned int len);
 	virtual void TimeConfirm(DuelPlayer* dp);
 	virtual void EndDuel();
+	virtual bool Snapshot(std::string& out);
+	virtual bool Resume(const std::string& snapshot, std::vector<DuelPlayer*>& members);
+	virtual void Detach();
 
 	void DuelEndProc();
+	void SendStart(bool swapped);
 	void WaitforResponse(int playerid);
 	void RefreshMzone(int player, int flag = 0x81fff, int use_cache = 1);
 	void RefreshSzone(int player, int flag = 0x81fff, int use_cache = 1);
@@ -45,7 +52,7 @@ protected:
 	DuelPlayer* players[2];
 	DuelPlayer* pplayer[2];
 	bool ready[2];
-	Deck pdeck[2];
+	CardDatabase::Deck pdeck[2];
 	unsigned char hand_result[2];
 	std::set<DuelPlayer*> observers;
 	Replay last_replay;
@@ -1,5 +1,7 @@
 #include "tag_duel.h"
 #include "DuelRoom.h"
+#include "Metrics.h"
+#include "CardDatabase.h"
 #include "game.h"
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/card.h"
@@ -151,8 +153,7 @@ void TagDuel::LeaveGame(DuelPlayer* dp) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			netServer->StopServer();
 		}
 	}
@@ -227,13 +228,23 @@ void TagDuel::ToObserver(DuelPlayer* dp) {
 	sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
 	netServer->SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
 }
+void TagDuel::AddObserver(DuelPlayer* dp) {
+	observers.insert(dp);
+	STOC_HS_WatchChange scwc;
+	scwc.watch_count = observers.size();
+	for(int i = 0; i < 4; ++i)
+		if(players[i])
+			netServer->SendPacketToPlayer(players[i], STOC_HS_WATCH_CHANGE, scwc);
+	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
+		netServer->SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+}
 void TagDuel::PlayerReady(DuelPlayer* dp, bool is_ready) {
 	if(dp->type > 3 || ready[dp->type] == is_ready)
 		return;
 	if(is_ready) {
 		bool allow_ocg = host_info.rule == 0 || host_info.rule == 2;
 		bool allow_tcg = host_info.rule == 1 || host_info.rule == 2;
-		int res = host_info.no_check_deck ? false : deckManager.CheckLFList(pdeck[dp->type], host_info.lflist, allow_ocg, allow_tcg);
+		int res = host_info.no_check_deck ? false : CardDatabase::getInstance()->CheckLFList(pdeck[dp->type], host_info.lflist, allow_ocg, allow_tcg);
 		if(res) {
 			STOC_HS_PlayerChange scpc;
 			scpc.status = (dp->type << 4) | PLAYERCHANGE_NOTREADY;
@@ -268,7 +279,7 @@ void TagDuel::UpdateDeck(DuelPlayer* dp, void* pdata) {
 	char* deckbuf = (char*)pdata;
 	int mainc = BufferIO::ReadInt32(deckbuf);
 	int sidec = BufferIO::ReadInt32(deckbuf);
-	deckManager.LoadDeck(pdeck[dp->type], (int*)deckbuf, mainc, sidec);
+	CardDatabase::getInstance()->LoadDeck(pdeck[dp->type], (int*)deckbuf, mainc, sidec);
 }
 void TagDuel::StartDuel(DuelPlayer* dp) {
 	if(dp != host_player)
@@ -303,8 +314,7 @@ void TagDuel::HandResult(DuelPlayer* dp, unsigned char res) {
 		schr.res2 = hand_result[1];
 		netServer->SendPacketToPlayer(players[0], STOC_HAND_RESULT, schr);
 		netServer->ReSendToPlayer(players[1]);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			netServer->ReSendToPlayer(*oit);
+		netServer->ReSendToObservers();
 		schr.res1 = hand_result[1];
 		schr.res2 = hand_result[0];
 		netServer->SendPacketToPlayer(players[2], STOC_HAND_RESULT, schr);
@@ -375,7 +385,7 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	}
 	time_limit[0] = host_info.time_limit;
 	time_limit[1] = host_info.time_limit;
-	set_card_reader((card_reader)DataManager::CardReader);
+	set_card_reader((card_reader)CardDatabase::CardReader);
 	set_message_handler((message_handler)TagDuel::MessageHandler);
 	rnd.reset(seed);
 	pduel = create_duel(rnd.rand());
@@ -395,46 +405,46 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	//
 	last_replay.WriteInt32(pdeck[0].main.size(), false);
 	for(int i = pdeck[0].main.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[0].main[i]->first, 0, 0, LOCATION_DECK, 0, 0);
-		last_replay.WriteInt32(pdeck[0].main[i]->first, false);
+		new_card(pduel, pdeck[0].main[i]->code, 0, 0, LOCATION_DECK, 0, 0);
+		last_replay.WriteInt32(pdeck[0].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[0].extra.size(), false);
 	for(int i = pdeck[0].extra.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[0].extra[i]->first, 0, 0, LOCATION_EXTRA, 0, 0);
-		last_replay.WriteInt32(pdeck[0].extra[i]->first, false);
+		new_card(pduel, pdeck[0].extra[i]->code, 0, 0, LOCATION_EXTRA, 0, 0);
+		last_replay.WriteInt32(pdeck[0].extra[i]->code, false);
 	}
 	//
 	last_replay.WriteInt32(pdeck[1].main.size(), false);
 	for(int i = pdeck[1].main.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[1].main[i]->first, 0, LOCATION_DECK);
-		last_replay.WriteInt32(pdeck[1].main[i]->first, false);
+		new_tag_card(pduel, pdeck[1].main[i]->code, 0, LOCATION_DECK);
+		last_replay.WriteInt32(pdeck[1].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[1].extra.size(), false);
 	for(int i = pdeck[1].extra.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[1].extra[i]->first, 0, LOCATION_EXTRA);
-		last_replay.WriteInt32(pdeck[1].extra[i]->first, false);
+		new_tag_card(pduel, pdeck[1].extra[i]->code, 0, LOCATION_EXTRA);
+		last_replay.WriteInt32(pdeck[1].extra[i]->code, false);
 	}
 	//
 	last_replay.WriteInt32(pdeck[3].main.size(), false);
 	for(int i = pdeck[3].main.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[3].main[i]->first, 1, 1, LOCATION_DECK, 0, 0);
-		last_replay.WriteInt32(pdeck[3].main[i]->first, false);
+		new_card(pduel, pdeck[3].main[i]->code, 1, 1, LOCATION_DECK, 0, 0);
+		last_replay.WriteInt32(pdeck[3].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[3].extra.size(), false);
 	for(int i = pdeck[3].extra.size() - 1; i >= 0; --i) {
-		new_card(pduel, pdeck[3].extra[i]->first, 1, 1, LOCATION_EXTRA, 0, 0);
-		last_replay.WriteInt32(pdeck[3].extra[i]->first, false);
+		new_card(pduel, pdeck[3].extra[i]->code, 1, 1, LOCATION_EXTRA, 0, 0);
+		last_replay.WriteInt32(pdeck[3].extra[i]->code, false);
 	}
 	//
 	last_replay.WriteInt32(pdeck[2].main.size(), false);
 	for(int i = pdeck[2].main.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[2].main[i]->first, 1, LOCATION_DECK);
-		last_replay.WriteInt32(pdeck[2].main[i]->first, false);
+		new_tag_card(pduel, pdeck[2].main[i]->code, 1, LOCATION_DECK);
+		last_replay.WriteInt32(pdeck[2].main[i]->code, false);
 	}
 	last_replay.WriteInt32(pdeck[2].extra.size(), false);
 	for(int i = pdeck[2].extra.size() - 1; i >= 0; --i) {
-		new_tag_card(pduel, pdeck[2].extra[i]->first, 1, LOCATION_EXTRA);
-		last_replay.WriteInt32(pdeck[2].extra[i]->first, false);
+		new_tag_card(pduel, pdeck[2].extra[i]->code, 1, LOCATION_EXTRA);
+		last_replay.WriteInt32(pdeck[2].extra[i]->code, false);
 	}
 	last_replay.Flush();
 	char startbuf[32], *pbuf = startbuf;
@@ -454,8 +464,8 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	if(!swapped)
 		startbuf[1] = 0x10;
 	else startbuf[1] = 0x11;
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 18);
+	netServer->StartObserverStream();
+	netServer->SendBufferToObservers(STOC_GAME_MSG, startbuf, 18);
 	RefreshExtra(0);
 	RefreshExtra(1);
 	start_duel(pduel, opt);
@@ -468,7 +478,11 @@ void TagDuel::Process() {
 	while (!stop) {
 		if (engFlag == 2)
 			break;
+		uint64_t engineStart = RoomUsage::nowNs();
 		int result = process(pduel);
+		uint64_t engineNs = RoomUsage::nowNs() - engineStart;
+		netServer->accounting.engineNs += engineNs;
+		Metrics::getInstance()->counters.engineNs += engineNs;
 		engLen = result & 0xffff;
 		engFlag = result >> 16;
 		if (engLen > 0) {
@@ -484,8 +498,7 @@ void TagDuel::DuelEndProc() {
 	netServer->ReSendToPlayer(players[1]);
 	netServer->ReSendToPlayer(players[2]);
 	netServer->ReSendToPlayer(players[3]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->ReSendToPlayer(*oit);
+	netServer->ReSendToObservers();
 	netServer->StopServer();
 }
 void TagDuel::Surrender(DuelPlayer* dp) {
@@ -497,6 +510,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 	while (pbuf - msgbuffer < len) {
 		offset = pbuf;
 		unsigned char engType = BufferIO::ReadUInt8(pbuf);
+		netServer->accounting.messages++;
 		switch (engType) {
 		case MSG_RETRY: {
 			WaitforResponse(last_response);
@@ -524,8 +538,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 				for(int i = 0; i < 4; ++i)
 					if(players[i] != cur_player[player])
 						netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 				break;
 			}
 			}
@@ -538,8 +551,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			EndDuel();
 			return 2;
 		}
@@ -683,8 +695,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CONFIRM_CARDS: {
@@ -696,8 +707,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 				netServer->ReSendToPlayer(players[1]);
 				netServer->ReSendToPlayer(players[2]);
 				netServer->ReSendToPlayer(players[3]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			} else {
 				pbuf += count * 7;
 				netServer->SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, offset, pbuf - offset);
@@ -710,8 +720,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SHUFFLE_HAND: {
@@ -723,8 +732,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshHand(player, 0x181fff, 0);
 			break;
 		}
@@ -734,8 +742,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SWAP_GRAVE_DECK: {
@@ -744,8 +751,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshGrave(player);
 			break;
 		}
@@ -754,8 +760,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DECK_TOP: {
@@ -764,8 +769,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SHUFFLE_SET_CARD: {
@@ -775,8 +779,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0, 0x181fff, 0);
 			RefreshMzone(1, 0x181fff, 0);
 			break;
@@ -789,8 +792,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			if(turn_count > 0) {
 				if(turn_count % 2 == 0) {
 					if(cur_player[0] == players[0])
@@ -813,8 +815,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -840,8 +841,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 				netServer->ReSendToPlayer(players[1]);
 				netServer->ReSendToPlayer(players[2]);
 				netServer->ReSendToPlayer(players[3]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			} else {
 				netServer->SendBufferToPlayer(cur_player[cc], STOC_GAME_MSG, offset, pbuf - offset);
 				if (!(cl & 0xb0) && !((cl & 0xc) && (cp & POS_FACEUP)))
@@ -849,8 +849,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 				for(int i = 0; i < 4; ++i)
 					if(players[i] != cur_player[cc])
 						netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					netServer->ReSendToPlayer(*oit);
+				netServer->ReSendToObservers();
 			}
 			if (cl != 0 && (cl & 0x80) == 0 && (cl != pl || pc != cc))
 				RefreshSingle(cc, cl, cs);
@@ -867,8 +866,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -880,8 +878,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SWAP: {
@@ -890,8 +887,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_FIELD_DISABLED: {
@@ -900,8 +896,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SUMMONING: {
@@ -910,8 +905,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SUMMONED: {
@@ -919,8 +913,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -933,8 +926,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_SPSUMMONED: {
@@ -942,8 +934,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -957,8 +948,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_FLIPSUMMONED: {
@@ -966,8 +956,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -980,8 +969,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAINED: {
@@ -990,8 +978,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1006,8 +993,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAIN_SOLVED: {
@@ -1016,8 +1002,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1031,8 +1016,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			RefreshSzone(0);
@@ -1047,8 +1031,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CHAIN_DISABLED: {
@@ -1057,8 +1040,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CARD_SELECTED: {
@@ -1075,8 +1057,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_BECOME_TARGET: {
@@ -1086,8 +1067,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DRAW: {
@@ -1105,8 +1085,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DAMAGE: {
@@ -1115,8 +1094,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_RECOVER: {
@@ -1125,8 +1103,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_EQUIP: {
@@ -1135,8 +1112,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_LPUPDATE: {
@@ -1145,8 +1121,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_UNEQUIP: {
@@ -1155,8 +1130,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CARD_TARGET: {
@@ -1165,8 +1139,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_CANCEL_TARGET: {
@@ -1175,8 +1148,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_PAY_LPCOST: {
@@ -1185,8 +1157,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ADD_COUNTER: {
@@ -1195,8 +1166,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_REMOVE_COUNTER: {
@@ -1205,8 +1175,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ATTACK: {
@@ -1215,8 +1184,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_BATTLE: {
@@ -1225,8 +1193,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ATTACK_DISABLED: {
@@ -1234,8 +1201,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_DAMAGE_STEP_START: {
@@ -1243,8 +1209,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			break;
@@ -1254,8 +1219,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshMzone(0);
 			RefreshMzone(1);
 			break;
@@ -1274,8 +1238,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_TOSS_DICE: {
@@ -1286,8 +1249,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_ANNOUNCE_RACE: {
@@ -1324,8 +1286,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			netServer->ReSendToPlayer(players[1]);
 			netServer->ReSendToPlayer(players[2]);
 			netServer->ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			break;
 		}
 		case MSG_TAG_SWAP: {
@@ -1355,8 +1316,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					netServer->SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				netServer->ReSendToPlayer(*oit);
+			netServer->ReSendToObservers();
 			RefreshExtra(player);
 			RefreshMzone(0, 0x81fff, 0);
 			RefreshMzone(1, 0x81fff, 0);
@@ -1402,8 +1362,7 @@ void TagDuel::EndDuel() {
 	netServer->ReSendToPlayer(players[1]);
 	netServer->ReSendToPlayer(players[2]);
 	netServer->ReSendToPlayer(players[3]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		netServer->ReSendToPlayer(*oit);
+	netServer->ReSendToObservers();
 	end_duel(pduel);
 	pduel = 0;
 }